@@ -1,6 +1,18 @@
 #ifndef TOY_EXCEPTIONS
 #define TOY_EXCEPTIONS
 
+#include <string>
+
 class NotImplementedYet {};
 
+// Thrown when solving with a factorisation of a singular matrix.
+class SingularMatrix {};
+
+// Thrown when a matrix file cannot be opened, read or parsed.
+class ToyIOError {
+ public:
+  ToyIOError(const std::string& message = std::string()) : Message(message) {}
+  std::string Message;
+};
+
 #endif
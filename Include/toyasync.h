@@ -0,0 +1,323 @@
+//------------------------------------------------------------------------------
+// Asynchronous matrix operations on the global thread pool.
+//
+// Every operation returns a ToyFuture immediately. Futures can be passed as
+// operands of further operations, which are then scheduled as soon as all
+// of their inputs are available, so a pipeline never has to join in between:
+//
+//   ToyFuture<ToyMatrix<float> > c = multiplyAsync(toyReady(A), toyReady(B));
+//   ToyFuture<ToyMatrix<float> > d = addAsync(c, toyReady(E));
+//   d.onComplete([](const ToyFuture<ToyMatrix<float> >& f) { ... });
+//
+// cancel() prevents an operation from starting; operations that depend on a
+// cancelled or failed future are cancelled or fail with the same exception.
+// A kernel that is already running is not interrupted. get() rethrows the
+// exception of a failed operation and throws ToyCancelled after cancel().
+//
+// Tasks run on pool threads. Kernels built on parallelFor() run serially
+// there, but large products still spread over the idle workers, because
+// operator* uses toyRecursiveGemm() on the global work-stealing scheduler
+// (see toyworksteal.h); beyond that, the parallelism comes from
+// independent operations running side by side.
+//------------------------------------------------------------------------------
+
+#ifndef TOYASYNC_H
+#define TOYASYNC_H
+
+#include <toylu.h>
+#include <toymatrix.h>
+#include <toyparallel.h>
+#include <toyvector.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Thrown by ToyFuture::get() for cancelled operations.
+class ToyCancelled {};
+
+//------------------------------------------------------------------------------
+// Shared state of one operation. The untyped part is all that dependent
+// operations need to know about their inputs.
+//------------------------------------------------------------------------------
+class ToyAsyncStateBase {
+public:
+  enum Status { Pending, Running, Done, Failed, Cancelled };
+
+  ToyAsyncStateBase() : CurrentStatus(Pending) {}
+  virtual ~ToyAsyncStateBase() {}
+
+  Status getStatus()
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return CurrentStatus;
+  }
+
+  bool isFinished()
+  {
+    Status status = getStatus();
+    return status == Done || status == Failed || status == Cancelled;
+  }
+
+  std::exception_ptr getError()
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    return Error;
+  }
+
+  // Runs callback once the state is finished, immediately if it already is.
+  void addContinuation(const std::function<void()>& callback)
+  {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      if (CurrentStatus == Pending || CurrentStatus == Running) {
+        Continuations.push_back(callback);
+        return;
+      }
+    }
+    callback();
+  }
+
+  bool start()
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (CurrentStatus != Pending) return false;
+    CurrentStatus = Running;
+    return true;
+  }
+
+  bool cancel()
+  {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      if (CurrentStatus != Pending) return false;
+      CurrentStatus = Cancelled;
+    }
+    finish();
+    return true;
+  }
+
+  void fail(std::exception_ptr error)
+  {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      if (CurrentStatus != Pending && CurrentStatus != Running) return;
+      Error = error;
+      CurrentStatus = Failed;
+    }
+    finish();
+  }
+
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(Mutex);
+    while (CurrentStatus == Pending || CurrentStatus == Running) Finished.wait(lock);
+  }
+
+  bool waitFor(int milliseconds)
+  {
+    std::unique_lock<std::mutex> lock(Mutex);
+    return Finished.wait_for(lock, std::chrono::milliseconds(milliseconds), [this]() {
+      return CurrentStatus != Pending && CurrentStatus != Running;
+    });
+  }
+
+protected:
+  void finish()
+  {
+    std::vector<std::function<void()> > callbacks;
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      callbacks.swap(Continuations);
+    }
+    Finished.notify_all();
+    for (size_t i=0; i<callbacks.size(); i++) callbacks[i]();
+  }
+
+  std::mutex              Mutex;
+  std::condition_variable Finished;
+  Status                  CurrentStatus;
+  std::exception_ptr      Error;
+  std::vector<std::function<void()> > Continuations;
+};
+
+template<class R>
+class ToyAsyncState : public ToyAsyncStateBase {
+public:
+  void setValue(R* value)
+  {
+    {
+      std::lock_guard<std::mutex> lock(Mutex);
+      Value.reset(value);
+      CurrentStatus = Done;
+    }
+    finish();
+  }
+
+  const R& getValue()
+  {
+    wait();
+    std::lock_guard<std::mutex> lock(Mutex);
+    if (CurrentStatus == Cancelled) throw ToyCancelled();
+    if (CurrentStatus == Failed) std::rethrow_exception(Error);
+    return *Value;
+  }
+
+private:
+  std::unique_ptr<R> Value;
+};
+
+template<class R>
+class ToyFuture {
+public:
+  typedef R ValueType;
+
+  ToyFuture() {}
+  explicit ToyFuture(const std::shared_ptr<ToyAsyncState<R> >& state) : State(state) {}
+
+  bool     isValid() const     { return State != 0; }
+  bool     isReady() const     { return State->isFinished(); }
+  bool     isCancelled() const { return State->getStatus() == ToyAsyncStateBase::Cancelled; }
+  bool     hasFailed() const   { return State->getStatus() == ToyAsyncStateBase::Failed; }
+  void     wait() const        { State->wait(); }
+  bool     waitFor(int milliseconds) const { return State->waitFor(milliseconds); }
+  const R& get() const         { return State->getValue(); }
+
+  //! Returns false if the operation has already started or finished.
+  bool     cancel()            { return State->cancel(); }
+
+  //! Called on the completing thread once the operation has finished,
+  //! whether it succeeded, failed or was cancelled.
+  void onComplete(const std::function<void(const ToyFuture&)>& callback) const
+  {
+    ToyFuture self(*this);
+    State->addContinuation([self, callback]() { callback(self); });
+  }
+
+  const std::shared_ptr<ToyAsyncState<R> >& getState() const { return State; }
+
+private:
+  std::shared_ptr<ToyAsyncState<R> > State;
+};
+
+//! A future that is already finished with a copy of value.
+template<class R>
+ToyFuture<R> toyReady(const R& value)
+{
+  std::shared_ptr<ToyAsyncState<R> > state(new ToyAsyncState<R>());
+  state->start();
+  state->setValue(new R(value));
+  return ToyFuture<R>(state);
+}
+
+//------------------------------------------------------------------------------
+// Schedules func on the global pool once all dependencies have finished.
+// func returns a heap-allocated result, whose ownership goes to the future.
+//------------------------------------------------------------------------------
+template<class R, class F>
+ToyFuture<R> toyScheduleAfter(const std::vector<std::shared_ptr<ToyAsyncStateBase> >& dependencies, F func)
+{
+  std::shared_ptr<ToyAsyncState<R> > state(new ToyAsyncState<R>());
+  std::shared_ptr<std::atomic<int> > pending(new std::atomic<int>((int)dependencies.size() + 1));
+  std::vector<std::shared_ptr<ToyAsyncStateBase> > inputs(dependencies);
+
+  std::function<void()> ready = [state, pending, inputs, func]() {
+    if (--(*pending) > 0) return;
+    for (size_t i=0; i<inputs.size(); i++) {
+      ToyAsyncStateBase::Status status = inputs[i]->getStatus();
+      if (status == ToyAsyncStateBase::Cancelled) {
+        state->cancel();
+        return;
+      }
+      if (status == ToyAsyncStateBase::Failed) {
+        state->fail(inputs[i]->getError());
+        return;
+      }
+    }
+    ToyThreadPool::global().submit([state, func]() {
+      if (!state->start()) return;
+      try {
+        state->setValue(func());
+      }
+      catch (...) {
+        state->fail(std::current_exception());
+      }
+    });
+  };
+  for (size_t i=0; i<dependencies.size(); i++) dependencies[i]->addContinuation(ready);
+  ready();
+  return ToyFuture<R>(state);
+}
+
+template<class A, class B>
+std::vector<std::shared_ptr<ToyAsyncStateBase> > toyDependencies(const ToyFuture<A>& a, const ToyFuture<B>& b)
+{
+  std::vector<std::shared_ptr<ToyAsyncStateBase> > dependencies;
+  dependencies.push_back(a.getState());
+  dependencies.push_back(b.getState());
+  return dependencies;
+}
+
+template<class T>
+ToyFuture<ToyMatrix<T> > multiplyAsync(const ToyFuture<ToyMatrix<T> >& a, const ToyFuture<ToyMatrix<T> >& b)
+{
+  return toyScheduleAfter<ToyMatrix<T> >(toyDependencies(a, b), [a, b]() {
+    return new ToyMatrix<T>(a.get() * b.get());
+  });
+}
+
+template<class T>
+ToyFuture<ToyVector<T> > multiplyAsync(const ToyFuture<ToyMatrix<T> >& a, const ToyFuture<ToyVector<T> >& x)
+{
+  return toyScheduleAfter<ToyVector<T> >(toyDependencies(a, x), [a, x]() {
+    return new ToyVector<T>(a.get() * x.get());
+  });
+}
+
+template<class T>
+ToyFuture<ToyMatrix<T> > addAsync(const ToyFuture<ToyMatrix<T> >& a, const ToyFuture<ToyMatrix<T> >& b)
+{
+  return toyScheduleAfter<ToyMatrix<T> >(toyDependencies(a, b), [a, b]() {
+    return new ToyMatrix<T>(a.get() + b.get());
+  });
+}
+
+//! Solves A*X = B through ToyLU, B being a ToyVector or a ToyMatrix.
+template<class T, class R>
+ToyFuture<R> solveAsync(const ToyFuture<ToyMatrix<T> >& a, const ToyFuture<R>& b)
+{
+  return toyScheduleAfter<R>(toyDependencies(a, b), [a, b]() {
+    return new R(ToyLU<T>(a.get()).solve(b.get()));
+  });
+}
+
+template<class T>
+ToyFuture<ToyMatrix<T> > multiplyAsync(const ToyMatrix<T>& a, const ToyMatrix<T>& b)
+{
+  return multiplyAsync(toyReady(a), toyReady(b));
+}
+
+template<class T>
+ToyFuture<ToyVector<T> > multiplyAsync(const ToyMatrix<T>& a, const ToyVector<T>& x)
+{
+  return multiplyAsync(toyReady(a), toyReady(x));
+}
+
+template<class T>
+ToyFuture<ToyMatrix<T> > addAsync(const ToyMatrix<T>& a, const ToyMatrix<T>& b)
+{
+  return addAsync(toyReady(a), toyReady(b));
+}
+
+template<class T, class R>
+ToyFuture<R> solveAsync(const ToyMatrix<T>& a, const R& b)
+{
+  return solveAsync(toyReady(a), toyReady(b));
+}
+
+#endif // TOYASYNC_H
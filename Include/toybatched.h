@@ -0,0 +1,257 @@
+//------------------------------------------------------------------------------
+// Many independent products of small N x N matrices, e.g. 4x4 transforms.
+//
+// ToyMatrixBatch stores its matrices interleaved across TOYBATCH_LANES
+// lanes: entry (i,j) of TOYBATCH_LANES consecutive matrices is contiguous,
+//
+//   entries[((group*N + i)*N + j)*TOYBATCH_LANES + lane],  index = group*L + lane
+//
+// so the innermost loop of the kernel runs over the lanes and is vectorised
+// by the compiler, while N is a template parameter and the remaining loops
+// are unrolled. A whole batch is multiplied in one call without allocating
+// per product, spread over the thread pool for large batches.
+//
+// toyComposeHierarchy() composes transform hierarchies: the world matrix of
+// node i is world[parent[i]] * local[i], roots (parent -1) keep their local
+// matrix. Nodes are processed level by level, so parents may appear in any
+// order, and the nodes of one level are multiplied as a batch.
+//------------------------------------------------------------------------------
+
+#ifndef TOYBATCHED_H
+#define TOYBATCHED_H
+
+#include <toymatrix.h>
+#include <toyparallel.h>
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#ifndef TOYBATCH_LANES
+#define TOYBATCH_LANES 8
+#endif
+
+template<class T, int N>
+class ToyMatrixBatch {
+public:
+  explicit ToyMatrixBatch(int count = 0);
+
+  int  getCount() const;
+  int  getNumGroups() const;
+  void resize(int count);
+
+  T&       operator()(int index, int row, int column);
+  const T& operator()(int index, int row, int column) const;
+
+  void         set(int index, const ToyMatrix<T>& matrix);
+  ToyMatrix<T> get(int index) const;
+  void         setIdentity(int index);
+
+  // The N*N*TOYBATCH_LANES entries of one group of matrices.
+  T*       getGroup(int group);
+  const T* getGroup(int group) const;
+
+private:
+  int            Count;
+  std::vector<T> Entries;
+};
+
+template<class T, int N>
+ToyMatrixBatch<T,N>::ToyMatrixBatch(int count /*= 0*/) :
+  Count(0)
+{
+  resize(count);
+}
+
+template<class T, int N>
+inline int ToyMatrixBatch<T,N>::getCount() const
+{
+  return Count;
+}
+
+template<class T, int N>
+inline int ToyMatrixBatch<T,N>::getNumGroups() const
+{
+  return (Count + TOYBATCH_LANES - 1) / TOYBATCH_LANES;
+}
+
+//! New matrices are zero; unused lanes of the last group stay zero too.
+template<class T, int N>
+void ToyMatrixBatch<T,N>::resize(int count)
+{
+  // Matrices dropped from the group that stays last are cleared by hand.
+  int end = std::min(Count, (count + TOYBATCH_LANES - 1) / TOYBATCH_LANES * TOYBATCH_LANES);
+  for (int index=count; index<end; index++) {
+    int group = index / TOYBATCH_LANES, lane = index % TOYBATCH_LANES;
+    for (size_t e=0; e<(size_t)N*N; e++) {
+      Entries[((size_t)group*N*N + e)*TOYBATCH_LANES + lane] = T();
+    }
+  }
+  Count = count;
+  Entries.resize((size_t)getNumGroups()*N*N*TOYBATCH_LANES, T());
+}
+
+template<class T, int N>
+inline T& ToyMatrixBatch<T,N>::operator()(int index, int row, int column)
+{
+  assert(index < Count && row < N && column < N);
+  int group = index / TOYBATCH_LANES, lane = index % TOYBATCH_LANES;
+  return Entries[(((size_t)group*N + row)*N + column)*TOYBATCH_LANES + lane];
+}
+
+template<class T, int N>
+inline const T& ToyMatrixBatch<T,N>::operator()(int index, int row, int column) const
+{
+  assert(index < Count && row < N && column < N);
+  int group = index / TOYBATCH_LANES, lane = index % TOYBATCH_LANES;
+  return Entries[(((size_t)group*N + row)*N + column)*TOYBATCH_LANES + lane];
+}
+
+template<class T, int N>
+void ToyMatrixBatch<T,N>::set(int index, const ToyMatrix<T>& matrix)
+{
+  assert(matrix.getNumRows() == N && matrix.getNumColumns() == N);
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<N; j++) (*this)(index, i, j) = matrix(i, j);
+  }
+}
+
+template<class T, int N>
+ToyMatrix<T> ToyMatrixBatch<T,N>::get(int index) const
+{
+  ToyMatrix<T> matrix(N, N, toyUninitialized);
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<N; j++) matrix(i, j) = (*this)(index, i, j);
+  }
+  return matrix;
+}
+
+template<class T, int N>
+void ToyMatrixBatch<T,N>::setIdentity(int index)
+{
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<N; j++) (*this)(index, i, j) = (i == j) ? T(1) : T();
+  }
+}
+
+template<class T, int N>
+inline T* ToyMatrixBatch<T,N>::getGroup(int group)
+{
+  return &Entries[(size_t)group*N*N*TOYBATCH_LANES];
+}
+
+template<class T, int N>
+inline const T* ToyMatrixBatch<T,N>::getGroup(int group) const
+{
+  return &Entries[(size_t)group*N*N*TOYBATCH_LANES];
+}
+
+//------------------------------------------------------------------------------
+// c = a*b for the TOYBATCH_LANES matrices of one group. c must not overlap
+// a or b.
+//------------------------------------------------------------------------------
+template<class T, int N>
+inline void toyBatchedKernel(const T* a, const T* b, T* c)
+{
+  const int L = TOYBATCH_LANES;
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<N; j++) {
+      T sum[L];
+      for (int l=0; l<L; l++) sum[l] = T();
+      for (int p=0; p<N; p++) {
+        const T* ap = a + (i*N + p)*L;
+        const T* bp = b + (p*N + j)*L;
+        for (int l=0; l<L; l++) sum[l] += ap[l] * bp[l];
+      }
+      T* cij = c + (i*N + j)*L;
+      for (int l=0; l<L; l++) cij[l] = sum[l];
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// c[i] = a[i]*b[i] for every matrix of the batches. c is resized as needed
+// and must be a different batch than a and b.
+//------------------------------------------------------------------------------
+template<class T, int N>
+void toyBatchedMultiply(const ToyMatrixBatch<T,N>& a, const ToyMatrixBatch<T,N>& b,
+                        ToyMatrixBatch<T,N>& c)
+{
+  assert(a.getCount() == b.getCount());
+  assert(&c != &a && &c != &b);
+  c.resize(a.getCount());
+  ToyThreadPool::global().parallelFor(0, a.getNumGroups(), [&](int lo, int hi) {
+    for (int g=lo; g<hi; g++) toyBatchedKernel<T,N>(a.getGroup(g), b.getGroup(g), c.getGroup(g));
+  }, 256);
+}
+
+//------------------------------------------------------------------------------
+// world[i] = world[parent[i]] * local[i] for all nodes, with parent[i] == -1
+// for roots. The parent links must not form cycles.
+//------------------------------------------------------------------------------
+template<class T, int N>
+void toyComposeHierarchy(const ToyMatrixBatch<T,N>& local, const std::vector<int>& parent,
+                         ToyMatrixBatch<T,N>& world)
+{
+  const int L = TOYBATCH_LANES;
+  int count = local.getCount();
+  assert((int)parent.size() == count);
+  assert(&world != &local);
+  world.resize(count);
+
+  // Depth of every node, following each parent chain only once.
+  std::vector<int> depth(count, -1), chain;
+  int numLevels = 0;
+  for (int i=0; i<count; i++) {
+    int node = i;
+    while (node >= 0 && depth[node] < 0) {
+      assert((int)chain.size() < count && "cycle in hierarchy");
+      assert(parent[node] < count);
+      chain.push_back(node);
+      node = parent[node];
+    }
+    int d = (node < 0) ? -1 : depth[node];
+    for (int c=(int)chain.size()-1; c>=0; c--) depth[chain[c]] = ++d;
+    chain.clear();
+    numLevels = std::max(numLevels, depth[i] + 1);
+  }
+
+  // Nodes sorted by level, keeping their order within a level.
+  std::vector<int> levelStart(numLevels + 1, 0), nodes(count);
+  for (int i=0; i<count; i++) levelStart[depth[i] + 1]++;
+  for (int d=0; d<numLevels; d++) levelStart[d+1] += levelStart[d];
+  std::vector<int> fill(levelStart.begin(), levelStart.end() - 1);
+  for (int i=0; i<count; i++) nodes[fill[depth[i]]++] = i;
+
+  if (numLevels == 0) return;
+  for (int i=0; i<levelStart[1]; i++) {
+    for (int r=0; r<N; r++) {
+      for (int c=0; c<N; c++) world(nodes[i], r, c) = local(nodes[i], r, c);
+    }
+  }
+
+  for (int d=1; d<numLevels; d++) {
+    int begin = levelStart[d], numChunks = (levelStart[d+1] - begin + L - 1) / L;
+    ToyThreadPool::global().parallelFor(0, numChunks, [&](int lo, int hi) {
+      T parents[N*N*L], locals[N*N*L], results[N*N*L];
+      for (int chunk=lo; chunk<hi; chunk++) {
+        int first = begin + chunk*L;
+        int lanes = std::min(L, levelStart[d+1] - first);
+        // Gather the matrices into lanes; unused lanes multiply zeros.
+        for (int e=0; e<N*N; e++) {
+          int r = e / N, c = e % N;
+          for (int l=0; l<L; l++) {
+            parents[e*L + l] = (l < lanes) ? world(parent[nodes[first + l]], r, c) : T();
+            locals[e*L + l]  = (l < lanes) ? local(nodes[first + l], r, c) : T();
+          }
+        }
+        toyBatchedKernel<T,N>(parents, locals, results);
+        for (int e=0; e<N*N; e++) {
+          for (int l=0; l<lanes; l++) world(nodes[first + l], e / N, e % N) = results[e*L + l];
+        }
+      }
+    }, 64);
+  }
+}
+
+#endif // TOYBATCHED_H
@@ -0,0 +1,343 @@
+//------------------------------------------------------------------------------
+// Bit-packed boolean matrices, e.g. adjacency and reachability matrices of
+// graphs. Every row is stored as 64-bit words, 64 entries per word, so the
+// matrix needs a 32nd of the memory of a ToyMatrix<int>.
+//
+// The product is the boolean one, C(i,j) = OR over k of A(i,k) AND B(k,j),
+// and works on whole words: either the rows of B selected by the set bits
+// of a row of A are OR-ed together, or rows of A are AND-ed with the rows
+// of B' until a word is non-zero. operator* picks the cheaper of the two
+// for the operands at hand. toyCountPaths() uses the second scheme with
+// popcount to count the k instead, which gives the number of paths of
+// length two.
+//
+// Unused bits at the end of each row are always zero.
+//------------------------------------------------------------------------------
+
+#ifndef TOYBITS_H
+#define TOYBITS_H
+
+#include <toymatrix.h>
+#include <toyparallel.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+inline int toyPopcount(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_popcountll(word);
+#else
+  word = word - ((word >> 1) & 0x5555555555555555ull);
+  word = (word & 0x3333333333333333ull) + ((word >> 2) & 0x3333333333333333ull);
+  word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0full;
+  return (int)((word * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+//! Index of the lowest set bit; word must not be zero.
+inline int toyLowestBit(uint64_t word)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(word);
+#else
+  return toyPopcount((word & (0 - word)) - 1);
+#endif
+}
+
+class ToyBitMatrix {
+public:
+  ToyBitMatrix(int rows = 0, int columns = 0);
+  // Entries that are not zero become set bits.
+  template<class T>
+  explicit ToyBitMatrix(const ToyMatrix<T>& matrix);
+
+  int getNumRows() const;
+  int getNumColumns() const;
+  int getWordsPerRow() const;
+
+  bool get(int row, int column) const;
+  void set(int row, int column, bool value = true);
+  void makeIdentity();
+
+  // The words of one row; bit c%64 of word c/64 is column c.
+  uint64_t*       getRow(int row);
+  const uint64_t* getRow(int row) const;
+
+  // Number of set entries.
+  long long count() const;
+  ToyBitMatrix transposed() const;
+
+  ToyBitMatrix& operator|=(const ToyBitMatrix& rhs);
+  ToyBitMatrix& operator&=(const ToyBitMatrix& rhs);
+  bool operator==(const ToyBitMatrix& rhs) const;
+  bool operator!=(const ToyBitMatrix& rhs) const;
+
+  // Ones and zeros.
+  template<class T>
+  ToyMatrix<T> toMatrix() const;
+
+private:
+  int Rows, Columns, Words;
+  std::vector<uint64_t> Bits;
+};
+
+inline ToyBitMatrix::ToyBitMatrix(int rows /*= 0*/, int columns /*= 0*/) :
+  Rows(rows),
+  Columns(columns),
+  Words((columns + 63) / 64),
+  Bits((size_t)rows * ((columns + 63) / 64), 0)
+{
+}
+
+template<class T>
+ToyBitMatrix::ToyBitMatrix(const ToyMatrix<T>& matrix) :
+  Rows(matrix.getNumRows()),
+  Columns(matrix.getNumColumns()),
+  Words((matrix.getNumColumns() + 63) / 64),
+  Bits((size_t)Rows * Words, 0)
+{
+  for (int i=0; i<Rows; i++) {
+    uint64_t* row = getRow(i);
+    for (int j=0; j<Columns; j++) {
+      if (matrix(i, j) != T()) row[j >> 6] |= uint64_t(1) << (j & 63);
+    }
+  }
+}
+
+inline int ToyBitMatrix::getNumRows() const
+{
+  return Rows;
+}
+
+inline int ToyBitMatrix::getNumColumns() const
+{
+  return Columns;
+}
+
+inline int ToyBitMatrix::getWordsPerRow() const
+{
+  return Words;
+}
+
+inline bool ToyBitMatrix::get(int row, int column) const
+{
+  assert(row < Rows && column < Columns);
+  return (Bits[(size_t)row*Words + (column >> 6)] >> (column & 63)) & 1;
+}
+
+inline void ToyBitMatrix::set(int row, int column, bool value /*= true*/)
+{
+  assert(row < Rows && column < Columns);
+  uint64_t& word = Bits[(size_t)row*Words + (column >> 6)];
+  uint64_t bit = uint64_t(1) << (column & 63);
+  word = value ? (word | bit) : (word & ~bit);
+}
+
+inline void ToyBitMatrix::makeIdentity()
+{
+  if (Rows != Columns) return;
+  std::fill(Bits.begin(), Bits.end(), 0);
+  for (int i=0; i<Rows; i++) set(i, i);
+}
+
+inline uint64_t* ToyBitMatrix::getRow(int row)
+{
+  return Bits.empty() ? 0 : &Bits[(size_t)row*Words];
+}
+
+inline const uint64_t* ToyBitMatrix::getRow(int row) const
+{
+  return Bits.empty() ? 0 : &Bits[(size_t)row*Words];
+}
+
+inline long long ToyBitMatrix::count() const
+{
+  long long total = 0;
+  for (size_t w=0; w<Bits.size(); w++) total += toyPopcount(Bits[w]);
+  return total;
+}
+
+//------------------------------------------------------------------------------
+// Transposes 64 x 64 blocks of bits at a time: the block is gathered into
+// 64 words, transposed in place by swapping ever smaller sub-blocks, and
+// scattered again.
+//------------------------------------------------------------------------------
+inline ToyBitMatrix ToyBitMatrix::transposed() const
+{
+  ToyBitMatrix result(Columns, Rows);
+  for (int i0=0; i0<Rows; i0+=64) {
+    for (int w=0; w<Words; w++) {
+      uint64_t block[64];
+      for (int r=0; r<64; r++) block[r] = (i0 + r < Rows) ? Bits[(size_t)(i0 + r)*Words + w] : 0;
+      // After this, bit r of block[c] is bit c of the original block[r].
+      uint64_t mask = 0x00000000ffffffffull;
+      for (int width=32; width>0; width>>=1, mask ^= mask << width) {
+        for (int r=0; r<64; r=(r + width + 1) & ~width) {
+          uint64_t swap = ((block[r] >> width) ^ block[r + width]) & mask;
+          block[r] ^= swap << width;
+          block[r + width] ^= swap;
+        }
+      }
+      int outWord = i0 >> 6;
+      for (int c=0; c<64 && w*64 + c<Columns; c++) {
+        result.Bits[(size_t)(w*64 + c)*result.Words + outWord] = block[c];
+      }
+    }
+  }
+  return result;
+}
+
+inline ToyBitMatrix& ToyBitMatrix::operator|=(const ToyBitMatrix& rhs)
+{
+  assert(Rows == rhs.Rows && Columns == rhs.Columns);
+  for (size_t w=0; w<Bits.size(); w++) Bits[w] |= rhs.Bits[w];
+  return (*this);
+}
+
+inline ToyBitMatrix& ToyBitMatrix::operator&=(const ToyBitMatrix& rhs)
+{
+  assert(Rows == rhs.Rows && Columns == rhs.Columns);
+  for (size_t w=0; w<Bits.size(); w++) Bits[w] &= rhs.Bits[w];
+  return (*this);
+}
+
+inline bool ToyBitMatrix::operator==(const ToyBitMatrix& rhs) const
+{
+  return Rows == rhs.Rows && Columns == rhs.Columns && Bits == rhs.Bits;
+}
+
+inline bool ToyBitMatrix::operator!=(const ToyBitMatrix& rhs) const
+{
+  return !(*this == rhs);
+}
+
+template<class T>
+ToyMatrix<T> ToyBitMatrix::toMatrix() const
+{
+  ToyMatrix<T> matrix(Rows, Columns);
+  for (int i=0; i<Rows; i++) {
+    for (int j=0; j<Columns; j++) {
+      if (get(i, j)) matrix(i, j) = T(1);
+    }
+  }
+  return matrix;
+}
+
+inline ToyBitMatrix operator|(ToyBitMatrix lhs, const ToyBitMatrix& rhs)
+{
+  lhs |= rhs;
+  return lhs;
+}
+
+inline ToyBitMatrix operator&(ToyBitMatrix lhs, const ToyBitMatrix& rhs)
+{
+  lhs &= rhs;
+  return lhs;
+}
+
+//------------------------------------------------------------------------------
+// Boolean product. OR-ing rows of B costs a row of B for every set bit of
+// A; AND-ing with B' costs at most a row of A for every entry of C, less
+// when a common bit turns up early, as it does for dense operands. Rows
+// of C are computed in parallel.
+//------------------------------------------------------------------------------
+inline ToyBitMatrix operator*(const ToyBitMatrix& lhs, const ToyBitMatrix& rhs)
+{
+  assert(lhs.getNumColumns() == rhs.getNumRows());
+  int m = lhs.getNumRows(), n = rhs.getNumColumns(), wa = lhs.getWordsPerRow();
+  int wc = rhs.getWordsPerRow();
+  ToyBitMatrix result(m, n);
+  if (m == 0 || wc == 0) return result;
+
+  // A word pair of densities da and db shares a bit with probability
+  // 1 - (1 - da*db)^64, which gives the expected words per entry of C.
+  long long setA = lhs.count(), setB = rhs.count();
+  int k = lhs.getNumColumns();
+  double da = (double)setA / ((double)m*k), db = (double)setB / ((double)k*n);
+  double hit = 1.0 - std::pow(1.0 - da*db, 64);
+  double words = (hit > 0) ? std::min((double)wa, 1.0/hit) : wa;
+  double costOr = (double)setA * wc;
+  double costAnd = (double)m * n * words + (double)k * wc;
+  if (costOr <= costAnd) {
+    ToyThreadPool::global().parallelFor(0, m, [&](int lo, int hi) {
+      for (int i=lo; i<hi; i++) {
+        const uint64_t* a = lhs.getRow(i);
+        uint64_t* c = result.getRow(i);
+        for (int w=0; w<wa; w++) {
+          for (uint64_t bits=a[w]; bits; bits &= bits - 1) {
+            const uint64_t* b = rhs.getRow(w*64 + toyLowestBit(bits));
+            for (int v=0; v<wc; v++) c[v] |= b[v];
+          }
+        }
+      }
+    }, 16);
+    return result;
+  }
+
+  ToyBitMatrix bt = rhs.transposed();
+  ToyThreadPool::global().parallelFor(0, m, [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) {
+      const uint64_t* a = lhs.getRow(i);
+      uint64_t* c = result.getRow(i);
+      for (int j=0; j<n; j++) {
+        const uint64_t* b = bt.getRow(j);
+        for (int w=0; w<wa; w++) {
+          if (a[w] & b[w]) {
+            c[j >> 6] |= uint64_t(1) << (j & 63);
+            break;
+          }
+        }
+      }
+    }
+  }, 16);
+  return result;
+}
+
+//! C(i,j) = number of k with A(i,k) and B(k,j) set.
+inline ToyMatrix<int> toyCountPaths(const ToyBitMatrix& lhs, const ToyBitMatrix& rhs)
+{
+  assert(lhs.getNumColumns() == rhs.getNumRows());
+  int m = lhs.getNumRows(), n = rhs.getNumColumns(), wa = lhs.getWordsPerRow();
+  ToyMatrix<int> result(m, n, toyUninitialized);
+  ToyBitMatrix bt = rhs.transposed();
+  int* entries = result.getEntries();
+  ToyThreadPool::global().parallelFor(0, m, [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) {
+      const uint64_t* a = lhs.getRow(i);
+      for (int j=0; j<n; j++) {
+        const uint64_t* b = bt.getRow(j);
+        int paths = 0;
+        for (int w=0; w<wa; w++) paths += toyPopcount(a[w] & b[w]);
+        entries[(size_t)i*n + j] = paths;
+      }
+    }
+  }, 16);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// Transitive closure of a square matrix by repeated squaring: R |= R*R
+// doubles the path lengths covered, so it settles after about log2(n)
+// rounds. With reflexive set the diagonal is included as well.
+//------------------------------------------------------------------------------
+inline ToyBitMatrix toyTransitiveClosure(const ToyBitMatrix& matrix, bool reflexive = false)
+{
+  assert(matrix.getNumRows() == matrix.getNumColumns());
+  ToyBitMatrix closure(matrix);
+  if (reflexive) {
+    for (int i=0; i<closure.getNumRows(); i++) closure.set(i, i);
+  }
+  for (;;) {
+    ToyBitMatrix next = closure * closure;
+    next |= closure;
+    if (next == closure) break;
+    closure = next;
+  }
+  return closure;
+}
+
+#endif // TOYBITS_H
@@ -0,0 +1,226 @@
+//------------------------------------------------------------------------------
+// Lazily evaluated matrix products.
+//
+// ToyMatrix::operator* evaluates A*B*C*v from left to right, i.e. as two
+// matrix-matrix products followed by a matrix-vector product. Starting the
+// expression with toyLazy() only records the factors instead:
+//
+//   ToyVector<double> y = toyLazy(A) * B * C * v;    // A*(B*(C*v))
+//   ToyMatrix<double> M = toyLazy(A) * B * C;        // best of (AB)C, A(BC)
+//
+// On evaluation the classic dynamic programme for the matrix-chain problem
+// picks the order with the fewest multiply-adds, which also pushes vectors
+// inward: a vector at the end turns the whole chain into matrix-vector
+// products. Each single product then runs through ToyMatrix::operator*.
+//
+// Unlike ToyMatrix * ToyVector, a chain times a vector is the plain
+// product, without the homogeneous 1 added to the last entry.
+//
+// The chain keeps references to its factors, so it must be evaluated
+// before they go away; within one expression this is always the case.
+// Evaluation keeps its plan on the stack, so a chain may be evaluated by
+// several threads at once.
+//------------------------------------------------------------------------------
+
+#ifndef TOYCHAIN_H
+#define TOYCHAIN_H
+
+#include <toymatrix.h>
+#include <toyvector.h>
+
+#include <cassert>
+#include <sstream>
+#include <string>
+#include <vector>
+
+template<class T>
+class ToyProductChain {
+public:
+  explicit ToyProductChain(const ToyMatrix<T>& first);
+
+  ToyProductChain& operator*=(const ToyMatrix<T>& factor);
+
+  ToyMatrix<T> evaluate() const;
+  operator ToyMatrix<T>() const;
+  ToyVector<T> operator*(const ToyVector<T>& v) const;
+
+  int getNumFactors() const;
+  // Multiply-adds of the chosen order and of left-to-right evaluation.
+  long long getCost() const;
+  long long getLeftToRightCost() const;
+  // The chosen order with factors numbered from 0, e.g. "(0 (1 2))".
+  std::string getOrder() const;
+
+private:
+  // Fills split with the best split of factors [i, j] at i*n+j, returns
+  // the cost of the best order.
+  static long long plan(const std::vector<const ToyMatrix<T>*>& factors, std::vector<int>& split);
+  static ToyMatrix<T> evaluate(const std::vector<const ToyMatrix<T>*>& factors,
+                               const std::vector<int>& split, int first, int last);
+  void describe(std::ostringstream& out, const std::vector<int>& split, int first, int last) const;
+
+  std::vector<const ToyMatrix<T>*> Factors;
+};
+
+template<class T>
+ToyProductChain<T> toyLazy(const ToyMatrix<T>& first)
+{
+  return ToyProductChain<T>(first);
+}
+
+template<class T>
+ToyProductChain<T> operator*(ToyProductChain<T> chain, const ToyMatrix<T>& factor)
+{
+  chain *= factor;
+  return chain;
+}
+
+template<class T>
+ToyProductChain<T>::ToyProductChain(const ToyMatrix<T>& first) :
+  Factors(1, &first)
+{
+}
+
+template<class T>
+ToyProductChain<T>& ToyProductChain<T>::operator*=(const ToyMatrix<T>& factor)
+{
+  assert(Factors.back()->getNumColumns() == factor.getNumRows());
+  Factors.push_back(&factor);
+  return (*this);
+}
+
+template<class T>
+inline int ToyProductChain<T>::getNumFactors() const
+{
+  return (int)Factors.size();
+}
+
+//------------------------------------------------------------------------------
+// cost[i][j] = min over k of cost[i][k] + cost[k+1][j] + p[i]*p[k+1]*p[j+1],
+// where factor i is p[i] x p[i+1].
+//------------------------------------------------------------------------------
+template<class T>
+long long ToyProductChain<T>::plan(const std::vector<const ToyMatrix<T>*>& factors,
+                                   std::vector<int>& split)
+{
+  int n = (int)factors.size();
+  std::vector<long long> p(n+1);
+  p[0] = factors[0]->getNumRows();
+  for (int i=0; i<n; i++) p[i+1] = factors[i]->getNumColumns();
+
+  std::vector<long long> cost((size_t)n*n, 0);
+  split.assign((size_t)n*n, 0);
+  for (int length=2; length<=n; length++) {
+    for (int i=0; i+length-1<n; i++) {
+      int j = i+length-1;
+      long long best = -1;
+      for (int k=i; k<j; k++) {
+        long long c = cost[i*n+k] + cost[(k+1)*n+j] + p[i]*p[k+1]*p[j+1];
+        if (best < 0 || c < best) {
+          best = c;
+          split[i*n+j] = k;
+        }
+      }
+      cost[i*n+j] = best;
+    }
+  }
+  return cost[n-1];
+}
+
+template<class T>
+ToyMatrix<T> ToyProductChain<T>::evaluate(const std::vector<const ToyMatrix<T>*>& factors,
+                                          const std::vector<int>& split, int first, int last)
+{
+  int n = (int)factors.size();
+  if (first == last) return *factors[first];
+  int k = split[first*n+last];
+  // Single factors are used in place rather than copied.
+  if (first == k && k+1 == last) return (*factors[first]) * (*factors[last]);
+  if (first == k) return (*factors[first]) * evaluate(factors, split, k+1, last);
+  if (k+1 == last) return evaluate(factors, split, first, k) * (*factors[last]);
+  return evaluate(factors, split, first, k) * evaluate(factors, split, k+1, last);
+}
+
+template<class T>
+ToyMatrix<T> ToyProductChain<T>::evaluate() const
+{
+  std::vector<int> split;
+  plan(Factors, split);
+  return evaluate(Factors, split, 0, (int)Factors.size()-1);
+}
+
+template<class T>
+ToyProductChain<T>::operator ToyMatrix<T>() const
+{
+  return evaluate();
+}
+
+//! The vector takes part in the ordering as a final n x 1 factor. The result
+//! is the plain product, so toyLazy(A)*B*v differs from the eager A*B*v,
+//! where ToyMatrix * ToyVector adds the homogeneous 1 of a fresh ToyVector
+//! to the last entry.
+template<class T>
+ToyVector<T> ToyProductChain<T>::operator*(const ToyVector<T>& v) const
+{
+  assert(!v.isTransposed() && Factors.back()->getNumColumns() == v.getNumEntries());
+  int n = v.getNumEntries();
+  T* entries = new T[n];
+  for (int i=0; i<n; i++) entries[i] = v.getEntries()[i];
+  ToyMatrix<T> column(n, 1, entries);
+
+  std::vector<const ToyMatrix<T>*> factors(Factors);
+  factors.push_back(&column);
+  std::vector<int> split;
+  plan(factors, split);
+  ToyMatrix<T> product = evaluate(factors, split, 0, (int)factors.size()-1);
+
+  int m = product.getNumRows();
+  T* result = new T[m];
+  for (int i=0; i<m; i++) result[i] = product(i, 0);
+  return ToyVector<T>(m, result);
+}
+
+template<class T>
+long long ToyProductChain<T>::getCost() const
+{
+  std::vector<int> split;
+  return plan(Factors, split);
+}
+
+template<class T>
+long long ToyProductChain<T>::getLeftToRightCost() const
+{
+  long long cost = 0, rows = Factors[0]->getNumRows();
+  for (size_t i=1; i<Factors.size(); i++) {
+    cost += rows * Factors[i]->getNumRows() * Factors[i]->getNumColumns();
+  }
+  return cost;
+}
+
+template<class T>
+void ToyProductChain<T>::describe(std::ostringstream& out, const std::vector<int>& split,
+                                  int first, int last) const
+{
+  if (first == last) {
+    out << first;
+    return;
+  }
+  int k = split[first*(int)Factors.size()+last];
+  out << "(";
+  describe(out, split, first, k);
+  out << " ";
+  describe(out, split, k+1, last);
+  out << ")";
+}
+
+template<class T>
+std::string ToyProductChain<T>::getOrder() const
+{
+  std::vector<int> split;
+  plan(Factors, split);
+  std::ostringstream out;
+  describe(out, split, 0, (int)Factors.size()-1);
+  return out.str();
+}
+
+#endif // TOYCHAIN_H
@@ -0,0 +1,202 @@
+//------------------------------------------------------------------------------
+// Complex matrices.
+//
+// ToyMatrix<std::complex<float>> and ToyMatrix<std::complex<double>> work
+// like the real instantiations; their products go through the split
+// kernels in toykernels.h. ToySplitComplexMatrix stores the real and the
+// imaginary parts as two separate row-major arrays instead, so sums,
+// differences and scaling are plain real loops that the compiler
+// vectorises, and products skip the splitting step:
+//
+//   ToySplitComplexMatrix<float> a(toySplit(m)), b(toySplit(n));
+//   ToySplitComplexMatrix<float> c = toyMultiply(a, b, ToyComplex3M);
+//   ToyMatrix<std::complex<float> > result = c.toMatrix();
+//
+// See toySplitGemm() for the 3M and 4M product formulas.
+//------------------------------------------------------------------------------
+
+#ifndef TOYCOMPLEX_H
+#define TOYCOMPLEX_H
+
+#include <toykernels.h>
+#include <toymatrix.h>
+
+#include <cassert>
+#include <complex>
+#include <vector>
+
+template<class T>
+class ToySplitComplexMatrix {
+public:
+  ToySplitComplexMatrix(int rows = 0, int columns = 0);
+
+  int getNumRows() const;
+  int getNumColumns() const;
+
+  std::complex<T> get(int row, int column) const;
+  void            set(int row, int column, const std::complex<T>& value);
+
+  // The parts, each rows x columns in row-major order.
+  T*       getReal();
+  const T* getReal() const;
+  T*       getImag();
+  const T* getImag() const;
+
+  ToySplitComplexMatrix& operator+=(const ToySplitComplexMatrix& rhs);
+  ToySplitComplexMatrix& operator-=(const ToySplitComplexMatrix& rhs);
+  ToySplitComplexMatrix& operator*=(const std::complex<T>& rhs);
+
+  ToyMatrix<std::complex<T> > toMatrix() const;
+
+private:
+  int Rows, Columns;
+  std::vector<T> Real, Imag;
+};
+
+template<class T>
+ToySplitComplexMatrix<T>::ToySplitComplexMatrix(int rows /*= 0*/, int columns /*= 0*/) :
+  Rows(rows),
+  Columns(columns),
+  Real((size_t)rows*columns, T()),
+  Imag((size_t)rows*columns, T())
+{
+}
+
+template<class T>
+inline int ToySplitComplexMatrix<T>::getNumRows() const
+{
+  return Rows;
+}
+
+template<class T>
+inline int ToySplitComplexMatrix<T>::getNumColumns() const
+{
+  return Columns;
+}
+
+template<class T>
+inline std::complex<T> ToySplitComplexMatrix<T>::get(int row, int column) const
+{
+  assert(row < Rows && column < Columns);
+  return std::complex<T>(Real[(size_t)row*Columns + column], Imag[(size_t)row*Columns + column]);
+}
+
+template<class T>
+inline void ToySplitComplexMatrix<T>::set(int row, int column, const std::complex<T>& value)
+{
+  assert(row < Rows && column < Columns);
+  Real[(size_t)row*Columns + column] = value.real();
+  Imag[(size_t)row*Columns + column] = value.imag();
+}
+
+template<class T>
+inline T* ToySplitComplexMatrix<T>::getReal()
+{
+  return Real.empty() ? 0 : &Real[0];
+}
+
+template<class T>
+inline const T* ToySplitComplexMatrix<T>::getReal() const
+{
+  return Real.empty() ? 0 : &Real[0];
+}
+
+template<class T>
+inline T* ToySplitComplexMatrix<T>::getImag()
+{
+  return Imag.empty() ? 0 : &Imag[0];
+}
+
+template<class T>
+inline const T* ToySplitComplexMatrix<T>::getImag() const
+{
+  return Imag.empty() ? 0 : &Imag[0];
+}
+
+template<class T>
+ToySplitComplexMatrix<T>& ToySplitComplexMatrix<T>::operator+=(const ToySplitComplexMatrix& rhs)
+{
+  assert(Rows == rhs.Rows && Columns == rhs.Columns);
+  toyAxpy((int)Real.size(), T(1), rhs.getReal(), getReal());
+  toyAxpy((int)Imag.size(), T(1), rhs.getImag(), getImag());
+  return (*this);
+}
+
+template<class T>
+ToySplitComplexMatrix<T>& ToySplitComplexMatrix<T>::operator-=(const ToySplitComplexMatrix& rhs)
+{
+  assert(Rows == rhs.Rows && Columns == rhs.Columns);
+  toyAxpy((int)Real.size(), T(-1), rhs.getReal(), getReal());
+  toyAxpy((int)Imag.size(), T(-1), rhs.getImag(), getImag());
+  return (*this);
+}
+
+template<class T>
+ToySplitComplexMatrix<T>& ToySplitComplexMatrix<T>::operator*=(const std::complex<T>& rhs)
+{
+  T sr = rhs.real(), si = rhs.imag();
+  T* re = getReal();
+  T* im = getImag();
+  for (size_t i=0; i<Real.size(); i++) {
+    T r = re[i];
+    re[i] = sr*r - si*im[i];
+    im[i] = sr*im[i] + si*r;
+  }
+  return (*this);
+}
+
+template<class T>
+ToyMatrix<std::complex<T> > ToySplitComplexMatrix<T>::toMatrix() const
+{
+  ToyMatrix<std::complex<T> > matrix(Rows, Columns, toyUninitialized);
+  std::complex<T>* entries = matrix.getEntries();
+  for (size_t i=0; i<Real.size(); i++) entries[i] = std::complex<T>(Real[i], Imag[i]);
+  return matrix;
+}
+
+template<class T>
+ToySplitComplexMatrix<T> toySplit(const ToyMatrix<std::complex<T> >& matrix)
+{
+  ToySplitComplexMatrix<T> split(matrix.getNumRows(), matrix.getNumColumns());
+  toySplitEntries(matrix.getNumRows(), matrix.getNumColumns(), matrix.getEntries(),
+                  matrix.getRowStride(), matrix.getColumnStride(),
+                  split.getReal(), split.getImag());
+  return split;
+}
+
+template<class T>
+ToySplitComplexMatrix<T> operator+(ToySplitComplexMatrix<T> lhs, const ToySplitComplexMatrix<T>& rhs)
+{
+  lhs += rhs;
+  return lhs;
+}
+
+template<class T>
+ToySplitComplexMatrix<T> operator-(ToySplitComplexMatrix<T> lhs, const ToySplitComplexMatrix<T>& rhs)
+{
+  lhs -= rhs;
+  return lhs;
+}
+
+template<class T>
+ToySplitComplexMatrix<T> toyMultiply(const ToySplitComplexMatrix<T>& lhs,
+                                     const ToySplitComplexMatrix<T>& rhs,
+                                     ToyComplexProduct method = ToyComplex4M)
+{
+  assert(lhs.getNumColumns() == rhs.getNumRows());
+  int m = lhs.getNumRows(), n = rhs.getNumColumns(), k = lhs.getNumColumns();
+  ToySplitComplexMatrix<T> result(m, n);
+  toySplitGemm(m, n, k, lhs.getReal(), lhs.getImag(), k, 1,
+               rhs.getReal(), rhs.getImag(), n, 1,
+               result.getReal(), result.getImag(), n, 1, method);
+  return result;
+}
+
+template<class T>
+ToySplitComplexMatrix<T> operator*(const ToySplitComplexMatrix<T>& lhs,
+                                   const ToySplitComplexMatrix<T>& rhs)
+{
+  return toyMultiply(lhs, rhs);
+}
+
+#endif // TOYCOMPLEX_H
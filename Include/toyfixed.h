@@ -0,0 +1,187 @@
+//------------------------------------------------------------------------------
+// Fixed-size matrices and vectors whose arithmetic is constexpr, so constant
+// tables (projections, basis changes, lookup matrices) can be computed by
+// the compiler and placed in read-only data:
+//
+//   constexpr ToyFixedMatrix<float,4,4> view = toyFixedIdentity<float,4>();
+//   constexpr ToyFixedMatrix<float,4,4> table = projection * view;
+//
+// The dimensions are template parameters, so mismatched operands fail to
+// compile instead of tripping the runtime asserts of ToyMatrix. Entries are
+// stored in row-major order in a plain array; the types are aggregates
+// and can be brace-initialised. toMatrix() converts to ToyMatrix for use
+// with the dynamic code.
+//------------------------------------------------------------------------------
+
+#ifndef TOYFIXED_H
+#define TOYFIXED_H
+
+#include <toymatrix.h>
+#include <toyvector.h>
+
+template<class T, int R, int C>
+struct ToyFixedMatrix {
+  static_assert(R > 0 && C > 0, "fixed matrices need positive dimensions");
+
+  constexpr int getNumRows() const { return R; }
+  constexpr int getNumColumns() const { return C; }
+
+  constexpr const T& operator()(int row, int column) const { return Entries[row*C + column]; }
+  constexpr T&       operator()(int row, int column)       { return Entries[row*C + column]; }
+  // Entry i in storage order, for vectors.
+  constexpr const T& operator[](int i) const { return Entries[i]; }
+  constexpr T&       operator[](int i)       { return Entries[i]; }
+
+  ToyMatrix<T> toMatrix() const;
+  ToyVector<T> toVector() const;
+
+  T Entries[R*C];
+};
+
+// Column vectors are N x 1 matrices, so matrix-vector products need no
+// extra code.
+template<class T, int N>
+using ToyFixedVector = ToyFixedMatrix<T, N, 1>;
+
+template<class T, int R, int C>
+ToyMatrix<T> ToyFixedMatrix<T,R,C>::toMatrix() const
+{
+  T* entries = new T[R*C];
+  for (int i=0; i<R*C; i++) entries[i] = Entries[i];
+  return ToyMatrix<T>(R, C, entries);
+}
+
+template<class T, int R, int C>
+ToyVector<T> ToyFixedMatrix<T,R,C>::toVector() const
+{
+  static_assert(C == 1, "only column vectors convert to ToyVector");
+  T* entries = new T[R];
+  for (int i=0; i<R; i++) entries[i] = Entries[i];
+  return ToyVector<T>(R, entries);
+}
+
+template<class T, int R, int C>
+constexpr ToyFixedMatrix<T,R,C> toyFixedZero()
+{
+  ToyFixedMatrix<T,R,C> result = {};
+  return result;
+}
+
+template<class T, int N>
+constexpr ToyFixedMatrix<T,N,N> toyFixedIdentity()
+{
+  ToyFixedMatrix<T,N,N> result = {};
+  for (int i=0; i<N; i++) result(i,i) = T(1);
+  return result;
+}
+
+template<class T, int R, int C1, int C2, int N>
+constexpr ToyFixedMatrix<T,R,N> operator*(const ToyFixedMatrix<T,R,C1>& lhs,
+                                          const ToyFixedMatrix<T,C2,N>& rhs)
+{
+  static_assert(C1 == C2, "inner dimensions of a matrix product must agree");
+  ToyFixedMatrix<T,R,N> result = {};
+  for (int i=0; i<R; i++) {
+    for (int j=0; j<N; j++) {
+      T sum = T();
+      for (int k=0; k<C1; k++) sum += lhs(i,k) * rhs(k,j);
+      result(i,j) = sum;
+    }
+  }
+  return result;
+}
+
+template<class T, int R, int C>
+constexpr ToyFixedMatrix<T,R,C> operator+(const ToyFixedMatrix<T,R,C>& lhs,
+                                          const ToyFixedMatrix<T,R,C>& rhs)
+{
+  ToyFixedMatrix<T,R,C> result = {};
+  for (int i=0; i<R*C; i++) result[i] = lhs[i] + rhs[i];
+  return result;
+}
+
+template<class T, int R, int C>
+constexpr ToyFixedMatrix<T,R,C> operator-(const ToyFixedMatrix<T,R,C>& lhs,
+                                          const ToyFixedMatrix<T,R,C>& rhs)
+{
+  ToyFixedMatrix<T,R,C> result = {};
+  for (int i=0; i<R*C; i++) result[i] = lhs[i] - rhs[i];
+  return result;
+}
+
+template<class T, int R, int C>
+constexpr ToyFixedMatrix<T,R,C> operator*(T lhs, const ToyFixedMatrix<T,R,C>& rhs)
+{
+  ToyFixedMatrix<T,R,C> result = {};
+  for (int i=0; i<R*C; i++) result[i] = lhs * rhs[i];
+  return result;
+}
+
+template<class T, int R, int C>
+constexpr bool operator==(const ToyFixedMatrix<T,R,C>& lhs, const ToyFixedMatrix<T,R,C>& rhs)
+{
+  for (int i=0; i<R*C; i++) {
+    if (!(lhs[i] == rhs[i])) return false;
+  }
+  return true;
+}
+
+template<class T, int R, int C>
+constexpr ToyFixedMatrix<T,C,R> toyTranspose(const ToyFixedMatrix<T,R,C>& m)
+{
+  ToyFixedMatrix<T,C,R> result = {};
+  for (int i=0; i<R; i++) {
+    for (int j=0; j<C; j++) result(j,i) = m(i,j);
+  }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// Determinant by fraction-free (Bareiss) elimination: every division is
+// exact, so integer matrices give exact results as well.
+//------------------------------------------------------------------------------
+template<class T, int N>
+constexpr T toyDeterminant(ToyFixedMatrix<T,N,N> m)
+{
+  T sign = T(1), previous = T(1);
+  for (int k=0; k<N-1; k++) {
+    if (m(k,k) == T()) {
+      int pivot = k+1;
+      while (pivot < N && m(pivot,k) == T()) pivot++;
+      if (pivot == N) return T();
+      for (int j=0; j<N; j++) {
+        T swap = m(k,j);
+        m(k,j) = m(pivot,j);
+        m(pivot,j) = swap;
+      }
+      sign = -sign;
+    }
+    for (int i=k+1; i<N; i++) {
+      for (int j=k+1; j<N; j++) {
+        m(i,j) = (m(i,j)*m(k,k) - m(i,k)*m(k,j)) / previous;
+      }
+    }
+    previous = m(k,k);
+  }
+  return sign * m(N-1,N-1);
+}
+
+template<class T, int N>
+constexpr T toyDot(const ToyFixedVector<T,N>& lhs, const ToyFixedVector<T,N>& rhs)
+{
+  T sum = T();
+  for (int i=0; i<N; i++) sum += lhs[i] * rhs[i];
+  return sum;
+}
+
+template<class T, int N>
+constexpr ToyFixedVector<T,3> toyCross(const ToyFixedVector<T,N>& lhs, const ToyFixedVector<T,N>& rhs)
+{
+  static_assert(N == 3, "the cross product needs 3D vectors");
+  ToyFixedVector<T,3> result = {{ lhs[1]*rhs[2] - lhs[2]*rhs[1],
+                                  lhs[2]*rhs[0] - lhs[0]*rhs[2],
+                                  lhs[0]*rhs[1] - lhs[1]*rhs[0] }};
+  return result;
+}
+
+#endif // TOYFIXED_H
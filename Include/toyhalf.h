@@ -0,0 +1,204 @@
+//------------------------------------------------------------------------------
+// 16-bit floating point element types for bandwidth-bound matrices.
+//
+//   ToyHalf      IEEE 754 binary16: 5 exponent bits, 10 mantissa bits
+//   ToyBFloat16  bfloat16: float's 8 exponent bits, 7 mantissa bits
+//
+// Both store 16 bits and behave like float in expressions: they convert
+// implicitly to and from float with round-to-nearest-even. Conversions use
+// the F16C instructions when the compiler targets them (-mf16c) and exact
+// bit manipulation otherwise.
+//
+// The kernels accumulate products of these types in float (see
+// ToyAccumulator in toykernels.h), so ToyMatrix<ToyHalf> * ToyMatrix<ToyHalf>
+// only rounds to 16 bits when storing the result. toyConvert() turns whole
+// matrices into other element types, e.g. from and to ToyMatrix<float>:
+//
+//   ToyMatrix<ToyHalf> weights = toyConvert<ToyHalf>(floatWeights);
+//   ToyMatrix<float>   output  = toyConvert<float>(weights * inputs);
+//------------------------------------------------------------------------------
+
+#ifndef TOYHALF_H
+#define TOYHALF_H
+
+#include <toykernels.h>
+#include <toymatrix.h>
+#include <toyparallel.h>
+
+#include <cstring>
+#include <stdint.h>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+struct ToyHalfFormat {
+  static uint16_t fromFloat(float value);
+  static float    toFloat(uint16_t bits);
+};
+
+struct ToyBFloat16Format {
+  static uint16_t fromFloat(float value);
+  static float    toFloat(uint16_t bits);
+};
+
+//------------------------------------------------------------------------------
+// Default construction leaves the bits undefined, as for float, so the
+// type stays trivial and large matrices of it can be mapped lazily.
+//------------------------------------------------------------------------------
+template<class Format>
+class ToyFloat16 {
+public:
+  ToyFloat16() = default;
+  ToyFloat16(float value) : Bits(Format::fromFloat(value)) {}
+
+  operator float() const { return Format::toFloat(Bits); }
+
+  ToyFloat16& operator+=(float rhs) { return (*this) = float(*this) + rhs; }
+  ToyFloat16& operator-=(float rhs) { return (*this) = float(*this) - rhs; }
+  ToyFloat16& operator*=(float rhs) { return (*this) = float(*this) * rhs; }
+  ToyFloat16& operator/=(float rhs) { return (*this) = float(*this) / rhs; }
+
+  uint16_t getBits() const { return Bits; }
+  static ToyFloat16 fromBits(uint16_t bits) { ToyFloat16 value; value.Bits = bits; return value; }
+
+private:
+  uint16_t Bits;
+};
+
+typedef ToyFloat16<ToyHalfFormat>     ToyHalf;
+typedef ToyFloat16<ToyBFloat16Format> ToyBFloat16;
+
+template<class Format>
+struct ToyAccumulator<ToyFloat16<Format> > {
+  typedef float Type;
+  typedef float Wide;
+  static bool widen() { return false; }
+};
+
+inline uint32_t toyFloatBits(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline float toyBitsFloat(uint32_t bits)
+{
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+inline uint16_t ToyHalfFormat::fromFloat(float value)
+{
+#ifdef __F16C__
+  return (uint16_t)_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+  uint32_t bits = toyFloatBits(value);
+  uint32_t sign = (bits >> 16) & 0x8000;
+  bits &= 0x7fffffff;
+  if (bits >= (uint32_t)(127+16) << 23) {
+    // Too large for a half: infinity, or a quiet NaN.
+    return (uint16_t)(sign | (bits > 0x7f800000 ? 0x7e00 : 0x7c00));
+  }
+  if (bits < (uint32_t)(127-14) << 23) {
+    // Subnormal or zero: adding 0.5 lets the FPU do the rounding shift.
+    float shifted = toyBitsFloat(bits) + 0.5f;
+    return (uint16_t)(sign | (toyFloatBits(shifted) - 0x3f000000));
+  }
+  // Rebias the exponent and round the 13 dropped mantissa bits to even;
+  // a carry into the exponent correctly rounds up to infinity.
+  uint32_t odd = (bits >> 13) & 1;
+  bits += ((uint32_t)(15-127) << 23) + 0xfff + odd;
+  return (uint16_t)(sign | (bits >> 13));
+#endif
+}
+
+inline float ToyHalfFormat::toFloat(uint16_t half)
+{
+#ifdef __F16C__
+  return _cvtsh_ss(half);
+#else
+  uint32_t bits = (uint32_t)(half & 0x7fff) << 13;
+  uint32_t exponent = bits & (0x7c00 << 13);
+  bits += (uint32_t)(127-15) << 23;
+  if (exponent == (0x7c00 << 13)) {
+    bits += (uint32_t)(128-16) << 23;         // infinity or NaN
+  } else if (exponent == 0) {
+    bits += 1 << 23;                          // subnormal: renormalise
+    bits = toyFloatBits(toyBitsFloat(bits) - toyBitsFloat((uint32_t)(127-14) << 23));
+  }
+  return toyBitsFloat(bits | (uint32_t)(half & 0x8000) << 16);
+#endif
+}
+
+inline uint16_t ToyBFloat16Format::fromFloat(float value)
+{
+  uint32_t bits = toyFloatBits(value);
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    return (uint16_t)((bits >> 16) | 0x40);  // keep NaNs quiet
+  }
+  bits += 0x7fff + ((bits >> 16) & 1);
+  return (uint16_t)(bits >> 16);
+}
+
+inline float ToyBFloat16Format::toFloat(uint16_t bits)
+{
+  return toyBitsFloat((uint32_t)bits << 16);
+}
+
+//------------------------------------------------------------------------------
+// Converts count contiguous entries. The float <-> half pairs convert eight
+// entries per instruction with F16C.
+//------------------------------------------------------------------------------
+template<class S, class D>
+void toyConvertEntries(const S* source, D* destination, size_t count)
+{
+  for (size_t i=0; i<count; i++) destination[i] = D(source[i]);
+}
+
+inline void toyConvertEntries(const float* source, ToyHalf* destination, size_t count)
+{
+  size_t i = 0;
+#ifdef __F16C__
+  for (; i+8<=count; i+=8) {
+    __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(source + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i*)(destination + i), half);
+  }
+#endif
+  for (; i<count; i++) destination[i] = ToyHalf(source[i]);
+}
+
+inline void toyConvertEntries(const ToyHalf* source, float* destination, size_t count)
+{
+  size_t i = 0;
+#ifdef __F16C__
+  for (; i+8<=count; i+=8) {
+    __m128i half = _mm_loadu_si128((const __m128i*)(source + i));
+    _mm256_storeu_ps(destination + i, _mm256_cvtph_ps(half));
+  }
+#endif
+  for (; i<count; i++) destination[i] = float(source[i]);
+}
+
+//------------------------------------------------------------------------------
+// Returns a copy of source with every entry converted to D. The storage
+// layout, including the transposed state, is kept.
+//------------------------------------------------------------------------------
+template<class D, class S>
+ToyMatrix<D> toyConvert(const ToyMatrix<S>& source)
+{
+  int rows = source.getNumRows(), columns = source.getNumColumns();
+  if (source.isTransposed()) std::swap(rows, columns);
+  ToyMatrix<D> result(rows, columns, toyUninitialized);
+  const S* from = source.getEntries();
+  D* to = result.getEntries();
+  ToyThreadPool::global().parallelFor(0, rows, [&](int lo, int hi) {
+    toyConvertEntries(from + (size_t)lo*columns, to + (size_t)lo*columns, (size_t)(hi-lo)*columns);
+  }, 64);
+  if (source.isTransposed()) result.transpose();
+  return result;
+}
+
+#endif // TOYHALF_H
@@ -0,0 +1,648 @@
+//------------------------------------------------------------------------------
+// Fast text import and export of ToyMatrix and ToyVector as CSV and as
+// Matrix Market files.
+//
+// Writers format whole rows into a TOYIO_CHUNK byte buffer and hand full
+// buffers to the stream. Readers pull the stream into memory in chunks of
+// the same size, index the line starts and parse the lines straight into the
+// entries; input larger than TOYIO_PARALLEL_BYTES is parsed by the thread
+// pool unless parallel parsing is switched off.
+//
+// Numbers are converted with std::to_chars/std::from_chars where the
+// standard library provides them (C++17); otherwise integers use the
+// hand-written loops below and floating point numbers snprintf/strtod with
+// enough digits to round-trip exactly. On POSIX systems the fallback runs
+// in the "C" numeric locale, so files always use '.' as decimal point,
+// whatever LC_NUMERIC the program has set.
+//
+// Matrix Market files are written in dense "array" format. The readers also
+// accept "coordinate" files, including pattern and symmetric ones, and
+// expand them into a dense ToyMatrix, since there is no sparse matrix type;
+// of several coordinate entries for one position the last one wins.
+// Errors throw ToyIOError with the line number of the first bad line in
+// the file.
+//------------------------------------------------------------------------------
+
+#ifndef TOYIO_H
+#define TOYIO_H
+
+#include <exception.h>
+#include <toymatrix.h>
+#include <toyparallel.h>
+#include <toyvector.h>
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#if defined(__cpp_lib_to_chars)
+#define TOYIO_HAS_CHARCONV 1
+#endif
+#endif
+#endif
+
+#if !defined(TOYIO_HAS_CHARCONV) && (defined(__unix__) || defined(__APPLE__))
+#include <locale.h>
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
+#define TOYIO_USELOCALE 1
+#endif
+
+#ifndef TOYIO_CHUNK
+#define TOYIO_CHUNK (1 << 20)
+#endif
+#ifndef TOYIO_PARALLEL_BYTES
+#define TOYIO_PARALLEL_BYTES (1 << 20)
+#endif
+
+// Longest text one number can produce.
+#define TOYIO_MAX_NUMBER 40
+
+//! Puts the calling thread into the "C" numeric locale while in scope.
+class ToyCNumericLocale {
+public:
+#ifdef TOYIO_USELOCALE
+  ToyCNumericLocale() : Previous(cLocale() ? uselocale(cLocale()) : (locale_t)0) {}
+  ~ToyCNumericLocale() { if (Previous) uselocale(Previous); }
+
+private:
+  static locale_t cLocale()
+  {
+    static locale_t c = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+    return c;
+  }
+  locale_t Previous;
+#endif
+};
+
+//------------------------------------------------------------------------------
+// Number formatting: writes value at p and returns the end of the text.
+//------------------------------------------------------------------------------
+inline char* toyFormatInteger(char* p, long long value)
+{
+  unsigned long long magnitude = (value < 0) ? 0ull - (unsigned long long)value
+                                             : (unsigned long long)value;
+  if (value < 0) *p++ = '-';
+  char digits[24];
+  int n = 0;
+  do {
+    digits[n++] = char('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+  while (n) *p++ = digits[--n];
+  return p;
+}
+
+inline char* toyFormatNumber(char* p, double value)
+{
+#ifdef TOYIO_HAS_CHARCONV
+  return std::to_chars(p, p + TOYIO_MAX_NUMBER, value).ptr;
+#else
+  ToyCNumericLocale locale;
+  return p + snprintf(p, TOYIO_MAX_NUMBER, "%.17g", value);
+#endif
+}
+
+inline char* toyFormatNumber(char* p, float value)
+{
+#ifdef TOYIO_HAS_CHARCONV
+  return std::to_chars(p, p + TOYIO_MAX_NUMBER, value).ptr;
+#else
+  ToyCNumericLocale locale;
+  return p + snprintf(p, TOYIO_MAX_NUMBER, "%.9g", (double)value);
+#endif
+}
+
+//! Integers, and any other type through float.
+template<class T>
+char* toyFormatNumber(char* p, T value)
+{
+  if (std::is_integral<T>::value) return toyFormatInteger(p, (long long)value);
+  return toyFormatNumber(p, (float)value);
+}
+
+//------------------------------------------------------------------------------
+// Number parsing: reads a number starting at p, skipping leading blanks.
+// Returns the position after it, or 0 if there is no number or an integer
+// does not fit into its type. The text must be followed by a character that
+// is not part of a number, e.g. '\0'.
+//------------------------------------------------------------------------------
+inline const char* toySkipBlanks(const char* p)
+{
+  while (*p == ' ' || *p == '\t') p++;
+  return p;
+}
+
+//! End of the number starting at p. Numbers consist of digits, letters
+//! (exponents, inf, nan), signs and the decimal point.
+inline const char* toyNumberEnd(const char* p)
+{
+  while (isalnum((unsigned char)*p) || *p == '.' || *p == '+' || *p == '-') p++;
+  return p;
+}
+
+inline const char* toyParseInteger(const char* p, long long& value)
+{
+  p = toySkipBlanks(p);
+  bool negative = (*p == '-');
+  if (*p == '-' || *p == '+') p++;
+  if (*p < '0' || *p > '9') return 0;
+  unsigned long long limit = (unsigned long long)LLONG_MAX + (negative ? 1 : 0);
+  unsigned long long magnitude = 0;
+  while (*p >= '0' && *p <= '9') {
+    unsigned long long digit = (unsigned long long)(*p++ - '0');
+    if (magnitude > (limit - digit) / 10) return 0;
+    magnitude = magnitude*10 + digit;
+  }
+  // Negated this way round, LLONG_MIN does not overflow.
+  value = negative ? -(long long)(magnitude - 1) - 1 : (long long)magnitude;
+  return p;
+}
+
+inline const char* toyParseNumber(const char* p, double& value)
+{
+  p = toySkipBlanks(p);
+  // strtod() would skip line breaks as well.
+  if (*p == '\n' || *p == '\r' || *p == '\0') return 0;
+#ifdef TOYIO_HAS_CHARCONV
+  if (*p == '+') p++;
+  std::from_chars_result result = std::from_chars(p, toyNumberEnd(p), value);
+  return (result.ec == std::errc()) ? result.ptr : 0;
+#else
+  ToyCNumericLocale locale;
+  char* end;
+  value = strtod(p, &end);
+  return (end == p) ? 0 : end;
+#endif
+}
+
+inline const char* toyParseNumber(const char* p, float& value)
+{
+  p = toySkipBlanks(p);
+  if (*p == '\n' || *p == '\r' || *p == '\0') return 0;
+#ifdef TOYIO_HAS_CHARCONV
+  if (*p == '+') p++;
+  std::from_chars_result result = std::from_chars(p, toyNumberEnd(p), value);
+  return (result.ec == std::errc()) ? result.ptr : 0;
+#else
+  ToyCNumericLocale locale;
+  char* end;
+  value = strtof(p, &end);
+  return (end == p) ? 0 : end;
+#endif
+}
+
+template<class T>
+const char* toyParseNumber(const char* p, T& value)
+{
+  if (std::is_integral<T>::value) {
+    long long integer = 0;
+    p = toyParseInteger(p, integer);
+    if (!p) return 0;
+    if (integer < (long long)std::numeric_limits<T>::min()) return 0;
+    if ((unsigned long long)std::numeric_limits<T>::max() < (unsigned long long)LLONG_MAX &&
+        integer > (long long)std::numeric_limits<T>::max()) return 0;
+    value = T(integer);
+    return p;
+  }
+  float real;
+  p = toyParseNumber(p, real);
+  value = T(real);
+  return p;
+}
+
+//! True if nothing but blanks follows p on its line.
+inline bool toyAtLineEnd(const char* p)
+{
+  p = toySkipBlanks(p);
+  if (*p == '\r') p++;
+  return *p == '\n' || *p == '\0';
+}
+
+//! Why no number could be parsed at p: digits that do not fit, or none.
+inline const char* toyNumberError(const char* p)
+{
+  p = toySkipBlanks(p);
+  if (*p == '-' || *p == '+') p++;
+  return (*p >= '0' && *p <= '9') ? "number out of range" : "expected a number";
+}
+
+//------------------------------------------------------------------------------
+// Buffered output: collects text and writes it out TOYIO_CHUNK bytes at once.
+//------------------------------------------------------------------------------
+class ToyOutputBuffer {
+public:
+  explicit ToyOutputBuffer(std::ostream& out) : Out(out), Buffer(TOYIO_CHUNK + 2*TOYIO_MAX_NUMBER), Used(0) {}
+  ~ToyOutputBuffer() { flush(); }
+
+  // Room for at least one more number.
+  char* reserve()
+  {
+    if (Used + TOYIO_MAX_NUMBER + 1 > TOYIO_CHUNK) flush();
+    return &Buffer[Used];
+  }
+  void commit(char* end) { Used = end - &Buffer[0]; }
+
+  template<class T>
+  void number(T value) { commit(toyFormatNumber(reserve(), value)); }
+  void character(char c) { *reserve() = c; Used++; }
+  void text(const std::string& s)
+  {
+    for (size_t i=0; i<s.size(); i++) character(s[i]);
+  }
+  void flush()
+  {
+    if (Used) Out.write(&Buffer[0], Used);
+    Used = 0;
+  }
+
+private:
+  std::ostream&     Out;
+  std::vector<char> Buffer;
+  size_t            Used;
+};
+
+//! Reads the rest of the stream in TOYIO_CHUNK sized pieces. The result
+//! is terminated by '\0' for the parsers.
+inline std::string toyReadAll(std::istream& in)
+{
+  std::string text;
+  std::vector<char> chunk(TOYIO_CHUNK);
+  while (in) {
+    in.read(&chunk[0], TOYIO_CHUNK);
+    text.append(&chunk[0], (size_t)in.gcount());
+  }
+  text.push_back('\0');
+  return text;
+}
+
+struct ToyTextLine {
+  size_t Start;    // offset into the text
+  size_t Number;   // 1-based line number in the file
+};
+
+//! All lines from offset on that are neither empty nor start with the
+//! comment character.
+inline std::vector<ToyTextLine> toyLineStarts(const std::string& text, size_t offset, char comment)
+{
+  std::vector<ToyTextLine> starts;
+  size_t size = text.size() - 1;
+  size_t number = 1 + (size_t)std::count(text.begin(), text.begin() + offset, '\n');
+  for (; offset < size; number++) {
+    const char* line = text.c_str() + offset;
+    const char* newline = (const char*)memchr(line, '\n', size - offset);
+    size_t next = newline ? (size_t)(newline - text.c_str()) + 1 : size;
+    const char* first = toySkipBlanks(line);
+    if (*first != comment && *first != '\n' && *first != '\r' && *first != '\0') {
+      ToyTextLine start = {offset, number};
+      starts.push_back(start);
+    }
+    offset = next;
+  }
+  return starts;
+}
+
+//! Calls parse(first, last) for the line ranges, in parallel for large
+//! input. Each range stops at its first error; the error of the lowest
+//! range is rethrown on the calling thread, so it is always the one of the
+//! first bad line.
+template<class F>
+void toyParseLines(size_t numLines, size_t numBytes, bool parallel, F parse)
+{
+  if (!parallel || numBytes < TOYIO_PARALLEL_BYTES) {
+    parse(0, (int)numLines);
+    return;
+  }
+  std::mutex errorMutex;
+  int failedAt = -1;
+  ToyIOError error;
+  ToyThreadPool::global().parallelFor(0, (int)numLines, [&](int lo, int hi) {
+    try {
+      parse(lo, hi);
+    } catch (const ToyIOError& e) {
+      std::lock_guard<std::mutex> lock(errorMutex);
+      if (failedAt < 0 || lo < failedAt) {
+        error = e;
+        failedAt = lo;
+      }
+    }
+  }, 1024);
+  if (failedAt >= 0) throw error;
+}
+
+inline ToyIOError toyParseError(size_t line, const std::string& what)
+{
+  std::ostringstream message;
+  message << "line " << line << ": " << what;
+  return ToyIOError(message.str());
+}
+
+//! Parses the number at p, which must be the last one on its line.
+template<class T>
+void toyParseLastNumber(const char* p, T& value, size_t line)
+{
+  const char* end = toyParseNumber(p, value);
+  if (!end) throw toyParseError(line, toyNumberError(p));
+  if (!toyAtLineEnd(end)) throw toyParseError(line, "unexpected text after the number");
+}
+
+//------------------------------------------------------------------------------
+// CSV: one line per row, entries separated by delimiter.
+//------------------------------------------------------------------------------
+template<class T>
+void toyWriteCsv(std::ostream& out, const ToyMatrix<T>& m, char delimiter = ',')
+{
+  ToyOutputBuffer buffer(out);
+  for (int i=0; i<m.getNumRows(); i++) {
+    for (int j=0; j<m.getNumColumns(); j++) {
+      if (j) buffer.character(delimiter);
+      buffer.number(m(i,j));
+    }
+    buffer.character('\n');
+  }
+  buffer.flush();
+  if (!out) throw ToyIOError("write failed");
+}
+
+//! Lines starting with '#' are skipped. All rows need the same number of
+//! entries.
+template<class T>
+ToyMatrix<T> toyReadCsv(std::istream& in, char delimiter = ',', bool parallel = true)
+{
+  std::string text = toyReadAll(in);
+  std::vector<ToyTextLine> starts = toyLineStarts(text, 0, '#');
+  if (starts.empty()) throw ToyIOError("no data");
+
+  // The first row determines the number of columns.
+  int columns = 1;
+  for (const char* p = text.c_str() + starts[0].Start; *p && *p != '\n'; p++) {
+    if (*p == delimiter) columns++;
+  }
+  int rows = (int)starts.size();
+  ToyMatrix<T> m(rows, columns, toyUninitialized);
+  T* entries = m.getEntries();
+  const char* base = text.c_str();
+
+  toyParseLines(starts.size(), text.size(), parallel, [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) {
+      const char* p = base + starts[i].Start;
+      size_t line = starts[i].Number;
+      for (int j=0; j<columns; j++) {
+        if (j) {
+          p = toySkipBlanks(p);
+          if (*p != delimiter) throw toyParseError(line, "expected delimiter");
+          p++;
+        }
+        const char* number = p;
+        p = toyParseNumber(p, entries[(size_t)i*columns + j]);
+        if (!p) throw toyParseError(line, toyNumberError(number));
+      }
+      if (!toyAtLineEnd(p)) throw toyParseError(line, "too many entries");
+    }
+  });
+  return m;
+}
+
+//------------------------------------------------------------------------------
+// Matrix Market.
+//------------------------------------------------------------------------------
+template<class T>
+void toyWriteMatrixMarket(std::ostream& out, const ToyMatrix<T>& m)
+{
+  ToyOutputBuffer buffer(out);
+  buffer.text(std::is_integral<T>::value ? "%%MatrixMarket matrix array integer general\n"
+                                         : "%%MatrixMarket matrix array real general\n");
+  buffer.number(m.getNumRows());
+  buffer.character(' ');
+  buffer.number(m.getNumColumns());
+  buffer.character('\n');
+  // The array format lists the entries column by column.
+  for (int j=0; j<m.getNumColumns(); j++) {
+    for (int i=0; i<m.getNumRows(); i++) {
+      buffer.number(m(i,j));
+      buffer.character('\n');
+    }
+  }
+  buffer.flush();
+  if (!out) throw ToyIOError("write failed");
+}
+
+template<class T>
+ToyMatrix<T> toyReadMatrixMarket(std::istream& in, bool parallel = true)
+{
+  std::string text = toyReadAll(in);
+  const char* base = text.c_str();
+  size_t headerEnd = text.find('\n');
+  if (text.compare(0, 14, "%%MatrixMarket") != 0 || headerEnd == std::string::npos) {
+    throw ToyIOError("missing %%MatrixMarket header");
+  }
+  std::istringstream header(text.substr(14, headerEnd - 14));
+  std::string object, format, field, symmetry;
+  header >> object >> format >> field >> symmetry;
+  for (size_t c=0; c<format.size(); c++) format[c] = (char)tolower(format[c]);
+  for (size_t c=0; c<field.size(); c++) field[c] = (char)tolower(field[c]);
+  for (size_t c=0; c<symmetry.size(); c++) symmetry[c] = (char)tolower(symmetry[c]);
+  bool coordinate = (format == "coordinate");
+  bool pattern = (field == "pattern");
+  bool symmetric = (symmetry == "symmetric");
+  bool skew = (symmetry == "skew-symmetric");
+  if ((!coordinate && format != "array") || field == "complex" || symmetry == "hermitian") {
+    throw ToyIOError("unsupported Matrix Market format");
+  }
+
+  std::vector<ToyTextLine> starts = toyLineStarts(text, headerEnd + 1, '%');
+  if (starts.empty()) throw ToyIOError("missing size line");
+  long long sizes[3] = {0, 0, 0};
+  const char* p = base + starts[0].Start;
+  for (int s=0; s<(coordinate ? 3 : 2); s++) {
+    p = toyParseInteger(p, sizes[s]);
+    if (!p) throw ToyIOError("invalid size line");
+  }
+  if (!toyAtLineEnd(p) || sizes[0] < 1 || sizes[1] < 1 || sizes[0] > INT_MAX || sizes[1] > INT_MAX ||
+      (coordinate && sizes[2] < 0)) {
+    throw ToyIOError("invalid size line");
+  }
+  int rows = (int)sizes[0], columns = (int)sizes[1];
+  if ((symmetric || skew) && rows != columns) throw ToyIOError("symmetric matrix is not square");
+  size_t numLines = starts.size() - 1;
+  const ToyTextLine* lines = numLines ? &starts[1] : 0;
+
+  if (!coordinate) {
+    // Dense: one entry per line, column by column; symmetric files only
+    // list the lower triangle.
+    size_t expected = (symmetric || skew) ? (size_t)rows*(rows+1)/2 - (skew ? rows : 0)
+                                          : (size_t)rows*columns;
+    if (numLines != expected) throw ToyIOError("wrong number of entries");
+    ToyMatrix<T> m(rows, columns, toyUninitialized);
+    T* entries = m.getEntries();
+    if (!symmetric && !skew) {
+      toyParseLines(numLines, text.size(), parallel, [&](int lo, int hi) {
+        for (int e=lo; e<hi; e++) {
+          toyParseLastNumber(base + lines[e].Start, entries[(size_t)(e % rows)*columns + e / rows],
+                             lines[e].Number);
+        }
+      });
+      return m;
+    }
+    size_t e = 0;
+    for (int j=0; j<columns; j++) {
+      if (skew) entries[(size_t)j*columns + j] = T();
+      for (int i=(skew ? j+1 : j); i<rows; i++, e++) {
+        T value;
+        toyParseLastNumber(base + lines[e].Start, value, lines[e].Number);
+        entries[(size_t)i*columns + j] = value;
+        entries[(size_t)j*columns + i] = skew ? T(-value) : value;
+      }
+    }
+    return m;
+  }
+
+  // Coordinate: "row column [value]" with 1-based indices, expanded into
+  // a dense matrix. The lines are parsed in parallel into a list of
+  // entries, which is then written in file order, so of several entries
+  // for the same position the last one wins.
+  if (numLines != (size_t)sizes[2]) throw ToyIOError("wrong number of entries");
+  struct Entry {
+    int Row, Column;
+    T   Value;
+  };
+  std::vector<Entry> parsed(numLines);
+  toyParseLines(numLines, text.size(), parallel, [&](int lo, int hi) {
+    for (int e=lo; e<hi; e++) {
+      long long i, j;
+      const char* q = toyParseInteger(base + lines[e].Start, i);
+      if (q) q = toyParseInteger(q, j);
+      if (!q || i < 1 || i > rows || j < 1 || j > columns) throw toyParseError(lines[e].Number, "invalid index");
+      T value = T(1);
+      if (pattern) {
+        if (!toyAtLineEnd(q)) throw toyParseError(lines[e].Number, "unexpected text after the indices");
+      } else {
+        toyParseLastNumber(q, value, lines[e].Number);
+      }
+      parsed[e].Row = (int)i - 1;
+      parsed[e].Column = (int)j - 1;
+      parsed[e].Value = value;
+    }
+  });
+  ToyMatrix<T> m(rows, columns);
+  T* entries = m.getEntries();
+  for (size_t e=0; e<numLines; e++) {
+    const Entry& entry = parsed[e];
+    entries[(size_t)entry.Row*columns + entry.Column] = entry.Value;
+    if ((symmetric || skew) && entry.Row != entry.Column) {
+      entries[(size_t)entry.Column*columns + entry.Row] = skew ? T(-entry.Value) : entry.Value;
+    }
+  }
+  return m;
+}
+
+//------------------------------------------------------------------------------
+// Vectors are written as a single column and read from a file holding one
+// row or one column.
+//------------------------------------------------------------------------------
+template<class T>
+ToyMatrix<T> toyColumnMatrix(const ToyVector<T>& v)
+{
+  int n = v.getNumEntries();
+  T* entries = new T[n];
+  for (int i=0; i<n; i++) entries[i] = v.getEntries()[i];
+  return ToyMatrix<T>(n, 1, entries);
+}
+
+template<class T>
+ToyVector<T> toyVectorFromMatrix(const ToyMatrix<T>& m)
+{
+  if (m.getNumRows() != 1 && m.getNumColumns() != 1) throw ToyIOError("not a vector");
+  int n = m.getNumRows() * m.getNumColumns();
+  T* entries = new T[n];
+  for (int i=0; i<n; i++) entries[i] = m.getEntries()[i];
+  return ToyVector<T>(n, entries);
+}
+
+template<class T>
+void toyWriteCsv(std::ostream& out, const ToyVector<T>& v, char delimiter = ',')
+{
+  toyWriteCsv(out, toyColumnMatrix(v), delimiter);
+}
+
+template<class T>
+ToyVector<T> toyReadCsvVector(std::istream& in, char delimiter = ',', bool parallel = true)
+{
+  return toyVectorFromMatrix(toyReadCsv<T>(in, delimiter, parallel));
+}
+
+template<class T>
+void toyWriteMatrixMarket(std::ostream& out, const ToyVector<T>& v)
+{
+  toyWriteMatrixMarket(out, toyColumnMatrix(v));
+}
+
+template<class T>
+ToyVector<T> toyReadMatrixMarketVector(std::istream& in, bool parallel = true)
+{
+  return toyVectorFromMatrix(toyReadMatrixMarket<T>(in, parallel));
+}
+
+//------------------------------------------------------------------------------
+// File versions of the above.
+//------------------------------------------------------------------------------
+inline void toyOpen(std::ifstream& file, const std::string& path)
+{
+  file.open(path.c_str(), std::ios::in | std::ios::binary);
+  if (!file) throw ToyIOError("cannot open " + path);
+}
+
+inline void toyOpen(std::ofstream& file, const std::string& path)
+{
+  file.open(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!file) throw ToyIOError("cannot create " + path);
+}
+
+template<class M>
+void toyWriteCsv(const std::string& path, const M& m, char delimiter = ',')
+{
+  std::ofstream file;
+  toyOpen(file, path);
+  toyWriteCsv(file, m, delimiter);
+}
+
+template<class T>
+ToyMatrix<T> toyReadCsv(const std::string& path, char delimiter = ',', bool parallel = true)
+{
+  std::ifstream file;
+  toyOpen(file, path);
+  return toyReadCsv<T>(file, delimiter, parallel);
+}
+
+template<class M>
+void toyWriteMatrixMarket(const std::string& path, const M& m)
+{
+  std::ofstream file;
+  toyOpen(file, path);
+  toyWriteMatrixMarket(file, m);
+}
+
+template<class T>
+ToyMatrix<T> toyReadMatrixMarket(const std::string& path, bool parallel = true)
+{
+  std::ifstream file;
+  toyOpen(file, path);
+  return toyReadMatrixMarket<T>(file, parallel);
+}
+
+#endif // TOYIO_H
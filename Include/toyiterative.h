@@ -0,0 +1,308 @@
+//------------------------------------------------------------------------------
+// Krylov solvers: conjugate gradient (symmetric positive definite systems)
+// and BiCGSTAB (general systems), both with optional Jacobi preconditioning.
+//
+// The system matrix is any callable op(x, y) computing y = A*x on arrays of
+// getSize() entries; ToyMatrixOperator wraps a ToyMatrix. All work vectors
+// live in the solver object and are reused across solves, and the inner
+// loops only call the fused kernels of toykernels.h, so an iteration does
+// not allocate.
+//
+//   ToyIterativeSolver<double> solver(1000, 1e-10);
+//   solver.setJacobiPreconditioner(A);
+//   ToySolverStatus<double> status = solver.conjugateGradient(A, b, x);
+//
+// The convergence callback sees every iteration's relative residual and can
+// stop the solver by returning false; the timing callback receives the
+// wall-clock seconds each iteration took.
+//------------------------------------------------------------------------------
+
+#ifndef TOYITERATIVE_H
+#define TOYITERATIVE_H
+
+#include <toykernels.h>
+#include <toymatrix.h>
+#include <toyvector.h>
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+template<class T>
+class ToyMatrixOperator {
+public:
+  explicit ToyMatrixOperator(const ToyMatrix<T>& a) : A(a) {}
+  void operator()(const T* x, T* y) const
+  {
+    toyParallelGemv(A.getNumRows(), A.getNumColumns(), T(1), A.getEntries(),
+                    A.getRowStride(), A.getColumnStride(), x, T(), y);
+  }
+private:
+  const ToyMatrix<T>& A;
+};
+
+template<class T>
+struct ToySolverStatus {
+  int  Iterations;
+  T    Residual;     // |b - Ax| / |b| of the returned x
+  bool Converged;
+};
+
+template<class T>
+class ToyIterativeSolver {
+public:
+  ToyIterativeSolver(int maxIterations = 1000, T tolerance = T(1e-6));
+
+  void setMaxIterations(int maxIterations);
+  void setTolerance(T tolerance);
+
+  void setJacobiPreconditioner(const ToyMatrix<T>& a);
+  void setJacobiPreconditioner(const ToyVector<T>& diagonal);
+  void clearPreconditioner();
+
+  void setConvergenceCallback(const std::function<bool(int, T)>& callback);
+  void setTimingCallback(const std::function<void(int, double)>& callback);
+
+  template<class Op>
+  ToySolverStatus<T> conjugateGradient(const Op& op, const ToyVector<T>& b, ToyVector<T>& x);
+  ToySolverStatus<T> conjugateGradient(const ToyMatrix<T>& a, const ToyVector<T>& b, ToyVector<T>& x);
+
+  template<class Op>
+  ToySolverStatus<T> biCGStab(const Op& op, const ToyVector<T>& b, ToyVector<T>& x);
+  ToySolverStatus<T> biCGStab(const ToyMatrix<T>& a, const ToyVector<T>& b, ToyVector<T>& x);
+
+protected:
+  typedef std::chrono::steady_clock Clock;
+
+  void prepare(int n);
+  T    precondition(int n, const T* r, T* z);
+  bool reportIteration(int iteration, T residual, Clock::time_point& start);
+
+  int MaxIterations;
+  T   Tolerance;
+  std::vector<T> InverseDiagonal;
+  std::function<bool(int, T)>    ConvergenceCallback;
+  std::function<void(int, double)> TimingCallback;
+
+  // Work vectors, sized on first use.
+  std::vector<T> R, Z, P, Q, RHat, V, S, SHat, PHat, Tv;
+};
+
+template<class T>
+ToyIterativeSolver<T>::ToyIterativeSolver(int maxIterations /*= 1000*/, T tolerance /*= T(1e-6)*/) :
+  MaxIterations(maxIterations),
+  Tolerance(tolerance)
+{
+}
+
+template<class T>
+void ToyIterativeSolver<T>::setMaxIterations(int maxIterations)
+{
+  MaxIterations = maxIterations;
+}
+
+template<class T>
+void ToyIterativeSolver<T>::setTolerance(T tolerance)
+{
+  Tolerance = tolerance;
+}
+
+template<class T>
+void ToyIterativeSolver<T>::setJacobiPreconditioner(const ToyMatrix<T>& a)
+{
+  assert(a.getNumRows() == a.getNumColumns());
+  int n = a.getNumRows(), stride = a.getRowStride() + a.getColumnStride();
+  InverseDiagonal.resize(n);
+  for (int i=0; i<n; i++) {
+    T d = a.getEntries()[i*stride];
+    InverseDiagonal[i] = (d == T()) ? T(1) : T(1) / d;
+  }
+}
+
+template<class T>
+void ToyIterativeSolver<T>::setJacobiPreconditioner(const ToyVector<T>& diagonal)
+{
+  int n = diagonal.getNumEntries();
+  InverseDiagonal.resize(n);
+  for (int i=0; i<n; i++) {
+    T d = diagonal.getEntries()[i];
+    InverseDiagonal[i] = (d == T()) ? T(1) : T(1) / d;
+  }
+}
+
+template<class T>
+void ToyIterativeSolver<T>::clearPreconditioner()
+{
+  InverseDiagonal.clear();
+}
+
+template<class T>
+void ToyIterativeSolver<T>::setConvergenceCallback(const std::function<bool(int, T)>& callback)
+{
+  ConvergenceCallback = callback;
+}
+
+template<class T>
+void ToyIterativeSolver<T>::setTimingCallback(const std::function<void(int, double)>& callback)
+{
+  TimingCallback = callback;
+}
+
+template<class T>
+void ToyIterativeSolver<T>::prepare(int n)
+{
+  assert(InverseDiagonal.empty() || (int)InverseDiagonal.size() == n);
+  std::vector<T>* work[] = {&R, &Z, &P, &Q, &RHat, &V, &S, &SHat, &PHat, &Tv};
+  for (int i=0; i<10; i++) {
+    if ((int)work[i]->size() != n) work[i]->assign(n, T());
+  }
+}
+
+//! z = M^-1 * r, returns r'*z
+template<class T>
+inline T ToyIterativeSolver<T>::precondition(int n, const T* r, T* z)
+{
+  if (InverseDiagonal.empty()) {
+    for (int i=0; i<n; i++) z[i] = r[i];
+    return toyDot(n, r, r);
+  }
+  return toyScaleDot(n, &InverseDiagonal[0], r, z);
+}
+
+template<class T>
+bool ToyIterativeSolver<T>::reportIteration(int iteration, T residual, Clock::time_point& start)
+{
+  if (TimingCallback) {
+    Clock::time_point now = Clock::now();
+    TimingCallback(iteration, std::chrono::duration<double>(now - start).count());
+    start = now;
+  }
+  if (ConvergenceCallback) return ConvergenceCallback(iteration, residual);
+  return true;
+}
+
+template<class T>
+template<class Op>
+ToySolverStatus<T> ToyIterativeSolver<T>::conjugateGradient(const Op& op, const ToyVector<T>& b, ToyVector<T>& x)
+{
+  int n = b.getNumEntries();
+  assert(x.getNumEntries() == n);
+  prepare(n);
+  const T* bp = b.getEntries();
+  T* xp = x.getEntries();
+  T* r = &R[0]; T* z = &Z[0]; T* p = &P[0]; T* q = &Q[0];
+
+  ToySolverStatus<T> status = {0, T(), false};
+  T bnorm = std::sqrt(toyDot(n, bp, bp));
+  if (bnorm == T()) bnorm = T(1);
+
+  // r = b - A*x
+  op(xp, q);
+  T rr = toyWaxpyNorm2(n, T(-1), q, bp, r);
+  status.Residual = std::sqrt(rr) / bnorm;
+  if (status.Residual <= Tolerance) {
+    status.Converged = true;
+    return status;
+  }
+  T rz = precondition(n, r, z);
+  for (int i=0; i<n; i++) p[i] = z[i];
+
+  Clock::time_point start = Clock::now();
+  while (status.Iterations < MaxIterations) {
+    status.Iterations++;
+    op(p, q);
+    T alpha = rz / toyDot(n, p, q);
+    toyAxpy(n, alpha, p, xp);
+    rr = toyAxpyNorm2(n, -alpha, q, r);
+    status.Residual = std::sqrt(rr) / bnorm;
+    if (status.Residual <= Tolerance) status.Converged = true;
+    if (!reportIteration(status.Iterations, status.Residual, start) || status.Converged) break;
+
+    T rzNew = precondition(n, r, z);
+    toyXpby(n, z, rzNew / rz, p);
+    rz = rzNew;
+  }
+  return status;
+}
+
+template<class T>
+ToySolverStatus<T> ToyIterativeSolver<T>::conjugateGradient(const ToyMatrix<T>& a, const ToyVector<T>& b, ToyVector<T>& x)
+{
+  return conjugateGradient(ToyMatrixOperator<T>(a), b, x);
+}
+
+template<class T>
+template<class Op>
+ToySolverStatus<T> ToyIterativeSolver<T>::biCGStab(const Op& op, const ToyVector<T>& b, ToyVector<T>& x)
+{
+  int n = b.getNumEntries();
+  assert(x.getNumEntries() == n);
+  prepare(n);
+  const T* bp = b.getEntries();
+  T* xp = x.getEntries();
+  T* r = &R[0]; T* rhat = &RHat[0]; T* p = &P[0]; T* v = &V[0];
+  T* s = &S[0]; T* shat = &SHat[0]; T* phat = &PHat[0]; T* t = &Tv[0];
+
+  ToySolverStatus<T> status = {0, T(), false};
+  T bnorm = std::sqrt(toyDot(n, bp, bp));
+  if (bnorm == T()) bnorm = T(1);
+
+  op(xp, v);
+  T rr = toyWaxpyNorm2(n, T(-1), v, bp, r);
+  status.Residual = std::sqrt(rr) / bnorm;
+  if (status.Residual <= Tolerance) {
+    status.Converged = true;
+    return status;
+  }
+  for (int i=0; i<n; i++) {
+    rhat[i] = r[i];
+    p[i] = v[i] = T();
+  }
+  T rho = T(1), alpha = T(1), omega = T(1);
+
+  Clock::time_point start = Clock::now();
+  while (status.Iterations < MaxIterations) {
+    status.Iterations++;
+    T rhoNew = toyDot(n, rhat, r);
+    if (rhoNew == T()) break;  // breakdown, rhat orthogonal to r
+    T beta = (rhoNew / rho) * (alpha / omega);
+    rho = rhoNew;
+    // p = r + beta*(p - omega*v)
+    for (int i=0; i<n; i++) p[i] = r[i] + beta * (p[i] - omega * v[i]);
+
+    precondition(n, p, phat);
+    op(phat, v);
+    alpha = rho / toyDot(n, rhat, v);
+    T ss = toyWaxpyNorm2(n, -alpha, v, r, s);
+    if (std::sqrt(ss) / bnorm <= Tolerance) {
+      toyAxpy(n, alpha, phat, xp);
+      status.Residual = std::sqrt(ss) / bnorm;
+      status.Converged = true;
+      reportIteration(status.Iterations, status.Residual, start);
+      break;
+    }
+
+    precondition(n, s, shat);
+    op(shat, t);
+    T ts, tt;
+    toyDot2(n, s, t, ts, tt);
+    omega = (tt == T()) ? T() : ts / tt;
+    for (int i=0; i<n; i++) xp[i] += alpha * phat[i] + omega * shat[i];
+    rr = toyWaxpyNorm2(n, -omega, t, s, r);
+    status.Residual = std::sqrt(rr) / bnorm;
+    if (status.Residual <= Tolerance) status.Converged = true;
+    if (!reportIteration(status.Iterations, status.Residual, start) || status.Converged) break;
+    if (omega == T()) break;
+  }
+  return status;
+}
+
+template<class T>
+ToySolverStatus<T> ToyIterativeSolver<T>::biCGStab(const ToyMatrix<T>& a, const ToyVector<T>& b, ToyVector<T>& x)
+{
+  return biCGStab(ToyMatrixOperator<T>(a), b, x);
+}
+
+#endif // TOYITERATIVE_H
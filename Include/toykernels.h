@@ -0,0 +1,712 @@
+//------------------------------------------------------------------------------
+// Raw matrix kernels working on strided arrays.
+//
+// Element (i,j) of an operand lives at p[i*rowStride + j*columnStride], so a
+// ToyMatrix and its transposed view can both be passed without copying:
+// untransposed matrices have (Columns, 1) strides, transposed ones (1, Rows).
+//
+// toyGemm() computes C = alpha*A*B + beta*C. With beta == 0 the old
+// contents of C are never read, so C may be uninitialised. Its buffers are
+// allocated per call unless a ToyGemmWorkspace is passed.
+//
+// The vector kernels below fuse the update and reduction steps that
+// iterative solvers need into one pass over memory and never allocate.
+//
+// Block sizes and thresholds are read from toyKernelConfig() at run time.
+// The macros below are only the defaults; toytune.h measures better values
+// for the machine at hand, and the first read of the configuration loads
+// them from its cache (see toyStartupKernelConfig()).
+//------------------------------------------------------------------------------
+
+#ifndef TOYKERNELS_H
+#define TOYKERNELS_H
+
+#include <toyparallel.h>
+
+#include <algorithm>
+#include <atomic>
+#include <complex>
+#include <type_traits>
+#include <vector>
+
+// Block sizes of the gemm kernel. KC rows of B are packed into a
+// contiguous panel of NC columns, which should fit into the L2 cache.
+#ifndef TOYGEMM_KC
+#define TOYGEMM_KC 256
+#endif
+#ifndef TOYGEMM_NC
+#define TOYGEMM_NC 128
+#endif
+// Below this many multiply-adds a gemm stays on the calling thread.
+#ifndef TOYGEMM_PARALLEL_THRESHOLD
+#define TOYGEMM_PARALLEL_THRESHOLD (64*64*64)
+#endif
+// Recursive kernels stop splitting below this many multiply-adds.
+#ifndef TOYGEMM_RECURSIVE_GRAIN
+#define TOYGEMM_RECURSIVE_GRAIN (48*48*48)
+#endif
+// Block size of the symmetric rank-k update.
+#ifndef TOYSYRK_NB
+#define TOYSYRK_NB 64
+#endif
+// From this many multiply-adds on, complex gemms use three real products
+// instead of four.
+#ifndef TOYCOMPLEX_3M_THRESHOLD
+#define TOYCOMPLEX_3M_THRESHOLD (64*64*64)
+#endif
+
+struct ToyKernelConfig {
+  int       GemmKC;
+  int       GemmNC;
+  long long ParallelThreshold;
+  long long RecursiveGrain;
+  int       SyrkBlock;
+};
+
+inline ToyKernelConfig toyDefaultKernelConfig()
+{
+  ToyKernelConfig config;
+  config.GemmKC            = TOYGEMM_KC;
+  config.GemmNC            = TOYGEMM_NC;
+  config.ParallelThreshold = TOYGEMM_PARALLEL_THRESHOLD;
+  config.RecursiveGrain    = TOYGEMM_RECURSIVE_GRAIN;
+  config.SyrkBlock         = TOYSYRK_NB;
+  return config;
+}
+
+// Defined in toytune.h, which is included at the end of this header.
+inline ToyKernelConfig toyStartupKernelConfig();
+inline std::atomic<bool>& toyStartupTuningPending();
+inline void toyStartupTuning();
+
+inline ToyKernelConfig& toyKernelConfigSetting()
+{
+  // Thread-safe: the first caller loads the tuning cache, others wait.
+  static ToyKernelConfig config = toyStartupKernelConfig();
+  return config;
+}
+
+//! The configuration in effect. Change it only while no kernel is running.
+//! The first read tunes the kernels if TOYMATRIX_AUTOTUNE=1 asked for it.
+inline const ToyKernelConfig& toyKernelConfig()
+{
+  ToyKernelConfig& config = toyKernelConfigSetting();
+  if (toyStartupTuningPending().load(std::memory_order_acquire)) toyStartupTuning();
+  return config;
+}
+
+//! Not synchronised with the kernels: call it only while none is running.
+inline void toySetKernelConfig(const ToyKernelConfig& config)
+{
+  ToyKernelConfig& current = toyKernelConfigSetting();
+  current = config;
+  current.GemmKC    = std::max(1, current.GemmKC);
+  current.GemmNC    = std::max(1, current.GemmNC);
+  current.SyrkBlock = std::max(1, current.SyrkBlock);
+}
+
+//------------------------------------------------------------------------------
+// Type the kernels accumulate products of T in. 16-bit float types (see
+// toyhalf.h) accumulate in float. Float accumulates in double instead of
+// float while toySetDoubleAccumulation(true) is in effect, which keeps long
+// dot products accurate without storing the matrices as double.
+//
+// The setting may change while products run on other threads: every kernel
+// call reads it once, so a product split over several threads that overlaps
+// the change may accumulate some of its parts either way.
+//------------------------------------------------------------------------------
+inline std::atomic<bool>& toyDoubleAccumulationSetting()
+{
+  static std::atomic<bool> enabled(false);
+  return enabled;
+}
+
+inline void toySetDoubleAccumulation(bool enabled)
+{
+  toyDoubleAccumulationSetting().store(enabled, std::memory_order_relaxed);
+}
+
+inline bool toyGetDoubleAccumulation()
+{
+  return toyDoubleAccumulationSetting().load(std::memory_order_relaxed);
+}
+
+template<class T>
+struct ToyIsComplex : std::false_type {};
+template<class T>
+struct ToyIsComplex<std::complex<T> > : std::true_type {};
+
+template<class T>
+struct ToyAccumulator {
+  typedef T Type;
+  typedef T Wide;
+  static bool widen() { return false; }
+};
+
+template<>
+struct ToyAccumulator<float> {
+  typedef float  Type;
+  typedef double Wide;
+  static bool widen() { return toyGetDoubleAccumulation(); }
+};
+
+//! True if sums of T are currently formed in a wider type than T, in which
+//! case they must not be rounded to T halfway.
+template<class T>
+bool toyAccumulatesWider()
+{
+  return ToyAccumulator<T>::widen() ||
+         !std::is_same<typename ToyAccumulator<T>::Type, T>::value;
+}
+
+//! Makes buffer hold at least size elements. It never shrinks, so a
+//! buffer that is reused allocates only while the sizes still grow.
+template<class A>
+A* toyScratchBuffer(std::vector<A>& buffer, size_t size)
+{
+  if (buffer.size() < size) buffer.resize(size);
+  return buffer.empty() ? 0 : &buffer[0];
+}
+
+//! Buffers of one toyGemmAccumulate() call.
+template<class A>
+struct ToyGemmScratch {
+  std::vector<A> Panel;
+  std::vector<A> Accumulator;
+  std::vector<A> Sums;
+};
+
+//------------------------------------------------------------------------------
+// Buffers of the gemm kernels for callers that multiply over and over:
+//
+//   ToyGemmWorkspace<double> workspace;
+//   for (...) toyParallelGemm(n, n, n, 1.0, a, n, 1, b, n, 1, 0.0, c, n, 1, workspace);
+//
+// The buffers grow on first use and are reused afterwards, so products of
+// the same or smaller size allocate nothing. toyParallelGemm() keeps one
+// set per chunk. A workspace must not be used by two products at once.
+//------------------------------------------------------------------------------
+template<class T>
+struct ToyGemmWorkspace {
+  std::vector<ToyGemmScratch<typename ToyAccumulator<T>::Type> > Narrow;
+  std::vector<ToyGemmScratch<typename ToyAccumulator<T>::Wide> > Wide;
+};
+
+//! Complex products work on split parts, see toySplitGemm().
+template<class T>
+struct ToyGemmWorkspace<std::complex<T> > {
+  std::vector<T>      Parts;   // split operands and product
+  std::vector<T>      Split;   // sums and second product of the 3M method
+  ToyGemmWorkspace<T> Real;
+};
+
+//! toyGemm() with the sums formed in A. The packed panel of B is converted
+//! to A once, so narrow storage types are only widened once per panel.
+template<class T, class A>
+void toyGemmAccumulate(int m, int n, int k, T alpha,
+                       const T* a, int rsa, int csa,
+                       const T* b, int rsb, int csb,
+                       T beta, T* c, int rsc, int csc,
+                       ToyGemmScratch<A>* scratch = 0)
+{
+  if (m <= 0 || n <= 0) return;
+  const int KC = toyKernelConfig().GemmKC, NC = toyKernelConfig().GemmNC;
+  ToyGemmScratch<A> local;
+  if (!scratch) scratch = &local;
+  A* panel = toyScratchBuffer(scratch->Panel, (size_t)KC * NC);
+  A* acc = toyScratchBuffer(scratch->Accumulator, NC);
+  // With a wider accumulator the partial sums of all KC blocks are kept
+  // in A and C is written once at the end.
+  bool keepSums = !std::is_same<A, T>::value && k > KC;
+  A* sums = keepSums ? toyScratchBuffer(scratch->Sums, (size_t)m*NC) : 0;
+
+  for (int j0=0; j0<n; j0+=NC) {
+    int nb = std::min(NC, n-j0);
+    // An empty inner dimension still has to apply beta.
+    for (int p0=0; p0<k || p0==0; p0+=KC) {
+      int kb = std::max(0, std::min(KC, k-p0));
+      for (int p=0; p<kb; p++) {
+        const T* bp = b + (p0+p)*rsb + j0*csb;
+        A* dst = panel + p*nb;
+        for (int j=0; j<nb; j++) dst[j] = A(bp[j*csb]);
+      }
+      bool firstBlock = (p0 == 0);
+      for (int i=0; i<m; i++) {
+        for (int j=0; j<nb; j++) acc[j] = A();
+        const T* ai = a + i*rsa + p0*csa;
+        for (int p=0; p<kb; p++) {
+          A aip = A(ai[p*csa]);
+          const A* bp = panel + p*nb;
+          for (int j=0; j<nb; j++) acc[j] += aip * bp[j];
+        }
+        if (keepSums) {
+          A* si = sums + (size_t)i*nb;
+          for (int j=0; j<nb; j++) si[j] = firstBlock ? acc[j] : si[j] + acc[j];
+          continue;
+        }
+        T* ci = c + i*rsc + j0*csc;
+        if (!firstBlock) {
+          for (int j=0; j<nb; j++) ci[j*csc] = T(A(ci[j*csc]) + A(alpha) * acc[j]);
+        } else if (beta == T()) {
+          for (int j=0; j<nb; j++) ci[j*csc] = T(A(alpha) * acc[j]);
+        } else {
+          for (int j=0; j<nb; j++) ci[j*csc] = T(A(alpha) * acc[j] + A(beta) * A(ci[j*csc]));
+        }
+      }
+      if (k <= 0) break;
+    }
+    if (keepSums) {
+      for (int i=0; i<m; i++) {
+        const A* si = sums + (size_t)i*nb;
+        T* ci = c + i*rsc + j0*csc;
+        for (int j=0; j<nb; j++) {
+          ci[j*csc] = (beta == T()) ? T(A(alpha) * si[j])
+                                    : T(A(alpha) * si[j] + A(beta) * A(ci[j*csc]));
+        }
+      }
+    }
+  }
+}
+
+template<class T>
+void toyGemm(int m, int n, int k, T alpha,
+             const T* a, int rsa, int csa,
+             const T* b, int rsb, int csb,
+             T beta, T* c, int rsc, int csc)
+{
+  if (ToyAccumulator<T>::widen()) {
+    toyGemmAccumulate<T, typename ToyAccumulator<T>::Wide>(m, n, k, alpha, a, rsa, csa,
+                                                          b, rsb, csb, beta, c, rsc, csc);
+  } else {
+    toyGemmAccumulate<T, typename ToyAccumulator<T>::Type>(m, n, k, alpha, a, rsa, csa,
+                                                          b, rsb, csb, beta, c, rsc, csc);
+  }
+}
+
+//! toyGemm() on the buffers of slot of workspace, which must exist.
+template<class T>
+void toyGemmInSlot(int m, int n, int k, T alpha,
+                   const T* a, int rsa, int csa,
+                   const T* b, int rsb, int csb,
+                   T beta, T* c, int rsc, int csc,
+                   ToyGemmWorkspace<T>& workspace, int slot)
+{
+  if (ToyAccumulator<T>::widen()) {
+    toyGemmAccumulate<T, typename ToyAccumulator<T>::Wide>(m, n, k, alpha, a, rsa, csa,
+                                                          b, rsb, csb, beta, c, rsc, csc,
+                                                          &workspace.Wide[slot]);
+  } else {
+    toyGemmAccumulate<T, typename ToyAccumulator<T>::Type>(m, n, k, alpha, a, rsa, csa,
+                                                          b, rsb, csb, beta, c, rsc, csc,
+                                                          &workspace.Narrow[slot]);
+  }
+}
+
+template<class T>
+void toyGemm(int m, int n, int k, T alpha,
+             const T* a, int rsa, int csa,
+             const T* b, int rsb, int csb,
+             T beta, T* c, int rsc, int csc,
+             ToyGemmWorkspace<T>& workspace)
+{
+  if (workspace.Narrow.empty()) workspace.Narrow.resize(1);
+  if (workspace.Wide.empty()) workspace.Wide.resize(1);
+  toyGemmInSlot(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc, workspace, 0);
+}
+
+// Complex overloads, defined with the split kernels below.
+template<class T>
+void toyGemm(int m, int n, int k, std::complex<T> alpha,
+             const std::complex<T>* a, int rsa, int csa,
+             const std::complex<T>* b, int rsb, int csb,
+             std::complex<T> beta, std::complex<T>* c, int rsc, int csc);
+template<class T>
+void toyGemm(int m, int n, int k, std::complex<T> alpha,
+             const std::complex<T>* a, int rsa, int csa,
+             const std::complex<T>* b, int rsb, int csb,
+             std::complex<T> beta, std::complex<T>* c, int rsc, int csc,
+             ToyGemmWorkspace<std::complex<T> >& workspace);
+
+//------------------------------------------------------------------------------
+// Same as toyGemm(), but row panels of C are distributed over the global
+// thread pool once the product is large enough to pay for it.
+//------------------------------------------------------------------------------
+template<class T>
+void toyParallelGemm(int m, int n, int k, T alpha,
+                     const T* a, int rsa, int csa,
+                     const T* b, int rsb, int csb,
+                     T beta, T* c, int rsc, int csc)
+{
+  if ((long long)m*n*k < toyKernelConfig().ParallelThreshold) {
+    toyGemm(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+    return;
+  }
+  ToyThreadPool::global().parallelFor(0, m, [&](int lo, int hi) {
+    toyGemm(hi-lo, n, k, alpha, a + lo*rsa, rsa, csa, b, rsb, csb,
+            beta, c + lo*rsc, rsc, csc);
+  }, 16);
+}
+
+//! toyParallelGemm() on the buffers of workspace. Rows are cut into at
+//! most one chunk per thread, and chunk c always uses the buffers of slot c.
+template<class T>
+void toyParallelGemm(int m, int n, int k, T alpha,
+                     const T* a, int rsa, int csa,
+                     const T* b, int rsb, int csb,
+                     T beta, T* c, int rsc, int csc,
+                     ToyGemmWorkspace<T>& workspace)
+{
+  ToyThreadPool& pool = ToyThreadPool::global();
+  int numChunks = std::min(pool.getNumThreads(), (m + 15) / 16);
+  if ((long long)m*n*k < toyKernelConfig().ParallelThreshold || numChunks <= 1) {
+    toyGemm(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc, workspace);
+    return;
+  }
+  if ((int)workspace.Narrow.size() < numChunks) workspace.Narrow.resize(numChunks);
+  if ((int)workspace.Wide.size() < numChunks) workspace.Wide.resize(numChunks);
+  int chunk = m / numChunks, remainder = m % numChunks;
+  pool.parallelFor(0, numChunks, [&](int lo, int hi) {
+    for (int s=lo; s<hi; s++) {
+      int first = s*chunk + std::min(s, remainder);
+      int rows = chunk + (s < remainder ? 1 : 0);
+      toyGemmInSlot(rows, n, k, alpha, a + first*rsa, rsa, csa, b, rsb, csb,
+                    beta, c + first*rsc, rsc, csc, workspace, s);
+    }
+  });
+}
+
+//! Complex products are parallel in their real products already.
+template<class T>
+void toyParallelGemm(int m, int n, int k, std::complex<T> alpha,
+                     const std::complex<T>* a, int rsa, int csa,
+                     const std::complex<T>* b, int rsb, int csb,
+                     std::complex<T> beta, std::complex<T>* c, int rsc, int csc,
+                     ToyGemmWorkspace<std::complex<T> >& workspace)
+{
+  toyGemm(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc, workspace);
+}
+
+//------------------------------------------------------------------------------
+// Complex products on split storage, where the real and imaginary parts
+// are separate real matrices: C = A*B is formed from products of the real
+// gemm, whose inner loops vectorise, instead of complex multiplications.
+// The real products run on the thread pool when large enough.
+//
+//   4M:  Cr = Ar*Br - Ai*Bi,  Ci = Ar*Bi + Ai*Br
+//   3M:  T1 = Ar*Br, T2 = Ai*Bi, T3 = (Ar+Ai)*(Br+Bi)
+//        Cr = T1 - T2,  Ci = T3 - T1 - T2
+//
+// 3M saves a quarter of the multiplications but cancels in Ci, so its
+// imaginary parts are a little less accurate when Ci is small compared
+// to the other terms. Its buffers come from workspace if one is given.
+//------------------------------------------------------------------------------
+enum ToyComplexProduct {
+  ToyComplex4M,
+  ToyComplex3M
+};
+
+template<class T>
+void toySplitGemm(int m, int n, int k,
+                  const T* ar, const T* ai, int rsa, int csa,
+                  const T* br, const T* bi, int rsb, int csb,
+                  T* cr, T* ci, int rsc, int csc,
+                  ToyComplexProduct method = ToyComplex4M,
+                  ToyGemmWorkspace<std::complex<T> >* workspace = 0)
+{
+  if (m <= 0 || n <= 0) return;
+  ToyGemmWorkspace<std::complex<T> > local;
+  if (!workspace) workspace = &local;
+  ToyGemmWorkspace<T>& real = workspace->Real;
+  if (method == ToyComplex4M) {
+    toyParallelGemm(m, n, k, T(1), ar, rsa, csa, br, rsb, csb, T(), cr, rsc, csc, real);
+    toyParallelGemm(m, n, k, T(-1), ai, rsa, csa, bi, rsb, csb, T(1), cr, rsc, csc, real);
+    toyParallelGemm(m, n, k, T(1), ar, rsa, csa, bi, rsb, csb, T(), ci, rsc, csc, real);
+    toyParallelGemm(m, n, k, T(1), ai, rsa, csa, br, rsb, csb, T(1), ci, rsc, csc, real);
+    return;
+  }
+  T* sa = toyScratchBuffer(workspace->Split, (size_t)m*k + (size_t)k*n + (size_t)m*n);
+  T* sb = sa + (size_t)m*k;
+  T* t2 = sb + (size_t)k*n;
+  for (int i=0; i<m; i++) {
+    for (int p=0; p<k; p++) sa[(size_t)i*k + p] = ar[i*rsa + p*csa] + ai[i*rsa + p*csa];
+  }
+  for (int p=0; p<k; p++) {
+    for (int j=0; j<n; j++) sb[(size_t)p*n + j] = br[p*rsb + j*csb] + bi[p*rsb + j*csb];
+  }
+  toyParallelGemm(m, n, k, T(1), ar, rsa, csa, br, rsb, csb, T(), cr, rsc, csc, real);
+  toyParallelGemm(m, n, k, T(1), ai, rsa, csa, bi, rsb, csb, T(), t2, n, 1, real);
+  toyParallelGemm(m, n, k, T(1), sa, k, 1, sb, n, 1, T(), ci, rsc, csc, real);
+  for (int i=0; i<m; i++) {
+    T* cri = cr + i*rsc;
+    T* cii = ci + i*rsc;
+    const T* ti = t2 + (size_t)i*n;
+    for (int j=0; j<n; j++) {
+      cii[j*csc] -= cri[j*csc] + ti[j];
+      cri[j*csc] -= ti[j];
+    }
+  }
+}
+
+//! Copies an m x n strided complex matrix to contiguous row-major parts.
+template<class T>
+void toySplitEntries(int m, int n, const std::complex<T>* a, int rsa, int csa, T* re, T* im)
+{
+  for (int i=0; i<m; i++) {
+    for (int j=0; j<n; j++) {
+      const std::complex<T>& aij = a[i*rsa + j*csa];
+      re[(size_t)i*n + j] = aij.real();
+      im[(size_t)i*n + j] = aij.imag();
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// toyGemm() for interleaved std::complex storage. The operands are split,
+// multiplied with toySplitGemm() and merged into C, which avoids the slow
+// library routine behind each complex multiplication. Chosen over the
+// generic toyGemm() by overload resolution, so the parallel and recursive
+// drivers pick it up as well.
+//------------------------------------------------------------------------------
+template<class T>
+void toyGemm(int m, int n, int k, std::complex<T> alpha,
+             const std::complex<T>* a, int rsa, int csa,
+             const std::complex<T>* b, int rsb, int csb,
+             std::complex<T> beta, std::complex<T>* c, int rsc, int csc)
+{
+  ToyGemmWorkspace<std::complex<T> > workspace;
+  toyGemm(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc, workspace);
+}
+
+template<class T>
+void toyGemm(int m, int n, int k, std::complex<T> alpha,
+             const std::complex<T>* a, int rsa, int csa,
+             const std::complex<T>* b, int rsb, int csb,
+             std::complex<T> beta, std::complex<T>* c, int rsc, int csc,
+             ToyGemmWorkspace<std::complex<T> >& workspace)
+{
+  if (m <= 0 || n <= 0) return;
+  int kk = std::max(k, 0);
+  T* ar = toyScratchBuffer(workspace.Parts, 2*((size_t)m*kk + (size_t)kk*n + (size_t)m*n));
+  T* ai = ar + (size_t)m*kk;
+  T* br = ai + (size_t)m*kk;
+  T* bi = br + (size_t)kk*n;
+  T* cr = bi + (size_t)kk*n;
+  T* ci = cr + (size_t)m*n;
+  toySplitEntries(m, kk, a, rsa, csa, ar, ai);
+  toySplitEntries(kk, n, b, rsb, csb, br, bi);
+  ToyComplexProduct method = ((long long)m*n*kk >= TOYCOMPLEX_3M_THRESHOLD) ? ToyComplex3M
+                                                                          : ToyComplex4M;
+  toySplitGemm(m, n, kk, ar, ai, kk, 1, br, bi, n, 1, cr, ci, n, 1, method, &workspace);
+  for (int i=0; i<m; i++) {
+    for (int j=0; j<n; j++) {
+      std::complex<T>& cij = c[i*rsc + j*csc];
+      // Written out so that no complex multiplication is left.
+      T pr = cr[(size_t)i*n + j], pi = ci[(size_t)i*n + j];
+      T re = alpha.real()*pr - alpha.imag()*pi;
+      T im = alpha.real()*pi + alpha.imag()*pr;
+      if (beta != std::complex<T>()) {
+        re += beta.real()*cij.real() - beta.imag()*cij.imag();
+        im += beta.real()*cij.imag() + beta.imag()*cij.real();
+      }
+      cij = std::complex<T>(re, im);
+    }
+  }
+}
+
+enum ToyTriangle {
+  ToyLowerTriangle,
+  ToyUpperTriangle
+};
+
+//------------------------------------------------------------------------------
+// A += alpha*x*y' for an m x n matrix A. The loop runs along the contiguous
+// dimension of A, so transposed matrices are updated with unit stride too.
+//------------------------------------------------------------------------------
+template<class T>
+void toyGer(int m, int n, T alpha, const T* x, const T* y, T* a, int rsa, int csa)
+{
+  if (csa != 1 && rsa == 1) {
+    // Column-major storage: the same update of A' with x and y swapped.
+    toyGer(n, m, alpha, y, x, a, csa, rsa);
+    return;
+  }
+  auto update = [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) {
+      T axi = alpha * x[i];
+      T* ai = a + (size_t)i*rsa;
+      for (int j=0; j<n; j++) ai[j*csa] += axi * y[j];
+    }
+  };
+  if ((long long)m*n < toyKernelConfig().ParallelThreshold / 16) {
+    update(0, m);
+  } else {
+    ToyThreadPool::global().parallelFor(0, m, update, 16);
+  }
+}
+
+//------------------------------------------------------------------------------
+// C = alpha*A*A' + beta*C for an n x k matrix A, touching only the given
+// triangle of the n x n matrix C (diagonal included).
+//
+// C is cut into square tiles of SyrkBlock rows (see ToyKernelConfig). Tiles
+// off the diagonal are plain gemm updates with A' read through swapped
+// strides; diagonal tiles are formed in a small buffer and only their
+// triangle is added. The tiles of the triangle are spread evenly over the
+// thread pool.
+//------------------------------------------------------------------------------
+template<class T>
+void toySyrk(int n, int k, T alpha, const T* a, int rsa, int csa,
+             T beta, T* c, int rsc, int csc, ToyTriangle triangle)
+{
+  if (n <= 0) return;
+  const int NB = toyKernelConfig().SyrkBlock;
+  int numBlocks = (n + NB - 1) / NB;
+  int numTiles = numBlocks * (numBlocks + 1) / 2;
+  auto tiles = [&](int lo, int hi) {
+    std::vector<T> diagonal;
+    for (int t=lo; t<hi; t++) {
+      // Tile t is (bi, bj) with bj <= bi, numbered row by row.
+      int bi = 0;
+      while ((bi+1)*(bi+2)/2 <= t) bi++;
+      int bj = t - bi*(bi+1)/2;
+      if (triangle == ToyUpperTriangle) std::swap(bi, bj);
+      int i0 = bi*NB, j0 = bj*NB;
+      int mb = std::min(NB, n-i0), nb = std::min(NB, n-j0);
+      const T* ai = a + (size_t)i0*rsa;
+      const T* aj = a + (size_t)j0*rsa;
+      T* cij = c + (size_t)i0*rsc + (size_t)j0*csc;
+      if (bi != bj) {
+        toyGemm(mb, nb, k, alpha, ai, rsa, csa, aj, csa, rsa, beta, cij, rsc, csc);
+        continue;
+      }
+      diagonal.resize((size_t)mb*nb);
+      toyGemm(mb, nb, k, alpha, ai, rsa, csa, aj, csa, rsa, T(), &diagonal[0], nb, 1);
+      for (int i=0; i<mb; i++) {
+        int from = (triangle == ToyLowerTriangle) ? 0 : i;
+        int to   = (triangle == ToyLowerTriangle) ? i+1 : nb;
+        for (int j=from; j<to; j++) {
+          T& cv = cij[(size_t)i*rsc + (size_t)j*csc];
+          cv = (beta == T()) ? diagonal[(size_t)i*nb + j] : diagonal[(size_t)i*nb + j] + beta*cv;
+        }
+      }
+    }
+  };
+  if ((long long)n*n*k < toyKernelConfig().ParallelThreshold) {
+    tiles(0, numTiles);
+  } else {
+    ToyThreadPool::global().parallelFor(0, numTiles, tiles, 1);
+  }
+}
+
+//------------------------------------------------------------------------------
+// y = alpha*A*x + beta*y for an m x n matrix A and contiguous x and y.
+//------------------------------------------------------------------------------
+template<class T>
+void toyGemv(int m, int n, T alpha, const T* a, int rsa, int csa,
+             const T* x, T beta, T* y)
+{
+  if (csa == 1) {
+    for (int i=0; i<m; i++) {
+      const T* ai = a + i*rsa;
+      T sum = T();
+      for (int j=0; j<n; j++) sum += ai[j] * x[j];
+      y[i] = (beta == T()) ? alpha*sum : alpha*sum + beta*y[i];
+    }
+    return;
+  }
+  // Column-major access, e.g. a transposed ToyMatrix: accumulate columns.
+  for (int i=0; i<m; i++) y[i] = (beta == T()) ? T() : beta*y[i];
+  for (int j=0; j<n; j++) {
+    const T* aj = a + j*csa;
+    T xj = alpha * x[j];
+    for (int i=0; i<m; i++) y[i] += aj[i*rsa] * xj;
+  }
+}
+
+template<class T>
+void toyParallelGemv(int m, int n, T alpha, const T* a, int rsa, int csa,
+                     const T* x, T beta, T* y)
+{
+  if ((long long)m*n < toyKernelConfig().ParallelThreshold) {
+    toyGemv(m, n, alpha, a, rsa, csa, x, beta, y);
+    return;
+  }
+  ToyThreadPool::global().parallelFor(0, m, [&](int lo, int hi) {
+    toyGemv(hi-lo, n, alpha, a + lo*rsa, rsa, csa, x, beta, y + lo);
+  }, 64);
+}
+
+template<class T>
+T toyDot(int n, const T* x, const T* y)
+{
+  T sum = T();
+  for (int i=0; i<n; i++) sum += x[i] * y[i];
+  return sum;
+}
+
+//! y += alpha*x
+template<class T>
+void toyAxpy(int n, T alpha, const T* x, T* y)
+{
+  for (int i=0; i<n; i++) y[i] += alpha * x[i];
+}
+
+//! y = x + beta*y
+template<class T>
+void toyXpby(int n, const T* x, T beta, T* y)
+{
+  for (int i=0; i<n; i++) y[i] = x[i] + beta * y[i];
+}
+
+//! y += alpha*x, returns y'*y
+template<class T>
+T toyAxpyNorm2(int n, T alpha, const T* x, T* y)
+{
+  T sum = T();
+  for (int i=0; i<n; i++) {
+    y[i] += alpha * x[i];
+    sum += y[i] * y[i];
+  }
+  return sum;
+}
+
+//! z = y + alpha*x, returns z'*z
+template<class T>
+T toyWaxpyNorm2(int n, T alpha, const T* x, const T* y, T* z)
+{
+  T sum = T();
+  for (int i=0; i<n; i++) {
+    z[i] = y[i] + alpha * x[i];
+    sum += z[i] * z[i];
+  }
+  return sum;
+}
+
+//! z = d.*r (elementwise), returns r'*z
+template<class T>
+T toyScaleDot(int n, const T* d, const T* r, T* z)
+{
+  T sum = T();
+  for (int i=0; i<n; i++) {
+    z[i] = d[i] * r[i];
+    sum += r[i] * z[i];
+  }
+  return sum;
+}
+
+//! Returns x'*y in xy and y'*y in yy from one pass.
+template<class T>
+void toyDot2(int n, const T* x, const T* y, T& xy, T& yy)
+{
+  T sxy = T(), syy = T();
+  for (int i=0; i<n; i++) {
+    sxy += x[i] * y[i];
+    syy += y[i] * y[i];
+  }
+  xy = sxy;
+  yy = syy;
+}
+
+#include <toytune.h>
+
+#endif // TOYKERNELS_H
@@ -0,0 +1,221 @@
+//------------------------------------------------------------------------------
+// LU factorisation with partial pivoting, PA = LU.
+//
+// The factorisation is right-looking and blocked: a panel of TOYLU_BLOCKSIZE
+// columns is factored unblocked, the matching block row of U is computed by
+// a triangular solve and the trailing submatrix is then updated with one
+// large matrix product (toyParallelGemm), which is where nearly all of the
+// flops go and which is split into row panels over the thread pool.
+//
+// A ToyLU object keeps the factors, so repeated solves against the same
+// matrix only pay for the triangular solves:
+//
+//   ToyLU<float> lu(A);
+//   ToyVector<float> x = lu.solve(b);
+//   ToyMatrix<float> X = lu.solve(B);   // one column per right-hand side
+//------------------------------------------------------------------------------
+
+#ifndef TOYLU_H
+#define TOYLU_H
+
+#include <exception.h>
+#include <toykernels.h>
+#include <toymatrix.h>
+#include <toyparallel.h>
+#include <toyvector.h>
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#ifndef TOYLU_BLOCKSIZE
+#define TOYLU_BLOCKSIZE 64
+#endif
+
+template<class T>
+class ToyLU {
+public:
+  ToyLU(const ToyMatrix<T>& a, int blockSize = TOYLU_BLOCKSIZE);
+
+  ToyVector<T> solve(const ToyVector<T>& b) const throw(SingularMatrix);
+  ToyMatrix<T> solve(const ToyMatrix<T>& b) const throw(SingularMatrix);
+
+  bool isSingular() const;
+  int  getSize() const;
+  T    determinant() const;
+
+protected:
+  void factorPanel(int k0, int kb);
+  void solveInPlace(T* x, int numRhs, int lo, int hi) const;
+
+  int            N;
+  std::vector<T> Factors;   // L below, U on and above the diagonal, row-major
+  std::vector<int> Pivots;  // row i was swapped with row Pivots[i]
+  bool           Singular;
+};
+
+template<class T>
+ToyLU<T>::ToyLU(const ToyMatrix<T>& a, int blockSize /*= TOYLU_BLOCKSIZE*/) :
+  N(a.getNumRows()),
+  Factors(N*N),
+  Pivots(N),
+  Singular(false)
+{
+  assert(a.getNumRows() == a.getNumColumns());
+  if (blockSize < 1) blockSize = 1;
+
+  const T* src = a.getEntries();
+  int rs = a.getRowStride(), cs = a.getColumnStride();
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<N; j++) {
+      Factors[i*N+j] = src[i*rs + j*cs];
+    }
+  }
+
+  T* f = Factors.data();
+  for (int k0=0; k0<N; k0+=blockSize) {
+    int kb = std::min(blockSize, N-k0);
+    int rest = k0 + kb;
+    factorPanel(k0, kb);
+    if (rest >= N) break;
+
+    // U12 = L11^-1 * A12, independent for every column of A12.
+    ToyThreadPool::global().parallelFor(rest, N, [&](int lo, int hi) {
+      for (int i=k0+1; i<rest; i++) {
+        T* ui = f + i*N;
+        for (int j=k0; j<i; j++) {
+          T lij = ui[j];
+          const T* uj = f + j*N;
+          for (int c=lo; c<hi; c++) ui[c] -= lij * uj[c];
+        }
+      }
+    }, 64);
+
+    // A22 -= L21 * U12
+    int m = N - rest;
+    toyParallelGemm(m, m, kb, T(-1),
+                    f + rest*N + k0, N, 1,
+                    f + k0*N + rest, N, 1,
+                    T(1), f + rest*N + rest, N, 1);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Unblocked factorisation of the columns [k0, k0+kb) below row k0. Row swaps
+// are applied to complete rows, so the trailing matrix sees them as well.
+//------------------------------------------------------------------------------
+template<class T>
+void ToyLU<T>::factorPanel(int k0, int kb)
+{
+  T* f = Factors.data();
+  for (int j=k0; j<k0+kb; j++) {
+    int pivot = j;
+    for (int i=j+1; i<N; i++) {
+      if (std::abs(f[i*N+j]) > std::abs(f[pivot*N+j])) pivot = i;
+    }
+    Pivots[j] = pivot;
+    if (pivot != j) {
+      std::swap_ranges(f + j*N, f + (j+1)*N, f + pivot*N);
+    }
+    if (f[j*N+j] == T()) {
+      Singular = true;
+      continue;
+    }
+    T inverse = T(1) / f[j*N+j];
+    const T* uj = f + j*N;
+    for (int i=j+1; i<N; i++) {
+      T* li = f + i*N;
+      li[j] *= inverse;
+      for (int c=j+1; c<k0+kb; c++) li[c] -= li[j] * uj[c];
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// Solves in place for the right-hand side columns [lo, hi) of the row-major
+// n x numRhs array x, which must already be permuted.
+//------------------------------------------------------------------------------
+template<class T>
+void ToyLU<T>::solveInPlace(T* x, int numRhs, int lo, int hi) const
+{
+  const T* f = Factors.data();
+  for (int i=1; i<N; i++) {
+    T* xi = x + i*numRhs;
+    for (int j=0; j<i; j++) {
+      T lij = f[i*N+j];
+      const T* xj = x + j*numRhs;
+      for (int c=lo; c<hi; c++) xi[c] -= lij * xj[c];
+    }
+  }
+  for (int i=N-1; i>=0; i--) {
+    T* xi = x + i*numRhs;
+    for (int j=i+1; j<N; j++) {
+      T uij = f[i*N+j];
+      const T* xj = x + j*numRhs;
+      for (int c=lo; c<hi; c++) xi[c] -= uij * xj[c];
+    }
+    T inverse = T(1) / f[i*N+i];
+    for (int c=lo; c<hi; c++) xi[c] *= inverse;
+  }
+}
+
+template<class T>
+ToyVector<T> ToyLU<T>::solve(const ToyVector<T>& b) const throw(SingularMatrix)
+{
+  assert(b.getNumEntries() == N);
+  if (Singular) throw SingularMatrix();
+  T* x = new T[N];
+  const T* src = b.getEntries();
+  for (int i=0; i<N; i++) x[i] = src[i];
+  for (int i=0; i<N; i++) std::swap(x[i], x[Pivots[i]]);
+  solveInPlace(x, 1, 0, 1);
+  return ToyVector<T>(N, x);
+}
+
+template<class T>
+ToyMatrix<T> ToyLU<T>::solve(const ToyMatrix<T>& b) const throw(SingularMatrix)
+{
+  assert(b.getNumRows() == N);
+  if (Singular) throw SingularMatrix();
+  int numRhs = b.getNumColumns();
+  T* x = new T[N*numRhs];
+  const T* src = b.getEntries();
+  int rs = b.getRowStride(), cs = b.getColumnStride();
+  for (int i=0; i<N; i++) {
+    for (int c=0; c<numRhs; c++) x[i*numRhs+c] = src[i*rs + c*cs];
+  }
+  for (int i=0; i<N; i++) {
+    if (Pivots[i] != i) {
+      std::swap_ranges(x + i*numRhs, x + (i+1)*numRhs, x + Pivots[i]*numRhs);
+    }
+  }
+  ToyThreadPool::global().parallelFor(0, numRhs, [&](int lo, int hi) {
+    solveInPlace(x, numRhs, lo, hi);
+  }, 8);
+  return ToyMatrix<T>(N, numRhs, x);
+}
+
+template<class T>
+inline bool ToyLU<T>::isSingular() const
+{
+  return Singular;
+}
+
+template<class T>
+inline int ToyLU<T>::getSize() const
+{
+  return N;
+}
+
+template<class T>
+T ToyLU<T>::determinant() const
+{
+  T det = T(1);
+  for (int i=0; i<N; i++) {
+    det *= Factors[i*N+i];
+    if (Pivots[i] != i) det = -det;
+  }
+  return det;
+}
+
+#endif // TOYLU_H
@@ -5,15 +5,31 @@
 // won't need to go through function calls for
 // e.g. multiplication.
 //
+// - Copy-on-write: after setSharedStorage(true), copies of a matrix share
+// its entries through an atomic reference count, so copying is O(1) and
+// read-only copies can be handed to other threads. The non-const accessors
+// (operator(), getEntries()) and the compound operators give a matrix its
+// own entries before writing, if they are still shared. Writes through
+// pointers obtained earlier bypass this.
 //
+// - Structure tags: a matrix records structure it is known to have (zero,
+// identity, diagonal, triangular, affine 4x4). Constructors, makeIdentity()
+// and the arithmetic operators set and maintain the tags, the non-const
+// accessors clear them, and the operators use them to skip work: a product
+// with an identity is a copy, one with a diagonal matrix a scaling. Like
+// sharing, tags do not see writes through pointers obtained earlier.
 //------------------------------------------------------------------------------
 
 #ifndef TOYMATRIX_H
 #define TOYMATRIX_H
 
 #include <arithmeticex.h>
+#include <toynuma.h>
 #include <toyvector.h>
+#include <toyworksteal.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <iostream> 
 using namespace std;
@@ -23,6 +39,24 @@ template<class T> class ToyMatrix;
 template<class T> ToyMatrix<T> operator*(const ToyMatrix<T>& lhs, int rhs) throw(ValueRangeExceeded<T>);
 template<class T> ToyMatrix<T> operator*(int lhs, const ToyMatrix<T>& rhs) throw(ValueRangeExceeded<T>);
 
+// Tag for constructing a matrix whose entries are left uninitialised,
+// for results that are completely overwritten anyway.
+struct ToyUninitialized {};
+static const ToyUninitialized toyUninitialized = ToyUninitialized();
+
+// Structure tags, combined as bits. They describe the matrix as seen
+// through transpose(), and the weaker tags that follow from a tag (e.g.
+// diagonal and both triangles from identity) are always set along with it.
+enum ToyStructure {
+  ToyStructureNone     = 0,
+  ToyStructureZero     = 1,
+  ToyStructureIdentity = 2,
+  ToyStructureDiagonal = 4,
+  ToyStructureUpper    = 8,    // zero below the diagonal
+  ToyStructureLower    = 16,   // zero above the diagonal
+  ToyStructureAffine   = 32    // 4x4 with last row 0 0 0 1
+};
+
 //-----------------------------------------------------------------------------
 // Entries are stored in row-major order.
 //-----------------------------------------------------------------------------
@@ -31,19 +65,21 @@ class ToyMatrix {
   friend class ToyVector<T>;
 public:
   ToyMatrix(int rows = 4, int columns = 4, T* entries = 0x0);
+  ToyMatrix(int rows, int columns, ToyUninitialized);
   ToyMatrix(const ToyMatrix& other);
   ~ToyMatrix();
 
   ToyMatrix&   operator=(const ToyMatrix& rhs);
-  T&           operator()(const int& row, const int& column) const; //TODO: check assembler output for inlined code
+  T&           operator()(const int& row, const int& column); //TODO: check assembler output for inlined code
+  const T&     operator()(const int& row, const int& column) const;
 
   friend ToyMatrix<T> operator*<>(const ToyMatrix<T>& lhs, int rhs) throw(ValueRangeExceeded<T>);
   friend ToyMatrix<T> operator*<>(int lhs, const ToyMatrix<T>& rhs) throw(ValueRangeExceeded<T>);
 
-  ToyMatrix    operator*(const ToyMatrix&    rhs) throw(ValueRangeExceeded<T>);
-  ToyVector<T> operator*(const ToyVector<T>& rhs) throw(ValueRangeExceeded<T>);
-  ToyMatrix    operator+(const ToyMatrix&    rhs) throw(ValueRangeExceeded<T>);
-  ToyMatrix    operator-(const ToyMatrix&    rhs) throw(ValueRangeExceeded<T>);
+  ToyMatrix    operator*(const ToyMatrix&    rhs) const throw(ValueRangeExceeded<T>);
+  ToyVector<T> operator*(const ToyVector<T>& rhs) const throw(ValueRangeExceeded<T>);
+  ToyMatrix    operator+(const ToyMatrix&    rhs) const throw(ValueRangeExceeded<T>);
+  ToyMatrix    operator-(const ToyMatrix&    rhs) const throw(ValueRangeExceeded<T>);
 
   ToyMatrix&   operator*=(const ToyMatrix& rhs)   throw(ValueRangeExceeded<T>);
   ToyMatrix&   operator+=(const ToyMatrix& rhs)   throw(ValueRangeExceeded<T>);
@@ -52,43 +88,116 @@ public:
   ToyMatrix<T>& transpose();
   void          makeIdentity(); 
 
-  bool isTransposed();
-  int  getNumRows();
-  int  getNumColumns();
+  bool isTransposed() const;
+  int  getNumRows() const;
+  int  getNumColumns() const;
+
+  // Direct access to the storage for the raw kernels. Element (i,j) is
+  // found at getEntries()[i*getRowStride() + j*getColumnStride()].
+  T*       getEntries();
+  const T* getEntries() const;
+  int  getRowStride() const;
+  int  getColumnStride() const;
  
+  // Reports the NUMA node of every page of the entries.
+  ToyPagePlacement getPagePlacement() const;
+
+  // Copy-on-write sharing of the entries, see above. Switching it off
+  // gives the matrix its own entries again.
+  void setSharedStorage(bool shared);
+  bool hasSharedStorage() const;
+  // Number of matrices using these entries, 1 if not shared.
+  int  getUseCount() const;
+
+  // Structure tags, see above. setStructure() declares structure the
+  // caller has established, e.g. after filling in a diagonal;
+  // detectStructure() looks at the entries instead, at O(n^2) cost.
+  int  getStructure() const;
+  bool hasStructure(int tags) const;
+  void setStructure(int tags);
+  int  detectStructure();
+
   void printValues() const;
 
 protected:
+  // Gives the matrix entries of its own before they are written.
+  void detach();
+  // Drops this matrix's reference to its entries.
+  void release();
+  // Takes over the entries of other, which is left empty.
+  void adopt(ToyMatrix& other);
+
+  // Writes the product with rhs to result (row-major), summing in A.
+  template<class A>
+  void multiplyEntries(const ToyMatrix& rhs, T* result) const throw(ValueRangeExceeded<T>);
+  void multiplyEntries(const ToyMatrix& rhs, T* result) const throw(ValueRangeExceeded<T>);
+  // Picks the kernel for a dense product written to result (row-major).
+  void multiplyDense(const ToyMatrix& rhs, T* result) const throw(ValueRangeExceeded<T>);
+  // Products where one factor is diagonal, or both are affine 4x4.
+  ToyMatrix multiplyDiagonal(const ToyMatrix& rhs) const;
+  ToyMatrix multiplyAffine(const ToyMatrix& rhs) const;
+  // This matrix in row-major layout, the layout computed results have.
+  ToyMatrix untransposedCopy() const;
+
+  // tags together with the tags they imply for a matrix of this shape.
+  int completeStructure(int tags) const;
+
   int Rows, Columns;
   T* Entries;
   int Transposed;
+  int Allocation;
+  // Shared by all matrices using the same entries; 0 unless shared storage
+  // was switched on.
+  std::atomic<int>* RefCount;
+  // ToyStructure bits. Any access that could write to the entries
+  // clears them.
+  int Structure;
 };
 
 
-//! entries: ownership goes to the object
+//! entries: ownership goes to the object, must be allocated with new[]
 template<class T>
 ToyMatrix<T>::ToyMatrix(int rows /*= 4*/, int columns /*= 4*/, T* entries /*= 0x0*/) :
   Rows(rows),
   Columns(columns),
   Entries(entries),
-  Transposed(0)
+  Transposed(0),
+  Allocation(ToyAllocatedNew),
+  RefCount(0),
+  Structure(ToyStructureNone)
 {
   if (!Entries) {
-    Entries = new T[Rows*Columns];
-    for (int i=0; i<(Rows*Columns); i++) {
-      Entries[i] = T();
-    }
+    // Zero-filled by the thread pool or lazily zeroed pages for large
+    // sizes, see toynuma.h.
+    Entries = toyAllocateEntries<T>(Rows, Columns, Allocation);
+    Structure = completeStructure(ToyStructureZero);
   } else {
     Entries = entries;
   }
 }
 
+template<class T>
+ToyMatrix<T>::ToyMatrix(int rows, int columns, ToyUninitialized) :
+  Rows(rows),
+  Columns(columns),
+  Entries(0x0),
+  Transposed(0),
+  Allocation(ToyAllocatedNew),
+  RefCount(0),
+  Structure(ToyStructureNone)
+{
+  Entries = toyAllocateEntries<T>(Rows, Columns, Allocation, (const T*)0x0, false);
+}
+
 template<class T>
 ToyMatrix<T>::ToyMatrix(const ToyMatrix& other) :
   Rows(0),
   Columns(0),
   Entries(0x0),
-  Transposed(0)
+  Transposed(0),
+  Allocation(ToyAllocatedNew),
+  RefCount(0),
+  Structure(ToyStructureNone)
 {
   (*this) = other;
 }
@@ -97,7 +206,76 @@ ToyMatrix<T>::ToyMatrix(const ToyMatrix& other) :
 template<class T>
 ToyMatrix<T>::~ToyMatrix()
 {
-  delete[] Entries;
+  release();
+}
+
+template<class T>
+void ToyMatrix<T>::release()
+{
+  if (RefCount) {
+    if (RefCount->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      toyFreeEntries(Entries, (size_t)Rows*Columns, Allocation);
+      delete RefCount;
+    }
+    RefCount = 0;
+  } else {
+    toyFreeEntries(Entries, (size_t)Rows*Columns, Allocation);
+  }
+  Entries = 0x0;
+}
+
+template<class T>
+inline void ToyMatrix<T>::detach()
+{
+  if (!RefCount || RefCount->load(std::memory_order_acquire) == 1) return;
+  int allocation;
+  T* entries = toyAllocateEntries<T>(Rows, Columns, allocation, Entries);
+  release();
+  Entries = entries;
+  Allocation = allocation;
+  RefCount = new std::atomic<int>(1);
+}
+
+template<class T>
+void ToyMatrix<T>::adopt(ToyMatrix& other)
+{
+  bool shared = (RefCount != 0);
+  release();
+  Rows = other.Rows;
+  Columns = other.Columns;
+  Transposed = other.Transposed;
+  Entries = other.Entries;
+  Allocation = other.Allocation;
+  RefCount = other.RefCount;
+  Structure = other.Structure;
+  other.Entries = 0x0;
+  other.RefCount = 0;
+  other.Rows = other.Columns = 0;
+  if (shared && !RefCount) RefCount = new std::atomic<int>(1);
+}
+
+template<class T>
+void ToyMatrix<T>::setSharedStorage(bool shared)
+{
+  if (shared && !RefCount) {
+    RefCount = new std::atomic<int>(1);
+  } else if (!shared && RefCount) {
+    detach();
+    delete RefCount;
+    RefCount = 0;
+  }
+}
+
+template<class T>
+inline bool ToyMatrix<T>::hasSharedStorage() const
+{
+  return RefCount != 0;
+}
+
+template<class T>
+inline int ToyMatrix<T>::getUseCount() const
+{
+  return RefCount ? RefCount->load(std::memory_order_acquire) : 1;
 }
 
 template<class T>
@@ -105,20 +283,51 @@ inline ToyMatrix<T>& ToyMatrix<T>::operator=(const ToyMatrix& rhs)
 {
   // Check for self-assignment
   if (this == &rhs) return (*this);
+  Structure = rhs.Structure;
+  if (rhs.RefCount) {
+    // Share the entries of rhs.
+    rhs.RefCount->fetch_add(1, std::memory_order_relaxed);
+    release();
+    Entries = rhs.Entries;
+    Allocation = rhs.Allocation;
+    RefCount = rhs.RefCount;
+    Transposed = rhs.Transposed;
+    Columns = rhs.Columns;
+    Rows = rhs.Rows;
+    return (*this);
+  }
+  if (RefCount) {
+    // Copies of unshared matrices are unshared.
+    release();
+    Rows = Columns = 0;
+  }
   if ((Rows != rhs.Rows) || (Columns != rhs.Columns)) {
-    delete[] Entries;
+    if (Entries) toyFreeEntries(Entries, (size_t)Rows*Columns, Allocation);
     Transposed = rhs.Transposed;
     Columns = rhs.Columns;
     Rows = rhs.Rows;
-    Entries = new T[Rows*Columns];
+    // The copy doubles as first touch of the new pages.
+    Entries = toyAllocateEntries<T>(Rows, Columns, Allocation, rhs.Entries);
+    return (*this);
   }
-  memcpy(Entries, rhs.Entries, Rows*Columns*sizeof(T));
+  Transposed = rhs.Transposed;
+  std::copy(rhs.Entries, rhs.Entries + Rows*Columns, Entries);
   return (*this);
 }
 
 // INFO: Check assembler output whether this is actually inlined
 template<class T>
-inline T& ToyMatrix<T>::operator()(const int& row, const int& column) const
+inline T& ToyMatrix<T>::operator()(const int& row, const int& column)
+{
+  assert(row < Rows && column < Columns);
+  if (RefCount) detach();
+  Structure = ToyStructureNone;
+  int notTransposed = (Transposed+1)%2;
+  return Entries[notTransposed * (row*Columns+column) + Transposed * (column*Rows+row)];
+}
+
+template<class T>
+inline const T& ToyMatrix<T>::operator()(const int& row, const int& column) const
 {
   assert(row < Rows && column < Columns);
   // To avoid if/else we put the index calculation of transposed
@@ -132,83 +341,244 @@ inline T& ToyMatrix<T>::operator()(const int& row, const int& column) const
 template<class U>  
 ToyMatrix<U> operator*(const ToyMatrix<U>& lhs, int rhs) throw(ValueRangeExceeded<U>)
 {
-  ToyMatrix<U> result(lhs);
+  ToyMatrix<U> result(lhs.Rows, lhs.Columns, toyUninitialized);
+  result.Transposed = lhs.Transposed;
   for (int i=0; i< lhs.Rows*lhs.Columns; i++)
   {
-    result.Entries[i]*=rhs; 
+    result.Entries[i] = lhs.Entries[i]*rhs; 
   }
+  result.Structure = lhs.Structure & (ToyStructureZero | ToyStructureDiagonal |
+                                      ToyStructureUpper | ToyStructureLower);
   return result;
 }
 
 template<class U>  
 ToyMatrix<U> operator*(int lhs, const ToyMatrix<U>& rhs) throw(ValueRangeExceeded<U>)
 {
-  ToyMatrix<U> result(rhs);
+  ToyMatrix<U> result(rhs.Rows, rhs.Columns, toyUninitialized);
+  result.Transposed = rhs.Transposed;
   for (int i=0; i< rhs.Rows*rhs.Columns; i++)
   {
-    result.Entries[i]*=lhs; 
+    result.Entries[i] = rhs.Entries[i]*lhs; 
   }
+  result.Structure = rhs.Structure & (ToyStructureZero | ToyStructureDiagonal |
+                                      ToyStructureUpper | ToyStructureLower);
   return result;
 }
 
 template<class T>
-inline ToyMatrix<T> ToyMatrix<T>::operator*(const ToyMatrix& rhs) throw (ValueRangeExceeded<T>)
+inline ToyMatrix<T> ToyMatrix<T>::operator*(const ToyMatrix& rhs) const throw (ValueRangeExceeded<T>)
 {
   assert(Columns == rhs.Rows);
-  ToyMatrix<T> result(Rows, rhs.Columns);
+  // Products with zero or identity need no arithmetic at all.
+  if ((Structure | rhs.Structure) & ToyStructureZero) return ToyMatrix<T>(Rows, rhs.Columns);
+  if (Structure & ToyStructureIdentity) return rhs.untransposedCopy();
+  if (rhs.Structure & ToyStructureIdentity) return untransposedCopy();
+#ifndef ARITHMETIC_EXCEPTIONS
+  if ((Structure | rhs.Structure) & ToyStructureDiagonal) return multiplyDiagonal(rhs);
+  if (Structure & rhs.Structure & ToyStructureAffine) return multiplyAffine(rhs);
+#endif
+  // Every entry is written exactly once below, so skip the zero fill.
+  ToyMatrix<T> result(Rows, rhs.Columns, toyUninitialized);
+  multiplyDense(rhs, result.Entries);
+  result.Structure = completeStructure(Structure & rhs.Structure &
+                                       (ToyStructureUpper | ToyStructureLower | ToyStructureAffine));
+  return result;
+}
+
+template<class T>
+void ToyMatrix<T>::multiplyDense(const ToyMatrix& rhs, T* result) const throw (ValueRangeExceeded<T>)
+{
+#ifndef ARITHMETIC_EXCEPTIONS
+  // Complex products are split into real ones once, at any size; the
+  // split kernels parallelise the real products themselves.
+  if (ToyIsComplex<T>::value) {
+    toyGemm(Rows, rhs.Columns, Columns, T(1),
+            Entries, getRowStride(), getColumnStride(),
+            rhs.Entries, rhs.getRowStride(), rhs.getColumnStride(),
+            T(), result, rhs.Columns, 1);
+    return;
+  }
+  // Large products are split recursively over the work-stealing scheduler.
+  if ((long long)Rows*rhs.Columns*Columns >= toyKernelConfig().ParallelThreshold) {
+    toyRecursiveGemm(Rows, rhs.Columns, Columns, T(1),
+                     Entries, getRowStride(), getColumnStride(),
+                     rhs.Entries, rhs.getRowStride(), rhs.getColumnStride(),
+                     T(), result, rhs.Columns, 1);
+    return;
+  }
+#endif
+  multiplyEntries(rhs, result);
+}
+
+template<class T>
+ToyMatrix<T> ToyMatrix<T>::untransposedCopy() const
+{
+  if (!Transposed) return (*this);
+  ToyMatrix<T> result(Rows, Columns, toyUninitialized);
+  for (int i=0; i<Rows; i++) {
+    for (int j=0; j<Columns; j++) result.Entries[i*Columns + j] = (*this)(i,j);
+  }
+  result.Structure = Structure;
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// A diagonal factor scales the rows or columns of the other one, O(n^2);
+// two diagonal factors give a diagonal product in O(n).
+//------------------------------------------------------------------------------
+template<class T>
+ToyMatrix<T> ToyMatrix<T>::multiplyDiagonal(const ToyMatrix& rhs) const
+{
+  const int triangular = ToyStructureDiagonal | ToyStructureUpper | ToyStructureLower;
+  if (Structure & rhs.Structure & ToyStructureDiagonal) {
+    ToyMatrix<T> result(Rows, rhs.Columns);
+    for (int i=0; i<std::min(Rows, rhs.Columns); i++) {
+      T left = (i < Columns) ? (*this)(i,i) : T();
+      T right = (i < rhs.Rows) ? rhs(i,i) : T();
+      result.Entries[i*rhs.Columns + i] = left * right;
+    }
+    result.Structure = completeStructure(ToyStructureDiagonal);
+    return result;
+  }
+  ToyMatrix<T> result(Rows, rhs.Columns, toyUninitialized);
+  if (Structure & ToyStructureDiagonal) {
+    // Rows past the diagonal of a tall factor are zero.
+    for (int i=0; i<Rows; i++) {
+      for (int j=0; j<rhs.Columns; j++) {
+        result.Entries[i*rhs.Columns + j] = (i < Columns) ? T((*this)(i,i) * rhs(i,j)) : T();
+      }
+    }
+    result.Structure = completeStructure(rhs.Structure & triangular);
+  } else {
+    for (int i=0; i<Rows; i++) {
+      for (int j=0; j<rhs.Columns; j++) {
+        result.Entries[i*rhs.Columns + j] = (j < rhs.Rows) ? T((*this)(i,j) * rhs(j,j)) : T();
+      }
+    }
+    result.Structure = completeStructure(Structure & triangular);
+  }
+  return result;
+}
+
+//! [A a; 0 1] * [B b; 0 1] = [AB Ab+a; 0 1]: 36 multiplications instead of 64.
+template<class T>
+ToyMatrix<T> ToyMatrix<T>::multiplyAffine(const ToyMatrix& rhs) const
+{
+  ToyMatrix<T> result(4, 4, toyUninitialized);
+  for (int i=0; i<3; i++) {
+    for (int j=0; j<4; j++) {
+      T sum = (j == 3) ? (*this)(i,3) : T();
+      for (int k=0; k<3; k++) sum += (*this)(i,k) * rhs(k,j);
+      result.Entries[i*4 + j] = sum;
+    }
+  }
+  for (int j=0; j<4; j++) result.Entries[12 + j] = (j == 3) ? T(1) : T();
+  result.Structure = completeStructure(Structure & rhs.Structure &
+                                       (ToyStructureAffine | ToyStructureUpper | ToyStructureLower));
+  return result;
+}
+
+template<class T>
+template<class A>
+void ToyMatrix<T>::multiplyEntries(const ToyMatrix& rhs, T* result) const throw (ValueRangeExceeded<T>)
+{
   for(int row=0; row < Rows; row++) {
     for(int column=0; column < rhs.Columns; column++) {
+      A sum = A();
       for (int component=0; component < Columns; component++) {
 #ifdef ARITHMETIC_EXCEPTIONS
         multRangeCheck((*this)(row, component), rhs(component, column));
 #endif        
-	result(row, column) += (*this)(row, component) * rhs(component, column);
+	sum += A((*this)(row, component)) * A(rhs(component, column));
       }
+      result[row*rhs.Columns + column] = T(sum);
     }
   }
-  return result;
 }
 
 template<class T>
-inline ToyVector<T> ToyMatrix<T>::operator*(const ToyVector<T>& rhs) throw (ValueRangeExceeded<T>)
+inline void ToyMatrix<T>::multiplyEntries(const ToyMatrix& rhs, T* result) const throw (ValueRangeExceeded<T>)
+{
+  if (ToyAccumulator<T>::widen()) {
+    multiplyEntries<typename ToyAccumulator<T>::Wide>(rhs, result);
+  } else {
+    multiplyEntries<typename ToyAccumulator<T>::Type>(rhs, result);
+  }
+}
+
+template<class T>
+inline ToyVector<T> ToyMatrix<T>::operator*(const ToyVector<T>& rhs) const throw (ValueRangeExceeded<T>)
 {
   assert(Columns==rhs.Rows);
+  typedef typename ToyAccumulator<T>::Type A;
+  const T* x = rhs.getEntries();
   ToyVector<T> res(Rows);
+  if (Structure & ToyStructureZero) return res;
+  if (Structure & ToyStructureDiagonal) {
+    for (int i=0; i<std::min(Rows, Columns); i++) res(i) += (*this)(i,i) * x[i];
+    return res;
+  }
   for (int i=0; i<Rows; i++)
   {
+    A sum = A(res(i));
     for (int j=0; j<Columns; j++)
     {
-      res(i) += (*this)(i,j) * rhs.Entries[j];
+      sum += A((*this)(i,j)) * A(x[j]);
     }
+    res(i) = T(sum);
   }
   return res;
 }
 
 template<class T>
-inline ToyMatrix<T> ToyMatrix<T>::operator+(const ToyMatrix& rhs) throw (ValueRangeExceeded<T>) 
+inline ToyMatrix<T> ToyMatrix<T>::operator+(const ToyMatrix& rhs) const throw (ValueRangeExceeded<T>) 
 {
   assert(Rows==rhs.Rows && Columns==rhs.Columns);
-  ToyMatrix result(Rows, Columns);
+  if (rhs.Structure & ToyStructureZero) return untransposedCopy();
+  if (Structure & ToyStructureZero) return rhs.untransposedCopy();
+  if (Structure & rhs.Structure & ToyStructureDiagonal) {
+    ToyMatrix result(Rows, Columns);
+    for (int i=0; i<std::min(Rows, Columns); i++) {
+      result.Entries[i*Columns + i] = (*this)(i,i) + rhs(i,i);
+    }
+    result.Structure = completeStructure(ToyStructureDiagonal);
+    return result;
+  }
+  ToyMatrix result(Rows, Columns, toyUninitialized);
   for (int i=0; i < Rows; i++)
   {
     for (int j=0; j < Columns; j++) {
       result(i, j) = (*this)(i,j) + rhs(i,j);
     }
   }
+  result.Structure = completeStructure(Structure & rhs.Structure &
+                                       (ToyStructureUpper | ToyStructureLower));
   return result;
 }
 
 template<class T>
-inline ToyMatrix<T> ToyMatrix<T>::operator-(const ToyMatrix& rhs) throw (ValueRangeExceeded<T>) 
+inline ToyMatrix<T> ToyMatrix<T>::operator-(const ToyMatrix& rhs) const throw (ValueRangeExceeded<T>) 
 {
   assert(Rows==rhs.Rows && Columns==rhs.Columns);
-  ToyMatrix result(Rows, Columns);
+  if (rhs.Structure & ToyStructureZero) return untransposedCopy();
+  if (Structure & rhs.Structure & ToyStructureDiagonal) {
+    ToyMatrix result(Rows, Columns);
+    for (int i=0; i<std::min(Rows, Columns); i++) {
+      result.Entries[i*Columns + i] = (*this)(i,i) - rhs(i,i);
+    }
+    result.Structure = completeStructure(ToyStructureDiagonal);
+    return result;
+  }
+  ToyMatrix result(Rows, Columns, toyUninitialized);
   for (int i=0; i < Rows; i++)
   {
     for (int j=0; j < Columns; j++) {
       result(i, j) = (*this)(i,j) - rhs(i,j);
     }
   }
+  result.Structure = completeStructure(Structure & rhs.Structure &
+                                       (ToyStructureUpper | ToyStructureLower));
   return result;
 }
 
@@ -216,11 +586,19 @@ template<class T>
 inline ToyMatrix<T>& ToyMatrix<T>::operator+=(const ToyMatrix& rhs) throw (ValueRangeExceeded<T>) 
 {
   assert(Rows==rhs.Rows && Columns==rhs.Columns);
-  for (int i=0; i < Rows; i++) {
-    for (int j=0; j < Columns; j++) {
-      (*this)(i,j) += rhs(i,j);
+  if (rhs.Structure & ToyStructureZero) return (*this);
+  int structure = completeStructure(Structure & rhs.Structure &
+                                    (ToyStructureDiagonal | ToyStructureUpper | ToyStructureLower));
+  if (structure & ToyStructureDiagonal) {
+    for (int i=0; i<std::min(Rows, Columns); i++) (*this)(i,i) += rhs(i,i);
+  } else {
+    for (int i=0; i < Rows; i++) {
+      for (int j=0; j < Columns; j++) {
+        (*this)(i,j) += rhs(i,j);
+      }
     }
   }
+  Structure = structure;
   return (*this);
 }
 
@@ -228,11 +606,19 @@ template<class T>
 inline ToyMatrix<T>& ToyMatrix<T>::operator-=(const ToyMatrix& rhs) throw (ValueRangeExceeded<T>)
 {
   assert(Rows==rhs.Rows && Columns==rhs.Columns);
-  for (int i=0; i < Rows; i++) {
-    for (int j=0; j < Columns; j++) {
-      (*this)(i,j) -= rhs(i,j);
+  if (rhs.Structure & ToyStructureZero) return (*this);
+  int structure = completeStructure(Structure & rhs.Structure &
+                                    (ToyStructureDiagonal | ToyStructureUpper | ToyStructureLower));
+  if (structure & ToyStructureDiagonal) {
+    for (int i=0; i<std::min(Rows, Columns); i++) (*this)(i,i) -= rhs(i,i);
+  } else {
+    for (int i=0; i < Rows; i++) {
+      for (int j=0; j < Columns; j++) {
+        (*this)(i,j) -= rhs(i,j);
+      }
     }
   }
+  Structure = structure;
   return (*this);
 }
 
@@ -240,23 +626,10 @@ template<class T>
 inline ToyMatrix<T>& ToyMatrix<T>::operator*=(const ToyMatrix& rhs) throw (ValueRangeExceeded<T>) 
 {
   assert(Columns == rhs.Rows);
-  int newRows=Rows, newColumns=rhs.Columns;
-  T *resultEntriesp = new T[newRows*newColumns]();
-  for (int i=0; i<newRows; i++) {
-    for (int j=0; j<newColumns; j++) {
-      for (int component=0; component<Columns; component++) {
-#ifdef ARITHMETIC_EXCEPTIONS
-        multRangeCheck((*this)(i,component), rhs(component,j));
-#endif
-        resultEntriesp[i*newColumns+j]+= (*this)(i, component) * rhs(component, j);
-      }
-    }
-  } 
-  delete[] Entries; 
-  Entries = resultEntriesp;
-  Rows = newRows;
-  Columns = newColumns;
-  Transposed = 0;
+  // The product goes to new entries anyway, so shared entries are simply
+  // released instead of copied first.
+  ToyMatrix<T> product((*this) * rhs);
+  adopt(product);
   return (*this);
 }
 
@@ -267,6 +640,10 @@ ToyMatrix<T>& ToyMatrix<T>::transpose()
   int tmp = Rows;
   Rows = Columns;
   Columns = tmp;
+  // The triangles swap; the last row of an affine matrix becomes a column.
+  int triangles = ((Structure & ToyStructureUpper) ? ToyStructureLower : 0) |
+                  ((Structure & ToyStructureLower) ? ToyStructureUpper : 0);
+  Structure = (Structure & (ToyStructureZero | ToyStructureIdentity | ToyStructureDiagonal)) | triangles;
   return (*this);
 }
 
@@ -277,30 +654,129 @@ void ToyMatrix<T>::makeIdentity()
   if (Rows != Columns) {
     return;  
   }
-  memset(Entries,T(),Rows*Columns*sizeof(T));
+  if (RefCount) detach();
+  // A freshly constructed matrix is already zero.
+  if (!(Structure & ToyStructureZero)) {
+    std::fill(Entries, Entries + Rows*Columns, T());
+  }
   for (int i=0; i<Rows; i++) {
     Entries[i*Rows+i] = 1;
   }
+  Structure = completeStructure(ToyStructureIdentity);
 }
 
 template<class T>
-inline bool ToyMatrix<T>::isTransposed()
+inline bool ToyMatrix<T>::isTransposed() const
 {
   return  (Transposed?true:false);
 }
 
 template<class T>
-inline int ToyMatrix<T>::getNumRows()
+inline int ToyMatrix<T>::getNumRows() const
 {
   return Rows;
 }
 
 template<class T>
-inline int ToyMatrix<T>::getNumColumns()
+inline int ToyMatrix<T>::getNumColumns() const
 {
   return Columns;
 }
 
+template<class T>
+inline T* ToyMatrix<T>::getEntries()
+{
+  if (RefCount) detach();
+  Structure = ToyStructureNone;
+  return Entries;
+}
+
+template<class T>
+inline const T* ToyMatrix<T>::getEntries() const
+{
+  return Entries;
+}
+
+template<class T>
+inline int ToyMatrix<T>::getRowStride() const
+{
+  return Transposed ? 1 : Columns;
+}
+
+template<class T>
+inline int ToyMatrix<T>::getColumnStride() const
+{
+  return Transposed ? Rows : 1;
+}
+
+template<class T>
+int ToyMatrix<T>::completeStructure(int tags) const
+{
+  if (tags & ToyStructureZero) tags |= ToyStructureDiagonal;
+  if (tags & ToyStructureIdentity) {
+    tags |= ToyStructureDiagonal;
+    if (Rows == 4 && Columns == 4) tags |= ToyStructureAffine;
+  }
+  if (tags & ToyStructureDiagonal) tags |= ToyStructureUpper | ToyStructureLower;
+  if (Rows != 4 || Columns != 4) tags &= ~ToyStructureAffine;
+  return tags;
+}
+
+template<class T>
+inline int ToyMatrix<T>::getStructure() const
+{
+  return Structure;
+}
+
+template<class T>
+inline bool ToyMatrix<T>::hasStructure(int tags) const
+{
+  return (Structure & tags) == tags;
+}
+
+//! The matrix must really have the structure; nothing checks it.
+template<class T>
+void ToyMatrix<T>::setStructure(int tags)
+{
+  Structure = completeStructure(tags);
+}
+
+//! Not const: the tags it finds are stored, which must not race with
+//! readers of a matrix shared between threads.
+template<class T>
+int ToyMatrix<T>::detectStructure()
+{
+  const ToyMatrix& self = *this;   // reads must not clear the tags
+  bool zero = true, identity = (Rows == Columns), upper = true, lower = true;
+  for (int i=0; i<Rows; i++) {
+    for (int j=0; j<Columns; j++) {
+      const T& entry = self(i,j);
+      if (entry == T()) {
+        if (i == j) identity = false;
+        continue;
+      }
+      zero = false;
+      if (i != j || !(entry == T(1))) identity = false;
+      if (i > j) upper = false;
+      if (i < j) lower = false;
+    }
+  }
+  bool affine = (Rows == 4 && Columns == 4) && self(3,0) == T() && self(3,1) == T() &&
+                self(3,2) == T() && self(3,3) == T(1);
+  Structure = completeStructure((zero ? ToyStructureZero : 0) |
+                                (identity ? ToyStructureIdentity : 0) |
+                                (upper && lower ? ToyStructureDiagonal : 0) |
+                                (upper ? ToyStructureUpper : 0) | (lower ? ToyStructureLower : 0) |
+                                (affine ? ToyStructureAffine : 0));
+  return Structure;
+}
+
+template<class T>
+ToyPagePlacement ToyMatrix<T>::getPagePlacement() const
+{
+  return toyPagePlacement(Entries, (size_t)Rows*Columns*sizeof(T));
+}
+
 template<class T>
 void ToyMatrix<T>::printValues() const
 {
@@ -0,0 +1,258 @@
+//------------------------------------------------------------------------------
+// Cache of matrix products, for programs that multiply the same operands
+// over and over, e.g. view*projection per camera and request.
+//
+//   ToyProductCache<float> cache(128);
+//   ToyMatrix<float> vp = cache.multiply(view, projection);
+//
+// Operands are identified by a fingerprint of their entries, dimensions
+// and transposed state, so equal matrices hit the cache no matter where
+// they come from. A hit is confirmed by comparing the operands with the
+// stored ones, so a fingerprint collision costs a product but can never
+// return a wrong one. Entries are compared bit by bit: 0.0 and -0.0 are
+// different operands here, NaNs with equal bits the same.
+//
+// The cache holds at most getCapacity() products and evicts the least
+// recently used one. All member functions may be called concurrently;
+// products are computed outside the lock, so two threads that miss on
+// the same operands at once both compute it. Results share their entries
+// with the cached copy (see setSharedStorage()), so a hit costs no copy
+// until the result is written to.
+//------------------------------------------------------------------------------
+
+#ifndef TOYMEMO_H
+#define TOYMEMO_H
+
+#include <toymatrix.h>
+
+#include <cassert>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <type_traits>
+#include <unordered_map>
+
+#ifndef TOYMEMO_DEFAULT_CAPACITY
+#define TOYMEMO_DEFAULT_CAPACITY 64
+#endif
+
+//------------------------------------------------------------------------------
+// 64-bit hash of a block of memory in the style of xxHash64: four
+// independent lanes take 32 bytes per round, so the loop runs at memory
+// speed and the compiler can keep the lanes in vector registers.
+//------------------------------------------------------------------------------
+inline unsigned long long toyRotateLeft(unsigned long long x, int bits)
+{
+  return (x << bits) | (x >> (64 - bits));
+}
+
+inline unsigned long long toyHashBytes(const void* data, size_t bytes, unsigned long long seed = 0)
+{
+  const unsigned long long P1 = 0x9E3779B185EBCA87ULL, P2 = 0xC2B2AE3D27D4EB4FULL,
+                           P3 = 0x165667B19E3779F9ULL, P4 = 0x85EBCA77C2B2AE63ULL;
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  const unsigned char* end = p + bytes;
+  unsigned long long hash;
+  if (bytes >= 32) {
+    unsigned long long lanes[4] = { seed + P1 + P2, seed + P2, seed, seed - P1 };
+    for (; p + 32 <= end; p += 32) {
+      unsigned long long words[4];
+      std::memcpy(words, p, 32);
+      for (int l=0; l<4; l++) lanes[l] = toyRotateLeft(lanes[l] + words[l]*P2, 31) * P1;
+    }
+    hash = toyRotateLeft(lanes[0], 1) + toyRotateLeft(lanes[1], 7) +
+           toyRotateLeft(lanes[2], 12) + toyRotateLeft(lanes[3], 18);
+    for (int l=0; l<4; l++) hash = (hash ^ (toyRotateLeft(lanes[l]*P2, 31) * P1)) * P1 + P4;
+  } else {
+    hash = seed + P3;
+  }
+  hash += bytes;
+  for (; p + 8 <= end; p += 8) {
+    unsigned long long word;
+    std::memcpy(&word, p, 8);
+    hash = toyRotateLeft(hash ^ (toyRotateLeft(word*P2, 31) * P1), 27) * P1 + P4;
+  }
+  for (; p < end; p++) hash = toyRotateLeft(hash ^ (*p * P3), 11) * P1;
+  hash ^= hash >> 33;
+  hash *= P2;
+  hash ^= hash >> 29;
+  hash *= P3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+//! Fingerprint of the entries, dimensions and transposed state of matrix.
+template<class T>
+unsigned long long toyFingerprint(const ToyMatrix<T>& matrix)
+{
+  static_assert(std::is_trivially_copyable<T>::value, "fingerprints hash the bytes of the entries");
+  int shape[3] = { matrix.getNumRows(), matrix.getNumColumns(), matrix.isTransposed() ? 1 : 0 };
+  return toyHashBytes(matrix.getEntries(), sizeof(T)*matrix.getNumRows()*matrix.getNumColumns(),
+                      toyHashBytes(shape, sizeof(shape)));
+}
+
+struct ToyProductCacheStats {
+  ToyProductCacheStats() : Hits(0), Misses(0), Evictions(0), Size(0) {}
+
+  double hitRate() const { return (Hits + Misses) ? (double)Hits / (Hits + Misses) : 0; }
+
+  long long Hits;
+  long long Misses;
+  long long Evictions;
+  int       Size;        // products cached now
+};
+
+template<class T>
+class ToyProductCache {
+public:
+  explicit ToyProductCache(int capacity = TOYMEMO_DEFAULT_CAPACITY);
+
+  // lhs*rhs, from the cache if possible.
+  ToyMatrix<T> multiply(const ToyMatrix<T>& lhs, const ToyMatrix<T>& rhs);
+
+  void clear();
+  int  getCapacity() const;
+  void setCapacity(int capacity);
+
+  ToyProductCacheStats getStats() const;
+  void resetStats();
+
+private:
+  ToyProductCache(const ToyProductCache&);
+  ToyProductCache& operator=(const ToyProductCache&);
+
+  struct Key {
+    unsigned long long Lhs, Rhs;
+    bool operator==(const Key& other) const { return Lhs == other.Lhs && Rhs == other.Rhs; }
+  };
+  struct KeyHash {
+    size_t operator()(const Key& key) const { return (size_t)(key.Lhs ^ toyRotateLeft(key.Rhs, 29)); }
+  };
+  struct Entry {
+    Key          Fingerprints;
+    ToyMatrix<T> Lhs, Rhs, Product;
+  };
+  typedef std::list<Entry> EntryList;   // most recently used first
+
+  static bool sameOperand(const ToyMatrix<T>& a, const ToyMatrix<T>& b);
+  static ToyMatrix<T> share(const ToyMatrix<T>& matrix);
+  void evict(int capacity);
+
+  int Capacity;
+  EntryList Entries;
+  std::unordered_map<Key, typename EntryList::iterator, KeyHash> Index;
+  ToyProductCacheStats Stats;
+  mutable std::mutex Mutex;
+};
+
+template<class T>
+ToyProductCache<T>::ToyProductCache(int capacity /*= TOYMEMO_DEFAULT_CAPACITY*/) :
+  Capacity(capacity)
+{
+  assert(capacity > 0);
+}
+
+template<class T>
+bool ToyProductCache<T>::sameOperand(const ToyMatrix<T>& a, const ToyMatrix<T>& b)
+{
+  return a.getNumRows() == b.getNumRows() && a.getNumColumns() == b.getNumColumns() &&
+         a.isTransposed() == b.isTransposed() &&
+         std::memcmp(a.getEntries(), b.getEntries(), sizeof(T)*a.getNumRows()*a.getNumColumns()) == 0;
+}
+
+//! A copy whose entries are shared by all further copies.
+template<class T>
+ToyMatrix<T> ToyProductCache<T>::share(const ToyMatrix<T>& matrix)
+{
+  ToyMatrix<T> copy(matrix);
+  copy.setSharedStorage(true);
+  return copy;
+}
+
+template<class T>
+ToyMatrix<T> ToyProductCache<T>::multiply(const ToyMatrix<T>& lhs, const ToyMatrix<T>& rhs)
+{
+  Key key = { toyFingerprint(lhs), toyFingerprint(rhs) };
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    typename std::unordered_map<Key, typename EntryList::iterator, KeyHash>::iterator found = Index.find(key);
+    if (found != Index.end() &&
+        sameOperand(found->second->Lhs, lhs) && sameOperand(found->second->Rhs, rhs)) {
+      Entries.splice(Entries.begin(), Entries, found->second);
+      Stats.Hits++;
+      return found->second->Product;
+    }
+    Stats.Misses++;
+  }
+
+  Entry entry;
+  entry.Fingerprints = key;
+  entry.Product = share(lhs*rhs);
+  entry.Lhs = share(lhs);
+  entry.Rhs = share(rhs);
+
+  std::lock_guard<std::mutex> lock(Mutex);
+  // Another thread may have stored the same product, or a colliding one,
+  // in the meantime; the newer entry replaces it.
+  typename std::unordered_map<Key, typename EntryList::iterator, KeyHash>::iterator found = Index.find(key);
+  if (found != Index.end()) {
+    Entries.erase(found->second);
+    Index.erase(found);
+  }
+  Entries.push_front(entry);
+  Index[key] = Entries.begin();
+  evict(Capacity);
+  return entry.Product;
+}
+
+template<class T>
+void ToyProductCache<T>::evict(int capacity)
+{
+  while ((int)Entries.size() > capacity) {
+    Index.erase(Entries.back().Fingerprints);
+    Entries.pop_back();
+    Stats.Evictions++;
+  }
+}
+
+template<class T>
+void ToyProductCache<T>::clear()
+{
+  std::lock_guard<std::mutex> lock(Mutex);
+  Entries.clear();
+  Index.clear();
+}
+
+template<class T>
+int ToyProductCache<T>::getCapacity() const
+{
+  std::lock_guard<std::mutex> lock(Mutex);
+  return Capacity;
+}
+
+template<class T>
+void ToyProductCache<T>::setCapacity(int capacity)
+{
+  assert(capacity > 0);
+  std::lock_guard<std::mutex> lock(Mutex);
+  Capacity = capacity;
+  evict(Capacity);
+}
+
+template<class T>
+ToyProductCacheStats ToyProductCache<T>::getStats() const
+{
+  std::lock_guard<std::mutex> lock(Mutex);
+  ToyProductCacheStats stats = Stats;
+  stats.Size = (int)Entries.size();
+  return stats;
+}
+
+template<class T>
+void ToyProductCache<T>::resetStats()
+{
+  std::lock_guard<std::mutex> lock(Mutex);
+  Stats = ToyProductCacheStats();
+}
+
+#endif // TOYMEMO_H
@@ -0,0 +1,213 @@
+//------------------------------------------------------------------------------
+// NUMA-aware storage for matrix entries.
+//
+// Linux places a page on the NUMA node of the thread that first writes to
+// it. Large matrices (at least TOYMATRIX_NUMA_THRESHOLD bytes) are therefore
+// mapped untouched and initialised by the thread pool, with the same row
+// partitioning that parallelFor() uses for the kernels:
+//
+//   ToyPlacementPartitioned  every pool thread first-touches its own rows
+//                            (the default)
+//   ToyPlacementInterleaved  pages are spread round-robin over all nodes
+//                            with mbind(), independent of the threads
+//   ToyPlacementSerial       nothing is touched up front; pages go to the
+//                            node of whichever thread writes them first
+//
+// Fresh mappings read as zero, so only partitioned placement pays for an
+// explicit zero fill; the other policies get lazily zeroed pages for free.
+// Entries allocated without initialisation are not touched at all, and the
+// kernel writing the result places them.
+//
+// The row partitioning only matches the kernels built on parallelFor(), such
+// as the reductions, toyParallelGemm() and the factorisations. Large
+// products through operator* run toyRecursiveGemm() on the work-stealing
+// scheduler, which hands out blocks of C to whichever worker steals them,
+// so their pages are generally not local to the thread reading them.
+//
+// toySetPlacement() may be called while other threads allocate; each
+// allocation reads the setting once.
+//
+// toyPagePlacement() asks the kernel where the pages of a matrix ended up.
+// On other systems, for small matrices and for non-trivial element types
+// the entries are allocated with new[] as before.
+//------------------------------------------------------------------------------
+
+#ifndef TOYNUMA_H
+#define TOYNUMA_H
+
+#include <toyparallel.h>
+
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef TOYMATRIX_NUMA_THRESHOLD
+#define TOYMATRIX_NUMA_THRESHOLD (1 << 20)
+#endif
+
+enum ToyPlacement {
+  ToyPlacementPartitioned,
+  ToyPlacementInterleaved,
+  ToyPlacementSerial
+};
+
+// How a block of entries was allocated, so it can be released the same way.
+enum ToyAllocation {
+  ToyAllocatedNew,
+  ToyAllocatedMapped
+};
+
+struct ToyPagePlacement {
+  std::vector<long> PagesPerNode;
+  long              UnplacedPages;  // not touched yet or not queryable
+};
+
+inline std::atomic<ToyPlacement>& toyPlacementSetting()
+{
+  static std::atomic<ToyPlacement> placement(ToyPlacementPartitioned);
+  return placement;
+}
+
+inline void toySetPlacement(ToyPlacement placement)
+{
+  toyPlacementSetting().store(placement, std::memory_order_relaxed);
+}
+
+inline ToyPlacement toyGetPlacement()
+{
+  return toyPlacementSetting().load(std::memory_order_relaxed);
+}
+
+//! Number of configured NUMA nodes, 1 if unknown.
+inline int toyNumaNodeCount()
+{
+  // Function-local statics are initialised once, even by concurrent callers.
+  static const int count = []() {
+    std::ifstream online("/sys/devices/system/node/possible");
+    std::string range;
+    if (!(online >> range)) return 1;
+    // Format "0" or "0-N"; the highest node id is what matters.
+    size_t dash = range.rfind('-');
+    return atoi(range.c_str() + (dash == std::string::npos ? 0 : dash+1)) + 1;
+  }();
+  return count;
+}
+
+inline size_t toyPageSize()
+{
+#ifdef __linux__
+  return (size_t)sysconf(_SC_PAGESIZE);
+#else
+  return 4096;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Allocates rows*columns entries and initialises them with source (row-major,
+// contiguous), with zeros, or not at all if initialize is false.
+// allocation receives the kind of memory used.
+//------------------------------------------------------------------------------
+template<class T>
+T* toyAllocateEntries(int rows, int columns, int& allocation, const T* source = 0,
+                      bool initialize = true)
+{
+  size_t count = (size_t)rows * columns;
+  size_t bytes = count * sizeof(T);
+#ifdef __linux__
+  if (std::is_trivial<T>::value && bytes >= TOYMATRIX_NUMA_THRESHOLD) {
+    void* memory = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED) {
+      T* entries = (T*)memory;
+      int nodes = toyNumaNodeCount();
+      ToyPlacement placement = toyGetPlacement();
+      if (placement == ToyPlacementInterleaved && nodes > 1) {
+        const int MPOL_INTERLEAVE_MODE = 3;
+        std::vector<unsigned long> mask((nodes + 8*sizeof(unsigned long) - 1) / (8*sizeof(unsigned long)), 0);
+        for (int n=0; n<nodes; n++) mask[n / (8*sizeof(unsigned long))] |= 1ul << (n % (8*sizeof(unsigned long)));
+        syscall(SYS_mbind, memory, bytes, MPOL_INTERLEAVE_MODE, &mask[0], (unsigned long)nodes + 1, 0);
+      }
+      bool touch = source || (initialize && placement == ToyPlacementPartitioned);
+      if (touch) {
+        // Same chunking as the row-parallel kernels, see the note above.
+        ToyThreadPool::global().parallelFor(0, rows, [&](int lo, int hi) {
+          size_t first = (size_t)lo * columns, length = (size_t)(hi - lo) * columns;
+          if (source) {
+            memcpy((void*)(entries + first), source + first, length * sizeof(T));
+          } else {
+            memset((void*)(entries + first), 0, length * sizeof(T));
+          }
+        }, 16);
+      }
+      allocation = ToyAllocatedMapped;
+      return entries;
+    }
+  }
+#endif
+  T* entries = new T[count];
+  if (source) {
+    for (size_t i=0; i<count; i++) entries[i] = source[i];
+  } else if (initialize) {
+    for (size_t i=0; i<count; i++) entries[i] = T();
+  }
+  allocation = ToyAllocatedNew;
+  return entries;
+}
+
+template<class T>
+void toyFreeEntries(T* entries, size_t count, int allocation)
+{
+#ifdef __linux__
+  if (allocation == ToyAllocatedMapped) {
+    munmap(entries, count * sizeof(T));
+    return;
+  }
+#else
+  (void)count;
+  (void)allocation;
+#endif
+  delete[] entries;
+}
+
+//------------------------------------------------------------------------------
+// Counts the pages of [address, address+bytes) per NUMA node, using
+// move_pages() in query mode.
+//------------------------------------------------------------------------------
+inline ToyPagePlacement toyPagePlacement(const void* address, size_t bytes)
+{
+  ToyPagePlacement placement;
+  placement.PagesPerNode.assign(toyNumaNodeCount(), 0);
+  placement.UnplacedPages = 0;
+  if (bytes == 0) return placement;
+
+  size_t pageSize = toyPageSize();
+  size_t first = (size_t)address & ~(pageSize - 1);
+  size_t numPages = ((size_t)address + bytes - first + pageSize - 1) / pageSize;
+#ifdef __linux__
+  std::vector<void*> pages(numPages);
+  std::vector<int> status(numPages, -1);
+  for (size_t i=0; i<numPages; i++) pages[i] = (void*)(first + i*pageSize);
+  if (syscall(SYS_move_pages, 0, (unsigned long)numPages, &pages[0], 0, &status[0], 0) == 0) {
+    for (size_t i=0; i<numPages; i++) {
+      if (status[i] >= 0 && status[i] < (int)placement.PagesPerNode.size()) {
+        placement.PagesPerNode[status[i]]++;
+      } else {
+        placement.UnplacedPages++;
+      }
+    }
+    return placement;
+  }
+#endif
+  placement.UnplacedPages = (long)numPages;
+  return placement;
+}
+
+#endif // TOYNUMA_H
@@ -0,0 +1,421 @@
+//------------------------------------------------------------------------------
+// A small fixed-size thread pool shared by the matrix kernels.
+//
+// Work is split statically: parallelFor() cuts the index range into one
+// contiguous chunk per thread, the calling thread processes the first chunk
+// itself and waits for the others. Chunk c goes to worker c-1 unless that
+// worker is busy with other work, so on an idle pool two parallelFor()
+// calls over the same range touch the same rows on the same threads;
+// toynuma.h relies on this for first-touch placement. Calls
+// made from inside a pool thread run serially, so kernels can nest without
+// deadlocking the pool.
+//
+// If func throws, the chunks not started yet are dropped, the chunks
+// already running finish, and parallelFor() rethrows the first exception
+// on the calling thread.
+//
+// The number of threads defaults to the hardware concurrency and can be
+// overridden with the environment variable TOYMATRIX_NUM_THREADS. Setting
+// TOYMATRIX_PIN_THREADS=1 pins worker i to CPU i+1 (Linux only), which keeps
+// the workers on the NUMA node their pages were placed on.
+//
+// addIdleWork() lends idle workers to other schedulers: a worker with
+// nothing else to do calls the given functions in turn until one of them
+// runs a task of its scheduler. The global work-stealing scheduler runs
+// this way, so the two together never start more threads than there are
+// cores; further schedulers can share the same pool.
+//------------------------------------------------------------------------------
+
+#ifndef TOYPARALLEL_H
+#define TOYPARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// parallelFor() tracks its chunks in one 64-bit mask.
+#define TOYPARALLEL_MAX_CHUNKS 64
+
+class ToyThreadPool {
+public:
+  explicit ToyThreadPool(int numThreads = 0);
+  ~ToyThreadPool();
+
+  static ToyThreadPool& global();
+
+  int  getNumThreads() const;
+  bool isWorkerThread() const;
+
+  void submit(const std::function<void()>& task);
+
+  // func(context, worker) runs one task and returns false if there was
+  // none; it must not throw. notifyIdleWork() must follow every new task.
+  // removeIdleWork() returns once no worker is inside func any more.
+  void addIdleWork(bool (*func)(void* context, int worker), void* context);
+  void removeIdleWork(bool (*func)(void* context, int worker), void* context);
+  void notifyIdleWork();
+
+  template<class F>
+  void parallelFor(int begin, int end, F func, int minChunk = 1);
+
+private:
+  ToyThreadPool(const ToyThreadPool&);
+  ToyThreadPool& operator=(const ToyThreadPool&);
+
+  // One parallelFor() call. It lives on the stack of the calling thread
+  // and is linked into Jobs while its chunks are handed out.
+  struct Job {
+    void (*Call)(const void* func, int lo, int hi);
+    const void*        Func;
+    int                Begin, Chunk, Remainder, NumChunks;
+    unsigned long long Unclaimed;   // bit c: chunk c not started yet
+    int                Pending;     // chunks not finished yet
+    std::exception_ptr Error;       // first exception thrown by a chunk
+    std::condition_variable Done;
+    Job*               Next;
+  };
+
+  struct IdleHook {
+    bool (*Func)(void* context, int worker);
+    void*  Context;
+  };
+
+  enum WorkerState { Sleeping, Waking, Busy };
+
+  struct Worker {
+    std::condition_variable WakeUp;
+    WorkerState             State;
+  };
+
+  template<class F>
+  static void callChunk(const void* func, int lo, int hi);
+
+  void workerLoop(int worker, bool pin);
+  static bool& insideWorker();
+  bool claimChunk(int worker, Job*& job, int& chunk);
+  bool stealChunk(Job& job, int worker, int& chunk);
+  void runChunk(Job& job, int chunk);
+  void wake(int worker);
+  void wakeAny();
+
+  // Everything below is guarded by Mutex.
+  std::vector<std::thread>           Threads;
+  std::vector<std::unique_ptr<Worker> > Workers;
+  std::deque<std::function<void()> > Tasks;
+  Job*                               Jobs;
+  std::vector<IdleHook>              IdleWork;
+  unsigned long long                 IdleEpoch;   // counts notifyIdleWork()
+  int                                IdleCalls;   // workers inside IdleWork
+  std::condition_variable            IdleDone;
+  std::mutex                         Mutex;
+  bool                               Stopping;
+};
+
+inline ToyThreadPool::ToyThreadPool(int numThreads /*= 0*/) :
+  Jobs(0),
+  IdleEpoch(0),
+  IdleCalls(0),
+  Stopping(false)
+{
+  if (numThreads <= 0) {
+    const char* env = getenv("TOYMATRIX_NUM_THREADS");
+    numThreads = env ? atoi(env) : (int)std::thread::hardware_concurrency();
+  }
+  if (numThreads <= 0) numThreads = 1;
+  const char* pinEnv = getenv("TOYMATRIX_PIN_THREADS");
+  bool pin = pinEnv && atoi(pinEnv) != 0;
+  // The calling thread always takes part in parallelFor(), so one
+  // thread less is enough to occupy all cores.
+  for (int i=0; i<numThreads-1; i++) {
+    Workers.push_back(std::unique_ptr<Worker>(new Worker()));
+    Workers.back()->State = Waking;
+  }
+  for (int i=0; i<numThreads-1; i++) {
+    Threads.push_back(std::thread(&ToyThreadPool::workerLoop, this, i, pin));
+  }
+}
+
+inline ToyThreadPool::~ToyThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(Mutex);
+    Stopping = true;
+    for (size_t i=0; i<Workers.size(); i++) Workers[i]->WakeUp.notify_one();
+  }
+  for (size_t i=0; i<Threads.size(); i++) {
+    Threads[i].join();
+  }
+}
+
+inline ToyThreadPool& ToyThreadPool::global()
+{
+  static ToyThreadPool pool;
+  return pool;
+}
+
+inline int ToyThreadPool::getNumThreads() const
+{
+  return (int)Threads.size() + 1;
+}
+
+inline bool& ToyThreadPool::insideWorker()
+{
+  static thread_local bool inside = false;
+  return inside;
+}
+
+inline bool ToyThreadPool::isWorkerThread() const
+{
+  return insideWorker();
+}
+
+//! Wakes worker if it sleeps. Called with Mutex held.
+inline void ToyThreadPool::wake(int worker)
+{
+  if (Workers[worker]->State != Sleeping) return;
+  Workers[worker]->State = Waking;
+  Workers[worker]->WakeUp.notify_one();
+}
+
+//! Wakes one sleeping worker, if there is one. Called with Mutex held.
+inline void ToyThreadPool::wakeAny()
+{
+  for (size_t i=0; i<Workers.size(); i++) {
+    if (Workers[i]->State == Sleeping) {
+      wake((int)i);
+      return;
+    }
+  }
+}
+
+inline void ToyThreadPool::submit(const std::function<void()>& task)
+{
+  if (Workers.empty()) {
+    task();
+    return;
+  }
+  std::lock_guard<std::mutex> lock(Mutex);
+  Tasks.push_back(task);
+  wakeAny();
+}
+
+inline void ToyThreadPool::addIdleWork(bool (*func)(void* context, int worker), void* context)
+{
+  std::lock_guard<std::mutex> lock(Mutex);
+  IdleHook hook = {func, context};
+  IdleWork.push_back(hook);
+}
+
+inline void ToyThreadPool::removeIdleWork(bool (*func)(void* context, int worker), void* context)
+{
+  std::unique_lock<std::mutex> lock(Mutex);
+  for (size_t i=0; i<IdleWork.size(); i++) {
+    if (IdleWork[i].Func == func && IdleWork[i].Context == context) {
+      IdleWork.erase(IdleWork.begin() + i);
+      break;
+    }
+  }
+  while (IdleCalls > 0) IdleDone.wait(lock);
+}
+
+inline void ToyThreadPool::notifyIdleWork()
+{
+  std::lock_guard<std::mutex> lock(Mutex);
+  IdleEpoch++;
+  wakeAny();
+}
+
+//------------------------------------------------------------------------------
+// Chunk c of a parallelFor() belongs to worker c-1 (the caller itself is
+// -1 and owns chunk 0). Others only take it while that worker is busy, so
+// an idle pool always runs chunk c on the same thread, but a long task
+// from submit() cannot hold up a parallelFor(). Called with Mutex held.
+//------------------------------------------------------------------------------
+inline bool ToyThreadPool::stealChunk(Job& job, int worker, int& chunk)
+{
+  for (int c=1; c<job.NumChunks; c++) {
+    if ((job.Unclaimed & (1ull << c)) && c-1 != worker && Workers[c-1]->State == Busy) {
+      job.Unclaimed &= ~(1ull << c);
+      chunk = c;
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool ToyThreadPool::claimChunk(int worker, Job*& job, int& chunk)
+{
+  for (Job* j=Jobs; j; j=j->Next) {
+    if (worker + 1 < j->NumChunks && (j->Unclaimed & (1ull << (worker + 1)))) {
+      j->Unclaimed &= ~(1ull << (worker + 1));
+      job = j;
+      chunk = worker + 1;
+      return true;
+    }
+  }
+  for (job=Jobs; job; job=job->Next) {
+    if (stealChunk(*job, worker, chunk)) return true;
+  }
+  return false;
+}
+
+//! Runs chunk of job; Mutex is held on entry and on return.
+inline void ToyThreadPool::runChunk(Job& job, int chunk)
+{
+  int lo = job.Begin + chunk*job.Chunk + std::min(chunk, job.Remainder);
+  int hi = lo + job.Chunk + (chunk < job.Remainder ? 1 : 0);
+  std::exception_ptr error;
+  Mutex.unlock();
+  try {
+    job.Call(job.Func, lo, hi);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  Mutex.lock();
+  if (error) {
+    if (!job.Error) job.Error = error;
+    // Nobody will run the chunks that are left.
+    for (int c=0; c<job.NumChunks; c++) {
+      if (job.Unclaimed & (1ull << c)) job.Pending--;
+    }
+    job.Unclaimed = 0;
+  }
+  if (--job.Pending == 0) job.Done.notify_one();
+}
+
+inline void ToyThreadPool::workerLoop(int worker, bool pin)
+{
+  insideWorker() = true;
+#ifdef __linux__
+  if (pin) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET((worker + 1) % std::max(1, (int)std::thread::hardware_concurrency()), &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#else
+  (void)pin;
+#endif
+  Worker& self = *Workers[worker];
+  std::unique_lock<std::mutex> lock(Mutex);
+  bool triedIdleWork = false;
+  for (;;) {
+    Job* job;
+    int chunk;
+    if (claimChunk(worker, job, chunk)) {
+      self.State = Busy;
+      triedIdleWork = false;
+      runChunk(*job, chunk);
+    } else if (!Tasks.empty()) {
+      self.State = Busy;
+      triedIdleWork = false;
+      std::function<void()> task;
+      task.swap(Tasks.front());
+      Tasks.pop_front();
+      lock.unlock();
+      task();
+      lock.lock();
+    } else if (Stopping) {
+      return;
+    } else {
+      if (!IdleWork.empty() && !triedIdleWork) {
+        // A task notified after epoch was read is either seen by a call
+        // or changes IdleEpoch, so no wakeup is lost.
+        self.State = Busy;
+        unsigned long long epoch = IdleEpoch;
+        bool ran = false;
+        for (size_t i=0; i<IdleWork.size() && !ran; i++) {
+          IdleHook hook = IdleWork[i];
+          IdleCalls++;
+          lock.unlock();
+          ran = hook.Func(hook.Context, worker);
+          lock.lock();
+          if (--IdleCalls == 0) IdleDone.notify_all();
+        }
+        if (ran || epoch != IdleEpoch) continue;
+        // Chunks and tasks posted during the calls saw this worker Busy
+        // and did not wake it, so look at them once more before sleeping.
+        triedIdleWork = true;
+        continue;
+      }
+      triedIdleWork = false;
+      self.State = Sleeping;
+      self.WakeUp.wait(lock);
+    }
+  }
+}
+
+template<class F>
+void ToyThreadPool::callChunk(const void* func, int lo, int hi)
+{
+  (*static_cast<const F*>(func))(lo, hi);
+}
+
+//------------------------------------------------------------------------------
+// Calls func(lo, hi) for disjoint chunks covering [begin, end). Chunks are
+// never smaller than minChunk, so small ranges stay on the calling thread.
+// Nothing is allocated: the job lives on this stack frame, and only the
+// workers that own a chunk, or one idle stand-in each for busy owners, are
+// woken.
+//------------------------------------------------------------------------------
+template<class F>
+void ToyThreadPool::parallelFor(int begin, int end, F func, int minChunk /*= 1*/)
+{
+  int count = end - begin;
+  if (count <= 0) return;
+  if (minChunk < 1) minChunk = 1;
+  int numChunks = std::min(std::min(getNumThreads(), TOYPARALLEL_MAX_CHUNKS),
+                           (count + minChunk - 1) / minChunk);
+  if (numChunks <= 1 || isWorkerThread()) {
+    func(begin, end);
+    return;
+  }
+
+  Job job;
+  job.Call = &callChunk<F>;
+  job.Func = &func;
+  job.Begin = begin;
+  job.Chunk = count / numChunks;
+  job.Remainder = count % numChunks;
+  job.NumChunks = numChunks;
+  job.Unclaimed = ((numChunks == 64) ? ~0ull : ((1ull << numChunks) - 1)) & ~1ull;
+  job.Pending = numChunks;
+
+  std::unique_lock<std::mutex> lock(Mutex);
+  job.Next = Jobs;
+  Jobs = &job;
+  for (int c=1; c<numChunks; c++) {
+    if (Workers[c-1]->State == Busy) wakeAny();
+    else wake(c-1);
+  }
+  runChunk(job, 0);
+  // Chunks whose owners are still busy are run here rather than waited for.
+  int chunk;
+  while (stealChunk(job, -1, chunk)) runChunk(job, chunk);
+  while (job.Pending > 0) job.Done.wait(lock);
+  for (Job** j=&Jobs; *j; j=&(*j)->Next) {
+    if (*j == &job) {
+      *j = job.Next;
+      break;
+    }
+  }
+  if (job.Error) {
+    lock.unlock();
+    std::rethrow_exception(job.Error);
+  }
+}
+
+#endif // TOYPARALLEL_H
@@ -0,0 +1,291 @@
+//------------------------------------------------------------------------------
+// Integer powers and the exponential of square matrices.
+//
+// toyPow(A, k) uses binary exponentiation: about 2*log2(k) products
+// instead of k-1. toyExpm(A) is e^A by scaling and squaring with a Padé
+// approximant (Higham, "The scaling and squaring method for the matrix
+// exponential revisited", 2005):
+//
+//   ToyMatrix<double> P100 = toyPow(transitions, 100);
+//   ToyMatrix<float>  X    = toyExpm(generator);
+//
+// Both allocate their working buffers and one ToyGemmWorkspace once and
+// then alternate between them, so the chains of products allocate nothing
+// per step, unlike repeated operator*=: the number of allocations does not
+// depend on k or on the number of squarings. Products run on
+// toyParallelGemm. Zero and diagonal matrices (see ToyStructure) are
+// handled entry by entry.
+//------------------------------------------------------------------------------
+
+#ifndef TOYPOWER_H
+#define TOYPOWER_H
+
+#include <exception.h>
+#include <toykernels.h>
+#include <toylu.h>
+#include <toymatrix.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+//! c = a*b for n x n row-major buffers.
+template<class T>
+void toyPowerMultiply(int n, const T* a, const T* b, T* c, ToyGemmWorkspace<T>& workspace)
+{
+  toyParallelGemm(n, n, n, T(1), a, n, 1, b, n, 1, T(), c, n, 1, workspace);
+}
+
+//! Copies matrix into the n x n row-major buffer entries.
+template<class T>
+void toyPowerCopy(const ToyMatrix<T>& matrix, T* entries)
+{
+  const int n = matrix.getNumRows();
+  const T* source = matrix.getEntries();
+  int rs = matrix.getRowStride(), cs = matrix.getColumnStride();
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<n; j++) entries[i*n + j] = source[i*rs + j*cs];
+  }
+}
+
+template<class T>
+ToyMatrix<T> toyPowerMatrix(int n, const T* entries)
+{
+  ToyMatrix<T> result(n, n, toyUninitialized);
+  std::copy(entries, entries + n*n, result.getEntries());
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// A^k for square A; A^0 is the identity. Three buffers hold the result so
+// far, the current square A^(2^i) and the product being formed.
+//------------------------------------------------------------------------------
+template<class T>
+ToyMatrix<T> toyPow(const ToyMatrix<T>& a, unsigned long long k) throw(ValueRangeExceeded<T>)
+{
+  assert(a.getNumRows() == a.getNumColumns());
+  const int n = a.getNumRows();
+  ToyMatrix<T> identity(n, n);
+  identity.makeIdentity();
+  // An empty matrix leaves nothing to multiply.
+  if (k == 0 || n == 0 || a.hasStructure(ToyStructureIdentity)) return identity;
+  if (k == 1 || a.hasStructure(ToyStructureZero)) return a;
+  if (a.hasStructure(ToyStructureDiagonal)) {
+    ToyMatrix<T> result(n, n);
+    for (int i=0; i<n; i++) {
+      T base = a(i,i), power = T(1);
+      for (unsigned long long e = k; e; e >>= 1) {
+        if (e & 1) power *= base;
+        if (e > 1) base *= base;
+      }
+      result(i,i) = power;
+    }
+    result.setStructure(ToyStructureDiagonal);
+    return result;
+  }
+
+#ifdef ARITHMETIC_EXCEPTIONS
+  // Overflow checks live in ToyMatrix::operator*, not in the raw kernels.
+  ToyMatrix<T> result(identity), base(a);
+  bool started = false;
+  for (; k; k >>= 1) {
+    if (k & 1) {
+      result = started ? result * base : base;
+      started = true;
+    }
+    if (k > 1) base = base * base;
+  }
+  return result;
+#else
+  std::vector<T> buffers((size_t)3*n*n);
+  ToyGemmWorkspace<T> workspace;
+  T* result = &buffers[0];
+  T* base = result + n*n;
+  T* scratch = base + n*n;
+  toyPowerCopy(a, base);
+  bool started = false;
+  for (; k; k >>= 1) {
+    if (k & 1) {
+      if (started) {
+        toyPowerMultiply(n, result, base, scratch, workspace);
+        std::swap(result, scratch);
+      } else {
+        std::copy(base, base + n*n, result);
+        started = true;
+      }
+    }
+    if (k > 1) {
+      toyPowerMultiply(n, base, base, scratch, workspace);
+      std::swap(base, scratch);
+    }
+  }
+  return toyPowerMatrix(n, result);
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Padé degrees m and the largest 1-norm theta_m of the scaled matrix for
+// which the [m/m] approximant is accurate to the unit roundoff of the
+// entries. Single precision never needs more than degree 7.
+//------------------------------------------------------------------------------
+template<class R>
+int toyPadeDegrees(const int*& degrees, const double*& thetas)
+{
+  static const int    singleDegrees[] = { 3, 5, 7 };
+  static const double singleThetas[]  = { 4.258730016922831e-1, 1.880152677804762e0,
+                                          3.925724783138660e0 };
+  static const int    doubleDegrees[] = { 3, 5, 7, 9, 13 };
+  static const double doubleThetas[]  = { 1.495585217958292e-2, 2.539398330063230e-1,
+                                          9.504178996162932e-1, 2.097847961257068e0,
+                                          5.371920351148152e0 };
+  if (sizeof(R) <= sizeof(float)) {
+    degrees = singleDegrees;
+    thetas = singleThetas;
+    return 3;
+  }
+  degrees = doubleDegrees;
+  thetas = doubleThetas;
+  return 5;
+}
+
+//! Coefficients b_0..b_m of the [m/m] Padé approximant of e^x.
+inline const double* toyPadeCoefficients(int m)
+{
+  static const double b3[]  = { 120, 60, 12, 1 };
+  static const double b5[]  = { 30240, 15120, 3360, 420, 30, 1 };
+  static const double b7[]  = { 17297280, 8648640, 1995840, 277200, 25200, 1512, 56, 1 };
+  static const double b9[]  = { 17643225600., 8821612800., 2075673600., 302702400., 30270240.,
+                                2162160., 110880., 3960., 90., 1. };
+  static const double b13[] = { 64764752532480000., 32382376266240000., 7771770303897600.,
+                                1187353796428800., 129060195264000., 10559470521600.,
+                                670442572800., 33522128640., 1323241920., 40840800., 960960.,
+                                16380., 182., 1. };
+  switch (m) {
+  case 3:  return b3;
+  case 5:  return b5;
+  case 7:  return b7;
+  case 9:  return b9;
+  default: return b13;
+  }
+}
+
+//------------------------------------------------------------------------------
+// e^A for square A of floating point or complex entries. A is scaled by
+// 2^-s until its 1-norm is below theta_m, e^(A/2^s) is approximated by
+// r_m = q_m^-1 p_m with p_m = V + U and q_m = V - U (U holds the odd,
+// V the even powers), and the result is squared s times. Throws
+// SingularMatrix if q_m is singular, which does not happen for finite A.
+//------------------------------------------------------------------------------
+template<class T>
+ToyMatrix<T> toyExpm(const ToyMatrix<T>& a) throw(SingularMatrix)
+{
+  typedef decltype(std::abs(T())) R;
+  static_assert(std::is_floating_point<R>::value, "toyExpm needs floating point entries");
+  assert(a.getNumRows() == a.getNumColumns());
+  const int n = a.getNumRows();
+  // An empty matrix is diagonal too, and needs no buffers.
+  if (n == 0 || a.hasStructure(ToyStructureDiagonal)) {
+    ToyMatrix<T> result(n, n);
+    for (int i=0; i<n; i++) result(i,i) = std::exp(a(i,i));
+    result.setStructure(ToyStructureDiagonal);
+    return result;
+  }
+
+  // 1-norm: the largest absolute column sum.
+  R norm = 0;
+  for (int j=0; j<n; j++) {
+    R sum = 0;
+    for (int i=0; i<n; i++) sum += std::abs(a(i,j));
+    norm = std::max(norm, sum);
+  }
+  const int* degrees;
+  const double* thetas;
+  int numDegrees = toyPadeDegrees<R>(degrees, thetas);
+  int m = degrees[numDegrees - 1], squarings = 0;
+  for (int d=0; d<numDegrees; d++) {
+    if (norm <= thetas[d]) {
+      m = degrees[d];
+      break;
+    }
+  }
+  if (norm > thetas[numDegrees - 1]) {
+    squarings = (int)std::ceil(std::log2(norm / thetas[numDegrees - 1]));
+  }
+  const T scale = T(std::ldexp(1.0, -squarings));
+  const double* b = toyPadeCoefficients(m);
+  const size_t nn = (size_t)n*n;
+
+  // Buffers: A, A^2, A^4, A^6 (A^8 for m = 9), the odd and even sums and
+  // the scratch for products; the squaring phase reuses two of them.
+  std::vector<T> buffers(8*nn);
+  ToyGemmWorkspace<T> workspace;
+  T* x = &buffers[0];
+  T* powers[4] = { x + nn, x + 2*nn, x + 3*nn, x + 4*nn };   // A^2, A^4, A^6, A^8
+  T* odd = x + 5*nn;
+  T* even = x + 6*nn;
+  T* scratch = x + 7*nn;
+  toyPowerCopy(a, x);
+  for (size_t i=0; i<nn; i++) x[i] *= scale;
+  toyPowerMultiply(n, x, x, powers[0], workspace);
+  int numPowers = (m == 13) ? 3 : m/2;
+  for (int p=1; p<numPowers; p++) {
+    toyPowerMultiply(n, powers[p-1], powers[0], powers[p], workspace);
+  }
+
+  std::fill(odd, odd + nn, T());
+  std::fill(even, even + nn, T());
+  if (m == 13) {
+    // U = A (A6 (b13 A6 + b11 A4 + b9 A2) + b7 A6 + b5 A4 + b3 A2 + b1 I)
+    // V =    A6 (b12 A6 + b10 A4 + b8 A2) + b6 A6 + b4 A4 + b2 A2 + b0 I
+    for (size_t i=0; i<nn; i++) {
+      scratch[i] = T(b[13])*powers[2][i] + T(b[11])*powers[1][i] + T(b[9])*powers[0][i];
+    }
+    toyPowerMultiply(n, powers[2], scratch, odd, workspace);
+    for (size_t i=0; i<nn; i++) {
+      scratch[i] = T(b[12])*powers[2][i] + T(b[10])*powers[1][i] + T(b[8])*powers[0][i];
+    }
+    toyPowerMultiply(n, powers[2], scratch, even, workspace);
+    for (size_t i=0; i<nn; i++) {
+      odd[i] += T(b[7])*powers[2][i] + T(b[5])*powers[1][i] + T(b[3])*powers[0][i];
+      even[i] += T(b[6])*powers[2][i] + T(b[4])*powers[1][i] + T(b[2])*powers[0][i];
+    }
+  } else {
+    // U = A (b_m A^(m-1) + ... + b3 A2 + b1 I), V = b_(m-1) A^(m-1) + ... + b2 A2 + b0 I
+    for (int p=0; p<numPowers; p++) {
+      T oddCoefficient = T(b[2*p + 3]), evenCoefficient = T(b[2*p + 2]);
+      for (size_t i=0; i<nn; i++) {
+        odd[i] += oddCoefficient*powers[p][i];
+        even[i] += evenCoefficient*powers[p][i];
+      }
+    }
+  }
+  for (int i=0; i<n; i++) {
+    odd[i*n + i] += T(b[1]);
+    even[i*n + i] += T(b[0]);
+  }
+  toyPowerMultiply(n, x, odd, scratch, workspace);   // U
+
+  ToyMatrix<T> p(n, n, toyUninitialized), q(n, n, toyUninitialized);
+  T* pe = p.getEntries();
+  T* qe = q.getEntries();
+  for (size_t i=0; i<nn; i++) {
+    pe[i] = even[i] + scratch[i];
+    qe[i] = even[i] - scratch[i];
+  }
+  ToyLU<T> lu(q);
+  ToyMatrix<T> r = lu.solve(p);
+  if (squarings == 0) return r;
+
+  T* current = odd;
+  T* next = even;
+  toyPowerCopy(r, current);
+  for (int s=0; s<squarings; s++) {
+    toyPowerMultiply(n, current, current, next, workspace);
+    std::swap(current, next);
+  }
+  return toyPowerMatrix(n, current);
+}
+
+#endif // TOYPOWER_H
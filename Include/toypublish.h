@@ -0,0 +1,238 @@
+//------------------------------------------------------------------------------
+// A matrix that one thread updates while others keep reading it, e.g. the
+// gains of a control loop.
+//
+// ToyPublishedMatrix follows the Left-Right scheme: it keeps two copies of
+// the matrix and readers always use the one the writer is not touching.
+// A writer updates the idle copy, switches the readers over to it, waits
+// until no reader is left on the old copy and brings that up to date as
+// well. Reading costs two atomic increments and never waits, so readers
+// are wait-free and always see one complete version of the matrix. Writers
+// are serialised by a mutex and may wait for readers still on the old copy.
+//
+//   ToyPublishedMatrix<float> gains(k);
+//   gains.publish(newGains);                 // control thread
+//   ToyVector<float> u = gains * x;          // any reader thread
+//
+// Keep the functions passed to read() short; a writer cannot finish while
+// a reader holds the copy it wants to update.
+//------------------------------------------------------------------------------
+
+#ifndef TOYPUBLISH_H
+#define TOYPUBLISH_H
+
+#include <toykernels.h>
+#include <toymatrix.h>
+#include <toyvector.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Counters that readers announce themselves on; more slots mean less
+// contention between reader threads, but a longer scan for the writer.
+#ifndef TOYPUBLISH_READ_SLOTS
+#define TOYPUBLISH_READ_SLOTS 16
+#endif
+
+template<class T>
+class ToyPublishedMatrix {
+public:
+  explicit ToyPublishedMatrix(const ToyMatrix<T>& initial = ToyMatrix<T>());
+
+  // Writer side.
+  void publish(const ToyMatrix<T>& matrix);
+  // Calls func on each of the two copies in turn, so it must change them
+  // the same way every time it is called.
+  template<class Func>
+  void modify(Func func);
+
+  // Reader side. func gets the current version as const ToyMatrix<T>&.
+  template<class Func>
+  auto read(Func func) const -> decltype(func(std::declval<const ToyMatrix<T>&>()));
+  ToyMatrix<T> snapshot() const;
+  // Same result as ToyMatrix<T>::operator*(const ToyVector<T>&).
+  ToyVector<T> operator*(const ToyVector<T>& rhs) const;
+  // y = A*x for contiguous x and y, without allocating.
+  void multiply(const T* x, T* y) const;
+
+  // Number of updates published so far.
+  unsigned long long getVersion() const;
+
+private:
+  ToyPublishedMatrix(const ToyPublishedMatrix&);
+  ToyPublishedMatrix& operator=(const ToyPublishedMatrix&);
+
+  struct alignas(64) Slot {
+    std::atomic<int> Readers;
+  };
+
+  // Marks the calling thread as reading for as long as it lives.
+  class ReadGuard {
+  public:
+    explicit ReadGuard(const ToyPublishedMatrix& owner);
+    ~ReadGuard();
+    const ToyMatrix<T>& matrix() const;
+  private:
+    const ToyPublishedMatrix& Owner;
+    Slot& Counter;
+  };
+
+  static int  readSlot();
+  static void assign(ToyMatrix<T>& target, const ToyMatrix<T>& source);
+  // Switches readers to the updated copy and waits until the other copy
+  // is free; returns the index of that copy.
+  int  switchCopies();
+  bool hasReaders(int version) const;
+
+  ToyMatrix<T>              Copies[2];
+  std::atomic<int>          Current;       // copy that readers use
+  std::atomic<int>          ReadVersion;   // counters that new readers use
+  mutable Slot              Counters[2][TOYPUBLISH_READ_SLOTS];
+  std::atomic<unsigned long long> Version;
+  std::mutex                WriteMutex;
+};
+
+template<class T>
+ToyPublishedMatrix<T>::ToyPublishedMatrix(const ToyMatrix<T>& initial /*= ToyMatrix<T>()*/) :
+  Current(0),
+  ReadVersion(0),
+  Version(0)
+{
+  assign(Copies[0], initial);
+  assign(Copies[1], initial);
+  for (int v=0; v<2; v++) {
+    for (int s=0; s<TOYPUBLISH_READ_SLOTS; s++) Counters[v][s].Readers.store(0);
+  }
+}
+
+template<class T>
+int ToyPublishedMatrix<T>::readSlot()
+{
+  static thread_local int slot =
+    (int)(std::hash<std::thread::id>()(std::this_thread::get_id()) % TOYPUBLISH_READ_SLOTS);
+  return slot;
+}
+
+//! Copies entries in place when the shapes agree, so publishing does not allocate.
+template<class T>
+void ToyPublishedMatrix<T>::assign(ToyMatrix<T>& target, const ToyMatrix<T>& source)
+{
+  if (target.getNumRows() == source.getNumRows() &&
+      target.getNumColumns() == source.getNumColumns() &&
+      target.isTransposed() == source.isTransposed() && !target.hasSharedStorage()) {
+    const T* entries = source.getEntries();
+    std::copy(entries, entries + source.getNumRows()*source.getNumColumns(), target.getEntries());
+  } else {
+    target = source;
+    target.setSharedStorage(false);
+  }
+}
+
+template<class T>
+ToyPublishedMatrix<T>::ReadGuard::ReadGuard(const ToyPublishedMatrix& owner) :
+  Owner(owner),
+  Counter(owner.Counters[owner.ReadVersion.load()][readSlot()])
+{
+  Counter.Readers.fetch_add(1);
+}
+
+template<class T>
+inline ToyPublishedMatrix<T>::ReadGuard::~ReadGuard()
+{
+  Counter.Readers.fetch_sub(1);
+}
+
+template<class T>
+inline const ToyMatrix<T>& ToyPublishedMatrix<T>::ReadGuard::matrix() const
+{
+  return Owner.Copies[Owner.Current.load()];
+}
+
+template<class T>
+bool ToyPublishedMatrix<T>::hasReaders(int version) const
+{
+  for (int s=0; s<TOYPUBLISH_READ_SLOTS; s++) {
+    if (Counters[version][s].Readers.load() != 0) return true;
+  }
+  return false;
+}
+
+//------------------------------------------------------------------------------
+// Readers that arrived before the switch of Current may still use the old
+// copy. They are all counted under the old ReadVersion once the new one is
+// empty, so flipping ReadVersion and draining its old counters is enough.
+//------------------------------------------------------------------------------
+template<class T>
+int ToyPublishedMatrix<T>::switchCopies()
+{
+  int old = Current.load();
+  Current.store(1 - old);
+  int version = ReadVersion.load();
+  while (hasReaders(1 - version)) std::this_thread::yield();
+  ReadVersion.store(1 - version);
+  while (hasReaders(version)) std::this_thread::yield();
+  return old;
+}
+
+template<class T>
+void ToyPublishedMatrix<T>::publish(const ToyMatrix<T>& matrix)
+{
+  std::lock_guard<std::mutex> lock(WriteMutex);
+  assign(Copies[1 - Current.load()], matrix);
+  assign(Copies[switchCopies()], matrix);
+  Version.fetch_add(1);
+}
+
+template<class T>
+template<class Func>
+void ToyPublishedMatrix<T>::modify(Func func)
+{
+  std::lock_guard<std::mutex> lock(WriteMutex);
+  func(Copies[1 - Current.load()]);
+  func(Copies[switchCopies()]);
+  Version.fetch_add(1);
+}
+
+template<class T>
+template<class Func>
+auto ToyPublishedMatrix<T>::read(Func func) const -> decltype(func(std::declval<const ToyMatrix<T>&>()))
+{
+  ReadGuard guard(*this);
+  return func(guard.matrix());
+}
+
+template<class T>
+ToyMatrix<T> ToyPublishedMatrix<T>::snapshot() const
+{
+  ReadGuard guard(*this);
+  ToyMatrix<T> copy(guard.matrix());
+  copy.setSharedStorage(false);
+  return copy;
+}
+
+template<class T>
+ToyVector<T> ToyPublishedMatrix<T>::operator*(const ToyVector<T>& rhs) const
+{
+  ReadGuard guard(*this);
+  return guard.matrix() * rhs;
+}
+
+template<class T>
+void ToyPublishedMatrix<T>::multiply(const T* x, T* y) const
+{
+  ReadGuard guard(*this);
+  const ToyMatrix<T>& a = guard.matrix();
+  toyGemv(a.getNumRows(), a.getNumColumns(), T(1), a.getEntries(),
+          a.getRowStride(), a.getColumnStride(), x, T(), y);
+}
+
+template<class T>
+inline unsigned long long ToyPublishedMatrix<T>::getVersion() const
+{
+  return Version.load();
+}
+
+#endif // TOYPUBLISH_H
@@ -0,0 +1,367 @@
+//------------------------------------------------------------------------------
+// Householder QR factorisation, A = QR, and linear least squares.
+//
+// ToyQR is blocked: each panel of TOYQR_BLOCKSIZE columns is factored with
+// plain Householder reflectors, which are then accumulated into the compact
+// WY form Q = I - V*T*V' (T upper triangular). The trailing columns are
+// updated with that block reflector using two toyGemm() calls, split over
+// column chunks of the thread pool.
+//
+// For tall and skinny matrices ToyTSQR factors independent row blocks in
+// parallel, stacks their R factors and factors that stack once more.
+//
+//   ToyVector<float> x = leastSquares(A, b);  // minimises |Ax - b|
+//
+// Both factorisations keep Q implicitly as Householder vectors below the
+// diagonal. Solving with a rank deficient R throws SingularMatrix.
+//------------------------------------------------------------------------------
+
+#ifndef TOYQR_H
+#define TOYQR_H
+
+#include <exception.h>
+#include <toykernels.h>
+#include <toymatrix.h>
+#include <toyparallel.h>
+#include <toyvector.h>
+
+#include <cassert>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#ifndef TOYQR_BLOCKSIZE
+#define TOYQR_BLOCKSIZE 32
+#endif
+// leastSquares() switches to TSQR once a matrix has this many rows
+// per column and per thread.
+#ifndef TOYQR_TSQR_RATIO
+#define TOYQR_TSQR_RATIO 64
+#endif
+
+template<class T>
+class ToyQR {
+public:
+  ToyQR(const ToyMatrix<T>& a, int blockSize = TOYQR_BLOCKSIZE);
+  ToyQR(int rows, int columns, const T* entries, int rowStride, int columnStride,
+        int blockSize = TOYQR_BLOCKSIZE);
+
+  ToyVector<T> solve(const ToyVector<T>& b) const throw(SingularMatrix);
+  ToyMatrix<T> getR() const;
+
+  // Raw interface on row-major arrays with getNumRows() rows.
+  void applyQTranspose(T* x, int numRhs) const;
+  void solveInPlace(T* x) const throw(SingularMatrix);
+
+  int getNumRows() const;
+  int getNumColumns() const;
+
+protected:
+  void factor(const T* entries, int rowStride, int columnStride, int blockSize);
+  void factorPanel(int k0, int kb);
+  void applyBlockReflector(int k0, int kb, const std::vector<T>& v,
+                           const std::vector<T>& t, int lo, int hi);
+
+  int            M, N;
+  std::vector<T> Factors;  // R on and above the diagonal, V below, row-major
+  std::vector<T> Tau;
+};
+
+template<class T>
+ToyQR<T>::ToyQR(const ToyMatrix<T>& a, int blockSize /*= TOYQR_BLOCKSIZE*/) :
+  M(a.getNumRows()),
+  N(a.getNumColumns())
+{
+  factor(a.getEntries(), a.getRowStride(), a.getColumnStride(), blockSize);
+}
+
+template<class T>
+ToyQR<T>::ToyQR(int rows, int columns, const T* entries, int rowStride, int columnStride,
+                int blockSize /*= TOYQR_BLOCKSIZE*/) :
+  M(rows),
+  N(columns)
+{
+  factor(entries, rowStride, columnStride, blockSize);
+}
+
+template<class T>
+void ToyQR<T>::factor(const T* entries, int rowStride, int columnStride, int blockSize)
+{
+  assert(M >= N);
+  if (blockSize < 1) blockSize = 1;
+  Factors.resize(M*N);
+  Tau.assign(N, T());
+  for (int i=0; i<M; i++) {
+    for (int j=0; j<N; j++) Factors[i*N+j] = entries[i*rowStride + j*columnStride];
+  }
+
+  std::vector<T> v, t;
+  for (int k0=0; k0<N; k0+=blockSize) {
+    int kb = std::min(blockSize, N-k0);
+    factorPanel(k0, kb);
+    if (k0+kb >= N) break;
+
+    // Explicit V with its unit diagonal, (M-k0) x kb.
+    int mv = M - k0;
+    v.assign(mv*kb, T());
+    for (int i=0; i<mv; i++) {
+      for (int j=0; j<kb && j<=i; j++) {
+        v[i*kb+j] = (i == j) ? T(1) : Factors[(k0+i)*N + k0+j];
+      }
+    }
+
+    // T such that H(k0)...H(k0+kb-1) = I - V*T*V'.
+    t.assign(kb*kb, T());
+    std::vector<T> z(kb);
+    for (int i=0; i<kb; i++) {
+      for (int r=0; r<i; r++) {
+        z[r] = T();
+        for (int row=i; row<mv; row++) z[r] += v[row*kb+r] * v[row*kb+i];
+      }
+      for (int r=0; r<i; r++) {
+        T sum = T();
+        for (int s=r; s<i; s++) sum += t[r*kb+s] * z[s];
+        t[r*kb+i] = -Tau[k0+i] * sum;
+      }
+      t[i*kb+i] = Tau[k0+i];
+    }
+
+    ToyThreadPool::global().parallelFor(k0+kb, N, [&](int lo, int hi) {
+      applyBlockReflector(k0, kb, v, t, lo, hi);
+    }, 16);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Unblocked Householder QR of the columns [k0, k0+kb). Each reflector is
+// H = I - tau*v*v' with v(0) = 1, chosen so H*x = (beta, 0, ..., 0)'.
+//------------------------------------------------------------------------------
+template<class T>
+void ToyQR<T>::factorPanel(int k0, int kb)
+{
+  T* f = &Factors[0];
+  std::vector<T> w(kb);
+  for (int j=k0; j<k0+kb; j++) {
+    T alpha = f[j*N+j];
+    T sigma = T();
+    for (int i=j+1; i<M; i++) sigma += f[i*N+j] * f[i*N+j];
+    if (sigma == T()) {
+      Tau[j] = T();
+      continue;
+    }
+    T beta = std::sqrt(alpha*alpha + sigma);
+    if (alpha > T()) beta = -beta;
+    Tau[j] = (beta - alpha) / beta;
+    T scale = T(1) / (alpha - beta);
+    for (int i=j+1; i<M; i++) f[i*N+j] *= scale;
+    f[j*N+j] = beta;
+
+    // Apply H to the remaining panel columns, row by row.
+    int end = k0 + kb;
+    for (int c=j+1; c<end; c++) w[c-k0] = f[j*N+c];
+    for (int i=j+1; i<M; i++) {
+      T vi = f[i*N+j];
+      for (int c=j+1; c<end; c++) w[c-k0] += vi * f[i*N+c];
+    }
+    for (int c=j+1; c<end; c++) f[j*N+c] -= Tau[j] * w[c-k0];
+    for (int i=j+1; i<M; i++) {
+      T tv = Tau[j] * f[i*N+j];
+      for (int c=j+1; c<end; c++) f[i*N+c] -= tv * w[c-k0];
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// C = (I - V*T'*V') * C for the trailing columns [lo, hi):
+// W = V'*C, W = T'*W, C = C - V*W.
+//------------------------------------------------------------------------------
+template<class T>
+void ToyQR<T>::applyBlockReflector(int k0, int kb, const std::vector<T>& v,
+                                   const std::vector<T>& t, int lo, int hi)
+{
+  int mv = M - k0, nc = hi - lo;
+  T* c = &Factors[k0*N + lo];
+  std::vector<T> w(kb*nc);
+  toyGemm(kb, nc, mv, T(1), &v[0], 1, kb, c, N, 1, T(), &w[0], nc, 1);
+  for (int r=kb-1; r>=0; r--) {
+    T* wr = &w[r*nc];
+    for (int j=0; j<nc; j++) wr[j] *= t[r*kb+r];
+    for (int s=0; s<r; s++) {
+      T tsr = t[s*kb+r];
+      const T* ws = &w[s*nc];
+      for (int j=0; j<nc; j++) wr[j] += tsr * ws[j];
+    }
+  }
+  toyGemm(mv, nc, kb, T(-1), &v[0], kb, 1, &w[0], nc, 1, T(1), c, N, 1);
+}
+
+template<class T>
+void ToyQR<T>::applyQTranspose(T* x, int numRhs) const
+{
+  const T* f = &Factors[0];
+  std::vector<T> w(numRhs);
+  for (int j=0; j<N; j++) {
+    if (Tau[j] == T()) continue;
+    for (int c=0; c<numRhs; c++) w[c] = x[j*numRhs+c];
+    for (int i=j+1; i<M; i++) {
+      T vi = f[i*N+j];
+      for (int c=0; c<numRhs; c++) w[c] += vi * x[i*numRhs+c];
+    }
+    for (int c=0; c<numRhs; c++) x[j*numRhs+c] -= Tau[j] * w[c];
+    for (int i=j+1; i<M; i++) {
+      T tv = Tau[j] * f[i*N+j];
+      for (int c=0; c<numRhs; c++) x[i*numRhs+c] -= tv * w[c];
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// x has M entries on input; on return its first N entries hold the least
+// squares solution and the others the rotated residual.
+//------------------------------------------------------------------------------
+template<class T>
+void ToyQR<T>::solveInPlace(T* x) const throw(SingularMatrix)
+{
+  applyQTranspose(x, 1);
+  const T* f = &Factors[0];
+  for (int i=N-1; i>=0; i--) {
+    if (f[i*N+i] == T()) throw SingularMatrix();
+    T sum = x[i];
+    for (int j=i+1; j<N; j++) sum -= f[i*N+j] * x[j];
+    x[i] = sum / f[i*N+i];
+  }
+}
+
+template<class T>
+ToyVector<T> ToyQR<T>::solve(const ToyVector<T>& b) const throw(SingularMatrix)
+{
+  assert(b.getNumEntries() == M);
+  std::vector<T> x(b.getEntries(), b.getEntries() + M);
+  solveInPlace(&x[0]);
+  T* result = new T[N];
+  for (int i=0; i<N; i++) result[i] = x[i];
+  return ToyVector<T>(N, result);
+}
+
+template<class T>
+ToyMatrix<T> ToyQR<T>::getR() const
+{
+  T* r = new T[N*N];
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<N; j++) r[i*N+j] = (j >= i) ? Factors[i*N+j] : T();
+  }
+  return ToyMatrix<T>(N, N, r);
+}
+
+template<class T>
+inline int ToyQR<T>::getNumRows() const
+{
+  return M;
+}
+
+template<class T>
+inline int ToyQR<T>::getNumColumns() const
+{
+  return N;
+}
+
+//------------------------------------------------------------------------------
+// Tall-skinny QR: every row block of at least rowBlockSize rows is factored
+// on its own thread, the stacked R factors are factored once more.
+//------------------------------------------------------------------------------
+template<class T>
+class ToyTSQR {
+public:
+  ToyTSQR(const ToyMatrix<T>& a, int rowBlockSize = 0);
+
+  ToyVector<T> solve(const ToyVector<T>& b) const throw(SingularMatrix);
+  ToyMatrix<T> getR() const;
+
+  int getNumBlocks() const;
+
+protected:
+  int M, N, BlockRows;
+  std::vector<std::unique_ptr<ToyQR<T> > > Blocks;
+  std::unique_ptr<ToyQR<T> >               Top;
+};
+
+template<class T>
+ToyTSQR<T>::ToyTSQR(const ToyMatrix<T>& a, int rowBlockSize /*= 0*/) :
+  M(a.getNumRows()),
+  N(a.getNumColumns())
+{
+  assert(M >= N);
+  if (rowBlockSize <= 0) {
+    rowBlockSize = M / ToyThreadPool::global().getNumThreads();
+  }
+  BlockRows = std::max(rowBlockSize, std::max(N, 1));
+  int numBlocks = std::max(1, M / BlockRows);
+  Blocks.resize(numBlocks);
+
+  const T* entries = a.getEntries();
+  int rs = a.getRowStride(), cs = a.getColumnStride();
+  ToyThreadPool::global().parallelFor(0, numBlocks, [&](int lo, int hi) {
+    for (int blk=lo; blk<hi; blk++) {
+      int first = blk*BlockRows;
+      int rows = (blk == numBlocks-1) ? M - first : BlockRows;
+      Blocks[blk].reset(new ToyQR<T>(rows, N, entries + first*rs, rs, cs));
+    }
+  });
+
+  std::vector<T> stacked(numBlocks*N*N, T());
+  for (int blk=0; blk<numBlocks; blk++) {
+    ToyMatrix<T> r = Blocks[blk]->getR();
+    for (int i=0; i<N; i++) {
+      for (int j=i; j<N; j++) stacked[(blk*N+i)*N + j] = r(i,j);
+    }
+  }
+  Top.reset(new ToyQR<T>(numBlocks*N, N, &stacked[0], N, 1));
+}
+
+template<class T>
+ToyVector<T> ToyTSQR<T>::solve(const ToyVector<T>& b) const throw(SingularMatrix)
+{
+  assert(b.getNumEntries() == M);
+  int numBlocks = (int)Blocks.size();
+  std::vector<T> stacked(numBlocks*N);
+  const T* entries = b.getEntries();
+  ToyThreadPool::global().parallelFor(0, numBlocks, [&](int lo, int hi) {
+    for (int blk=lo; blk<hi; blk++) {
+      int first = blk*BlockRows;
+      std::vector<T> x(entries + first, entries + first + Blocks[blk]->getNumRows());
+      Blocks[blk]->applyQTranspose(&x[0], 1);
+      for (int i=0; i<N; i++) stacked[blk*N+i] = x[i];
+    }
+  });
+  Top->solveInPlace(&stacked[0]);
+  T* result = new T[N];
+  for (int i=0; i<N; i++) result[i] = stacked[i];
+  return ToyVector<T>(N, result);
+}
+
+template<class T>
+ToyMatrix<T> ToyTSQR<T>::getR() const
+{
+  return Top->getR();
+}
+
+template<class T>
+inline int ToyTSQR<T>::getNumBlocks() const
+{
+  return (int)Blocks.size();
+}
+
+//------------------------------------------------------------------------------
+// Solves min |Ax - b| for a matrix with at least as many rows as columns.
+//------------------------------------------------------------------------------
+template<class T>
+ToyVector<T> leastSquares(const ToyMatrix<T>& a, const ToyVector<T>& b) throw(SingularMatrix)
+{
+  long long threads = ToyThreadPool::global().getNumThreads();
+  if (threads > 1 && a.getNumRows() >= (long long)TOYQR_TSQR_RATIO * a.getNumColumns() * threads) {
+    return ToyTSQR<T>(a).solve(b);
+  }
+  return ToyQR<T>(a).solve(b);
+}
+
+#endif // TOYQR_H
@@ -0,0 +1,445 @@
+//------------------------------------------------------------------------------
+// Reductions over ToyMatrix entries: sums, norms, trace, minimum, maximum
+// and their positions, for the whole matrix or per row and column.
+//
+// Whole-matrix reductions do not depend on the order of the entries, so they
+// run over the contiguous storage whether the matrix is transposed or not.
+// The storage is cut into blocks of TOYREDUCE_BLOCK entries that the thread
+// pool reduces independently; the block results are then combined in a fixed
+// order, so results do not depend on the number of threads.
+//
+// Sums are formed in ToyAccumulator<T>::Type and either pairwise (the
+// default: error grows with log n, and the leaves use several independent
+// accumulators that the compiler vectorises) or with Kahan compensation.
+//
+// Per-row and per-column results are returned as ToyVector. Lines that are
+// contiguous in storage are reduced one by one; across the storage the
+// kernels accumulate whole rows at a time, so they stay unit-stride for
+// transposed matrices too.
+//------------------------------------------------------------------------------
+
+#ifndef TOYREDUCE_H
+#define TOYREDUCE_H
+
+#include <toykernels.h>
+#include <toymatrix.h>
+#include <toyparallel.h>
+#include <toyvector.h>
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#ifndef TOYREDUCE_BLOCK
+#define TOYREDUCE_BLOCK 4096
+#endif
+// Leaves of the pairwise summation.
+#ifndef TOYREDUCE_PAIRWISE_LEAF
+#define TOYREDUCE_PAIRWISE_LEAF 128
+#endif
+
+enum ToySummation {
+  ToySummationPairwise,
+  ToySummationKahan
+};
+
+// What is summed for each entry.
+template<class T>
+struct ToyReduceValue {
+  typedef typename ToyAccumulator<T>::Type A;
+  A operator()(T x) const { return A(x); }
+};
+
+template<class T>
+struct ToyReduceSquare {
+  typedef typename ToyAccumulator<T>::Type A;
+  A operator()(T x) const { return A(x) * A(x); }
+};
+
+template<class T>
+struct ToyReduceAbs {
+  typedef typename ToyAccumulator<T>::Type A;
+  A operator()(T x) const { return A(x) < A() ? -A(x) : A(x); }
+};
+
+//------------------------------------------------------------------------------
+// Sum of f(x[i]) for the n contiguous entries of x.
+//------------------------------------------------------------------------------
+template<class T, class F>
+typename F::A toyPairwiseSum(const T* x, size_t n, F f)
+{
+  typedef typename F::A A;
+  if (n <= TOYREDUCE_PAIRWISE_LEAF) {
+    const int lanes = 8;
+    A partial[lanes];
+    for (int l=0; l<lanes; l++) partial[l] = A();
+    size_t i = 0;
+    for (; i+lanes<=n; i+=lanes) {
+      for (int l=0; l<lanes; l++) partial[l] += f(x[i+l]);
+    }
+    for (; i<n; i++) partial[i % lanes] += f(x[i]);
+    return ((partial[0] + partial[1]) + (partial[2] + partial[3])) +
+           ((partial[4] + partial[5]) + (partial[6] + partial[7]));
+  }
+  size_t half = n / 2;
+  return toyPairwiseSum(x, half, f) + toyPairwiseSum(x + half, n - half, f);
+}
+
+template<class T, class F>
+typename F::A toyKahanSum(const T* x, size_t n, F f)
+{
+  typedef typename F::A A;
+  A sum = A(), compensation = A();
+  for (size_t i=0; i<n; i++) {
+    A y = f(x[i]) - compensation;
+    A t = sum + y;
+    compensation = (t - sum) - y;
+    sum = t;
+  }
+  return sum;
+}
+
+template<class T, class F>
+typename F::A toySumEntries(const T* x, size_t n, F f, ToySummation summation)
+{
+  return (summation == ToySummationKahan) ? toyKahanSum(x, n, f) : toyPairwiseSum(x, n, f);
+}
+
+//------------------------------------------------------------------------------
+// Sum of f over all count entries, block by block over the thread pool.
+//------------------------------------------------------------------------------
+template<class T, class F>
+typename F::A toyParallelSum(const T* x, size_t count, F f, ToySummation summation)
+{
+  typedef typename F::A A;
+  int numBlocks = (int)((count + TOYREDUCE_BLOCK - 1) / TOYREDUCE_BLOCK);
+  if (numBlocks <= 1) return toySumEntries(x, count, f, summation);
+  std::vector<A> partial(numBlocks);
+  ToyThreadPool::global().parallelFor(0, numBlocks, [&](int lo, int hi) {
+    for (int b=lo; b<hi; b++) {
+      size_t first = (size_t)b * TOYREDUCE_BLOCK;
+      partial[b] = toySumEntries(x + first, std::min((size_t)TOYREDUCE_BLOCK, count - first), f, summation);
+    }
+  }, 4);
+  ToyReduceValue<A> identity;
+  return toySumEntries(&partial[0], partial.size(), identity, summation);
+}
+
+//------------------------------------------------------------------------------
+// Index of the largest (greater) or smallest entry among the count
+// contiguous entries, the first one on ties.
+//------------------------------------------------------------------------------
+template<class T>
+size_t toyExtremeIndex(const T* x, size_t count, bool greater)
+{
+  size_t best = 0;
+  for (size_t i=1; i<count; i++) {
+    if (greater ? (x[best] < x[i]) : (x[i] < x[best])) best = i;
+  }
+  return best;
+}
+
+//! Storage index of the extreme entry; ties go to the first logical index.
+template<class T>
+size_t toyExtremeStorageIndex(const ToyMatrix<T>& m, bool greater)
+{
+  const T* x = m.getEntries();
+  size_t count = (size_t)m.getNumRows() * m.getNumColumns();
+  assert(count > 0);
+  int numBlocks = (int)((count + TOYREDUCE_BLOCK - 1) / TOYREDUCE_BLOCK);
+  // The first match in storage order is the first logical match only if
+  // the matrix is untransposed; otherwise all equal entries are compared.
+  int storageColumns = m.isTransposed() ? m.getNumRows() : m.getNumColumns();
+  int transposed = m.isTransposed() ? 1 : 0;
+  auto logical = [&](size_t s) {
+    size_t r = s / storageColumns, c = s % storageColumns;
+    return transposed ? c * (count / storageColumns) + r : s;
+  };
+  auto better = [&](size_t a, size_t b) {
+    if (greater ? (x[b] < x[a]) : (x[a] < x[b])) return true;
+    if (greater ? (x[a] < x[b]) : (x[b] < x[a])) return false;
+    return logical(a) < logical(b);
+  };
+  std::vector<size_t> partial(numBlocks);
+  ToyThreadPool::global().parallelFor(0, numBlocks, [&](int lo, int hi) {
+    for (int b=lo; b<hi; b++) {
+      size_t first = (size_t)b * TOYREDUCE_BLOCK, last = std::min(count, first + TOYREDUCE_BLOCK);
+      size_t best = first + toyExtremeIndex(x + first, last - first, greater);
+      if (transposed) {
+        for (size_t s=first; s<last; s++) {
+          if (better(s, best)) best = s;
+        }
+      }
+      partial[b] = best;
+    }
+  }, 4);
+  size_t best = partial[0];
+  for (int b=1; b<numBlocks; b++) {
+    if (better(partial[b], best)) best = partial[b];
+  }
+  return best;
+}
+
+//------------------------------------------------------------------------------
+// Whole matrix reductions.
+//------------------------------------------------------------------------------
+template<class T>
+T toySum(const ToyMatrix<T>& m, ToySummation summation = ToySummationPairwise)
+{
+  return T(toyParallelSum(m.getEntries(), (size_t)m.getNumRows()*m.getNumColumns(),
+                          ToyReduceValue<T>(), summation));
+}
+
+template<class T>
+T toyFrobeniusNorm(const ToyMatrix<T>& m, ToySummation summation = ToySummationPairwise)
+{
+  return T(std::sqrt(toyParallelSum(m.getEntries(), (size_t)m.getNumRows()*m.getNumColumns(),
+                                    ToyReduceSquare<T>(), summation)));
+}
+
+template<class T>
+T toyTrace(const ToyMatrix<T>& m)
+{
+  typedef typename ToyAccumulator<T>::Type A;
+  int n = std::min(m.getNumRows(), m.getNumColumns());
+  const T* x = m.getEntries();
+  int step = m.getRowStride() + m.getColumnStride();
+  A sum = A();
+  for (int i=0; i<n; i++) sum += A(x[(size_t)i*step]);
+  return T(sum);
+}
+
+template<class T>
+T toyMax(const ToyMatrix<T>& m)
+{
+  return m.getEntries()[toyExtremeStorageIndex(m, true)];
+}
+
+template<class T>
+T toyMin(const ToyMatrix<T>& m)
+{
+  return m.getEntries()[toyExtremeStorageIndex(m, false)];
+}
+
+//! Returns the largest entry and its position, the first in row-major
+//! order if it occurs several times.
+template<class T>
+T toyArgMax(const ToyMatrix<T>& m, int& row, int& column)
+{
+  size_t s = toyExtremeStorageIndex(m, true);
+  int storageColumns = m.isTransposed() ? m.getNumRows() : m.getNumColumns();
+  row    = (int)(s / storageColumns);
+  column = (int)(s % storageColumns);
+  if (m.isTransposed()) std::swap(row, column);
+  return m.getEntries()[s];
+}
+
+template<class T>
+T toyArgMin(const ToyMatrix<T>& m, int& row, int& column)
+{
+  size_t s = toyExtremeStorageIndex(m, false);
+  int storageColumns = m.isTransposed() ? m.getNumRows() : m.getNumColumns();
+  row    = (int)(s / storageColumns);
+  column = (int)(s % storageColumns);
+  if (m.isTransposed()) std::swap(row, column);
+  return m.getEntries()[s];
+}
+
+//------------------------------------------------------------------------------
+// Line reductions on the storage: one result per storage row (contiguous)
+// or per storage column. Results are written as accumulator values.
+//------------------------------------------------------------------------------
+template<class T, class F>
+void toySumStorageRows(const T* x, int rows, int columns, F f, ToySummation summation,
+                       typename F::A* result)
+{
+  ToyThreadPool::global().parallelFor(0, rows, [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) result[i] = toySumEntries(x + (size_t)i*columns, columns, f, summation);
+  }, std::max(1, TOYREDUCE_BLOCK / std::max(1, columns)));
+}
+
+//! Pairwise over the rows, adding whole rows of columns [lo, hi) into
+//! result[0, hi-lo). scratch holds hi-lo entries per recursion level.
+template<class T, class F>
+void toyPairwiseColumnSums(const T* x, int rows, int columns, int lo, int hi, F f,
+                           typename F::A* result, typename F::A* scratch)
+{
+  typedef typename F::A A;
+  int width = hi - lo;
+  if (rows <= 16) {
+    for (int j=0; j<width; j++) result[j] = A();
+    for (int i=0; i<rows; i++) {
+      const T* xi = x + (size_t)i*columns + lo;
+      for (int j=0; j<width; j++) result[j] += f(xi[j]);
+    }
+    return;
+  }
+  int half = rows / 2;
+  toyPairwiseColumnSums(x, half, columns, lo, hi, f, result, scratch);
+  toyPairwiseColumnSums(x + (size_t)half*columns, rows - half, columns, lo, hi, f,
+                        scratch, scratch + width);
+  for (int j=0; j<width; j++) result[j] += scratch[j];
+}
+
+template<class T, class F>
+void toySumStorageColumns(const T* x, int rows, int columns, F f, ToySummation summation,
+                          typename F::A* result)
+{
+  typedef typename F::A A;
+  ToyThreadPool::global().parallelFor(0, columns, [&](int lo, int hi) {
+    if (summation == ToySummationPairwise) {
+      int levels = 1;
+      for (int r=rows; r>16; r=(r+1)/2) levels++;
+      std::vector<A> scratch((size_t)levels*(hi-lo));
+      toyPairwiseColumnSums(x, rows, columns, lo, hi, f, result + lo, &scratch[0]);
+      return;
+    }
+    std::vector<A> compensation(hi - lo, A());
+    for (int j=lo; j<hi; j++) result[j] = A();
+    for (int i=0; i<rows; i++) {
+      const T* xi = x + (size_t)i*columns;
+      for (int j=lo; j<hi; j++) {
+        A y = f(xi[j]) - compensation[j-lo];
+        A t = result[j] + y;
+        compensation[j-lo] = (t - result[j]) - y;
+        result[j] = t;
+      }
+    }
+  }, std::max(16, TOYREDUCE_BLOCK / std::max(1, rows)));
+}
+
+//! Sums of f along every logical row (rowWise) or column of m.
+template<class T, class F>
+std::vector<typename F::A> toyLineSums(const ToyMatrix<T>& m, bool rowWise, F f, ToySummation summation)
+{
+  int storageRows = m.isTransposed() ? m.getNumColumns() : m.getNumRows();
+  int storageColumns = m.isTransposed() ? m.getNumRows() : m.getNumColumns();
+  // Logical rows are storage rows unless the matrix is transposed.
+  bool contiguous = (rowWise != m.isTransposed());
+  std::vector<typename F::A> sums(contiguous ? storageRows : storageColumns);
+  if (sums.empty()) return sums;
+  if (contiguous) {
+    toySumStorageRows(m.getEntries(), storageRows, storageColumns, f, summation, &sums[0]);
+  } else {
+    toySumStorageColumns(m.getEntries(), storageRows, storageColumns, f, summation, &sums[0]);
+  }
+  return sums;
+}
+
+//! Largest (greater) or smallest entry of every logical row or column, zero
+//! for empty lines.
+template<class T>
+ToyVector<T> toyLineExtremes(const ToyMatrix<T>& m, bool rowWise, bool greater)
+{
+  int storageRows = m.isTransposed() ? m.getNumColumns() : m.getNumRows();
+  int storageColumns = m.isTransposed() ? m.getNumRows() : m.getNumColumns();
+  bool contiguous = (rowWise != m.isTransposed());
+  const T* x = m.getEntries();
+  ToyVector<T> result(contiguous ? storageRows : storageColumns);
+  T* r = result.getEntries();
+  if ((contiguous ? storageColumns : storageRows) == 0) {
+    // Empty lines have no entries to pick from.
+    for (int i=0; i<result.getNumEntries(); i++) r[i] = T();
+    return result;
+  }
+  if (contiguous) {
+    ToyThreadPool::global().parallelFor(0, storageRows, [&](int lo, int hi) {
+      for (int i=lo; i<hi; i++) {
+        const T* xi = x + (size_t)i*storageColumns;
+        r[i] = xi[toyExtremeIndex(xi, storageColumns, greater)];
+      }
+    }, std::max(1, TOYREDUCE_BLOCK / std::max(1, storageColumns)));
+  } else {
+    ToyThreadPool::global().parallelFor(0, storageColumns, [&](int lo, int hi) {
+      for (int j=lo; j<hi; j++) r[j] = x[j];
+      for (int i=1; i<storageRows; i++) {
+        const T* xi = x + (size_t)i*storageColumns;
+        for (int j=lo; j<hi; j++) {
+          if (greater ? (r[j] < xi[j]) : (xi[j] < r[j])) r[j] = xi[j];
+        }
+      }
+    }, std::max(16, TOYREDUCE_BLOCK / std::max(1, storageRows)));
+  }
+  return result;
+}
+
+template<class T, class A>
+ToyVector<T> toyMakeVector(const std::vector<A>& values, bool root)
+{
+  ToyVector<T> result((int)values.size());
+  T* r = result.getEntries();
+  for (size_t i=0; i<values.size(); i++) r[i] = T(root ? std::sqrt(values[i]) : values[i]);
+  return result;
+}
+
+//------------------------------------------------------------------------------
+// Per row and per column reductions.
+//------------------------------------------------------------------------------
+template<class T>
+ToyVector<T> toyRowSums(const ToyMatrix<T>& m, ToySummation summation = ToySummationPairwise)
+{
+  return toyMakeVector<T>(toyLineSums(m, true, ToyReduceValue<T>(), summation), false);
+}
+
+template<class T>
+ToyVector<T> toyColumnSums(const ToyMatrix<T>& m, ToySummation summation = ToySummationPairwise)
+{
+  return toyMakeVector<T>(toyLineSums(m, false, ToyReduceValue<T>(), summation), false);
+}
+
+//! Euclidean norms of the rows.
+template<class T>
+ToyVector<T> toyRowNorms(const ToyMatrix<T>& m, ToySummation summation = ToySummationPairwise)
+{
+  return toyMakeVector<T>(toyLineSums(m, true, ToyReduceSquare<T>(), summation), true);
+}
+
+template<class T>
+ToyVector<T> toyColumnNorms(const ToyMatrix<T>& m, ToySummation summation = ToySummationPairwise)
+{
+  return toyMakeVector<T>(toyLineSums(m, false, ToyReduceSquare<T>(), summation), true);
+}
+
+template<class T>
+ToyVector<T> toyRowMax(const ToyMatrix<T>& m)
+{
+  return toyLineExtremes(m, true, true);
+}
+
+template<class T>
+ToyVector<T> toyColumnMax(const ToyMatrix<T>& m)
+{
+  return toyLineExtremes(m, false, true);
+}
+
+template<class T>
+ToyVector<T> toyRowMin(const ToyMatrix<T>& m)
+{
+  return toyLineExtremes(m, true, false);
+}
+
+template<class T>
+ToyVector<T> toyColumnMin(const ToyMatrix<T>& m)
+{
+  return toyLineExtremes(m, false, false);
+}
+
+//! Maximum absolute column sum.
+template<class T>
+T toyNorm1(const ToyMatrix<T>& m)
+{
+  std::vector<typename ToyAccumulator<T>::Type> sums =
+    toyLineSums(m, false, ToyReduceAbs<T>(), ToySummationPairwise);
+  return sums.empty() ? T() : T(sums[toyExtremeIndex(&sums[0], sums.size(), true)]);
+}
+
+//! Maximum absolute row sum.
+template<class T>
+T toyNormInf(const ToyMatrix<T>& m)
+{
+  std::vector<typename ToyAccumulator<T>::Type> sums =
+    toyLineSums(m, true, ToyReduceAbs<T>(), ToySummationPairwise);
+  return sums.empty() ? T() : T(sums[toyExtremeIndex(&sums[0], sums.size(), true)]);
+}
+
+#endif // TOYREDUCE_H
@@ -0,0 +1,624 @@
+//------------------------------------------------------------------------------
+// Streaming transforms of points, e.g. sensor frames.
+//
+// A ToyStreamPipeline is a chain of stages, each running on its own thread.
+// The source pushes points one at a time; they are collected into chunks of
+// ChunkSize points stored one after the other, and each stage works on a
+// whole chunk at once: a matrix stage is a single gemm per chunk, the other
+// stages are plain loops over contiguous points. Stages are connected by
+// bounded single-producer/single-consumer ring buffers, and all chunks are
+// allocated by start(), so nothing is allocated per point.
+//
+//   ToyStreamPipeline<float> pipeline(3);
+//   pipeline.addTransform(rotation);
+//   pipeline.addNormalize();
+//   pipeline.start([](const float* points, int count, int dimension) { ... });
+//   for (...) pipeline.push(frame);
+//   pipeline.close();
+//
+// When the stages fall behind, the queues and then the pool of free chunks
+// fill up and push() waits: the source is slowed down to the speed of the
+// slowest stage instead of memory growing. tryPush() returns false instead
+// of waiting. Matrix stages compute the plain product A*x, without the
+// initial value that ToyMatrix<T>::operator*(const ToyVector<T>&) adds.
+//
+// The sink is called on the thread of the last stage, or inside push()
+// for a pipeline without stages. If a stage or the sink throws, the
+// remaining points are dropped and close() rethrows the first exception.
+//------------------------------------------------------------------------------
+
+#ifndef TOYSTREAM_H
+#define TOYSTREAM_H
+
+#include <toykernels.h>
+#include <toymatrix.h>
+#include <toyvector.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Times push() and pop() retry before they go to sleep.
+#ifndef TOYSTREAM_SPIN_COUNT
+#define TOYSTREAM_SPIN_COUNT 64
+#endif
+
+//------------------------------------------------------------------------------
+// Bounded queue between exactly one producer and one consumer thread. Each
+// side only writes its own index, padded apart so the two do not share a
+// cache line. push() and pop() wait: they retry TOYSTREAM_SPIN_COUNT times
+// and then sleep until the other side has changed the queue, so an idle
+// pipeline uses no CPU. A lock is only taken to sleep and to wake a
+// sleeping side.
+//------------------------------------------------------------------------------
+template<class E>
+class ToyRingBuffer {
+public:
+  explicit ToyRingBuffer(int capacity);
+
+  bool tryPush(const E& element);   // producer only
+  bool tryPop(E& element);          // consumer only
+  void push(const E& element);      // producer only, waits for a free slot
+  void pop(E& element);             // consumer only, waits for an element
+
+  int  size() const;                // approximate when read concurrently
+  int  getCapacity() const;
+
+private:
+  ToyRingBuffer(const ToyRingBuffer&);
+  ToyRingBuffer& operator=(const ToyRingBuffer&);
+
+  bool pushIndex(const E& element);
+  bool popIndex(E& element);
+  template<class Try>
+  void wait(Try attempt);
+  void wakeWaiter();
+
+  std::vector<E> Elements;
+  int Mask;
+  std::atomic<unsigned> Head;   // next element to pop
+  char Padding[64];
+  std::atomic<unsigned> Tail;   // next free slot
+  char MorePadding[64];
+  std::atomic<int> Sleeping;    // sides asleep in wait()
+  std::mutex Mutex;
+  std::condition_variable Changed;
+};
+
+template<class E>
+ToyRingBuffer<E>::ToyRingBuffer(int capacity) :
+  Head(0),
+  Tail(0),
+  Sleeping(0)
+{
+  assert(capacity > 0);
+  int slots = 1;
+  while (slots < capacity) slots *= 2;
+  Elements.resize(slots);
+  Mask = slots - 1;
+}
+
+template<class E>
+bool ToyRingBuffer<E>::pushIndex(const E& element)
+{
+  unsigned tail = Tail.load(std::memory_order_relaxed);
+  if (tail - Head.load() > (unsigned)Mask) return false;
+  Elements[tail & Mask] = element;
+  Tail.store(tail + 1);
+  return true;
+}
+
+template<class E>
+bool ToyRingBuffer<E>::popIndex(E& element)
+{
+  unsigned head = Head.load(std::memory_order_relaxed);
+  if (head == Tail.load()) return false;
+  element = Elements[head & Mask];
+  Head.store(head + 1);
+  return true;
+}
+
+template<class E>
+bool ToyRingBuffer<E>::tryPush(const E& element)
+{
+  if (!pushIndex(element)) return false;
+  wakeWaiter();
+  return true;
+}
+
+template<class E>
+bool ToyRingBuffer<E>::tryPop(E& element)
+{
+  if (!popIndex(element)) return false;
+  wakeWaiter();
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// The indices and Sleeping are sequentially consistent: either the last
+// attempt of a side going to sleep sees the index update of the other
+// side, or the other side sees the sleeper and notifies it under Mutex,
+// which the sleeper holds until it waits.
+//------------------------------------------------------------------------------
+template<class E>
+inline void ToyRingBuffer<E>::wakeWaiter()
+{
+  if (Sleeping.load() == 0) return;
+  std::lock_guard<std::mutex> lock(Mutex);
+  Changed.notify_all();
+}
+
+//! Retries attempt until it succeeds, then wakes the other side.
+template<class E>
+template<class Try>
+void ToyRingBuffer<E>::wait(Try attempt)
+{
+  bool done = false;
+  for (int spin=0; spin<TOYSTREAM_SPIN_COUNT && !done; spin++) {
+    done = attempt();
+    if (!done) std::this_thread::yield();
+  }
+  if (!done) {
+    std::unique_lock<std::mutex> lock(Mutex);
+    Sleeping++;
+    while (!attempt()) Changed.wait(lock);
+    Sleeping--;
+  }
+  wakeWaiter();
+}
+
+template<class E>
+void ToyRingBuffer<E>::push(const E& element)
+{
+  wait([&]() { return pushIndex(element); });
+}
+
+template<class E>
+void ToyRingBuffer<E>::pop(E& element)
+{
+  wait([&]() { return popIndex(element); });
+}
+
+template<class E>
+inline int ToyRingBuffer<E>::size() const
+{
+  return (int)(Tail.load(std::memory_order_acquire) - Head.load(std::memory_order_acquire));
+}
+
+template<class E>
+inline int ToyRingBuffer<E>::getCapacity() const
+{
+  return Mask + 1;
+}
+
+struct ToyStreamOptions {
+  ToyStreamOptions() : ChunkSize(256), QueueCapacity(4) {}
+
+  int ChunkSize;       // points per chunk
+  int QueueCapacity;   // chunks in flight per stage
+};
+
+// Counters of one stage, or of the source for getSourceMetrics().
+struct ToyStreamMetrics {
+  ToyStreamMetrics() : Points(0), Chunks(0), Seconds(0), Stalls(0), QueueDepth(0), MaxQueueDepth(0) {}
+
+  double pointsPerSecond() const { return Seconds > 0 ? Points / Seconds : 0; }
+
+  long long Points;
+  long long Chunks;
+  double    Seconds;         // time spent working (source: waiting for chunks)
+  long long Stalls;          // times the source had to wait for a free chunk
+  int       QueueDepth;      // chunks waiting in front of the stage now
+                             // (source: chunks handed out and not yet back)
+  int       MaxQueueDepth;
+};
+
+template<class T>
+class ToyStreamPipeline {
+public:
+  typedef std::function<void(T* point, int dimension)>                 PointFunction;
+  typedef std::function<void(const T* points, int count, int dimension)> Sink;
+
+  explicit ToyStreamPipeline(int dimension, const ToyStreamOptions& options = ToyStreamOptions());
+  ~ToyStreamPipeline();
+
+  // Stages; add them before start().
+  void addTransform(const ToyMatrix<T>& matrix);
+  void addNormalize();
+  void addFunction(PointFunction function);
+
+  void start(Sink sink);
+  // Takes getInputDimension() entries.
+  void push(const T* point);
+  void push(const ToyVector<T>& point);
+  bool tryPush(const T* point);
+  // Hands the points collected so far to the stages without waiting for a
+  // full chunk.
+  void flush();
+  // Processes the remaining points and stops the threads.
+  void close();
+
+  int getInputDimension() const;
+  int getOutputDimension() const;
+  int getNumStages() const;
+
+  ToyStreamMetrics getStageMetrics(int stage) const;
+  ToyStreamMetrics getSourceMetrics() const;
+
+private:
+  ToyStreamPipeline(const ToyStreamPipeline&);
+  ToyStreamPipeline& operator=(const ToyStreamPipeline&);
+
+  // Points of a chunk swap between the two buffers whenever a stage cannot
+  // work in place.
+  struct Chunk {
+    std::vector<T> Buffers[2];
+    int Current;
+    int Count;
+  };
+
+  struct Stage {
+    enum Kind { Transform, Normalize, Function };
+
+    Stage(Kind kind, int inDimension, int outDimension) :
+      StageKind(kind), InDimension(inDimension), OutDimension(outDimension),
+      Points(0), Chunks(0), Nanoseconds(0), MaxQueueDepth(0) {}
+
+    Kind          StageKind;
+    int           InDimension, OutDimension;
+    ToyMatrix<T>  Matrix;
+    PointFunction Callback;
+    std::unique_ptr<ToyRingBuffer<Chunk*> > Input;
+    std::thread   Thread;
+
+    std::atomic<long long> Points, Chunks, Nanoseconds;
+    std::atomic<int>       MaxQueueDepth;
+  };
+
+  void addStage(typename Stage::Kind kind, int outDimension);
+  void run(int stage);
+  void process(Stage& stage, Chunk& chunk);
+  void fail();
+  bool acquireChunk(bool wait);
+  void send(Chunk* chunk);
+
+  int Dimension;
+  ToyStreamOptions Options;
+  std::vector<std::unique_ptr<Stage> > Stages;
+  std::vector<std::unique_ptr<Chunk> > Chunks;
+  std::unique_ptr<ToyRingBuffer<Chunk*> > Free;   // last stage -> source
+  Sink Output;
+  Chunk* Filling;
+  bool Running;
+
+  std::atomic<bool> Failed;
+  std::exception_ptr Error;
+  std::atomic<long long> SourcePoints, SourceChunks, SourceNanoseconds, SourceStalls;
+};
+
+template<class T>
+ToyStreamPipeline<T>::ToyStreamPipeline(int dimension, const ToyStreamOptions& options /*= ToyStreamOptions()*/) :
+  Dimension(dimension),
+  Options(options),
+  Filling(0),
+  Running(false),
+  Failed(false),
+  SourcePoints(0),
+  SourceChunks(0),
+  SourceNanoseconds(0),
+  SourceStalls(0)
+{
+  assert(dimension > 0 && options.ChunkSize > 0 && options.QueueCapacity > 0);
+}
+
+template<class T>
+ToyStreamPipeline<T>::~ToyStreamPipeline()
+{
+  if (Running) {
+    try {
+      close();
+    } catch (...) {
+      // Errors are only reported by an explicit close().
+    }
+  }
+}
+
+template<class T>
+void ToyStreamPipeline<T>::addStage(typename Stage::Kind kind, int outDimension)
+{
+  assert(!Running);
+  Stages.push_back(std::unique_ptr<Stage>(
+    new Stage(kind, getOutputDimension(), outDimension)));
+}
+
+template<class T>
+void ToyStreamPipeline<T>::addTransform(const ToyMatrix<T>& matrix)
+{
+  assert(matrix.getNumColumns() == getOutputDimension());
+  addStage(Stage::Transform, matrix.getNumRows());
+  Stages.back()->Matrix = matrix;
+}
+
+template<class T>
+void ToyStreamPipeline<T>::addNormalize()
+{
+  addStage(Stage::Normalize, getOutputDimension());
+}
+
+//! function changes one point of getOutputDimension() entries in place.
+template<class T>
+void ToyStreamPipeline<T>::addFunction(PointFunction function)
+{
+  addStage(Stage::Function, getOutputDimension());
+  Stages.back()->Callback = function;
+}
+
+template<class T>
+inline int ToyStreamPipeline<T>::getInputDimension() const
+{
+  return Dimension;
+}
+
+template<class T>
+inline int ToyStreamPipeline<T>::getOutputDimension() const
+{
+  return Stages.empty() ? Dimension : Stages.back()->OutDimension;
+}
+
+template<class T>
+inline int ToyStreamPipeline<T>::getNumStages() const
+{
+  return (int)Stages.size();
+}
+
+//------------------------------------------------------------------------------
+// The chunks bound the memory of the pipeline: QueueCapacity per stage,
+// one more for each stage to work on and one for the source to fill. Once
+// all of them are in flight, push() waits for the last stage to return
+// one. The queues can hold every chunk, plus the null chunk of close(), so
+// passing a chunk on never waits.
+//------------------------------------------------------------------------------
+template<class T>
+void ToyStreamPipeline<T>::start(Sink sink)
+{
+  assert(!Running);
+  int width = Dimension;
+  for (size_t s=0; s<Stages.size(); s++) width = std::max(width, Stages[s]->OutDimension);
+  int count = (int)Stages.size() * (Options.QueueCapacity + 1) + 1;
+
+  Chunks.clear();
+  Free.reset(new ToyRingBuffer<Chunk*>(count));
+  for (int c=0; c<count; c++) {
+    Chunks.push_back(std::unique_ptr<Chunk>(new Chunk()));
+    Chunk& chunk = *Chunks.back();
+    chunk.Buffers[0].resize((size_t)width*Options.ChunkSize);
+    chunk.Buffers[1].resize((size_t)width*Options.ChunkSize);
+    chunk.Current = 0;
+    chunk.Count = 0;
+    Free->tryPush(&chunk);
+  }
+  for (size_t s=0; s<Stages.size(); s++) {
+    Stages[s]->Input.reset(new ToyRingBuffer<Chunk*>(count + 1));
+    Stages[s]->MaxQueueDepth = 0;
+  }
+  Output = sink;
+  Failed = false;
+  Error = std::exception_ptr();
+  Filling = 0;
+  Running = true;
+  for (size_t s=0; s<Stages.size(); s++) {
+    Stages[s]->Thread = std::thread(&ToyStreamPipeline::run, this, (int)s);
+  }
+}
+
+//! Takes a chunk from the free list into Filling, waiting for one if asked to.
+template<class T>
+bool ToyStreamPipeline<T>::acquireChunk(bool wait)
+{
+  if (Free->tryPop(Filling)) return true;
+  if (!wait) return false;
+  SourceStalls++;
+  std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+  Free->pop(Filling);
+  SourceNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - begin).count();
+  return true;
+}
+
+//! Passes a chunk to the first stage, or straight to the sink without stages.
+template<class T>
+void ToyStreamPipeline<T>::send(Chunk* chunk)
+{
+  SourceChunks++;
+  if (Stages.empty()) {
+    if (!Failed) {
+      try {
+        Output(&chunk->Buffers[chunk->Current][0], chunk->Count, Dimension);
+      } catch (...) {
+        fail();
+      }
+    }
+    chunk->Count = 0;
+    Free->tryPush(chunk);
+    return;
+  }
+  Stages[0]->Input->push(chunk);
+  int depth = Stages[0]->Input->size();
+  if (depth > Stages[0]->MaxQueueDepth) Stages[0]->MaxQueueDepth = depth;
+}
+
+template<class T>
+void ToyStreamPipeline<T>::push(const T* point)
+{
+  assert(Running);
+  if (!Filling) acquireChunk(true);
+  std::copy(point, point + Dimension, &Filling->Buffers[0][(size_t)Filling->Count*Dimension]);
+  Filling->Current = 0;
+  SourcePoints++;
+  if (++Filling->Count == Options.ChunkSize) flush();
+}
+
+template<class T>
+void ToyStreamPipeline<T>::push(const ToyVector<T>& point)
+{
+  assert(point.getNumEntries() == Dimension);
+  push(point.getEntries());
+}
+
+template<class T>
+bool ToyStreamPipeline<T>::tryPush(const T* point)
+{
+  assert(Running);
+  if (!Filling && !acquireChunk(false)) return false;
+  push(point);
+  return true;
+}
+
+template<class T>
+void ToyStreamPipeline<T>::flush()
+{
+  assert(Running);
+  if (!Filling || Filling->Count == 0) return;
+  Chunk* chunk = Filling;
+  Filling = 0;
+  send(chunk);
+}
+
+//! A null chunk tells the stages to finish; it travels behind the last points.
+template<class T>
+void ToyStreamPipeline<T>::close()
+{
+  if (!Running) return;
+  flush();
+  if (Filling) {
+    Free->tryPush(Filling);
+    Filling = 0;
+  }
+  if (!Stages.empty()) {
+    Stages[0]->Input->push(0);
+    for (size_t s=0; s<Stages.size(); s++) Stages[s]->Thread.join();
+  }
+  Running = false;
+  if (Error) {
+    std::exception_ptr error = Error;
+    Error = std::exception_ptr();
+    std::rethrow_exception(error);
+  }
+}
+
+template<class T>
+void ToyStreamPipeline<T>::fail()
+{
+  // The first failure wins; later ones are dropped.
+  bool expected = false;
+  if (Failed.compare_exchange_strong(expected, true)) Error = std::current_exception();
+}
+
+template<class T>
+void ToyStreamPipeline<T>::run(int index)
+{
+  Stage& stage = *Stages[index];
+  bool last = (index + 1 == (int)Stages.size());
+  for (;;) {
+    Chunk* chunk = 0;
+    stage.Input->pop(chunk);
+    if (chunk && !Failed) {
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      try {
+        process(stage, *chunk);
+        if (last) Output(&chunk->Buffers[chunk->Current][0], chunk->Count, stage.OutDimension);
+      } catch (...) {
+        fail();
+      }
+      stage.Nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - begin).count();
+      stage.Points += chunk->Count;
+      stage.Chunks++;
+    }
+    if (!last) {
+      Stage& next = *Stages[index + 1];
+      next.Input->push(chunk);
+      int depth = next.Input->size();
+      if (depth > next.MaxQueueDepth) next.MaxQueueDepth = depth;
+    } else if (chunk) {
+      chunk->Count = 0;
+      Free->tryPush(chunk);
+    }
+    if (!chunk) return;
+  }
+}
+
+//------------------------------------------------------------------------------
+// The chunk holds Count points of InDimension entries, one after the
+// other, i.e. a Count x InDimension row-major matrix X. A transform
+// computes X * A', reading A' through swapped strides.
+//------------------------------------------------------------------------------
+template<class T>
+void ToyStreamPipeline<T>::process(Stage& stage, Chunk& chunk)
+{
+  T* points = &chunk.Buffers[chunk.Current][0];
+  const int count = chunk.Count, dimension = stage.InDimension;
+  switch (stage.StageKind) {
+  case Stage::Transform: {
+    const ToyMatrix<T>& matrix = stage.Matrix;
+    T* result = &chunk.Buffers[1 - chunk.Current][0];
+    toyGemm(count, stage.OutDimension, dimension, T(1), points, dimension, 1,
+            matrix.getEntries(), matrix.getColumnStride(), matrix.getRowStride(),
+            T(), result, stage.OutDimension, 1);
+    chunk.Current = 1 - chunk.Current;
+    break;
+  }
+  case Stage::Normalize:
+    // Points of length zero have no direction and are left alone.
+    for (int p=0; p<count; p++) {
+      T* point = points + (size_t)p*dimension;
+      double sqrsum = 0;
+      for (int i=0; i<dimension; i++) sqrsum += std::norm(point[i]);
+      if (sqrsum == 0) continue;
+      double length = std::sqrt(sqrsum);
+      for (int i=0; i<dimension; i++) point[i] /= length;
+    }
+    break;
+  case Stage::Function:
+    for (int p=0; p<count; p++) stage.Callback(points + (size_t)p*dimension, dimension);
+    break;
+  }
+}
+
+template<class T>
+ToyStreamMetrics ToyStreamPipeline<T>::getStageMetrics(int index) const
+{
+  assert(index >= 0 && index < (int)Stages.size());
+  const Stage& stage = *Stages[index];
+  ToyStreamMetrics metrics;
+  metrics.Points = stage.Points;
+  metrics.Chunks = stage.Chunks;
+  metrics.Seconds = stage.Nanoseconds * 1e-9;
+  metrics.QueueDepth = stage.Input ? stage.Input->size() : 0;
+  metrics.MaxQueueDepth = stage.MaxQueueDepth;
+  return metrics;
+}
+
+template<class T>
+ToyStreamMetrics ToyStreamPipeline<T>::getSourceMetrics() const
+{
+  ToyStreamMetrics metrics;
+  metrics.Points = SourcePoints;
+  metrics.Chunks = SourceChunks;
+  metrics.Seconds = SourceNanoseconds * 1e-9;
+  metrics.Stalls = SourceStalls;
+  metrics.QueueDepth = Free ? (int)Chunks.size() - Free->size() : 0;
+  return metrics;
+}
+
+#endif // TOYSTREAM_H
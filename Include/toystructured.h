@@ -0,0 +1,821 @@
+//------------------------------------------------------------------------------
+// Matrices with structure that ToyMatrix would store as a full dense block:
+//
+//   ToySymmetricMatrix   lower triangle, packed row by row, n(n+1)/2 entries
+//   ToyTriangularMatrix  lower or upper triangle, packed row by row
+//   ToyBandMatrix        kl sub- and ku superdiagonals, kl+ku+1 per row
+//   ToyDiagonalMatrix    the diagonal only
+//
+// Entry (i,j) of a packed lower triangle is at i*(i+1)/2 + j, of a packed
+// upper triangle at i*n - i*(i-1)/2 + (j-i), and of a band at
+// i*(kl+ku+1) + (j-i+kl). operator() reads any entry and returns zero
+// outside the stored part, set() writes stored entries only.
+//
+// The products with a dense ToyMatrix or ToyVector and the solves visit
+// only the stored entries. Unlike ToyMatrix * ToyVector, the products with
+// a vector are the plain product, without the homogeneous 1 added to the
+// last entry.
+//------------------------------------------------------------------------------
+
+#ifndef TOYSTRUCTURED_H
+#define TOYSTRUCTURED_H
+
+#include <exception.h>
+#include <toykernels.h>
+#include <toymatrix.h>
+#include <toyparallel.h>
+#include <toyvector.h>
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// Symmetric matrices.
+//------------------------------------------------------------------------------
+template<class T>
+class ToySymmetricMatrix {
+public:
+  explicit ToySymmetricMatrix(int n = 0);
+  // Takes the lower triangle of matrix, which must be square.
+  explicit ToySymmetricMatrix(const ToyMatrix<T>& matrix);
+
+  int getSize() const;
+  T    operator()(int row, int column) const;
+  void set(int row, int column, const T& value);   // sets (column,row) as well
+
+  // The n(n+1)/2 packed entries of the lower triangle.
+  T*       getEntries();
+  const T* getEntries() const;
+
+  ToyMatrix<T> toMatrix() const;
+  ToyMatrix<T> operator*(const ToyMatrix<T>& rhs) const;
+  ToyVector<T> operator*(const ToyVector<T>& rhs) const;
+
+private:
+  int N;
+  std::vector<T> Packed;
+};
+
+//------------------------------------------------------------------------------
+// Triangular matrices, optionally with an implicit unit diagonal as the L
+// factor of an LU factorisation has.
+//------------------------------------------------------------------------------
+template<class T>
+class ToyTriangularMatrix {
+public:
+  explicit ToyTriangularMatrix(int n = 0, ToyTriangle triangle = ToyLowerTriangle,
+                               bool unitDiagonal = false);
+  // Takes the given triangle of matrix, which must be square.
+  ToyTriangularMatrix(const ToyMatrix<T>& matrix, ToyTriangle triangle,
+                      bool unitDiagonal = false);
+
+  int         getSize() const;
+  ToyTriangle getTriangle() const;
+  bool        hasUnitDiagonal() const;
+  T    operator()(int row, int column) const;
+  void set(int row, int column, const T& value);
+
+  T*       getEntries();
+  const T* getEntries() const;
+
+  ToyMatrix<T> toMatrix() const;
+  ToyMatrix<T> operator*(const ToyMatrix<T>& rhs) const;
+  ToyVector<T> operator*(const ToyVector<T>& rhs) const;
+
+  // Forward or back substitution for A*x = b.
+  ToyVector<T> solve(const ToyVector<T>& b) const throw(SingularMatrix);
+  ToyMatrix<T> solve(const ToyMatrix<T>& b) const throw(SingularMatrix);
+
+private:
+  size_t index(int row, int column) const;
+  bool isStored(int row, int column) const;
+  // Solves in place for the right-hand sides [lo, hi) of the row-major
+  // n x numRhs matrix x.
+  void solveInPlace(T* x, int numRhs, int lo, int hi) const;
+
+  int N;
+  ToyTriangle Triangle;
+  bool UnitDiagonal;
+  std::vector<T> Packed;
+};
+
+//------------------------------------------------------------------------------
+// Band matrices with kl subdiagonals and ku superdiagonals.
+//------------------------------------------------------------------------------
+template<class T>
+class ToyBandMatrix {
+public:
+  ToyBandMatrix(int rows = 0, int columns = 0, int kl = 0, int ku = 0);
+  // Takes the band of matrix; entries outside of it are dropped.
+  ToyBandMatrix(const ToyMatrix<T>& matrix, int kl, int ku);
+
+  int getNumRows() const;
+  int getNumColumns() const;
+  int getNumSubdiagonals() const;
+  int getNumSuperdiagonals() const;
+  T    operator()(int row, int column) const;
+  void set(int row, int column, const T& value);
+
+  // Rows of kl+ku+1 entries, see above. Slots outside the matrix are zero.
+  T*       getEntries();
+  const T* getEntries() const;
+
+  ToyMatrix<T> toMatrix() const;
+  ToyMatrix<T> operator*(const ToyMatrix<T>& rhs) const;
+  ToyVector<T> operator*(const ToyVector<T>& rhs) const;
+
+  // Gaussian elimination inside the band, without pivoting, so for square
+  // matrices that need none, e.g. diagonally dominant or positive definite
+  // ones such as stiffness matrices. Costs O(n*kl*ku) per solve.
+  ToyVector<T> solve(const ToyVector<T>& b) const throw(SingularMatrix);
+  ToyMatrix<T> solve(const ToyMatrix<T>& b) const throw(SingularMatrix);
+
+private:
+  bool isStored(int row, int column) const;
+  int  first(int row) const;    // first stored column of row
+  int  last(int row) const;     // one past the last stored column
+  void solveInPlace(T* x, int numRhs) const throw(SingularMatrix);
+
+  int Rows, Columns, KL, KU, Width;
+  std::vector<T> Band;
+};
+
+//------------------------------------------------------------------------------
+// Diagonal matrices.
+//------------------------------------------------------------------------------
+template<class T>
+class ToyDiagonalMatrix {
+public:
+  explicit ToyDiagonalMatrix(int n = 0, const T& value = T());
+  // Takes the diagonal of matrix, which must be square.
+  explicit ToyDiagonalMatrix(const ToyMatrix<T>& matrix);
+
+  int getSize() const;
+  T    operator()(int row, int column) const;
+  T&   operator[](int i);
+  const T& operator[](int i) const;
+
+  ToyMatrix<T> toMatrix() const;
+  // Scales the rows of rhs.
+  ToyMatrix<T> operator*(const ToyMatrix<T>& rhs) const;
+  ToyVector<T> operator*(const ToyVector<T>& rhs) const;
+
+  ToyVector<T> solve(const ToyVector<T>& b) const throw(SingularMatrix);
+  ToyMatrix<T> solve(const ToyMatrix<T>& b) const throw(SingularMatrix);
+
+private:
+  std::vector<T> Diagonal;
+};
+
+// Scales the columns of lhs.
+template<class T>
+ToyMatrix<T> operator*(const ToyMatrix<T>& lhs, const ToyDiagonalMatrix<T>& rhs);
+
+//------------------------------------------------------------------------------
+// Helpers for the dense operands: rows of a strided matrix, and a row-major
+// copy of the right-hand sides of a solve.
+//------------------------------------------------------------------------------
+template<class T>
+inline void toyAddScaledRow(int n, T alpha, const T* x, int stride, T* y)
+{
+  for (int c=0; c<n; c++) y[c] += alpha * x[c*stride];
+}
+
+template<class T>
+T* toyCopyRowMajor(const ToyMatrix<T>& b)
+{
+  int rows = b.getNumRows(), columns = b.getNumColumns();
+  int rs = b.getRowStride(), cs = b.getColumnStride();
+  const T* src = b.getEntries();
+  T* x = new T[(size_t)rows*columns];
+  for (int i=0; i<rows; i++) {
+    for (int c=0; c<columns; c++) x[(size_t)i*columns + c] = src[i*rs + c*cs];
+  }
+  return x;
+}
+
+template<class T>
+T* toyCopyEntries(const ToyVector<T>& b)
+{
+  int n = b.getNumEntries();
+  T* x = new T[n];
+  std::copy(b.getEntries(), b.getEntries() + n, x);
+  return x;
+}
+
+//------------------------------------------------------------------------------
+// ToySymmetricMatrix
+//------------------------------------------------------------------------------
+template<class T>
+ToySymmetricMatrix<T>::ToySymmetricMatrix(int n /*= 0*/) :
+  N(n),
+  Packed((size_t)n*(n+1)/2, T())
+{
+}
+
+template<class T>
+ToySymmetricMatrix<T>::ToySymmetricMatrix(const ToyMatrix<T>& matrix) :
+  N(matrix.getNumRows()),
+  Packed((size_t)N*(N+1)/2)
+{
+  assert(matrix.getNumRows() == matrix.getNumColumns());
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<=i; j++) Packed[(size_t)i*(i+1)/2 + j] = matrix(i, j);
+  }
+}
+
+template<class T>
+inline int ToySymmetricMatrix<T>::getSize() const
+{
+  return N;
+}
+
+template<class T>
+inline T ToySymmetricMatrix<T>::operator()(int row, int column) const
+{
+  assert(row < N && column < N);
+  if (column > row) std::swap(row, column);
+  return Packed[(size_t)row*(row+1)/2 + column];
+}
+
+template<class T>
+inline void ToySymmetricMatrix<T>::set(int row, int column, const T& value)
+{
+  assert(row < N && column < N);
+  if (column > row) std::swap(row, column);
+  Packed[(size_t)row*(row+1)/2 + column] = value;
+}
+
+template<class T>
+inline T* ToySymmetricMatrix<T>::getEntries()
+{
+  return Packed.empty() ? 0 : &Packed[0];
+}
+
+template<class T>
+inline const T* ToySymmetricMatrix<T>::getEntries() const
+{
+  return Packed.empty() ? 0 : &Packed[0];
+}
+
+template<class T>
+ToyMatrix<T> ToySymmetricMatrix<T>::toMatrix() const
+{
+  ToyMatrix<T> matrix(N, N, toyUninitialized);
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<N; j++) matrix(i, j) = (*this)(i, j);
+  }
+  return matrix;
+}
+
+//! Every stored entry below the diagonal is used for both of its positions.
+template<class T>
+ToyMatrix<T> ToySymmetricMatrix<T>::operator*(const ToyMatrix<T>& rhs) const
+{
+  assert(rhs.getNumRows() == N);
+  int p = rhs.getNumColumns(), rs = rhs.getRowStride(), cs = rhs.getColumnStride();
+  const T* b = rhs.getEntries();
+  ToyMatrix<T> result(N, p);
+  T* c = result.getEntries();
+  for (int i=0; i<N; i++) {
+    const T* ai = &Packed[(size_t)i*(i+1)/2];
+    for (int j=0; j<i; j++) {
+      toyAddScaledRow(p, ai[j], b + j*rs, cs, c + (size_t)i*p);
+      toyAddScaledRow(p, ai[j], b + i*rs, cs, c + (size_t)j*p);
+    }
+    toyAddScaledRow(p, ai[i], b + i*rs, cs, c + (size_t)i*p);
+  }
+  return result;
+}
+
+template<class T>
+ToyVector<T> ToySymmetricMatrix<T>::operator*(const ToyVector<T>& rhs) const
+{
+  assert(rhs.getNumEntries() == N);
+  const T* x = rhs.getEntries();
+  T* y = new T[N];
+  std::fill(y, y + N, T());
+  for (int i=0; i<N; i++) {
+    const T* ai = &Packed[(size_t)i*(i+1)/2];
+    T sum = T();
+    for (int j=0; j<i; j++) {
+      sum += ai[j] * x[j];
+      y[j] += ai[j] * x[i];
+    }
+    y[i] += sum + ai[i] * x[i];
+  }
+  return ToyVector<T>(N, y);
+}
+
+//------------------------------------------------------------------------------
+// ToyTriangularMatrix
+//------------------------------------------------------------------------------
+template<class T>
+ToyTriangularMatrix<T>::ToyTriangularMatrix(int n /*= 0*/,
+                                            ToyTriangle triangle /*= ToyLowerTriangle*/,
+                                            bool unitDiagonal /*= false*/) :
+  N(n),
+  Triangle(triangle),
+  UnitDiagonal(unitDiagonal),
+  Packed((size_t)n*(n+1)/2, T())
+{
+}
+
+template<class T>
+ToyTriangularMatrix<T>::ToyTriangularMatrix(const ToyMatrix<T>& matrix, ToyTriangle triangle,
+                                            bool unitDiagonal /*= false*/) :
+  N(matrix.getNumRows()),
+  Triangle(triangle),
+  UnitDiagonal(unitDiagonal),
+  Packed((size_t)N*(N+1)/2)
+{
+  assert(matrix.getNumRows() == matrix.getNumColumns());
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<N; j++) {
+      if (isStored(i, j)) Packed[index(i, j)] = matrix(i, j);
+    }
+  }
+}
+
+template<class T>
+inline int ToyTriangularMatrix<T>::getSize() const
+{
+  return N;
+}
+
+template<class T>
+inline ToyTriangle ToyTriangularMatrix<T>::getTriangle() const
+{
+  return Triangle;
+}
+
+template<class T>
+inline bool ToyTriangularMatrix<T>::hasUnitDiagonal() const
+{
+  return UnitDiagonal;
+}
+
+template<class T>
+inline size_t ToyTriangularMatrix<T>::index(int row, int column) const
+{
+  if (Triangle == ToyLowerTriangle) return (size_t)row*(row+1)/2 + column;
+  return (size_t)row*N - (size_t)row*(row-1)/2 + (column - row);
+}
+
+template<class T>
+inline bool ToyTriangularMatrix<T>::isStored(int row, int column) const
+{
+  return (Triangle == ToyLowerTriangle) ? (column <= row) : (column >= row);
+}
+
+//! The diagonal reads as one with an implicit unit diagonal.
+template<class T>
+inline T ToyTriangularMatrix<T>::operator()(int row, int column) const
+{
+  assert(row < N && column < N);
+  if (row == column && UnitDiagonal) return T(1);
+  return isStored(row, column) ? Packed[index(row, column)] : T();
+}
+
+template<class T>
+inline void ToyTriangularMatrix<T>::set(int row, int column, const T& value)
+{
+  assert(row < N && column < N && isStored(row, column));
+  Packed[index(row, column)] = value;
+}
+
+template<class T>
+inline T* ToyTriangularMatrix<T>::getEntries()
+{
+  return Packed.empty() ? 0 : &Packed[0];
+}
+
+template<class T>
+inline const T* ToyTriangularMatrix<T>::getEntries() const
+{
+  return Packed.empty() ? 0 : &Packed[0];
+}
+
+template<class T>
+ToyMatrix<T> ToyTriangularMatrix<T>::toMatrix() const
+{
+  ToyMatrix<T> matrix(N, N, toyUninitialized);
+  for (int i=0; i<N; i++) {
+    for (int j=0; j<N; j++) matrix(i, j) = (*this)(i, j);
+  }
+  return matrix;
+}
+
+template<class T>
+ToyMatrix<T> ToyTriangularMatrix<T>::operator*(const ToyMatrix<T>& rhs) const
+{
+  assert(rhs.getNumRows() == N);
+  int p = rhs.getNumColumns(), rs = rhs.getRowStride(), cs = rhs.getColumnStride();
+  const T* b = rhs.getEntries();
+  ToyMatrix<T> result(N, p);
+  T* c = result.getEntries();
+  ToyThreadPool::global().parallelFor(0, N, [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) {
+      int j0 = (Triangle == ToyLowerTriangle) ? 0 : i;
+      int j1 = (Triangle == ToyLowerTriangle) ? i+1 : N;
+      const T* ai = &Packed[index(i, j0)];
+      T* ci = c + (size_t)i*p;
+      for (int j=j0; j<j1; j++) {
+        T aij = (j == i && UnitDiagonal) ? T(1) : ai[j - j0];
+        toyAddScaledRow(p, aij, b + j*rs, cs, ci);
+      }
+    }
+  }, 16);
+  return result;
+}
+
+template<class T>
+ToyVector<T> ToyTriangularMatrix<T>::operator*(const ToyVector<T>& rhs) const
+{
+  assert(rhs.getNumEntries() == N);
+  const T* x = rhs.getEntries();
+  T* y = new T[N];
+  for (int i=0; i<N; i++) {
+    int j0 = (Triangle == ToyLowerTriangle) ? 0 : i;
+    int j1 = (Triangle == ToyLowerTriangle) ? i+1 : N;
+    const T* ai = &Packed[index(i, j0)];
+    T sum = T();
+    for (int j=j0; j<j1; j++) {
+      sum += ((j == i && UnitDiagonal) ? T(1) : ai[j - j0]) * x[j];
+    }
+    y[i] = sum;
+  }
+  return ToyVector<T>(N, y);
+}
+
+template<class T>
+void ToyTriangularMatrix<T>::solveInPlace(T* x, int numRhs, int lo, int hi) const
+{
+  bool lower = (Triangle == ToyLowerTriangle);
+  for (int step=0; step<N; step++) {
+    int i = lower ? step : N-1-step;
+    T* xi = x + (size_t)i*numRhs;
+    int j0 = lower ? 0 : i+1, j1 = lower ? i : N;
+    for (int j=j0; j<j1; j++) {
+      T aij = Packed[index(i, j)];
+      const T* xj = x + (size_t)j*numRhs;
+      for (int c=lo; c<hi; c++) xi[c] -= aij * xj[c];
+    }
+    if (!UnitDiagonal) {
+      T inverse = T(1) / Packed[index(i, i)];
+      for (int c=lo; c<hi; c++) xi[c] *= inverse;
+    }
+  }
+}
+
+template<class T>
+ToyVector<T> ToyTriangularMatrix<T>::solve(const ToyVector<T>& b) const throw(SingularMatrix)
+{
+  assert(b.getNumEntries() == N);
+  for (int i=0; i<N && !UnitDiagonal; i++) {
+    if (Packed[index(i, i)] == T()) throw SingularMatrix();
+  }
+  T* x = toyCopyEntries(b);
+  solveInPlace(x, 1, 0, 1);
+  return ToyVector<T>(N, x);
+}
+
+template<class T>
+ToyMatrix<T> ToyTriangularMatrix<T>::solve(const ToyMatrix<T>& b) const throw(SingularMatrix)
+{
+  assert(b.getNumRows() == N);
+  for (int i=0; i<N && !UnitDiagonal; i++) {
+    if (Packed[index(i, i)] == T()) throw SingularMatrix();
+  }
+  int numRhs = b.getNumColumns();
+  T* x = toyCopyRowMajor(b);
+  ToyThreadPool::global().parallelFor(0, numRhs, [&](int lo, int hi) {
+    solveInPlace(x, numRhs, lo, hi);
+  }, 8);
+  return ToyMatrix<T>(N, numRhs, x);
+}
+
+//------------------------------------------------------------------------------
+// ToyBandMatrix
+//------------------------------------------------------------------------------
+template<class T>
+ToyBandMatrix<T>::ToyBandMatrix(int rows /*= 0*/, int columns /*= 0*/, int kl /*= 0*/,
+                                int ku /*= 0*/) :
+  Rows(rows),
+  Columns(columns),
+  KL(kl),
+  KU(ku),
+  Width(kl+ku+1),
+  Band((size_t)rows*(kl+ku+1), T())
+{
+  assert(kl >= 0 && ku >= 0);
+}
+
+template<class T>
+ToyBandMatrix<T>::ToyBandMatrix(const ToyMatrix<T>& matrix, int kl, int ku) :
+  Rows(matrix.getNumRows()),
+  Columns(matrix.getNumColumns()),
+  KL(kl),
+  KU(ku),
+  Width(kl+ku+1),
+  Band((size_t)Rows*(kl+ku+1), T())
+{
+  assert(kl >= 0 && ku >= 0);
+  for (int i=0; i<Rows; i++) {
+    for (int j=first(i); j<last(i); j++) Band[(size_t)i*Width + (j-i+KL)] = matrix(i, j);
+  }
+}
+
+template<class T>
+inline int ToyBandMatrix<T>::getNumRows() const
+{
+  return Rows;
+}
+
+template<class T>
+inline int ToyBandMatrix<T>::getNumColumns() const
+{
+  return Columns;
+}
+
+template<class T>
+inline int ToyBandMatrix<T>::getNumSubdiagonals() const
+{
+  return KL;
+}
+
+template<class T>
+inline int ToyBandMatrix<T>::getNumSuperdiagonals() const
+{
+  return KU;
+}
+
+template<class T>
+inline bool ToyBandMatrix<T>::isStored(int row, int column) const
+{
+  return column >= row - KL && column <= row + KU;
+}
+
+template<class T>
+inline int ToyBandMatrix<T>::first(int row) const
+{
+  return std::max(0, row - KL);
+}
+
+template<class T>
+inline int ToyBandMatrix<T>::last(int row) const
+{
+  return std::min(Columns, row + KU + 1);
+}
+
+template<class T>
+inline T ToyBandMatrix<T>::operator()(int row, int column) const
+{
+  assert(row < Rows && column < Columns);
+  return isStored(row, column) ? Band[(size_t)row*Width + (column-row+KL)] : T();
+}
+
+template<class T>
+inline void ToyBandMatrix<T>::set(int row, int column, const T& value)
+{
+  assert(row < Rows && column < Columns && isStored(row, column));
+  Band[(size_t)row*Width + (column-row+KL)] = value;
+}
+
+template<class T>
+inline T* ToyBandMatrix<T>::getEntries()
+{
+  return Band.empty() ? 0 : &Band[0];
+}
+
+template<class T>
+inline const T* ToyBandMatrix<T>::getEntries() const
+{
+  return Band.empty() ? 0 : &Band[0];
+}
+
+template<class T>
+ToyMatrix<T> ToyBandMatrix<T>::toMatrix() const
+{
+  ToyMatrix<T> matrix(Rows, Columns);
+  for (int i=0; i<Rows; i++) {
+    for (int j=first(i); j<last(i); j++) matrix(i, j) = Band[(size_t)i*Width + (j-i+KL)];
+  }
+  return matrix;
+}
+
+template<class T>
+ToyMatrix<T> ToyBandMatrix<T>::operator*(const ToyMatrix<T>& rhs) const
+{
+  assert(rhs.getNumRows() == Columns);
+  int p = rhs.getNumColumns(), rs = rhs.getRowStride(), cs = rhs.getColumnStride();
+  const T* b = rhs.getEntries();
+  ToyMatrix<T> result(Rows, p);
+  T* c = result.getEntries();
+  ToyThreadPool::global().parallelFor(0, Rows, [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) {
+      const T* ai = &Band[(size_t)i*Width];
+      for (int j=first(i); j<last(i); j++) {
+        toyAddScaledRow(p, ai[j-i+KL], b + j*rs, cs, c + (size_t)i*p);
+      }
+    }
+  }, 64);
+  return result;
+}
+
+template<class T>
+ToyVector<T> ToyBandMatrix<T>::operator*(const ToyVector<T>& rhs) const
+{
+  assert(rhs.getNumEntries() == Columns);
+  const T* x = rhs.getEntries();
+  T* y = new T[Rows];
+  for (int i=0; i<Rows; i++) {
+    const T* ai = &Band[(size_t)i*Width];
+    T sum = T();
+    for (int j=first(i); j<last(i); j++) sum += ai[j-i+KL] * x[j];
+    y[i] = sum;
+  }
+  return ToyVector<T>(Rows, y);
+}
+
+//------------------------------------------------------------------------------
+// Without pivoting, eliminating column k changes only rows k+1 .. k+kl and
+// columns k .. k+ku, so the elimination works on a copy of the band itself.
+// The right-hand sides (row-major, numRhs columns) are updated alongside.
+//------------------------------------------------------------------------------
+template<class T>
+void ToyBandMatrix<T>::solveInPlace(T* x, int numRhs) const throw(SingularMatrix)
+{
+  std::vector<T> lu(Band);
+  int n = Rows;
+  for (int k=0; k<n; k++) {
+    // Entry (r,j) of the band is at lu[r*Width + j-r+KL].
+    const T* rowK = &lu[(size_t)k*Width + KL];
+    if (rowK[0] == T()) throw SingularMatrix();
+    T inverse = T(1) / rowK[0];
+    int end = last(k);
+    for (int i=k+1; i<std::min(n, k+KL+1); i++) {
+      T* rowI = &lu[(size_t)i*Width + KL];
+      T factor = rowI[k-i] * inverse;
+      for (int j=k+1; j<end; j++) rowI[j-i] -= factor * rowK[j-k];
+      toyAxpy(numRhs, -factor, x + (size_t)k*numRhs, x + (size_t)i*numRhs);
+    }
+  }
+  for (int i=n-1; i>=0; i--) {
+    const T* rowI = &lu[(size_t)i*Width + KL];
+    T* xi = x + (size_t)i*numRhs;
+    for (int j=i+1; j<last(i); j++) toyAxpy(numRhs, -rowI[j-i], x + (size_t)j*numRhs, xi);
+    T inverse = T(1) / rowI[0];
+    for (int c=0; c<numRhs; c++) xi[c] *= inverse;
+  }
+}
+
+template<class T>
+ToyVector<T> ToyBandMatrix<T>::solve(const ToyVector<T>& b) const throw(SingularMatrix)
+{
+  assert(Rows == Columns && b.getNumEntries() == Rows);
+  T* x = toyCopyEntries(b);
+  try {
+    solveInPlace(x, 1);
+  } catch (...) {
+    delete[] x;
+    throw;
+  }
+  return ToyVector<T>(Rows, x);
+}
+
+template<class T>
+ToyMatrix<T> ToyBandMatrix<T>::solve(const ToyMatrix<T>& b) const throw(SingularMatrix)
+{
+  assert(Rows == Columns && b.getNumRows() == Rows);
+  T* x = toyCopyRowMajor(b);
+  try {
+    solveInPlace(x, b.getNumColumns());
+  } catch (...) {
+    delete[] x;
+    throw;
+  }
+  return ToyMatrix<T>(Rows, b.getNumColumns(), x);
+}
+
+//------------------------------------------------------------------------------
+// ToyDiagonalMatrix
+//------------------------------------------------------------------------------
+template<class T>
+ToyDiagonalMatrix<T>::ToyDiagonalMatrix(int n /*= 0*/, const T& value /*= T()*/) :
+  Diagonal(n, value)
+{
+}
+
+template<class T>
+ToyDiagonalMatrix<T>::ToyDiagonalMatrix(const ToyMatrix<T>& matrix) :
+  Diagonal(matrix.getNumRows())
+{
+  assert(matrix.getNumRows() == matrix.getNumColumns());
+  for (int i=0; i<(int)Diagonal.size(); i++) Diagonal[i] = matrix(i, i);
+}
+
+template<class T>
+inline int ToyDiagonalMatrix<T>::getSize() const
+{
+  return (int)Diagonal.size();
+}
+
+template<class T>
+inline T ToyDiagonalMatrix<T>::operator()(int row, int column) const
+{
+  assert(row < getSize() && column < getSize());
+  return (row == column) ? Diagonal[row] : T();
+}
+
+template<class T>
+inline T& ToyDiagonalMatrix<T>::operator[](int i)
+{
+  return Diagonal[i];
+}
+
+template<class T>
+inline const T& ToyDiagonalMatrix<T>::operator[](int i) const
+{
+  return Diagonal[i];
+}
+
+template<class T>
+ToyMatrix<T> ToyDiagonalMatrix<T>::toMatrix() const
+{
+  int n = getSize();
+  ToyMatrix<T> matrix(n, n);
+  for (int i=0; i<n; i++) matrix(i, i) = Diagonal[i];
+  return matrix;
+}
+
+template<class T>
+ToyMatrix<T> ToyDiagonalMatrix<T>::operator*(const ToyMatrix<T>& rhs) const
+{
+  assert(rhs.getNumRows() == getSize());
+  int n = getSize(), p = rhs.getNumColumns();
+  int rs = rhs.getRowStride(), cs = rhs.getColumnStride();
+  const T* b = rhs.getEntries();
+  ToyMatrix<T> result(n, p, toyUninitialized);
+  T* c = result.getEntries();
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<p; j++) c[(size_t)i*p + j] = Diagonal[i] * b[i*rs + j*cs];
+  }
+  return result;
+}
+
+template<class T>
+ToyVector<T> ToyDiagonalMatrix<T>::operator*(const ToyVector<T>& rhs) const
+{
+  assert(rhs.getNumEntries() == getSize());
+  int n = getSize();
+  const T* x = rhs.getEntries();
+  T* y = new T[n];
+  for (int i=0; i<n; i++) y[i] = Diagonal[i] * x[i];
+  return ToyVector<T>(n, y);
+}
+
+template<class T>
+ToyMatrix<T> operator*(const ToyMatrix<T>& lhs, const ToyDiagonalMatrix<T>& rhs)
+{
+  assert(lhs.getNumColumns() == rhs.getSize());
+  int m = lhs.getNumRows(), n = rhs.getSize();
+  int rs = lhs.getRowStride(), cs = lhs.getColumnStride();
+  const T* a = lhs.getEntries();
+  ToyMatrix<T> result(m, n, toyUninitialized);
+  T* c = result.getEntries();
+  for (int i=0; i<m; i++) {
+    for (int j=0; j<n; j++) c[(size_t)i*n + j] = a[i*rs + j*cs] * rhs[j];
+  }
+  return result;
+}
+
+template<class T>
+ToyVector<T> ToyDiagonalMatrix<T>::solve(const ToyVector<T>& b) const throw(SingularMatrix)
+{
+  assert(b.getNumEntries() == getSize());
+  int n = getSize();
+  for (int i=0; i<n; i++) {
+    if (Diagonal[i] == T()) throw SingularMatrix();
+  }
+  const T* src = b.getEntries();
+  T* x = new T[n];
+  for (int i=0; i<n; i++) x[i] = src[i] / Diagonal[i];
+  return ToyVector<T>(n, x);
+}
+
+template<class T>
+ToyMatrix<T> ToyDiagonalMatrix<T>::solve(const ToyMatrix<T>& b) const throw(SingularMatrix)
+{
+  assert(b.getNumRows() == getSize());
+  int n = getSize();
+  for (int i=0; i<n; i++) {
+    if (Diagonal[i] == T()) throw SingularMatrix();
+  }
+  ToyDiagonalMatrix<T> inverse(n);
+  for (int i=0; i<n; i++) inverse[i] = T(1) / Diagonal[i];
+  return inverse * b;
+}
+
+#endif // TOYSTRUCTURED_H
@@ -0,0 +1,334 @@
+//------------------------------------------------------------------------------
+// Self-tuning of the kernel parameters in ToyKernelConfig.
+//
+// toyTune() times the gemm and syrk kernels for a few candidate block
+// sizes, recursion grains and parallel thresholds, installs the fastest
+// configuration and returns it. toySaveTuning() writes a configuration to a
+// small key=value file, toyLoadTuning() installs it again:
+//
+//   if (!toyLoadTuning(toyTuningCachePath())) {
+//     toyTune();
+//     toySaveTuning(toyTuningCachePath());
+//   }
+//
+// Each file records the host, the processor model and the number of
+// hardware threads it was measured on. Files from another machine, older
+// versions of this format or with missing entries count as stale and
+// leave the configuration alone, so the compiled-in defaults stay in
+// effect.
+//
+// The first read of toyKernelConfig() in a process does the above: it loads
+// the cache, and with TOYMATRIX_AUTOTUNE=1 in the environment a missing or
+// stale cache is tuned and written by the first product instead. Other
+// threads must not start products while that first one is tuning.
+// TOYMATRIX_TUNING_CACHE overrides the cache location, which defaults to
+// $HOME/.cache/toymatrix/tuning-<host>.
+//
+// toyTune() and toyLoadTuning() replace the configuration the kernels read
+// without synchronisation, so no kernel may be running on any thread while
+// they are called. Cache entries above TOYTUNE_MAX_BLOCK (block sizes) or
+// TOYTUNE_MAX_WORK (thresholds) make the file count as corrupt.
+//------------------------------------------------------------------------------
+
+#ifndef TOYTUNE_H
+#define TOYTUNE_H
+
+#include <toykernels.h>
+#include <toyparallel.h>
+#include <toyworksteal.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __unix__
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define TOYTUNE_FORMAT_VERSION 1
+
+// Largest values a tuning file may contain.
+#define TOYTUNE_MAX_BLOCK 4096
+#define TOYTUNE_MAX_WORK  (1ll << 40)
+
+// toykernels.h includes this header at its end, so toyworksteal.h may not
+// have been read yet.
+template<class T>
+void toyRecursiveGemm(int m, int n, int k, T alpha,
+                      const T* a, int rsa, int csa,
+                      const T* b, int rsb, int csb,
+                      T beta, T* c, int rsc, int csc);
+
+struct ToyTuneOptions {
+  ToyTuneOptions() : Size(192), Repetitions(3) {}
+
+  int Size;           // matrix size used to rank block sizes
+  int Repetitions;    // best of this many runs is taken
+};
+
+inline std::string toyTuningHost()
+{
+#ifdef __unix__
+  char name[256] = {0};
+  if (gethostname(name, sizeof(name) - 1) == 0 && name[0]) return name;
+#endif
+  return "unknown";
+}
+
+inline std::string toyTuningProcessor()
+{
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      size_t colon = line.find(':');
+      if (colon != std::string::npos) {
+        size_t begin = line.find_first_not_of(" \t", colon + 1);
+        return (begin == std::string::npos) ? std::string() : line.substr(begin);
+      }
+    }
+  }
+  return "unknown";
+}
+
+//! Identifies the machine a tuning file is valid for.
+inline std::string toyTuningSignature()
+{
+  std::ostringstream out;
+  out << TOYTUNE_FORMAT_VERSION << "|" << toyTuningHost() << "|" << toyTuningProcessor()
+      << "|" << std::thread::hardware_concurrency();
+  return out.str();
+}
+
+inline std::string toyTuningCachePath()
+{
+  const char* path = std::getenv("TOYMATRIX_TUNING_CACHE");
+  if (path && path[0]) return path;
+  const char* home = std::getenv("HOME");
+  std::string directory = (home && home[0]) ? std::string(home) + "/.cache/toymatrix" : ".";
+  return directory + "/tuning-" + toyTuningHost();
+}
+
+//! Writes config to path, creating the parent directory if needed.
+inline bool toySaveTuning(const std::string& path, const ToyKernelConfig& config = toyKernelConfig())
+{
+#ifdef __unix__
+  // Creates the missing directories of the path; existing ones are fine.
+  for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+    mkdir(path.substr(0, slash).c_str(), 0755);
+  }
+#endif
+  std::ofstream out(path.c_str());
+  if (!out) return false;
+  out << "# ToyMatrix kernel tuning\n"
+      << "signature=" << toyTuningSignature() << "\n"
+      << "GemmKC=" << config.GemmKC << "\n"
+      << "GemmNC=" << config.GemmNC << "\n"
+      << "ParallelThreshold=" << config.ParallelThreshold << "\n"
+      << "RecursiveGrain=" << config.RecursiveGrain << "\n"
+      << "SyrkBlock=" << config.SyrkBlock << "\n";
+  return (bool)out;
+}
+
+//------------------------------------------------------------------------------
+// Reads the configuration stored at path into config. Returns false and
+// leaves config alone if the file is missing, incomplete, out of range or
+// was written on another machine.
+//------------------------------------------------------------------------------
+inline bool toyReadTuning(const std::string& path, ToyKernelConfig& result)
+{
+  std::ifstream in(path.c_str());
+  if (!in) return false;
+
+  ToyKernelConfig config = toyDefaultKernelConfig();
+  bool current = false;
+  // One flag per key, so a repeated line cannot stand in for a missing one.
+  bool found[5] = { false, false, false, false, false };
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#') continue;
+    size_t equals = line.find('=');
+    if (equals == std::string::npos) return false;
+    std::string key = line.substr(0, equals), value = line.substr(equals + 1);
+    if (key == "signature") {
+      current = (value == toyTuningSignature());
+      continue;
+    }
+    char* end = 0;
+    long long number = std::strtoll(value.c_str(), &end, 10);
+    if (end == value.c_str() || *end != '\0' || number <= 0 || number > TOYTUNE_MAX_WORK) return false;
+    bool block = (key == "GemmKC" || key == "GemmNC" || key == "SyrkBlock");
+    if (block && number > TOYTUNE_MAX_BLOCK) return false;
+    if      (key == "GemmKC")            { config.GemmKC = (int)number;        found[0] = true; }
+    else if (key == "GemmNC")            { config.GemmNC = (int)number;        found[1] = true; }
+    else if (key == "ParallelThreshold") { config.ParallelThreshold = number;  found[2] = true; }
+    else if (key == "RecursiveGrain")    { config.RecursiveGrain = number;     found[3] = true; }
+    else if (key == "SyrkBlock")         { config.SyrkBlock = (int)number;     found[4] = true; }
+  }
+  if (!current) return false;
+  for (int i=0; i<5; i++) {
+    if (!found[i]) return false;
+  }
+  result = config;
+  return true;
+}
+
+//! Installs the configuration stored at path, see toyReadTuning().
+inline bool toyLoadTuning(const std::string& path)
+{
+  ToyKernelConfig config;
+  if (!toyReadTuning(path, config)) return false;
+  toySetKernelConfig(config);
+  return true;
+}
+
+//! Best wall time of repetitions calls of func, in seconds.
+template<class Func>
+double toyTuneTime(int repetitions, Func func)
+{
+  double best = 0;
+  for (int r=0; r<repetitions; r++) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    func();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (r == 0 || elapsed < best) best = elapsed;
+  }
+  return best;
+}
+
+//------------------------------------------------------------------------------
+// Measures every parameter in turn, keeping the winners of earlier steps
+// fixed: first the gemm blocking, then the size from which the parallel
+// gemm beats the serial one, the grain of the recursive gemm and the tile
+// size of syrk. The result is installed and returned.
+//------------------------------------------------------------------------------
+inline ToyKernelConfig toyTune(const ToyTuneOptions& options = ToyTuneOptions())
+{
+  const int n = std::max(16, options.Size), reps = std::max(1, options.Repetitions);
+  std::vector<double> a((size_t)n*n), b((size_t)n*n), c((size_t)n*n);
+  for (size_t i=0; i<a.size(); i++) {
+    a[i] = (double)(i % 17) - 8;
+    b[i] = (double)(i % 13) * 0.5;
+  }
+  ToyKernelConfig config = toyDefaultKernelConfig();
+  ToyKernelConfig best = config;
+
+  // Block sizes of the serial gemm.
+  static const int kcs[] = {64, 128, 256, 384};
+  static const int ncs[] = {32, 64, 128, 256};
+  double bestTime = -1;
+  for (int kc : kcs) {
+    for (int nc : ncs) {
+      config.GemmKC = kc;
+      config.GemmNC = nc;
+      toySetKernelConfig(config);
+      double time = toyTuneTime(reps, [&]() {
+        toyGemm(n, n, n, 1.0, &a[0], n, 1, &b[0], n, 1, 0.0, &c[0], n, 1);
+      });
+      if (bestTime < 0 || time < bestTime) {
+        bestTime = time;
+        best.GemmKC = kc;
+        best.GemmNC = nc;
+      }
+    }
+  }
+  config = best;
+
+  // Smallest size from which the parallel gemm wins for good: the sizes
+  // are measured from the largest down, and the first loss ends the search,
+  // so one lucky sample at a small size cannot lower the threshold.
+  config.ParallelThreshold = (long long)n*n*n;
+  if (ToyThreadPool::global().getNumThreads() > 1) {
+    static const int sizes[] = {16, 24, 32, 48, 64, 96, 128, 192};
+    long long threshold = config.ParallelThreshold;
+    config.ParallelThreshold = 0;
+    toySetKernelConfig(config);
+    for (int i=(int)(sizeof(sizes)/sizeof(sizes[0]))-1; i>=0; i--) {
+      int s = sizes[i];
+      if (s > n) continue;
+      double parallel = toyTuneTime(reps, [&]() {
+        toyParallelGemm(s, s, s, 1.0, &a[0], n, 1, &b[0], n, 1, 0.0, &c[0], n, 1);
+      });
+      double serial = toyTuneTime(reps, [&]() {
+        toyGemm(s, s, s, 1.0, &a[0], n, 1, &b[0], n, 1, 0.0, &c[0], n, 1);
+      });
+      if (parallel >= serial) break;
+      threshold = (long long)s*s*s;
+    }
+    config.ParallelThreshold = threshold;
+  }
+
+  // Leaf size of the recursive gemm.
+  static const int grains[] = {16, 32, 48, 64, 96};
+  bestTime = -1;
+  ToyKernelConfig trial = config;
+  for (int g : grains) {
+    trial.RecursiveGrain = (long long)g*g*g;
+    toySetKernelConfig(trial);
+    double time = toyTuneTime(reps, [&]() {
+      toyRecursiveGemm(n, n, n, 1.0, &a[0], n, 1, &b[0], n, 1, 0.0, &c[0], n, 1);
+    });
+    if (bestTime < 0 || time < bestTime) {
+      bestTime = time;
+      config.RecursiveGrain = trial.RecursiveGrain;
+    }
+  }
+
+  // Tile size of syrk.
+  static const int blocks[] = {32, 48, 64, 96, 128};
+  bestTime = -1;
+  trial = config;
+  for (int nb : blocks) {
+    trial.SyrkBlock = nb;
+    toySetKernelConfig(trial);
+    double time = toyTuneTime(reps, [&]() {
+      toySyrk(n, n, 1.0, &a[0], n, 1, 0.0, &c[0], n, 1, ToyLowerTriangle);
+    });
+    if (bestTime < 0 || time < bestTime) {
+      bestTime = time;
+      config.SyrkBlock = nb;
+    }
+  }
+
+  toySetKernelConfig(config);
+  return config;
+}
+
+//------------------------------------------------------------------------------
+// Startup: toyKernelConfigSetting() initialises the configuration with
+// toyStartupKernelConfig(), which reads the cache. Tuning cannot happen
+// there, since the kernels it times read the configuration themselves, so
+// a missing cache only marks the tuning as pending; the next
+// toyKernelConfig() call runs toyStartupTuning(), and the kernels it times
+// find nothing pending any more.
+//------------------------------------------------------------------------------
+inline std::atomic<bool>& toyStartupTuningPending()
+{
+  static std::atomic<bool> pending(false);
+  return pending;
+}
+
+inline ToyKernelConfig toyStartupKernelConfig()
+{
+  ToyKernelConfig config = toyDefaultKernelConfig();
+  if (toyReadTuning(toyTuningCachePath(), config)) return config;
+  const char* autotune = std::getenv("TOYMATRIX_AUTOTUNE");
+  if (autotune && std::string(autotune) == "1") toyStartupTuningPending() = true;
+  return config;
+}
+
+inline void toyStartupTuning()
+{
+  bool pending = true;
+  if (!toyStartupTuningPending().compare_exchange_strong(pending, false)) return;
+  toyTune();
+  toySaveTuning(toyTuningCachePath());
+}
+
+#endif // TOYTUNE_H
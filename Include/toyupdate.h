@@ -0,0 +1,44 @@
+//------------------------------------------------------------------------------
+// In-place rank updates of a ToyMatrix, e.g. for covariance and Gram
+// matrices:
+//
+//   rankOneUpdate(A, alpha, x, y)   A += alpha*x*y'     (outer product, GER)
+//   rankKUpdate(C, alpha, A)        C += alpha*A*A'     (one triangle, SYRK)
+//
+// Both write straight into the existing entries through the kernels of
+// toykernels.h and create no temporary matrices. Transposed operands are
+// handled through their strides.
+//------------------------------------------------------------------------------
+
+#ifndef TOYUPDATE_H
+#define TOYUPDATE_H
+
+#include <toykernels.h>
+#include <toymatrix.h>
+#include <toyvector.h>
+
+#include <cassert>
+
+template<class T>
+void rankOneUpdate(ToyMatrix<T>& a, T alpha, const ToyVector<T>& x, const ToyVector<T>& y)
+{
+  assert(a.getNumRows() == x.getNumEntries() && a.getNumColumns() == y.getNumEntries());
+  toyGer(a.getNumRows(), a.getNumColumns(), alpha, x.getEntries(), y.getEntries(),
+         a.getEntries(), a.getRowStride(), a.getColumnStride());
+}
+
+//! C = alpha*A*A' + beta*C for an n x k matrix A and an n x n matrix C.
+//! Only the given triangle of C is read and written. C must not share its
+//! entries with A.
+template<class T>
+void rankKUpdate(ToyMatrix<T>& c, T alpha, const ToyMatrix<T>& a, T beta = T(1),
+                 ToyTriangle triangle = ToyLowerTriangle)
+{
+  assert(c.getNumRows() == c.getNumColumns() && c.getNumRows() == a.getNumRows());
+  assert(c.getEntries() != a.getEntries());
+  toySyrk(a.getNumRows(), a.getNumColumns(), alpha, a.getEntries(), a.getRowStride(),
+          a.getColumnStride(), beta, c.getEntries(), c.getRowStride(), c.getColumnStride(),
+          triangle);
+}
+
+#endif // TOYUPDATE_H
@@ -7,6 +7,7 @@
 #include <cstring>
 #define _USE_MATH_DEFINES
 #include <cmath>
+#include <complex>
 #include <cassert>
 #include <iostream>
 using namespace std;
@@ -16,6 +17,12 @@ template<class T> class ToyVector;
 template<class T> ToyVector<T> operator*(const ToyVector<T>& lhs, T rhs) throw(ValueRangeExceeded<T>);
 template<class T> ToyVector<T> operator*(T lhs, const ToyVector<T>& rhs) throw(ValueRangeExceeded<T>);
 
+// Vectors with up to this many entries keep them inside the object
+// instead of on the heap.
+#ifndef TOYVECTOR_INLINE_CAPACITY
+#define TOYVECTOR_INLINE_CAPACITY 4
+#endif
+
 /*
 // Elements are stored in _row-major_ order.
 //
@@ -29,19 +36,24 @@ template<class T> ToyVector<T> operator*(T lhs, const ToyVector<T>& rhs) throw(V
 // transposing the vector, such that these members
 // can always be directly accessed w/o the need to
 // check the transposed state.
+//
+// Entries points either to the inline buffer (up to
+// TOYVECTOR_INLINE_CAPACITY entries) or to the heap,
+// so small vectors never touch the allocator.
 */
 
 template<class T>
 class ToyVector {
-  friend class ToyMatrix<float>;
-  friend class ToyMatrix<int>;
+  template<class U> friend class ToyMatrix;
 
 public:
   ToyVector(int rows = 4, T *entries = 0x0);
   ToyVector(const ToyVector& other);
+  ToyVector(ToyVector&& other);
   ~ToyVector();
 
   ToyVector& operator=(const ToyVector& rhs);
+  ToyVector& operator=(ToyVector&& rhs);
   T&         operator()(int index) const;
 
   friend ToyVector<T> operator*<>(const ToyVector<T>& lhs, T rhs) throw (ValueRangeExceeded<T>);
@@ -58,10 +70,13 @@ public:
   ToyVector& operator*=(T rhs);
   ToyVector& operator/=(T rhs);
 
-  int           getNumRows();
-  int           getNumColumns(); 
+  int           getNumRows() const;
+  int           getNumColumns() const; 
+  int           getNumEntries() const;
+  T*            getEntries() const;
   ToyVector     crossProduct(const ToyVector<T>& rhs);
-  bool          isTransposed();
+  bool          isTransposed() const;
+  bool          isInline() const;
   ToyVector<T>& transpose();
   ToyVector& normalize();
   ToyVector  normalized();
@@ -73,23 +88,37 @@ protected:
   int  Transposed;
   int  NumEntries;
   T*   Entries;
+  T    InlineEntries[TOYVECTOR_INLINE_CAPACITY];
+
+private:
+  void resize(int numEntries);
 };
 
 #include <toymatrix.h>
 
+//! entries: ownership goes to the object. Small vectors copy them
+//! into the inline buffer and release the array right away.
 template<class T>
 ToyVector<T>::ToyVector(int rows /*=4*/, T *entries /*= 0x0*/) :
   Rows(rows),
   Columns(1),
   Transposed(0),
-  NumEntries(rows)
+  NumEntries(rows),
+  Entries(InlineEntries)
 {
   if (!entries) {
-    Entries = new T[rows];
+    if (rows > TOYVECTOR_INLINE_CAPACITY) {
+      Entries = new T[rows];
+    }
     for (int i=0; i<rows-1; i++) {
       Entries[i] = T();
     }
     Entries[rows-1]=1;
+  } else if (rows <= TOYVECTOR_INLINE_CAPACITY) {
+    for (int i=0; i<rows; i++) {
+      InlineEntries[i] = entries[i];
+    }
+    delete[] entries;
   } else {
     Entries = entries;
   }
@@ -98,7 +127,7 @@ ToyVector<T>::ToyVector(int rows /*=4*/, T *entries /*= 0x0*/) :
 template<class T>
 ToyVector<T>::~ToyVector()
 {
-  delete[] Entries;
+  if (Entries != InlineEntries) delete[] Entries;
 }
 
 template<class T>
@@ -107,24 +136,63 @@ ToyVector<T>::ToyVector(const ToyVector& other) :
   Columns(0),
   Transposed(0),
   NumEntries(0),
-  Entries(0x0)
+  Entries(InlineEntries)
 {
   (*this) = other;
 }
 
+template<class T>
+ToyVector<T>::ToyVector(ToyVector&& other) :
+  Rows(0),
+  Columns(0),
+  Transposed(0),
+  NumEntries(0),
+  Entries(InlineEntries)
+{
+  (*this) = static_cast<ToyVector&&>(other);
+}
+
+//! Switches to a buffer for numEntries entries, without keeping the values.
+template<class T>
+void ToyVector<T>::resize(int numEntries)
+{
+  if (NumEntries == numEntries) return;
+  if (Entries != InlineEntries) delete[] Entries;
+  NumEntries = numEntries;
+  Entries = (numEntries > TOYVECTOR_INLINE_CAPACITY) ? new T[numEntries] : InlineEntries;
+}
+
 template<class T>
 ToyVector<T>& ToyVector<T>::operator=(const ToyVector& rhs)
 {
   if (this == &rhs) return *this;
-  if (NumEntries != rhs.NumEntries) {
-    delete Entries;
-    NumEntries = rhs.NumEntries;
-    Entries = new T[NumEntries];
-  }
+  resize(rhs.NumEntries);
   Transposed=rhs.Transposed;
   Columns=rhs.Columns;
   Rows = rhs.Rows;
-  memcpy(Entries, rhs.Entries, NumEntries*sizeof(T));
+  for (int i=0; i<NumEntries; i++) {
+    Entries[i] = rhs.Entries[i];
+  }
+  return (*this);
+}
+
+//! Takes over a heap buffer; inline entries are copied.
+template<class T>
+ToyVector<T>& ToyVector<T>::operator=(ToyVector&& rhs)
+{
+  if (this == &rhs) return *this;
+  if (rhs.Entries == rhs.InlineEntries) {
+    return (*this) = static_cast<const ToyVector&>(rhs);
+  }
+  if (Entries != InlineEntries) delete[] Entries;
+  Entries = rhs.Entries;
+  NumEntries = rhs.NumEntries;
+  Transposed = rhs.Transposed;
+  Columns = rhs.Columns;
+  Rows = rhs.Rows;
+  rhs.Entries = rhs.InlineEntries;
+  rhs.NumEntries = 0;
+  rhs.Rows = rhs.Columns = 0;
   return (*this);
 }
 
@@ -254,17 +322,29 @@ ToyVector<T>& ToyVector<T>::operator/=(T rhs)
 }
 
 template<class T>
-int ToyVector<T>::getNumRows()
+int ToyVector<T>::getNumRows() const
 {
   return Rows;
 }
 
 template<class T>
-int ToyVector<T>::getNumColumns()
+int ToyVector<T>::getNumColumns() const
 {
   return Columns;
 }
 
+template<class T>
+int ToyVector<T>::getNumEntries() const
+{
+  return NumEntries;
+}
+
+template<class T>
+T* ToyVector<T>::getEntries() const
+{
+  return Entries;
+}
+
 //----------------------------------------------------------------------------- 
 // A cross product on n-dimensional vectors is only defined for n-1 vectors. 
 // Since this function deals with two operands, we can only do the cross
@@ -285,11 +365,17 @@ ToyVector<T>  ToyVector<T>::crossProduct(const ToyVector& rhs)
 }
 
 template<class T>
-bool ToyVector<T>::isTransposed()
+bool ToyVector<T>::isTransposed() const
 {
   return (Transposed)?true:false;
 }
 
+template<class T>
+bool ToyVector<T>::isInline() const
+{
+  return Entries == InlineEntries;
+}
+
 
 template<class T>
 ToyVector<T>& ToyVector<T>::transpose()
@@ -305,12 +391,13 @@ ToyVector<T>& ToyVector<T>::transpose()
 template<class T>
 ToyVector<T>& ToyVector<T>::normalize()
 {
-  int sqrsum = 0;
+  // std::norm is the squared magnitude of real and complex entries alike.
+  double sqrsum = 0;
   for (int i=0; i<NumEntries; i++)
   {
-    sqrsum += Entries[i]*Entries[i];
+    sqrsum += std::norm(Entries[i]);
   }
-  float length = sqrt((float)sqrsum);
+  double length = sqrt(sqrsum);
   for (int i=0; i<NumEntries; i++)
   {
     Entries[i] /= length;
@@ -0,0 +1,482 @@
+//------------------------------------------------------------------------------
+// Work-stealing scheduler for recursive divide-and-conquer kernels.
+//
+// Every worker owns a deque. Tasks spawned by a worker go to the back of its
+// own deque and are popped from there again (depth first, cache friendly);
+// idle workers steal from the front of a random victim's deque, which holds
+// the oldest and therefore largest pieces of work. Tasks spawned from other
+// threads go to a shared injection deque that all workers steal from.
+//
+// ToyTaskGroup provides spawn/sync. sync() does not block: the waiting thread
+// keeps executing tasks until all children of the group have finished, so
+// groups nest to any depth.
+//
+//   ToyTaskGroup group;
+//   group.spawn([&]() { left(); });
+//   right();
+//   group.sync();
+//
+// getStatistics() reports executed tasks per worker, steals and idle time,
+// which shows how well the task tree was balanced.
+//
+// global() starts no threads of its own: its workers are those of
+// ToyThreadPool::global(), which run its tasks whenever they have no
+// chunks to process (see ToyThreadPool::addIdleWork()). For such a
+// scheduler a worker counts as idle from the moment it finds no task until
+// it next looks for one, which includes time spent on the pool's own
+// chunks. A scheduler constructed with a number of workers starts that
+// many threads. Idle workers spin briefly and then sleep until a task is
+// spawned.
+//
+// If a task throws, sync() rethrows the first exception of the group once
+// all its tasks have finished.
+//------------------------------------------------------------------------------
+
+#ifndef TOYWORKSTEAL_H
+#define TOYWORKSTEAL_H
+
+#include <toykernels.h>
+#include <toyparallel.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ToyTaskGroup;
+
+class ToyWorkStealingScheduler {
+  friend class ToyTaskGroup;
+public:
+  struct Statistics {
+    long long Spawned;
+    long long Executed;
+    long long Steals;
+    long long FailedSteals;
+    double    IdleSeconds;
+    std::vector<long long> ExecutedPerWorker;  // last entry: non-worker threads
+  };
+
+  explicit ToyWorkStealingScheduler(int numWorkers = 0);
+  explicit ToyWorkStealingScheduler(ToyThreadPool& pool);
+  ~ToyWorkStealingScheduler();
+
+  static ToyWorkStealingScheduler& global();
+
+  int        getNumWorkers() const;
+  Statistics getStatistics() const;
+  void       resetStatistics();
+
+private:
+  ToyWorkStealingScheduler(const ToyWorkStealingScheduler&);
+  ToyWorkStealingScheduler& operator=(const ToyWorkStealingScheduler&);
+
+  struct Task {
+    std::function<void()> Func;
+    ToyTaskGroup*         Group;
+  };
+
+  struct Worker {
+    Worker() : Executed(0), Steals(0), FailedSteals(0), IdleNanos(0), IdleSince(0) {}
+    std::mutex              Mutex;
+    std::deque<Task*>       Deque;
+    std::atomic<long long>  Executed;
+    std::atomic<long long>  Steals;
+    std::atomic<long long>  FailedSteals;
+    std::atomic<long long>  IdleNanos;
+    std::atomic<long long>  IdleSince;   // pool workers: when idling began, or 0
+  };
+
+  int   currentSlot() const;
+  void  push(Task* task);
+  Task* popLocal(int slot);
+  Task* steal(int slot, unsigned& seed, bool countFailure);
+  bool  runOne(int slot, unsigned& seed, bool countFailure = true);
+  void  workerLoop(int slot);
+  static bool runOnPool(void* scheduler, int worker);
+  static long long nowNanos();
+
+  // Slots 0..n-1 belong to the workers, slot n is the injection deque.
+  std::vector<std::unique_ptr<Worker> > Slots;
+  int                       NumWorkers;
+  ToyThreadPool*            Pool;       // lends its workers, or 0
+  std::vector<std::thread>  Threads;
+  std::atomic<bool>         Stopping;
+  std::atomic<long long>    Spawned;
+  // Pushes counts push() calls and only changes under SleepMutex, so a
+  // worker that saw no new push before going to sleep cannot miss one.
+  std::atomic<unsigned long long> Pushes;
+  int                       Sleeping;   // guarded by SleepMutex
+  std::mutex                SleepMutex;
+  std::condition_variable   WakeUp;
+
+  struct ThreadIdentity {
+    const ToyWorkStealingScheduler* Scheduler;
+    int                             Slot;
+  };
+  static ThreadIdentity& identity();
+};
+
+class ToyTaskGroup {
+public:
+  explicit ToyTaskGroup(ToyWorkStealingScheduler& scheduler = ToyWorkStealingScheduler::global());
+  ~ToyTaskGroup();
+
+  template<class F>
+  void spawn(F func);
+  void sync();
+
+private:
+  friend class ToyWorkStealingScheduler;
+  ToyTaskGroup(const ToyTaskGroup&);
+  ToyTaskGroup& operator=(const ToyTaskGroup&);
+
+  void wait();
+  void finish(std::exception_ptr error);
+
+  ToyWorkStealingScheduler& Scheduler;
+  std::atomic<int>          Pending;
+  std::exception_ptr        Error;       // first exception of a task
+  std::mutex                ErrorMutex;
+};
+
+inline ToyWorkStealingScheduler::ToyWorkStealingScheduler(int numWorkers /*= 0*/) :
+  NumWorkers(numWorkers),
+  Pool(0),
+  Stopping(false),
+  Spawned(0),
+  Pushes(0),
+  Sleeping(0)
+{
+  if (NumWorkers <= 0) {
+    const char* env = getenv("TOYMATRIX_NUM_THREADS");
+    NumWorkers = env ? atoi(env) : (int)std::thread::hardware_concurrency();
+  }
+  if (NumWorkers <= 0) NumWorkers = 1;
+  for (int i=0; i<=NumWorkers; i++) Slots.push_back(std::unique_ptr<Worker>(new Worker()));
+  for (int i=0; i<NumWorkers; i++) {
+    Threads.push_back(std::thread(&ToyWorkStealingScheduler::workerLoop, this, i));
+  }
+}
+
+inline ToyWorkStealingScheduler::ToyWorkStealingScheduler(ToyThreadPool& pool) :
+  NumWorkers(pool.getNumThreads() - 1),
+  Pool(&pool),
+  Stopping(false),
+  Spawned(0),
+  Pushes(0),
+  Sleeping(0)
+{
+  for (int i=0; i<=NumWorkers; i++) Slots.push_back(std::unique_ptr<Worker>(new Worker()));
+  pool.addIdleWork(&ToyWorkStealingScheduler::runOnPool, this);
+}
+
+inline ToyWorkStealingScheduler::~ToyWorkStealingScheduler()
+{
+  if (Pool) Pool->removeIdleWork(&ToyWorkStealingScheduler::runOnPool, this);
+  {
+    std::lock_guard<std::mutex> lock(SleepMutex);
+    Stopping = true;
+  }
+  WakeUp.notify_all();
+  for (size_t i=0; i<Threads.size(); i++) Threads[i].join();
+}
+
+inline ToyWorkStealingScheduler& ToyWorkStealingScheduler::global()
+{
+  static ToyWorkStealingScheduler scheduler(ToyThreadPool::global());
+  return scheduler;
+}
+
+inline int ToyWorkStealingScheduler::getNumWorkers() const
+{
+  return NumWorkers;
+}
+
+inline ToyWorkStealingScheduler::ThreadIdentity& ToyWorkStealingScheduler::identity()
+{
+  static thread_local ThreadIdentity id = {0, -1};
+  return id;
+}
+
+inline int ToyWorkStealingScheduler::currentSlot() const
+{
+  const ThreadIdentity& id = identity();
+  return (id.Scheduler == this) ? id.Slot : NumWorkers;
+}
+
+inline long long ToyWorkStealingScheduler::nowNanos()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline ToyWorkStealingScheduler::Statistics ToyWorkStealingScheduler::getStatistics() const
+{
+  Statistics stats;
+  stats.Spawned = Spawned;
+  stats.Executed = stats.Steals = stats.FailedSteals = 0;
+  long long now = nowNanos();
+  long long idle = 0;
+  for (size_t i=0; i<Slots.size(); i++) {
+    long long since = Slots[i]->IdleSince;
+    if (since) idle += now - since;
+    stats.ExecutedPerWorker.push_back(Slots[i]->Executed);
+    stats.Executed += Slots[i]->Executed;
+    stats.Steals += Slots[i]->Steals;
+    stats.FailedSteals += Slots[i]->FailedSteals;
+    idle += Slots[i]->IdleNanos;
+  }
+  stats.IdleSeconds = idle * 1e-9;
+  return stats;
+}
+
+inline void ToyWorkStealingScheduler::resetStatistics()
+{
+  Spawned = 0;
+  long long now = nowNanos();
+  for (size_t i=0; i<Slots.size(); i++) {
+    Slots[i]->Executed = 0;
+    Slots[i]->Steals = 0;
+    Slots[i]->FailedSteals = 0;
+    Slots[i]->IdleNanos = 0;
+    // A worker that is idle right now counts from here on.
+    long long since = Slots[i]->IdleSince;
+    if (since) Slots[i]->IdleSince.compare_exchange_strong(since, now);
+  }
+}
+
+inline void ToyWorkStealingScheduler::push(Task* task)
+{
+  Worker& own = *Slots[currentSlot()];
+  {
+    std::lock_guard<std::mutex> lock(own.Mutex);
+    own.Deque.push_back(task);
+  }
+  Spawned++;
+  if (Pool) {
+    Pool->notifyIdleWork();
+    return;
+  }
+  std::lock_guard<std::mutex> lock(SleepMutex);
+  Pushes++;
+  if (Sleeping > 0) WakeUp.notify_one();
+}
+
+inline ToyWorkStealingScheduler::Task* ToyWorkStealingScheduler::popLocal(int slot)
+{
+  Worker& own = *Slots[slot];
+  std::lock_guard<std::mutex> lock(own.Mutex);
+  if (own.Deque.empty()) return 0;
+  Task* task = own.Deque.back();
+  own.Deque.pop_back();
+  return task;
+}
+
+inline ToyWorkStealingScheduler::Task* ToyWorkStealingScheduler::steal(int slot, unsigned& seed, bool countFailure)
+{
+  int numSlots = (int)Slots.size();
+  seed = seed * 1103515245u + 12345u;
+  int start = (int)((seed >> 16) % numSlots);
+  for (int i=0; i<numSlots; i++) {
+    int victim = (start + i) % numSlots;
+    if (victim == slot) continue;
+    Worker& other = *Slots[victim];
+    std::lock_guard<std::mutex> lock(other.Mutex);
+    if (!other.Deque.empty()) {
+      Task* task = other.Deque.front();
+      other.Deque.pop_front();
+      Slots[slot]->Steals++;
+      return task;
+    }
+  }
+  if (countFailure) Slots[slot]->FailedSteals++;
+  return 0;
+}
+
+//! Runs one task; what it throws is handed to its group, never to the caller.
+inline bool ToyWorkStealingScheduler::runOne(int slot, unsigned& seed, bool countFailure /*= true*/)
+{
+  Task* task = popLocal(slot);
+  if (!task) task = steal(slot, seed, countFailure);
+  if (!task) return false;
+  std::exception_ptr error;
+  try {
+    task->Func();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  Slots[slot]->Executed++;
+  ToyTaskGroup* group = task->Group;
+  delete task;
+  group->finish(error);
+  return true;
+}
+
+inline void ToyWorkStealingScheduler::workerLoop(int slot)
+{
+  identity().Scheduler = this;
+  identity().Slot = slot;
+  unsigned seed = 2654435761u * (slot + 1);
+  int failures = 0;
+  while (!Stopping) {
+    unsigned long long pushes = Pushes;
+    if (runOne(slot, seed)) {
+      failures = 0;
+      continue;
+    }
+    std::chrono::steady_clock::time_point idleStart = std::chrono::steady_clock::now();
+    if (++failures < 64) {
+      std::this_thread::yield();
+    } else {
+      // A task pushed after pushes was read has changed Pushes by now.
+      std::unique_lock<std::mutex> lock(SleepMutex);
+      Sleeping++;
+      while (!Stopping && Pushes == pushes) WakeUp.wait(lock);
+      Sleeping--;
+      failures = 0;
+    }
+    Slots[slot]->IdleNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now() - idleStart).count();
+  }
+}
+
+//! Runs one task on worker of the thread pool the scheduler borrows.
+inline bool ToyWorkStealingScheduler::runOnPool(void* scheduler, int worker)
+{
+  ToyWorkStealingScheduler& self = *static_cast<ToyWorkStealingScheduler*>(scheduler);
+  identity().Scheduler = &self;
+  identity().Slot = worker;
+  Worker& own = *self.Slots[worker];
+  unsigned seed = 2654435761u * (worker + 1) + (unsigned)own.Executed;
+  long long since = own.IdleSince.exchange(0);
+  if (since) own.IdleNanos += nowNanos() - since;
+  bool ran = self.runOne(worker, seed);
+  if (!ran) own.IdleSince = nowNanos();
+  return ran;
+}
+
+inline ToyTaskGroup::ToyTaskGroup(ToyWorkStealingScheduler& scheduler /*= global()*/) :
+  Scheduler(scheduler),
+  Pending(0)
+{
+}
+
+inline ToyTaskGroup::~ToyTaskGroup()
+{
+  wait();
+}
+
+template<class F>
+void ToyTaskGroup::spawn(F func)
+{
+  ToyWorkStealingScheduler::Task* task = new ToyWorkStealingScheduler::Task();
+  task->Func = func;
+  task->Group = this;
+  Pending++;
+  Scheduler.push(task);
+}
+
+//! Runs tasks until all children have finished. Polls that find nothing
+//! are not failed steals: the thread is only waiting.
+inline void ToyTaskGroup::wait()
+{
+  int slot = Scheduler.currentSlot();
+  unsigned seed = 2654435761u ^ (unsigned)(size_t)this;
+  while (Pending > 0) {
+    if (!Scheduler.runOne(slot, seed, false)) std::this_thread::yield();
+  }
+}
+
+inline void ToyTaskGroup::sync()
+{
+  wait();
+  if (Error) {
+    std::exception_ptr error = Error;
+    Error = std::exception_ptr();
+    std::rethrow_exception(error);
+  }
+}
+
+//! Called by the scheduler when a task of the group has finished.
+inline void ToyTaskGroup::finish(std::exception_ptr error)
+{
+  if (error) {
+    std::lock_guard<std::mutex> lock(ErrorMutex);
+    if (!Error) Error = error;
+  }
+  // The group may be gone as soon as Pending drops to zero.
+  Pending--;
+}
+
+//------------------------------------------------------------------------------
+// Calls func(lo, hi) on halves of [begin, end), split recursively until a
+// piece has at most grainSize elements.
+//------------------------------------------------------------------------------
+template<class F>
+void toyRecursiveFor(int begin, int end, int grainSize, const F& func)
+{
+  if (end - begin <= std::max(grainSize, 1)) {
+    func(begin, end);
+    return;
+  }
+  int middle = begin + (end - begin) / 2;
+  ToyTaskGroup group;
+  group.spawn([=, &func]() { toyRecursiveFor(begin, middle, grainSize, func); });
+  toyRecursiveFor(middle, end, grainSize, func);
+  group.sync();
+}
+
+//------------------------------------------------------------------------------
+// Cache-oblivious C = alpha*A*B + beta*C. The largest of m and n is halved
+// in parallel; a much larger k is halved sequentially, the second half
+// accumulating onto the first. Pieces below the recursive grain of
+// toyKernelConfig() go to toyGemm().
+//------------------------------------------------------------------------------
+template<class T>
+void toyRecursiveGemm(int m, int n, int k, T alpha,
+                      const T* a, int rsa, int csa,
+                      const T* b, int rsb, int csb,
+                      T beta, T* c, int rsc, int csc)
+{
+  if ((long long)m*n*k <= toyKernelConfig().RecursiveGrain || (m <= 1 && n <= 1)) {
+    toyGemm(m, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+    return;
+  }
+  // Splitting k would round the partial sums to T when they are
+  // accumulated in a wider type.
+  if (k > 2*std::max(m, n) && !toyAccumulatesWider<T>()) {
+    int k1 = k/2;
+    toyRecursiveGemm(m, n, k1, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+    toyRecursiveGemm(m, n, k-k1, alpha, a + k1*csa, rsa, csa, b + k1*rsb, rsb, csb,
+                     T(1), c, rsc, csc);
+    return;
+  }
+  ToyTaskGroup group;
+  if (m >= n) {
+    int m1 = m/2;
+    group.spawn([=]() {
+      toyRecursiveGemm(m1, n, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+    });
+    toyRecursiveGemm(m-m1, n, k, alpha, a + m1*rsa, rsa, csa, b, rsb, csb,
+                     beta, c + m1*rsc, rsc, csc);
+  } else {
+    int n1 = n/2;
+    group.spawn([=]() {
+      toyRecursiveGemm(m, n1, k, alpha, a, rsa, csa, b, rsb, csb, beta, c, rsc, csc);
+    });
+    toyRecursiveGemm(m, n-n1, k, alpha, a, rsa, csa, b + n1*csb, rsb, csb,
+                     beta, c + n1*csc, rsc, csc);
+  }
+  group.sync();
+}
+
+#endif // TOYWORKSTEAL_H
@@ -0,0 +1,22 @@
+//------------------------------------------------------------------------------
+// Matrices shared by the unit tests. Entries are integers from -5 to 5
+// times scale, so with the default scale products are exact in every
+// entry type. Different seeds give different matrices.
+//------------------------------------------------------------------------------
+
+#ifndef TESTMATRICES_H
+#define TESTMATRICES_H
+
+#include <toymatrix.h>
+
+template<class T>
+ToyMatrix<T> makeTestMatrix(int rows, int columns, int seed = 0, double scale = 1)
+{
+  ToyMatrix<T> m(rows, columns);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) m(i,j) = T(((seed + 7*i + 3*j) % 11 - 5) * scale);
+  }
+  return m;
+}
+
+#endif // TESTMATRICES_H
@@ -0,0 +1,106 @@
+#include "toyasync.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+#include "testmatrices.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+using namespace std;
+
+// A future that only finishes when the test says so.
+template<class R>
+static ToyFuture<R> makeGate(shared_ptr<ToyAsyncState<R> >& state)
+{
+  state.reset(new ToyAsyncState<R>());
+  return ToyFuture<R>(state);
+}
+
+TEST(ToyAsyncTest, Pipeline) {
+  ToyMatrix<int> a = makeTestMatrix<int>(20, 30, 0);
+  ToyMatrix<int> b = makeTestMatrix<int>(30, 10, 1);
+  ToyMatrix<int> e = makeTestMatrix<int>(20, 10, 2);
+
+  atomic<int> completed(0);
+  ToyFuture<ToyMatrix<int> > c = multiplyAsync(a, b);
+  ToyFuture<ToyMatrix<int> > d = addAsync(c, toyReady(e));
+  d.onComplete([&](const ToyFuture<ToyMatrix<int> >& f) {
+    EXPECT_TRUE(f.isReady());
+    completed++;
+  });
+
+  ToyMatrix<int> expected = a*b + e;
+  const ToyMatrix<int>& result = d.get();
+  ASSERT_EQ(20, result.getNumRows());
+  ASSERT_EQ(10, result.getNumColumns());
+  for (int i=0; i<20; i++) {
+    for (int j=0; j<10; j++) EXPECT_EQ(expected(i,j), result(i,j));
+  }
+  d.wait();
+  while (completed == 0) this_thread::yield();
+  EXPECT_EQ(1, completed);
+
+  // A callback registered after completion runs immediately.
+  d.onComplete([&](const ToyFuture<ToyMatrix<int> >&) { completed++; });
+  EXPECT_EQ(2, completed);
+}
+
+TEST(ToyAsyncTest, SolveAsync) {
+  ToyMatrix<double> a(3, 3);
+  a(0,0) = 4.0; a(0,1) = 1.0; a(1,0) = 1.0; a(1,1) = 3.0; a(2,2) = 2.0;
+  double* entries = new double[3];
+  entries[0] = 6.0; entries[1] = 7.0; entries[2] = 8.0;
+  ToyVector<double> b(3, entries);
+
+  ToyFuture<ToyVector<double> > x = solveAsync(a, b);
+  EXPECT_DOUBLE_EQ(1.0, x.get()(0));
+  EXPECT_DOUBLE_EQ(2.0, x.get()(1));
+  EXPECT_DOUBLE_EQ(4.0, x.get()(2));
+
+  // Errors propagate to get() and to dependent operations.
+  ToyMatrix<double> singular(3, 3);
+  ToyFuture<ToyMatrix<double> > failed = solveAsync(singular, a);
+  ToyFuture<ToyMatrix<double> > dependent = addAsync(failed, toyReady(a));
+  dependent.wait();
+  EXPECT_TRUE(failed.hasFailed());
+  EXPECT_TRUE(dependent.hasFailed());
+  bool caught = false;
+  try {
+    dependent.get();
+  }
+  catch (SingularMatrix) {
+    caught = true;
+  }
+  EXPECT_TRUE(caught);
+}
+
+TEST(ToyAsyncTest, Cancellation) {
+  shared_ptr<ToyAsyncState<ToyMatrix<int> > > gateState;
+  ToyFuture<ToyMatrix<int> > gate = makeGate(gateState);
+  ToyMatrix<int> b = makeTestMatrix<int>(4, 4, 3);
+
+  ToyFuture<ToyMatrix<int> > product = multiplyAsync(gate, toyReady(b));
+  ToyFuture<ToyMatrix<int> > sum = addAsync(product, toyReady(b));
+  EXPECT_FALSE(product.waitFor(10));
+
+  // Cancelling an operation that waits for its inputs stops it and
+  // everything that depends on it.
+  EXPECT_TRUE(product.cancel());
+  EXPECT_TRUE(product.isCancelled());
+  sum.wait();
+  EXPECT_TRUE(sum.isCancelled());
+
+  gateState->start();
+  gateState->setValue(new ToyMatrix<int>(b));
+  bool caught = false;
+  try {
+    product.get();
+  }
+  catch (ToyCancelled) {
+    caught = true;
+  }
+  EXPECT_TRUE(caught);
+
+  // Finished operations cannot be cancelled any more.
+  EXPECT_FALSE(gate.cancel());
+}
@@ -0,0 +1,73 @@
+#include "toybatched.h"
+#include "toymatrix.h"
+#include "testmatrices.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+using namespace std;
+
+TEST(ToyBatchedTest, StorageIsInterleaved) {
+  ToyMatrixBatch<float, 3> batch(TOYBATCH_LANES + 2);
+  EXPECT_EQ(2, batch.getNumGroups());
+  batch(1, 2, 0) = 5.0f;
+  batch(TOYBATCH_LANES + 1, 0, 1) = 7.0f;
+  EXPECT_EQ(5.0f, batch.getGroup(0)[(2*3 + 0)*TOYBATCH_LANES + 1]);
+  EXPECT_EQ(7.0f, batch.getGroup(1)[(0*3 + 1)*TOYBATCH_LANES + 1]);
+
+  batch.setIdentity(4);
+  ToyMatrix<float> identity = batch.get(4);
+  EXPECT_EQ(1.0f, identity(2,2));
+  EXPECT_EQ(0.0f, identity(0,2));
+
+  // Shrinking clears the dropped lanes, so growing again yields zeros.
+  batch.resize(2);
+  EXPECT_EQ(1, batch.getNumGroups());
+  EXPECT_EQ(0.0f, batch.getGroup(0)[(2*3 + 2)*TOYBATCH_LANES + 4]);
+  EXPECT_EQ(5.0f, batch(1, 2, 0));
+  batch.resize(TOYBATCH_LANES + 2);
+  EXPECT_EQ(0.0f, batch(4, 2, 2));
+  EXPECT_EQ(0.0f, batch(TOYBATCH_LANES + 1, 0, 1));
+}
+
+TEST(ToyBatchedTest, MultipliesEveryPair) {
+  const int count = 1000;
+  ToyMatrixBatch<double, 4> a(count), b(count), c;
+  for (int i=0; i<count; i++) {
+    a.set(i, makeTestMatrix<double>(4, 4, i, 0.25));
+    b.set(i, makeTestMatrix<double>(4, 4, 3*i + 1, 0.25));
+  }
+  toyBatchedMultiply(a, b, c);
+  ASSERT_EQ(count, c.getCount());
+  for (int i=0; i<count; i++) {
+    ToyMatrix<double> expected = makeTestMatrix<double>(4, 4, i, 0.25) *
+                                 makeTestMatrix<double>(4, 4, 3*i + 1, 0.25);
+    for (int r=0; r<4; r++) {
+      for (int s=0; s<4; s++) ASSERT_DOUBLE_EQ(expected(r,s), c(i,r,s)) << "matrix " << i;
+    }
+  }
+}
+
+TEST(ToyBatchedTest, ComposesHierarchies) {
+  // Parents listed after some of their children, several roots and
+  // levels wider than one lane group.
+  const int count = 300;
+  vector<int> parent(count);
+  for (int i=0; i<count; i++) {
+    parent[i] = (i % 50 == 0) ? -1 : (i*37 + 11) % count;
+    if (parent[i] >= 0 && parent[i] % 50 != 0 && parent[i] >= i) parent[i] = (i/50)*50;
+  }
+  ToyMatrixBatch<double, 3> local(count), world;
+  for (int i=0; i<count; i++) local.set(i, makeTestMatrix<double>(3, 3, i, 0.25));
+  toyComposeHierarchy(local, parent, world);
+
+  for (int i=0; i<count; i++) {
+    ToyMatrix<double> expected = makeTestMatrix<double>(3, 3, i, 0.25);
+    for (int node=parent[i]; node>=0; node=parent[node]) {
+      expected = makeTestMatrix<double>(3, 3, node, 0.25) * expected;
+    }
+    for (int r=0; r<3; r++) {
+      for (int s=0; s<3; s++) ASSERT_NEAR(expected(r,s), world(i,r,s), 1e-9) << "node " << i;
+    }
+  }
+}
@@ -0,0 +1,85 @@
+#include "toybits.h"
+#include "toymatrix.h"
+
+#include <gtest/gtest.h>
+
+using namespace std;
+
+static ToyBitMatrix makeBits(int rows, int columns, int seed, int density)
+{
+  ToyBitMatrix bits(rows, columns);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) {
+      if ((i*131 + j*71 + seed) % density == 0) bits.set(i, j);
+    }
+  }
+  return bits;
+}
+
+TEST(ToyBitsTest, Conversions) {
+  ToyMatrix<int> m(3, 70);
+  m(0, 0) = 1;
+  m(1, 64) = -2;
+  m(2, 69) = 5;
+  ToyBitMatrix bits(m);
+  EXPECT_EQ(2, bits.getWordsPerRow());
+  EXPECT_EQ(3, bits.count());
+  EXPECT_TRUE(bits.get(1, 64));
+  EXPECT_FALSE(bits.get(1, 63));
+  ToyMatrix<float> back = bits.toMatrix<float>();
+  EXPECT_EQ(1.0f, back(1, 64));
+  EXPECT_EQ(0.0f, back(0, 1));
+
+  bits.set(1, 64, false);
+  EXPECT_FALSE(bits.get(1, 64));
+  EXPECT_EQ(bits, ToyBitMatrix(bits));
+
+  // Sizes that are not multiples of 64 in either direction.
+  ToyBitMatrix a = makeBits(130, 77, 1, 5);
+  ToyBitMatrix t = a.transposed();
+  ASSERT_EQ(77, t.getNumRows());
+  for (int i=0; i<130; i++) {
+    for (int j=0; j<77; j++) ASSERT_EQ(a.get(i, j), t.get(j, i)) << i << "," << j;
+  }
+  EXPECT_EQ(a, t.transposed());
+}
+
+TEST(ToyBitsTest, BooleanProduct) {
+  // Dense and sparse operands take the two different product schemes.
+  for (int density=2; density<=50; density+=48) {
+    ToyBitMatrix a = makeBits(90, 150, 3, density), b = makeBits(150, 70, 7, density);
+    ToyBitMatrix c = a*b;
+    ToyMatrix<int> paths = toyCountPaths(a, b);
+    for (int i=0; i<90; i++) {
+      for (int j=0; j<70; j++) {
+        int expected = 0;
+        for (int k=0; k<150; k++) expected += a.get(i, k) && b.get(k, j);
+        ASSERT_EQ(expected > 0, c.get(i, j)) << i << "," << j;
+        ASSERT_EQ(expected, paths(i, j)) << i << "," << j;
+      }
+    }
+  }
+  ToyBitMatrix identity(150, 150);
+  identity.makeIdentity();
+  ToyBitMatrix a = makeBits(90, 150, 3, 4);
+  EXPECT_EQ(a, a*identity);
+}
+
+TEST(ToyBitsTest, TransitiveClosure) {
+  // A chain 0 -> 1 -> ... -> n-1 plus an edge back from 150 to 100.
+  const int n = 200;
+  ToyBitMatrix edges(n, n);
+  for (int i=0; i+1<n; i++) edges.set(i, i+1);
+  edges.set(150, 100);
+  ToyBitMatrix closure = toyTransitiveClosure(edges);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<n; j++) {
+      bool reachable = (j > i) || (i >= 100 && i <= 150 && j >= 100);
+      ASSERT_EQ(reachable, closure.get(i, j)) << i << "," << j;
+    }
+  }
+  ToyBitMatrix reflexive = toyTransitiveClosure(edges, true);
+  EXPECT_TRUE(reflexive.get(0, 0));
+  // Only the nodes on the cycle reach themselves without it.
+  EXPECT_EQ(closure.count() + n - 51, reflexive.count());
+}
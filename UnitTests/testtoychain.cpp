@@ -0,0 +1,56 @@
+#include "toychain.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+#include "testmatrices.h"
+
+#include <gtest/gtest.h>
+
+using namespace std;
+
+TEST(ToyChainTest, ChoosesCheapestOrder) {
+  // The textbook example: 10x30, 30x5, 5x60 is best as (AB)C.
+  ToyMatrix<double> a = makeTestMatrix<double>(10, 30, 1);
+  ToyMatrix<double> b = makeTestMatrix<double>(30, 5, 2);
+  ToyMatrix<double> c = makeTestMatrix<double>(5, 60, 3);
+  ToyProductChain<double> chain = toyLazy(a) * b * c;
+  EXPECT_EQ("((0 1) 2)", chain.getOrder());
+  EXPECT_EQ(4500, chain.getCost());
+
+  // With the first factor tall, A(BC) wins.
+  ToyMatrix<double> tall = makeTestMatrix<double>(50, 10, 4);
+  ToyMatrix<double> wide = makeTestMatrix<double>(10, 40, 5);
+  ToyMatrix<double> thin = makeTestMatrix<double>(40, 2, 6);
+  ToyProductChain<double> second = toyLazy(tall) * wide * thin;
+  EXPECT_EQ("(0 (1 2))", second.getOrder());
+  EXPECT_LT(second.getCost(), second.getLeftToRightCost());
+
+  ToyMatrix<double> lazy = toyLazy(tall) * wide * thin;
+  ToyMatrix<double> eager = tall * wide * thin;
+  ASSERT_EQ(50, lazy.getNumRows());
+  ASSERT_EQ(2, lazy.getNumColumns());
+  for (int i=0; i<50; i++) {
+    for (int j=0; j<2; j++) EXPECT_DOUBLE_EQ(eager(i,j), lazy(i,j));
+  }
+}
+
+TEST(ToyChainTest, VectorsArePushedInward) {
+  ToyMatrix<double> a = makeTestMatrix<double>(20, 30, 1);
+  ToyMatrix<double> b = makeTestMatrix<double>(30, 30, 2);
+  ToyMatrix<double> c = makeTestMatrix<double>(25, 30, 3);
+  c.transpose();
+  ToyMatrix<double> d = makeTestMatrix<double>(25, 25, 4);
+  double* entries = new double[25];
+  for (int i=0; i<25; i++) entries[i] = i % 4 - 1.5;
+  ToyVector<double> v(25, entries);
+
+  ToyVector<double> y = toyLazy(a) * b * c * d * v;
+  ASSERT_EQ(20, y.getNumEntries());
+
+  // Reference: plain products, one matrix-vector step at a time.
+  ToyMatrix<double> m = a * b * c * d;
+  for (int i=0; i<20; i++) {
+    double expected = 0;
+    for (int j=0; j<25; j++) expected += m(i,j) * v(j);
+    EXPECT_NEAR(expected, y(i), 1e-9);
+  }
+}
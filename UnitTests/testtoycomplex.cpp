@@ -0,0 +1,117 @@
+#include "toycomplex.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+
+#include <gtest/gtest.h>
+
+#include <complex>
+
+using namespace std;
+
+typedef complex<double> Complex;
+
+template<class T>
+static ToyMatrix<complex<T> > makeComplex(int rows, int columns, int seed)
+{
+  ToyMatrix<complex<T> > m(rows, columns, toyUninitialized);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) {
+      m(i,j) = complex<T>(T(((seed + 3*i + 7*j) % 11) - 5), T(((seed + 5*i + 2*j) % 7) - 3));
+    }
+  }
+  return m;
+}
+
+template<class T>
+static ToyMatrix<complex<T> > naiveProduct(const ToyMatrix<complex<T> >& a, const ToyMatrix<complex<T> >& b)
+{
+  ToyMatrix<complex<T> > c(a.getNumRows(), b.getNumColumns());
+  for (int i=0; i<a.getNumRows(); i++) {
+    for (int j=0; j<b.getNumColumns(); j++) {
+      complex<T> sum;
+      for (int p=0; p<a.getNumColumns(); p++) sum += a(i,p) * b(p,j);
+      c(i,j) = sum;
+    }
+  }
+  return c;
+}
+
+TEST(ToyComplexTest, ComplexToyMatrix) {
+  ToyMatrix<Complex> a = makeComplex<double>(5, 3, 1);
+  ToyMatrix<Complex> b = makeComplex<double>(4, 3, 2);
+  b.transpose();
+  ToyMatrix<Complex> c = a*b, expected = naiveProduct(a, b);
+  ASSERT_EQ(4, c.getNumColumns());
+  for (int i=0; i<5; i++) {
+    for (int j=0; j<4; j++) EXPECT_EQ(expected(i,j), c(i,j)) << i << "," << j;
+  }
+
+  ToyMatrix<Complex> sum = a + a, difference = sum - a;
+  EXPECT_EQ(2.0*a(4,2), sum(4,2));
+  EXPECT_EQ(a(4,2), difference(4,2));
+  ToyMatrix<Complex> copy(a);
+  EXPECT_EQ(a(3,1), copy(3,1));
+
+  ToyMatrix<Complex> identity(3, 3);
+  identity.makeIdentity();
+  ToyMatrix<Complex> same = a*identity;
+  EXPECT_EQ(a(2,2), same(2,2));
+
+  Complex* x = new Complex[3];
+  for (int j=0; j<3; j++) x[j] = Complex(j, 1);
+  ToyVector<Complex> v(3, x);
+  ToyVector<Complex> w = a*v;
+  for (int i=0; i<5; i++) {
+    Complex dot;
+    for (int j=0; j<3; j++) dot += a(i,j) * v(j);
+    // The homogeneous 1 of the result vector ends up in its last entry.
+    if (i == 4) dot += 1.0;
+    EXPECT_EQ(dot, w(i));
+  }
+  ToyVector<Complex> scaled = v * Complex(0, 1);
+  EXPECT_EQ(Complex(-1, 2), scaled(2));
+}
+
+TEST(ToyComplexTest, LargeProductsUse3M) {
+  // Large enough for the recursive driver and the 3M product.
+  ToyMatrix<complex<float> > a = makeComplex<float>(130, 110, 3);
+  ToyMatrix<complex<float> > b = makeComplex<float>(110, 120, 4);
+  ToyMatrix<complex<float> > c = a*b, expected = naiveProduct(a, b);
+  for (int i=0; i<130; i++) {
+    for (int j=0; j<120; j++) {
+      // Integer entries: every partial sum is exact in float.
+      ASSERT_EQ(expected(i,j), c(i,j)) << i << "," << j;
+    }
+  }
+}
+
+TEST(ToyComplexTest, SplitLayout) {
+  ToyMatrix<Complex> a = makeComplex<double>(17, 23, 5);
+  ToyMatrix<Complex> b = makeComplex<double>(23, 9, 6);
+  ToyMatrix<Complex> expected = naiveProduct(a, b);
+  ToySplitComplexMatrix<double> sa = toySplit(a), sb = toySplit(b);
+  EXPECT_EQ(a(16,22), sa.get(16,22));
+
+  ToySplitComplexMatrix<double> c4 = toyMultiply(sa, sb, ToyComplex4M);
+  ToySplitComplexMatrix<double> c3 = toyMultiply(sa, sb, ToyComplex3M);
+  ToyMatrix<Complex> product = c3.toMatrix();
+  for (int i=0; i<17; i++) {
+    for (int j=0; j<9; j++) {
+      EXPECT_EQ(expected(i,j), c4.get(i,j));
+      EXPECT_EQ(expected(i,j), product(i,j));
+    }
+  }
+
+  // Transposed views are split in their logical layout.
+  ToyMatrix<Complex> t = makeComplex<double>(9, 23, 7);
+  t.transpose();
+  EXPECT_EQ(t(20,4), toySplit(t).get(20,4));
+
+  ToySplitComplexMatrix<double> sum = sa + sa;
+  sum -= sa;
+  sum *= Complex(0, 2);
+  EXPECT_EQ(a(3,4) * Complex(0, 2), sum.get(3,4));
+  sum.set(0, 0, Complex(1, -1));
+  EXPECT_EQ(1.0, sum.getReal()[0]);
+  EXPECT_EQ(-1.0, sum.getImag()[0]);
+}
@@ -0,0 +1,66 @@
+#include "toyfixed.h"
+#include "toymatrix.h"
+
+#include <gtest/gtest.h>
+
+using namespace std;
+
+// Computed entirely by the compiler.
+constexpr ToyFixedMatrix<int,2,3> A = {{ 1, 2, 3,
+                                         4, 5, 6 }};
+constexpr ToyFixedMatrix<int,3,2> At = toyTranspose(A);
+constexpr ToyFixedMatrix<int,2,2> AAt = A * At;
+constexpr ToyFixedMatrix<int,4,4> I4 = toyFixedIdentity<int,4>();
+constexpr ToyFixedMatrix<int,3,3> M = {{ 2, 0, 1,
+                                         1, 3, 2,
+                                         1, 1, 2 }};
+constexpr ToyFixedVector<int,3> X = {{ 1, 0, 0 }};
+constexpr ToyFixedVector<int,3> Y = {{ 0, 1, 0 }};
+
+static_assert(AAt(0,0) == 14 && AAt(0,1) == 32 && AAt(1,1) == 77, "A*A'");
+static_assert(At(2,1) == 6, "transpose");
+static_assert(I4 * I4 == I4, "identity");
+static_assert((A + A)(1,2) == 12 && (A - A)(1,2) == 0 && (3 * A)(0,1) == 6, "add, subtract, scale");
+static_assert(toyDeterminant(M) == 6, "determinant");
+static_assert(toyDeterminant(I4) == 1, "determinant of identity");
+static_assert(toyCross(X, Y)[2] == 1 && toyDot(X, Y) == 0, "cross and dot");
+static_assert((M * X)[1] == 1, "matrix times vector");
+
+TEST(ToyFixedTest, Determinants) {
+  // Needs a row swap: the first pivot is zero.
+  constexpr ToyFixedMatrix<double,3,3> swapped = {{ 0, 1, 2,
+                                                    3, 4, 5,
+                                                    6, 7, 9 }};
+  constexpr double det = toyDeterminant(swapped);
+  EXPECT_DOUBLE_EQ(-3.0, det);
+
+  constexpr ToyFixedMatrix<int,3,3> singular = {{ 1, 2, 3,
+                                                  2, 4, 6,
+                                                  1, 0, 1 }};
+  EXPECT_EQ(0, toyDeterminant(singular));
+
+  constexpr ToyFixedMatrix<long long,4,4> m = {{ 3, 2, 0, 1,
+                                                 4, 0, 1, 2,
+                                                 3, 0, 2, 1,
+                                                 9, 2, 3, 1 }};
+  EXPECT_EQ(24, toyDeterminant(m));
+}
+
+TEST(ToyFixedTest, ConvertsToDynamicTypes) {
+  ToyMatrix<int> a = A.toMatrix();
+  ASSERT_EQ(2, a.getNumRows());
+  ASSERT_EQ(3, a.getNumColumns());
+  ToyMatrix<int> product = a * At.toMatrix();
+  for (int i=0; i<2; i++) {
+    for (int j=0; j<2; j++) EXPECT_EQ(AAt(i,j), product(i,j));
+  }
+
+  ToyVector<int> cross = toyCross(X, Y).toVector();
+  ASSERT_EQ(3, cross.getNumEntries());
+  EXPECT_EQ(1, cross(2));
+
+  // Runtime use works as well.
+  ToyFixedMatrix<float,2,2> r = toyFixedZero<float,2,2>();
+  r(0,1) = 2.0f;
+  EXPECT_EQ(2.0f, toyTranspose(r)(1,0));
+}
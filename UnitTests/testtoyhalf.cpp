@@ -0,0 +1,107 @@
+#include "toyhalf.h"
+#include "toymatrix.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+using namespace std;
+
+TEST(ToyHalfTest, HalfConversion) {
+  EXPECT_EQ(0x3c00, ToyHalf(1.0f).getBits());
+  EXPECT_EQ(0xc000, ToyHalf(-2.0f).getBits());
+  EXPECT_EQ(0x7bff, ToyHalf(65504.0f).getBits());
+  EXPECT_EQ(0x7c00, ToyHalf(70000.0f).getBits());
+  EXPECT_EQ(0x0001, ToyHalf(ldexp(1.0f, -24)).getBits());
+  EXPECT_EQ(0x0000, ToyHalf(ldexp(1.0f, -26)).getBits());
+  // 1 + 2^-11 lies halfway between two halves and rounds to even.
+  EXPECT_EQ(0x3c00, ToyHalf(1.0f + ldexp(1.0f, -11)).getBits());
+  EXPECT_EQ(0x3c02, ToyHalf(1.0f + 3*ldexp(1.0f, -11)).getBits());
+
+  EXPECT_EQ(1.0f, float(ToyHalf::fromBits(0x3c00)));
+  EXPECT_EQ(ldexp(1.0f, -24), float(ToyHalf::fromBits(0x0001)));
+  EXPECT_EQ(ldexp(1023.0f, -24), float(ToyHalf::fromBits(0x03ff)));
+  EXPECT_EQ(-65504.0f, float(ToyHalf::fromBits(0xfbff)));
+  EXPECT_TRUE(std::isinf(float(ToyHalf::fromBits(0x7c00))));
+  EXPECT_TRUE(std::isnan(float(ToyHalf(numeric_limits<float>::quiet_NaN()))));
+
+  // Every half survives the round trip through float.
+  for (int bits=0; bits<0x10000; bits++) {
+    if ((bits & 0x7c00) == 0x7c00 && (bits & 0x3ff)) continue;
+    ToyHalf h = ToyHalf::fromBits((uint16_t)bits);
+    ASSERT_EQ(bits, ToyHalf(float(h)).getBits());
+  }
+}
+
+TEST(ToyHalfTest, BFloat16Conversion) {
+  EXPECT_EQ(0x3f80, ToyBFloat16(1.0f).getBits());
+  EXPECT_EQ(1.0f, float(ToyBFloat16(1.0f + ldexp(1.0f, -8))));
+  EXPECT_EQ(1.0f + ldexp(1.0f, -6), float(ToyBFloat16(1.0f + 3*ldexp(1.0f, -8))));
+  EXPECT_TRUE(std::isinf(float(ToyBFloat16(numeric_limits<float>::max()))));
+  EXPECT_TRUE(std::isnan(float(ToyBFloat16(numeric_limits<float>::quiet_NaN()))));
+}
+
+TEST(ToyHalfTest, ProductsAccumulateInFloat) {
+  // Large enough for the blocked kernels, with k spanning several blocks.
+  const int m = 40, k = 600, n = 30;
+  ToyMatrix<float> a(m, k), b(k, n);
+  for (int i=0; i<m; i++) {
+    for (int j=0; j<k; j++) a(i,j) = ((i + 2*j) % 7) * 0.25f;
+  }
+  for (int i=0; i<k; i++) {
+    for (int j=0; j<n; j++) b(i,j) = ((3*i + j) % 5) * 0.5f;
+  }
+  ToyMatrix<ToyHalf> ah = toyConvert<ToyHalf>(a);
+  ToyMatrix<ToyHalf> bh = toyConvert<ToyHalf>(b);
+  ToyMatrix<float> c = toyConvert<float>(ah * bh);
+  ToyMatrix<float> expected = a * b;
+  for (int i=0; i<m; i++) {
+    for (int j=0; j<n; j++) {
+      // Inputs are exact in half, only the result is rounded once.
+      EXPECT_EQ(float(ToyHalf(expected(i,j))), c(i,j)) << "row " << i << ", column " << j;
+    }
+  }
+
+  // Small products and transposed views.
+  ToyMatrix<ToyBFloat16> s(3, 3);
+  s.makeIdentity();
+  s(0,2) = 2.0f;
+  s.transpose();
+  ToyMatrix<float> st = toyConvert<float>(s);
+  EXPECT_TRUE(st.isTransposed());
+  EXPECT_EQ(2.0f, st(2,0));
+  ToyMatrix<ToyBFloat16> s2 = s * s;
+  EXPECT_EQ(4.0f, float(s2(2,0)));
+  s2 += s;
+  EXPECT_EQ(6.0f, float(s2(2,0)));
+}
+
+TEST(ToyHalfTest, DoubleAccumulationForFloat) {
+  // 1 + n tiny terms: float sums lose the tiny terms, double sums keep them.
+  const int k = 4096;
+  ToyMatrix<float> a(1, k+1), b(k+1, 1);
+  a(0,0) = 1.0f;
+  b(0,0) = 1.0f;
+  for (int i=1; i<=k; i++) {
+    a(0,i) = ldexp(1.0f, -13);
+    b(i,0) = ldexp(1.0f, -13);
+  }
+  float single = (a * b)(0,0);
+  EXPECT_EQ(1.0f, single);
+
+  toySetDoubleAccumulation(true);
+  float accurate = (a * b)(0,0);
+  ToyMatrix<float> big(64, k+1), bigB(k+1, 64);
+  for (int i=0; i<64; i++) {
+    for (int j=0; j<=k; j++) {
+      big(i,j) = a(0,j);
+      bigB(j,i) = b(j,0);
+    }
+  }
+  ToyMatrix<float> bigC = big * bigB;
+  toySetDoubleAccumulation(false);
+
+  float exact = 1.0f + k*ldexp(1.0f, -26);
+  EXPECT_EQ(exact, accurate);
+  for (int i=0; i<64; i++) EXPECT_EQ(exact, bigC(i, 63-i));
+}
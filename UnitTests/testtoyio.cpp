@@ -0,0 +1,222 @@
+#include "toyio.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+
+#include <gtest/gtest.h>
+
+#include <climits>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+using namespace std;
+
+TEST(ToyIOTest, CsvRoundTrip) {
+  ToyMatrix<double> m(3, 4);
+  for (int i=0; i<3; i++) {
+    for (int j=0; j<4; j++) m(i,j) = (i - 1.5) / (j + 3.0) * 1e10;
+  }
+  m(1,2) = 0.1;
+  m.transpose();
+
+  stringstream stream;
+  toyWriteCsv(stream, m);
+  ToyMatrix<double> read = toyReadCsv<double>(stream);
+  ASSERT_EQ(4, read.getNumRows());
+  ASSERT_EQ(3, read.getNumColumns());
+  for (int i=0; i<4; i++) {
+    for (int j=0; j<3; j++) EXPECT_EQ(m(i,j), read(i,j));
+  }
+
+  stringstream ints("# comment\n1;-2; 3\r\n\n40;+5;-60\n");
+  ToyMatrix<int> im = toyReadCsv<int>(ints, ';');
+  ASSERT_EQ(2, im.getNumRows());
+  EXPECT_EQ(3, im(0,2)); EXPECT_EQ(5, im(1,1)); EXPECT_EQ(-60, im(1,2));
+  stringstream out;
+  toyWriteCsv(out, im, ';');
+  EXPECT_EQ("1;-2;3\n40;5;-60\n", out.str());
+}
+
+TEST(ToyIOTest, CsvErrors) {
+  stringstream missing("1,2,3\n4,,6\n");
+  EXPECT_THROW(toyReadCsv<double>(missing), ToyIOError);
+  stringstream shortRow("1,2,3\n4,5\n6,7,8\n");
+  try {
+    toyReadCsv<float>(shortRow);
+    FAIL();
+  } catch (const ToyIOError& error) {
+    EXPECT_EQ("line 2: expected delimiter", error.Message);
+  }
+  stringstream longRow("1,2\n3,4,5\n");
+  EXPECT_THROW(toyReadCsv<int>(longRow), ToyIOError);
+  EXPECT_THROW(toyReadCsv<int>(string("/nonexistent/matrix.csv")), ToyIOError);
+  // Line numbers count comments and blank lines too.
+  stringstream overflow("# comment\n1,2\n\n3,4294967296\n");
+  try {
+    toyReadCsv<int>(overflow);
+    FAIL();
+  } catch (const ToyIOError& error) {
+    EXPECT_EQ("line 4: number out of range", error.Message);
+  }
+  stringstream huge("99999999999999999999\n");
+  EXPECT_THROW(toyReadCsv<long long>(huge), ToyIOError);
+  stringstream extremes("-9223372036854775808,9223372036854775807\n");
+  ToyMatrix<long long> e = toyReadCsv<long long>(extremes);
+  EXPECT_EQ(LLONG_MIN, e(0,0)); EXPECT_EQ(LLONG_MAX, e(0,1));
+}
+
+TEST(ToyIOTest, LargeInputIsParsedInParallel) {
+  // Several megabytes, above TOYIO_PARALLEL_BYTES.
+  const int rows = 2000, columns = 150;
+  ToyMatrix<float> m(rows, columns);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) m(i,j) = sin(i*0.37f + j*1.1f) * 1000.0f;
+  }
+  stringstream stream;
+  toyWriteCsv(stream, m);
+  ASSERT_GT(stream.str().size(), (size_t)TOYIO_PARALLEL_BYTES);
+  ToyMatrix<float> read = toyReadCsv<float>(stream);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) ASSERT_EQ(m(i,j), read(i,j));
+  }
+
+  stringstream market;
+  toyWriteMatrixMarket(market, m);
+  ToyMatrix<float> readMarket = toyReadMatrixMarket<float>(market);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) ASSERT_EQ(m(i,j), readMarket(i,j));
+  }
+
+  // With errors in several chunks the first bad line is reported.
+  string text = stream.str();
+  for (int r=0; r<5; r++) {
+    string broken = text;
+    size_t late = broken.find('\n', broken.size() - 100) + 1;
+    broken.insert(late, "x");
+    size_t early = 0;
+    for (int i=0; i<300; i++) early = broken.find('\n', early) + 1;
+    broken.insert(early, "y");
+    stringstream in(broken);
+    try {
+      toyReadCsv<float>(in);
+      FAIL();
+    } catch (const ToyIOError& error) {
+      EXPECT_EQ("line 301: expected a number", error.Message);
+    }
+  }
+
+  // Duplicate coordinate entries: the last one in the file wins.
+  ostringstream coordinate;
+  coordinate << "%%MatrixMarket matrix coordinate real general\n4 4 " << 200000 << "\n";
+  for (int e=0; e<200000; e++) coordinate << (e % 4 + 1) << " " << (e % 3 + 1) << " " << e << "\n";
+  ASSERT_GT(coordinate.str().size(), (size_t)TOYIO_PARALLEL_BYTES);
+  stringstream coordinateIn(coordinate.str());
+  ToyMatrix<double> last = toyReadMatrixMarket<double>(coordinateIn);
+  for (int e=200000-12; e<200000; e++) EXPECT_EQ(e, last(e % 4, e % 3));
+}
+
+TEST(ToyIOTest, DecimalPointIgnoresLocale) {
+  const char* locales[] = {"de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "nl_NL.UTF-8"};
+  const char* locale = 0;
+  for (size_t i=0; i<sizeof(locales)/sizeof(locales[0]) && !locale; i++) {
+    locale = setlocale(LC_NUMERIC, locales[i]);
+  }
+  // No decimal-comma locale installed.
+  if (!locale) return;
+  char probe[16];
+  snprintf(probe, sizeof(probe), "%g", 1.5);
+  EXPECT_STREQ("1,5", probe);
+
+  ToyMatrix<double> m(1, 2);
+  m(0,0) = 1.5; m(0,1) = -0.25;
+  stringstream csv;
+  toyWriteCsv(csv, m);
+  EXPECT_EQ("1.5,-0.25\n", csv.str());
+  ToyMatrix<double> read = toyReadCsv<double>(csv);
+  EXPECT_EQ(1.5, read(0,0)); EXPECT_EQ(-0.25, read(0,1));
+  stringstream market("%%MatrixMarket matrix array real general\n2 1\n2.5\n1e-3\n");
+  ToyMatrix<float> f = toyReadMatrixMarket<float>(market);
+  EXPECT_EQ(2.5f, f(0,0)); EXPECT_EQ(1e-3f, f(1,0));
+  setlocale(LC_NUMERIC, "C");
+}
+
+TEST(ToyIOTest, MatrixMarket) {
+  ToyMatrix<int> m(2, 3);
+  m(0,0) = 1; m(0,1) = 2; m(0,2) = 3; m(1,0) = -4; m(1,2) = 6;
+  stringstream out;
+  toyWriteMatrixMarket(out, m);
+  EXPECT_EQ("%%MatrixMarket matrix array integer general\n2 3\n1\n-4\n2\n0\n3\n6\n", out.str());
+
+  stringstream coordinate("%%MatrixMarket matrix coordinate real symmetric\n"
+                          "% a comment\n"
+                          "3 3 3\n"
+                          "1 1 2.5\n"
+                          "3 1 -1e2\n"
+                          "2 2 4\n");
+  ToyMatrix<double> c = toyReadMatrixMarket<double>(coordinate);
+  EXPECT_EQ(2.5, c(0,0)); EXPECT_EQ(-100, c(2,0)); EXPECT_EQ(-100, c(0,2));
+  EXPECT_EQ(4, c(1,1)); EXPECT_EQ(0, c(1,2));
+
+  stringstream pattern("%%MatrixMarket matrix coordinate pattern general\n2 2 1\n2 1\n");
+  ToyMatrix<float> p = toyReadMatrixMarket<float>(pattern);
+  EXPECT_EQ(1.0f, p(1,0)); EXPECT_EQ(0.0f, p(0,1));
+
+  stringstream skew("%%MatrixMarket matrix array real skew-symmetric\n3 3\n1\n2\n3\n");
+  ToyMatrix<double> s = toyReadMatrixMarket<double>(skew);
+  EXPECT_EQ(1, s(1,0)); EXPECT_EQ(-1, s(0,1)); EXPECT_EQ(3, s(2,1)); EXPECT_EQ(0, s(2,2));
+
+  stringstream bad("%%MatrixMarket matrix coordinate real general\n2 2 1\n3 1 1\n");
+  EXPECT_THROW(toyReadMatrixMarket<double>(bad), ToyIOError);
+  stringstream noHeader("2 2\n1\n2\n3\n4\n");
+  EXPECT_THROW(toyReadMatrixMarket<double>(noHeader), ToyIOError);
+
+  // Symmetric files must be square, sizes positive.
+  stringstream wide("%%MatrixMarket matrix coordinate real symmetric\n2 3 1\n1 3 5\n");
+  EXPECT_THROW(toyReadMatrixMarket<double>(wide), ToyIOError);
+  stringstream wideDense("%%MatrixMarket matrix array real symmetric\n3 2\n1\n2\n3\n4\n5\n");
+  EXPECT_THROW(toyReadMatrixMarket<double>(wideDense), ToyIOError);
+  stringstream negative("%%MatrixMarket matrix array real general\n-2 2\n");
+  EXPECT_THROW(toyReadMatrixMarket<double>(negative), ToyIOError);
+  stringstream empty("%%MatrixMarket matrix coordinate real general\n0 3 0\n");
+  EXPECT_THROW(toyReadMatrixMarket<double>(empty), ToyIOError);
+
+  // Like CSV, nothing but blanks may follow the last number of a line.
+  stringstream trailing("%%MatrixMarket matrix array real general\n1 2\n1.5 junk\n2\n");
+  try {
+    toyReadMatrixMarket<double>(trailing);
+    FAIL();
+  } catch (const ToyIOError& error) {
+    EXPECT_EQ("line 3: unexpected text after the number", error.Message);
+  }
+  stringstream blanks("%%MatrixMarket matrix array real general\n1 2 \n1.5 \t\r\n2\n");
+  EXPECT_EQ(1.5, toyReadMatrixMarket<double>(blanks)(0,0));
+  stringstream real("%%MatrixMarket matrix array real general\n1 1\n2.7\n");
+  EXPECT_THROW(toyReadMatrixMarket<int>(real), ToyIOError);
+  stringstream extra("%%MatrixMarket matrix coordinate real general\n2 2 1\n1 1 3 4\n");
+  EXPECT_THROW(toyReadMatrixMarket<double>(extra), ToyIOError);
+  stringstream extraPattern("%%MatrixMarket matrix coordinate pattern general\n2 2 1\n1 1 1\n");
+  EXPECT_THROW(toyReadMatrixMarket<double>(extraPattern), ToyIOError);
+  stringstream wrapped("%%MatrixMarket matrix array integer general\n1 1\n3000000000\n");
+  EXPECT_THROW(toyReadMatrixMarket<int>(wrapped), ToyIOError);
+}
+
+TEST(ToyIOTest, Vectors) {
+  int* entries = new int[5];
+  for (int i=0; i<5; i++) entries[i] = i*i;
+  ToyVector<int> v(5, entries);
+  stringstream csv;
+  toyWriteCsv(csv, v);
+  EXPECT_EQ("0\n1\n4\n9\n16\n", csv.str());
+  ToyVector<int> read = toyReadCsvVector<int>(csv);
+  ASSERT_EQ(5, read.getNumEntries());
+  EXPECT_EQ(16, read(4));
+
+  stringstream row("1.5,2.5,3.5\n");
+  ToyVector<double> fromRow = toyReadCsvVector<double>(row);
+  ASSERT_EQ(3, fromRow.getNumEntries());
+  EXPECT_EQ(3.5, fromRow(2));
+
+  stringstream market;
+  toyWriteMatrixMarket(market, v);
+  EXPECT_EQ(9, toyReadMatrixMarketVector<int>(market)(3));
+}
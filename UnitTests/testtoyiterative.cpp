@@ -0,0 +1,123 @@
+#include "toyiterative.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+using namespace std;
+
+// SPD tridiagonal matrix with a strongly varying diagonal, which
+// is where Jacobi preconditioning pays off.
+static ToyMatrix<double> makeSPDMatrix(int n)
+{
+  ToyMatrix<double> a(n, n);
+  for (int i=0; i<n; i++) {
+    a(i,i) = 2.0 + (i % 10) * 50.0;
+    if (i > 0)   a(i,i-1) = -1.0;
+    if (i < n-1) a(i,i+1) = -1.0;
+  }
+  return a;
+}
+
+static ToyVector<double> makeRhs(const ToyMatrix<double>& a, const ToyVector<double>& x)
+{
+  int n = a.getNumRows();
+  double* entries = new double[n];
+  for (int i=0; i<n; i++) {
+    entries[i] = 0.0;
+    for (int j=0; j<n; j++) entries[i] += a(i,j) * x(j);
+  }
+  return ToyVector<double>(n, entries);
+}
+
+static ToyVector<double> makeSolution(int n)
+{
+  double* entries = new double[n];
+  for (int i=0; i<n; i++) entries[i] = sin(0.1*i);
+  return ToyVector<double>(n, entries);
+}
+
+static ToyVector<double> zeros(int n)
+{
+  double* entries = new double[n];
+  for (int i=0; i<n; i++) entries[i] = 0.0;
+  return ToyVector<double>(n, entries);
+}
+
+TEST(ToyIterativeTest, ConjugateGradient) {
+  const int n = 200;
+  ToyMatrix<double> a = makeSPDMatrix(n);
+  ToyVector<double> expected = makeSolution(n);
+  ToyVector<double> b = makeRhs(a, expected);
+
+  ToyIterativeSolver<double> solver(1000, 1e-12);
+  ToyVector<double> x = zeros(n);
+  ToySolverStatus<double> plain = solver.conjugateGradient(a, b, x);
+  EXPECT_TRUE(plain.Converged);
+  for (int i=0; i<n; i++) EXPECT_NEAR(expected(i), x(i), 1e-9);
+
+  solver.setJacobiPreconditioner(a);
+  ToyVector<double> y = zeros(n);
+  ToySolverStatus<double> jacobi = solver.conjugateGradient(a, b, y);
+  EXPECT_TRUE(jacobi.Converged);
+  EXPECT_LT(jacobi.Iterations, plain.Iterations);
+  for (int i=0; i<n; i++) EXPECT_NEAR(expected(i), y(i), 1e-9);
+}
+
+TEST(ToyIterativeTest, BiCGStabNonSymmetric) {
+  const int n = 150;
+  ToyMatrix<double> a = makeSPDMatrix(n);
+  for (int i=0; i<n-2; i++) a(i,i+2) = 0.5;
+  ToyVector<double> expected = makeSolution(n);
+  ToyVector<double> b = makeRhs(a, expected);
+
+  ToyIterativeSolver<double> solver(500, 1e-12);
+  solver.setJacobiPreconditioner(a);
+  ToyVector<double> x = zeros(n);
+  ToySolverStatus<double> status = solver.biCGStab(a, b, x);
+  EXPECT_TRUE(status.Converged);
+  EXPECT_LE(status.Residual, 1e-12);
+  for (int i=0; i<n; i++) EXPECT_NEAR(expected(i), x(i), 1e-9);
+}
+
+TEST(ToyIterativeTest, CustomOperatorAndCallbacks) {
+  // Matrix-free 1D Laplacian plus identity.
+  const int n = 100;
+  auto laplacian = [n](const double* x, double* y) {
+    for (int i=0; i<n; i++) {
+      y[i] = 3.0*x[i];
+      if (i > 0)   y[i] -= x[i-1];
+      if (i < n-1) y[i] -= x[i+1];
+    }
+  };
+  double* bp = new double[n];
+  for (int i=0; i<n; i++) bp[i] = 1.0;
+  ToyVector<double> b(n, bp);
+
+  int reported = 0, timed = 0;
+  double lastResidual = 1.0;
+  ToyIterativeSolver<double> solver(1000, 1e-10);
+  solver.setConvergenceCallback([&](int iteration, double residual) {
+    reported = iteration;
+    lastResidual = residual;
+    return true;
+  });
+  solver.setTimingCallback([&](int, double seconds) {
+    EXPECT_GE(seconds, 0.0);
+    timed++;
+  });
+  ToyVector<double> x = zeros(n);
+  ToySolverStatus<double> status = solver.conjugateGradient(laplacian, b, x);
+  EXPECT_TRUE(status.Converged);
+  EXPECT_EQ(status.Iterations, reported);
+  EXPECT_EQ(status.Iterations, timed);
+  EXPECT_DOUBLE_EQ(status.Residual, lastResidual);
+
+  // Returning false from the callback stops the solver.
+  solver.setConvergenceCallback([](int iteration, double) { return iteration < 3; });
+  ToyVector<double> y = zeros(n);
+  status = solver.conjugateGradient(laplacian, b, y);
+  EXPECT_FALSE(status.Converged);
+  EXPECT_EQ(3, status.Iterations);
+}
@@ -0,0 +1,154 @@
+#include "toylu.h"
+#include "toyparallel.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <stdexcept>
+using namespace std;
+
+// Fills a diagonally dominant n x n matrix, which is safely non-singular
+// but still needs pivoting because of the large off-diagonal first column.
+static ToyMatrix<double> makeTestMatrix(int n)
+{
+  ToyMatrix<double> a(n, n);
+  srand(42);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<n; j++) {
+      a(i,j) = (rand() % 1000) / 1000.0 - 0.5;
+    }
+    a(i,i) += n;
+    a(i,0) += 2*n;
+  }
+  return a;
+}
+
+TEST(ToyLUTest, SolveSmallSystem) {
+  double entries[] = {0.0, 2.0, 1.0,
+                      1.0, 1.0, 1.0,
+                      2.0, 1.0, 3.0};
+  double *entriesp = new double[3*3];
+  memcpy(entriesp, &entries, 3*3*sizeof(double));
+  ToyMatrix<double> a(3, 3, entriesp);
+
+  // a(0,0) is zero, so this only works with pivoting.
+  ToyLU<double> lu(a);
+  EXPECT_FALSE(lu.isSingular());
+  EXPECT_DOUBLE_EQ(-3.0, lu.determinant());
+
+  double *bp = new double[3];
+  bp[0] = 7.0; bp[1] = 6.0; bp[2] = 13.0;
+  ToyVector<double> b(3, bp);
+  ToyVector<double> x = lu.solve(b);
+  EXPECT_DOUBLE_EQ(1.0, x(0)); EXPECT_DOUBLE_EQ(2.0, x(1)); EXPECT_DOUBLE_EQ(3.0, x(2));
+}
+
+TEST(ToyLUTest, BlockedSolveMatchesProduct) {
+  const int n = 150;
+  ToyMatrix<double> a = makeTestMatrix(n);
+
+  double *xp = new double[n];
+  for (int i=0; i<n; i++) xp[i] = i % 7 - 3.0;
+  ToyVector<double> expected(n, xp);
+  // Not a*expected: ToyVector keeps a homogeneous last entry.
+  double *bp = new double[n];
+  for (int i=0; i<n; i++) {
+    bp[i] = 0.0;
+    for (int j=0; j<n; j++) bp[i] += a(i,j) * expected(j);
+  }
+  ToyVector<double> b(n, bp);
+
+  // Block sizes that do and do not divide n.
+  int blockSizes[] = {1, 16, 64, 200};
+  for (int s=0; s<4; s++) {
+    ToyLU<double> lu(a, blockSizes[s]);
+    ToyVector<double> x = lu.solve(b);
+    for (int i=0; i<n; i++) {
+      EXPECT_NEAR(expected(i), x(i), 1e-9) << "block size " << blockSizes[s] << ", row " << i;
+    }
+  }
+}
+
+TEST(ToyLUTest, MultipleRightHandSides) {
+  const int n = 90, numRhs = 5;
+  ToyMatrix<double> a = makeTestMatrix(n);
+  ToyMatrix<double> expected(n, numRhs);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<numRhs; j++) expected(i,j) = (i*numRhs + j) % 11 - 5.0;
+  }
+  ToyMatrix<double> b = a * expected;
+
+  // Factor once, solve twice.
+  ToyLU<double> lu(a, 32);
+  ToyMatrix<double> x = lu.solve(b);
+  ASSERT_EQ(n, x.getNumRows());
+  ASSERT_EQ(numRhs, x.getNumColumns());
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<numRhs; j++) EXPECT_NEAR(expected(i,j), x(i,j), 1e-9);
+  }
+
+  // A transposed right-hand side is read through its strides.
+  ToyMatrix<double> bCopy(numRhs, n);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<numRhs; j++) bCopy(j,i) = b(i,j);
+  }
+  bCopy.transpose();
+  ToyMatrix<double> x2 = lu.solve(bCopy);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<numRhs; j++) EXPECT_NEAR(expected(i,j), x2(i,j), 1e-9);
+  }
+}
+
+TEST(ToyLUTest, SingularMatrixThrows) {
+  ToyMatrix<double> a(3, 3);
+  a(0,0) = 1.0; a(0,1) = 2.0; a(0,2) = 3.0;
+  a(1,0) = 2.0; a(1,1) = 4.0; a(1,2) = 6.0;
+  a(2,0) = 1.0; a(2,1) = 0.0; a(2,2) = 1.0;
+
+  ToyLU<double> lu(a);
+  EXPECT_TRUE(lu.isSingular());
+
+  bool caught = false;
+  try {
+    lu.solve(ToyVector<double>(3));
+  }
+  catch (SingularMatrix) {
+    caught = true;
+  }
+  EXPECT_TRUE(caught);
+}
+
+TEST(ToyLUTest, EmptyMatrix) {
+  ToyMatrix<double> a(0, 0);
+  ToyLU<double> lu(a);
+  EXPECT_FALSE(lu.isSingular());
+  EXPECT_EQ(1.0, lu.determinant());
+}
+
+TEST(ToyLUTest, ParallelForRethrows) {
+  ToyThreadPool pool(4);
+  // Thrown on the calling thread (chunk 0) and on a worker (the last chunk).
+  for (int throwAt=0; throwAt<1000; throwAt+=999) {
+    atomic<int> calls(0);
+    bool caught = false;
+    try {
+      pool.parallelFor(0, 1000, [&](int lo, int hi) {
+        calls++;
+        if (lo <= throwAt && throwAt < hi) throw runtime_error("chunk failed");
+      });
+    } catch (const runtime_error&) {
+      caught = true;
+    }
+    EXPECT_TRUE(caught);
+    EXPECT_LE(calls, 4);
+  }
+  // The pool is still usable afterwards.
+  atomic<int> sum(0);
+  pool.parallelFor(0, 100, [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) sum += i;
+  });
+  EXPECT_EQ(4950, sum);
+}
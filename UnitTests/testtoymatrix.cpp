@@ -5,6 +5,8 @@
 
 #include <limits>
 #include <cstdio>
+#include <thread>
+#include <vector>
 using namespace std;
 
 TEST(ToyMatrixTest, DefaultContructed) {
@@ -287,3 +289,214 @@ TEST(ToyMatrixTest, MultiplyAndTranspose) {
   EXPECT_FLOAT_EQ(520082.0, fMatrix4(1,0)); EXPECT_FLOAT_EQ(1508730.0, fMatrix4(1,1));
 }
 
+
+TEST(ToyMatrixTest, UninitializedAndIdentity) {
+  ToyMatrix<float> uninitialized(3, 5, toyUninitialized);
+  EXPECT_EQ(3, uninitialized.getNumRows());
+  EXPECT_EQ(5, uninitialized.getNumColumns());
+  EXPECT_EQ(false, uninitialized.isTransposed());
+
+  // Identity of a fresh (zero-tagged) matrix and of one with stale entries.
+  ToyMatrix<int> fresh(3, 3);
+  fresh.makeIdentity();
+  ToyMatrix<int> stale(3, 3, toyUninitialized);
+  for (int i=0; i<3; i++) {
+    for (int j=0; j<3; j++) stale(i,j) = 7;
+  }
+  stale.makeIdentity();
+  for (int i=0; i<3; i++) {
+    for (int j=0; j<3; j++) {
+      EXPECT_EQ(i==j ? 1 : 0, fresh(i,j));
+      EXPECT_EQ(i==j ? 1 : 0, stale(i,j));
+    }
+  }
+
+  // Large products overwrite their uninitialised result.
+  ToyMatrix<float> a(80, 70);
+  ToyMatrix<float> b(70, 60);
+  for (int i=0; i<80; i++) {
+    for (int j=0; j<70; j++) a(i,j) = (i+j) % 5;
+  }
+  for (int i=0; i<70; i++) {
+    for (int j=0; j<60; j++) b(i,j) = (i*j) % 3;
+  }
+  ToyMatrix<float> c = a*b;
+  for (int i=0; i<80; i+=7) {
+    for (int j=0; j<60; j+=5) {
+      float expected = 0;
+      for (int k=0; k<70; k++) expected += a(i,k) * b(k,j);
+      EXPECT_FLOAT_EQ(expected, c(i,j));
+    }
+  }
+}
+
+TEST(ToyMatrixTest, CopyOnWriteSharing) {
+  ToyMatrix<int> a(3, 3);
+  a.makeIdentity();
+  EXPECT_FALSE(a.hasSharedStorage());
+  a.setSharedStorage(true);
+
+  ToyMatrix<int> b(a);
+  ToyMatrix<int> c(2, 2);
+  c = a;
+  const ToyMatrix<int>& ca = a;
+  const ToyMatrix<int>& cb = b;
+  EXPECT_EQ(3, a.getUseCount());
+  EXPECT_EQ(ca.getEntries(), cb.getEntries());
+  EXPECT_EQ(1, cb(1,1));
+
+  // Writing detaches the written matrix only.
+  b(0,1) = 5;
+  EXPECT_EQ(2, a.getUseCount());
+  EXPECT_EQ(1, b.getUseCount());
+  EXPECT_NE(ca.getEntries(), cb.getEntries());
+  EXPECT_EQ(0, ca(0,1));
+  EXPECT_EQ(5, cb(0,1));
+
+  c += a;
+  EXPECT_EQ(1, a.getUseCount());
+  EXPECT_EQ(2, c(2,2));
+  EXPECT_EQ(1, ca(2,2));
+
+  ToyMatrix<int> d(a);
+  d *= b;
+  EXPECT_EQ(5, d(0,1));
+  EXPECT_EQ(0, ca(0,1));
+  EXPECT_TRUE(d.hasSharedStorage());
+
+  ToyMatrix<int> e(a);
+  ToyMatrix<int> scaled = e * 3;
+  EXPECT_EQ(3, scaled(2,2));
+  EXPECT_EQ(1, ca(2,2));
+  e.makeIdentity();
+  EXPECT_EQ(1, a.getUseCount());
+
+  // Copies of unshared matrices stay deep copies.
+  a.setSharedStorage(false);
+  ToyMatrix<int> f(a);
+  EXPECT_FALSE(f.hasSharedStorage());
+  EXPECT_NE(ca.getEntries(), static_cast<const ToyMatrix<int>&>(f).getEntries());
+}
+
+TEST(ToyMatrixTest, SharedAcrossThreads) {
+  ToyMatrix<double> a(50, 50);
+  for (int i=0; i<50; i++) a(i,i) = i;
+  a.setSharedStorage(true);
+
+  vector<thread> threads;
+  vector<double> sums(8, 0.0);
+  for (int t=0; t<8; t++) {
+    threads.push_back(thread([&, t]() {
+      for (int round=0; round<100; round++) {
+        ToyMatrix<double> copy(a);
+        const ToyMatrix<double>& view = copy;
+        sums[t] += view(t, t);
+        if (round % 10 == 0) copy(0, 0) = -1.0;
+      }
+    }));
+  }
+  for (size_t t=0; t<threads.size(); t++) threads[t].join();
+  for (int t=0; t<8; t++) EXPECT_EQ(100.0*t, sums[t]);
+  EXPECT_EQ(1, a.getUseCount());
+  EXPECT_EQ(0.0, static_cast<const ToyMatrix<double>&>(a)(0, 0));
+}
+
+static bool sameEntries(const ToyMatrix<int>& a, const ToyMatrix<int>& b)
+{
+  if (a.getNumRows() != b.getNumRows() || a.getNumColumns() != b.getNumColumns()) return false;
+  for (int i=0; i<a.getNumRows(); i++) {
+    for (int j=0; j<a.getNumColumns(); j++) {
+      if (a(i,j) != b(i,j)) return false;
+    }
+  }
+  return true;
+}
+
+TEST(ToyMatrixTest, StructureTags) {
+  ToyMatrix<int> zero(3, 3);
+  EXPECT_TRUE(zero.hasStructure(ToyStructureZero | ToyStructureDiagonal | ToyStructureUpper));
+  ToyMatrix<int> identity(4, 4, toyUninitialized);
+  EXPECT_EQ(ToyStructureNone, identity.getStructure());
+  identity.makeIdentity();
+  EXPECT_TRUE(identity.hasStructure(ToyStructureIdentity | ToyStructureAffine));
+  EXPECT_FALSE(identity.hasStructure(ToyStructureZero));
+
+  // Writing through operator() drops the tags; detectStructure() finds them again.
+  ToyMatrix<int> upper(4, 4);
+  for (int i=0; i<4; i++) {
+    for (int j=i; j<4; j++) upper(i,j) = i + j + 1;
+  }
+  EXPECT_EQ(ToyStructureNone, upper.getStructure());
+  EXPECT_EQ(ToyStructureUpper, upper.detectStructure());
+  upper.transpose();
+  EXPECT_EQ(ToyStructureLower, upper.getStructure());
+  upper.transpose();
+
+  // The shortcuts give the same results as the dense products.
+  ToyMatrix<int> dense(4, 4);
+  for (int i=0; i<4; i++) {
+    for (int j=0; j<4; j++) dense(i,j) = (i*3 + j*5) % 7 - 3;
+  }
+  ToyMatrix<int> diagonal(4, 4);
+  for (int i=0; i<4; i++) diagonal(i,i) = i - 2;
+  diagonal.setStructure(ToyStructureDiagonal);
+  ToyMatrix<int> affine(dense);
+  for (int j=0; j<4; j++) affine(3,j) = (j == 3) ? 1 : 0;
+  EXPECT_TRUE(affine.detectStructure() & ToyStructureAffine);
+
+  ToyMatrix<int> plainDiagonal(diagonal), plainAffine(affine);
+  // Writes through the non-const operator() on the copies only.
+  plainDiagonal(0,0) = static_cast<const ToyMatrix<int>&>(diagonal)(0,0);
+  plainAffine(0,0) = static_cast<const ToyMatrix<int>&>(affine)(0,0);
+  EXPECT_EQ(ToyStructureNone, plainDiagonal.getStructure());
+
+  EXPECT_TRUE(sameEntries(identity*dense, dense));
+  EXPECT_TRUE(sameEntries(dense*identity, dense));
+  EXPECT_TRUE(sameEntries(zero*ToyMatrix<int>(3, 2), ToyMatrix<int>(3, 2)));
+  EXPECT_TRUE(sameEntries(diagonal*dense, plainDiagonal*dense));
+  EXPECT_TRUE(sameEntries(dense*diagonal, dense*plainDiagonal));
+  EXPECT_TRUE((diagonal*diagonal).hasStructure(ToyStructureDiagonal));
+  EXPECT_TRUE(sameEntries(diagonal*diagonal, plainDiagonal*plainDiagonal));
+  EXPECT_TRUE(sameEntries(affine*affine, plainAffine*plainAffine));
+  EXPECT_TRUE((affine*affine).hasStructure(ToyStructureAffine));
+  EXPECT_TRUE((upper*upper).hasStructure(ToyStructureUpper));
+
+  EXPECT_TRUE(sameEntries(dense + ToyMatrix<int>(4, 4), dense));
+  EXPECT_TRUE(sameEntries(diagonal + identity, plainDiagonal + identity));
+  EXPECT_TRUE(sameEntries(diagonal - identity, plainDiagonal - identity));
+  ToyMatrix<int> sum(diagonal);
+  sum += identity;
+  EXPECT_TRUE(sameEntries(sum, plainDiagonal + identity));
+  EXPECT_TRUE(sum.hasStructure(ToyStructureDiagonal));
+
+  // A tall diagonal factor has zero rows below its diagonal.
+  ToyMatrix<int> tall(3, 2);
+  tall(0,0) = 2; tall(1,1) = 3;
+  tall.setStructure(ToyStructureDiagonal);
+  ToyMatrix<int> square(2, 2);
+  square(0,0) = 1; square(0,1) = 2; square(1,0) = 3; square(1,1) = 4;
+  ToyMatrix<int> plainTall(tall);
+  plainTall(0,0) = 2;
+  EXPECT_TRUE(sameEntries(tall*square, plainTall*square));
+
+  ToyVector<int> x;
+  x(0) = 1; x(1) = 2; x(2) = 3; x(3) = 4;
+  ToyVector<int> y = diagonal*x, z = plainDiagonal*x;
+  for (int i=0; i<4; i++) EXPECT_EQ(z(i), y(i));
+
+  // Shortcut results are row-major like computed ones.
+  ToyMatrix<int> denseT(dense);
+  denseT.transpose();
+  ToyMatrix<int> product(identity);
+  product *= denseT;
+  EXPECT_FALSE(product.isTransposed());
+  EXPECT_TRUE(sameEntries(product, denseT));
+  product = denseT;
+  product *= identity;
+  EXPECT_FALSE(product.isTransposed());
+  EXPECT_TRUE(sameEntries(product, denseT));
+  EXPECT_FALSE((ToyMatrix<int>(4, 4) + denseT).isTransposed());
+  EXPECT_FALSE((denseT + ToyMatrix<int>(4, 4)).isTransposed());
+  EXPECT_FALSE((denseT - ToyMatrix<int>(4, 4)).isTransposed());
+  EXPECT_EQ(denseT(1,2), (denseT - ToyMatrix<int>(4, 4))(1,2));
+}
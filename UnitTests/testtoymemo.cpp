@@ -0,0 +1,98 @@
+#include "toymemo.h"
+#include "toymatrix.h"
+#include "testmatrices.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST(ToyMemoTest, Fingerprints) {
+  ToyMatrix<double> a = makeTestMatrix<double>(5, 7, 1), b = makeTestMatrix<double>(5, 7, 1);
+  EXPECT_EQ(toyFingerprint(a), toyFingerprint(b));
+  b(4,6) += 1;
+  EXPECT_NE(toyFingerprint(a), toyFingerprint(b));
+
+  // Same entries in a different shape or transposed state.
+  ToyMatrix<double> c = makeTestMatrix<double>(7, 5, 1);
+  ToyMatrix<double> d(c);
+  d.transpose();
+  EXPECT_NE(toyFingerprint(c), toyFingerprint(d));
+  EXPECT_NE(toyHashBytes("abc", 3), toyHashBytes("abd", 3));
+  EXPECT_NE(toyHashBytes("abc", 3), toyHashBytes("abc", 3, 1));
+}
+
+TEST(ToyMemoTest, HitsMissesAndEviction) {
+  ToyProductCache<double> cache(2);
+  ToyMatrix<double> view = makeTestMatrix<double>(4, 4, 2), projection = makeTestMatrix<double>(4, 4, 5);
+  ToyMatrix<double> expected = view*projection;
+
+  ToyMatrix<double> first = cache.multiply(view, projection);
+  ToyMatrix<double> second = cache.multiply(makeTestMatrix<double>(4, 4, 2), makeTestMatrix<double>(4, 4, 5));
+  ToyProductCacheStats stats = cache.getStats();
+  EXPECT_EQ(1, stats.Hits);
+  EXPECT_EQ(1, stats.Misses);
+  EXPECT_EQ(1, stats.Size);
+  for (int i=0; i<4; i++) {
+    for (int j=0; j<4; j++) {
+      EXPECT_EQ(expected(i,j), first(i,j));
+      EXPECT_EQ(expected(i,j), second(i,j));
+    }
+  }
+
+  // Writing to a result does not change the cached product.
+  second(0,0) = 1000;
+  EXPECT_EQ(expected(0,0), cache.multiply(view, projection)(0,0));
+
+  // A changed operand misses; the least recently used product goes first.
+  ToyMatrix<double> moved(view);
+  moved(0,0) += 1;
+  cache.multiply(moved, projection);
+  cache.multiply(view, projection);
+  cache.multiply(projection, view);
+  stats = cache.getStats();
+  EXPECT_EQ(1, stats.Evictions);
+  EXPECT_EQ(2, stats.Size);
+  cache.multiply(view, projection);
+  cache.multiply(moved, projection);
+  stats = cache.getStats();
+  EXPECT_EQ(4, stats.Hits);
+  EXPECT_EQ(4, stats.Misses);
+
+  cache.setCapacity(1);
+  EXPECT_EQ(1, cache.getStats().Size);
+  cache.clear();
+  cache.resetStats();
+  EXPECT_EQ(0, cache.getStats().Size);
+  EXPECT_EQ(0, cache.getStats().Hits);
+}
+
+TEST(ToyMemoTest, ConcurrentUse) {
+  ToyProductCache<double> cache(8);
+  vector<ToyMatrix<double> > operands;
+  for (int s=0; s<4; s++) operands.push_back(makeTestMatrix<double>(6, 6, s));
+  vector<int> errors(4, 0);
+  vector<thread> threads;
+  for (int t=0; t<4; t++) {
+    threads.push_back(thread([&, t]() {
+      for (int r=0; r<50; r++) {
+        const ToyMatrix<double>& a = operands[(t + r) % 4];
+        const ToyMatrix<double>& b = operands[r % 4];
+        ToyMatrix<double> product = cache.multiply(a, b);
+        ToyMatrix<double> expected = a*b;
+        for (int i=0; i<6; i++) {
+          for (int j=0; j<6; j++) {
+            if (product(i,j) != expected(i,j)) errors[t]++;
+          }
+        }
+      }
+    }));
+  }
+  for (size_t t=0; t<threads.size(); t++) threads[t].join();
+  for (int t=0; t<4; t++) EXPECT_EQ(0, errors[t]);
+  ToyProductCacheStats stats = cache.getStats();
+  EXPECT_EQ(200, stats.Hits + stats.Misses);
+  EXPECT_GT(stats.Hits, 0);
+}
@@ -0,0 +1,117 @@
+#include "toynuma.h"
+#include "toymatrix.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static long totalPages(const ToyPagePlacement& placement)
+{
+  long pages = placement.UnplacedPages;
+  for (size_t i=0; i<placement.PagesPerNode.size(); i++) pages += placement.PagesPerNode[i];
+  return pages;
+}
+
+TEST(ToyNumaTest, LargeMatricesAreZeroedInParallel) {
+  // 700*700 doubles are well above TOYMATRIX_NUMA_THRESHOLD.
+  const int n = 700;
+  ToyMatrix<double> a(n, n);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<n; j++) ASSERT_EQ(0.0, a(i,j));
+  }
+
+  ToyPagePlacement placement = a.getPagePlacement();
+  ASSERT_EQ(toyNumaNodeCount(), (int)placement.PagesPerNode.size());
+  size_t bytes = (size_t)n*n*sizeof(double);
+  long expectedPages = (long)((bytes + toyPageSize() - 1) / toyPageSize());
+  EXPECT_LE(expectedPages, totalPages(placement));
+  EXPECT_GE(expectedPages + 1, totalPages(placement));
+
+  // Copies into differently sized matrices first-touch their new pages too.
+  a(3,5) = 42.0;
+  ToyMatrix<double> b(a);
+  EXPECT_EQ(42.0, b(3,5));
+  ToyMatrix<double> c(2, 2);
+  c = a;
+  EXPECT_EQ(42.0, c(3,5));
+  EXPECT_EQ(0.0, c(n-1,n-1));
+}
+
+TEST(ToyNumaTest, PlacementPolicies) {
+  ToyPlacement previous = toyGetPlacement();
+  const int n = 600;
+
+  toySetPlacement(ToyPlacementInterleaved);
+  ToyMatrix<float> interleaved(n, n);
+  EXPECT_EQ(0.0f, interleaved(n-1, n-1));
+  interleaved(n-1, n-1) = 1.0f;
+
+  toySetPlacement(ToyPlacementSerial);
+  ToyMatrix<float> serial(n, n);
+  EXPECT_EQ(0.0f, serial(n-1, n-1));
+
+  toySetPlacement(previous);
+  ToyMatrix<float> product = interleaved * serial;
+  EXPECT_EQ(0.0f, product(0,0));
+}
+
+TEST(ToyNumaTest, SmallAllocationsUseNew) {
+  int allocation = -1;
+  int* entries = toyAllocateEntries<int>(4, 4, allocation);
+  EXPECT_EQ(ToyAllocatedNew, allocation);
+  for (int i=0; i<16; i++) EXPECT_EQ(0, entries[i]);
+  toyFreeEntries(entries, 16, allocation);
+
+  ToyPagePlacement empty = toyPagePlacement(0, 0);
+  EXPECT_EQ(0, totalPages(empty));
+}
+
+TEST(ToyNumaTest, UninitializedMatricesAreNotTouched) {
+  // Neither the constructor nor the pool writes to these pages.
+  ToyMatrix<double> a(700, 700, toyUninitialized);
+  ToyPagePlacement placement = a.getPagePlacement();
+  for (size_t i=0; i<placement.PagesPerNode.size(); i++) EXPECT_EQ(0, placement.PagesPerNode[i]);
+  EXPECT_GT(placement.UnplacedPages, 0);
+
+  // With serial placement zeroed matrices get lazily zeroed pages.
+  ToyPlacement previous = toyGetPlacement();
+  toySetPlacement(ToyPlacementSerial);
+  ToyMatrix<double> b(700, 700);
+  toySetPlacement(previous);
+  placement = b.getPagePlacement();
+  for (size_t i=0; i<placement.PagesPerNode.size(); i++) EXPECT_EQ(0, placement.PagesPerNode[i]);
+  EXPECT_EQ(0.0, b(699, 699));
+}
+
+TEST(ToyNumaTest, ChunksStayOnTheirWorkers) {
+  ToyThreadPool pool(4);
+  // Rows touched by a chunk come back to the same thread while the pool is idle.
+  vector<thread::id> first(4), second(4);
+  pool.parallelFor(0, 4, [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) first[i] = this_thread::get_id();
+  });
+  pool.parallelFor(0, 4, [&](int lo, int hi) {
+    for (int i=lo; i<hi; i++) second[i] = this_thread::get_id();
+  });
+  for (int i=0; i<4; i++) EXPECT_EQ(first[i], second[i]);
+
+  // A worker stuck in a long task does not hold up parallelFor().
+  atomic<bool> release(false), started(false);
+  pool.submit([&]() {
+    started = true;
+    while (!release) this_thread::yield();
+  });
+  while (!started) this_thread::yield();
+  for (int r=0; r<20; r++) {
+    atomic<int> sum(0);
+    pool.parallelFor(0, 100, [&](int lo, int hi) {
+      for (int i=lo; i<hi; i++) sum += i;
+    });
+    EXPECT_EQ(4950, sum);
+  }
+  release = true;
+}
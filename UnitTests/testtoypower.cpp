@@ -0,0 +1,159 @@
+#include "toypower.h"
+#include "toymatrix.h"
+#include "testmatrices.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+// Counts the allocations of the whole program. Not inlined, so that the
+// compiler does not pair the new-expressions with free().
+static atomic<long long> allocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+  allocations++;
+  void* p = malloc(size ? size : 1);
+  if (!p) throw bad_alloc();
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept
+{
+  free(p);
+}
+
+template<class F>
+static long long countAllocations(F func)
+{
+  long long before = allocations;
+  func();
+  return allocations - before;
+}
+
+TEST(ToyPowerTest, IntegerPowers) {
+  // Fibonacci numbers: [1 1; 1 0]^k = [F(k+1) F(k); F(k) F(k-1)].
+  ToyMatrix<long long> fibonacci(2, 2);
+  fibonacci(0,0) = 1; fibonacci(0,1) = 1; fibonacci(1,0) = 1;
+  ToyMatrix<long long> f = toyPow(fibonacci, 90);
+  EXPECT_EQ(4660046610375530309LL, f(0,0));
+  EXPECT_EQ(2880067194370816120LL, f(0,1));
+  EXPECT_EQ(1779979416004714189LL, f(1,1));
+  ToyMatrix<long long> identity = toyPow(fibonacci, 0);
+  EXPECT_EQ(1, identity(0,0)); EXPECT_EQ(0, identity(0,1)); EXPECT_EQ(1, identity(1,1));
+
+  // Against repeated multiplication, for a transposed operand.
+  ToyMatrix<double> a(5, 5);
+  for (int i=0; i<5; i++) {
+    for (int j=0; j<5; j++) a(i,j) = ((i*3 + j*7) % 5 - 2) * 0.25;
+  }
+  a.transpose();
+  ToyMatrix<double> expected(a);
+  for (int k=1; k<13; k++) expected = expected*a;
+  ToyMatrix<double> power = toyPow(a, 13);
+  for (int i=0; i<5; i++) {
+    for (int j=0; j<5; j++) EXPECT_NEAR(expected(i,j), power(i,j), 1e-12);
+  }
+
+  // Diagonal matrices raise their entries.
+  ToyMatrix<double> d(3, 3);
+  d(0,0) = 2; d(1,1) = -1; d(2,2) = 0.5;
+  d.setStructure(ToyStructureDiagonal);
+  ToyMatrix<double> dp = toyPow(d, 11);
+  EXPECT_EQ(2048.0, dp(0,0));
+  EXPECT_EQ(-1.0, dp(1,1));
+  EXPECT_EQ(1.0/2048, dp(2,2));
+  EXPECT_EQ(0.0, dp(0,1));
+}
+
+TEST(ToyPowerTest, Exponential) {
+  // Rotation generator: e^[0 -t; t 0] = [cos t  -sin t; sin t  cos t].
+  const double angles[] = { 0.01, 0.5, 2, 30 };
+  for (double t : angles) {
+    ToyMatrix<double> g(2, 2);
+    g(0,1) = -t; g(1,0) = t;
+    ToyMatrix<double> r = toyExpm(g);
+    EXPECT_NEAR(cos(t), r(0,0), 1e-12);
+    EXPECT_NEAR(-sin(t), r(0,1), 1e-12);
+    EXPECT_NEAR(sin(t), r(1,0), 1e-12);
+    EXPECT_NEAR(cos(t), r(1,1), 1e-12);
+
+    ToyMatrix<float> gf(2, 2);
+    gf(0,1) = (float)-t; gf(1,0) = (float)t;
+    ToyMatrix<float> rf = toyExpm(gf);
+    EXPECT_NEAR(cos(t), rf(0,0), 1e-5 * (1 + t));
+    EXPECT_NEAR(sin(t), rf(1,0), 1e-5 * (1 + t));
+  }
+
+  // Nilpotent: e^N = I + N + N^2/2.
+  ToyMatrix<double> nilpotent(3, 3);
+  nilpotent(0,1) = 2; nilpotent(1,2) = 3; nilpotent(0,2) = 1;
+  ToyMatrix<double> e = toyExpm(nilpotent);
+  EXPECT_NEAR(1, e(0,0), 1e-14);
+  EXPECT_NEAR(2, e(0,1), 1e-13);
+  EXPECT_NEAR(1 + 3, e(0,2), 1e-13);
+  EXPECT_NEAR(3, e(1,2), 1e-13);
+  EXPECT_NEAR(0, e(2,0), 1e-14);
+
+  // Diagonal and zero matrices, and complex entries.
+  ToyMatrix<double> zero(4, 4);
+  ToyMatrix<double> one = toyExpm(zero);
+  EXPECT_EQ(1.0, one(3,3));
+  EXPECT_EQ(0.0, one(0,3));
+  ToyMatrix<complex<double> > c(1, 1);
+  c(0,0) = complex<double>(0, M_PI);
+  EXPECT_NEAR(-1, toyExpm(c)(0,0).real(), 1e-12);
+  EXPECT_NEAR(0, toyExpm(c)(0,0).imag(), 1e-12);
+
+  // e^A e^A = e^(2A) for a dense matrix that needs scaling.
+  ToyMatrix<double> a(6, 6);
+  for (int i=0; i<6; i++) {
+    for (int j=0; j<6; j++) a(i,j) = ((i*5 + j*3) % 7 - 3) * 0.4;
+  }
+  ToyMatrix<double> ea = toyExpm(a), e2a = toyExpm(2.0*a), squared = ea*ea;
+  for (int i=0; i<6; i++) {
+    for (int j=0; j<6; j++) EXPECT_NEAR(e2a(i,j), squared(i,j), 1e-9 * (1 + fabs(e2a(i,j))));
+  }
+}
+
+TEST(ToyPowerTest, NoAllocationsPerStep) {
+  // n = 64 is large enough for the products to run in parallel.
+  const int sizes[] = { 8, 64 };
+  for (int s=0; s<2; s++) {
+    int n = sizes[s];
+    ToyMatrix<double> a = makeTestMatrix<double>(n, n, 0, 1e-3);
+    long long few = countAllocations([&]() { toyPow(a, (1ull << 4) - 1); });
+    long long many = countAllocations([&]() { toyPow(a, (1ull << 20) - 1); });
+    EXPECT_EQ(few, many) << "n = " << n;
+
+    // 2^10 times the norm takes 10 more squarings.
+    ToyMatrix<double> small = makeTestMatrix<double>(n, n, 0, 0.1);
+    ToyMatrix<double> large = makeTestMatrix<double>(n, n, 0, 0.1 * 1024);
+    few = countAllocations([&]() { toyExpm(small); });
+    many = countAllocations([&]() { toyExpm(large); });
+    EXPECT_EQ(few, many) << "n = " << n;
+
+    // Complex products use three real ones from n = 64 on.
+    ToyMatrix<complex<double> > z = makeTestMatrix<complex<double> >(n, n, 0, 1e-3);
+    few = countAllocations([&]() { toyPow(z, (1ull << 4) - 1); });
+    many = countAllocations([&]() { toyPow(z, (1ull << 20) - 1); });
+    EXPECT_EQ(few, many) << "n = " << n;
+  }
+}
+
+TEST(ToyPowerTest, EmptyMatrix) {
+  ToyMatrix<double> empty(0, 0);
+  EXPECT_EQ(0, toyPow(empty, 5).getNumRows());
+  EXPECT_EQ(0, toyExpm(empty).getNumColumns());
+}
@@ -0,0 +1,94 @@
+#include "toypublish.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+static ToyMatrix<double> makeGains(int rows, int columns, double value)
+{
+  ToyMatrix<double> gains(rows, columns, toyUninitialized);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) gains(i,j) = value;
+  }
+  return gains;
+}
+
+TEST(ToyPublishTest, PublishAndRead) {
+  ToyPublishedMatrix<double> gains(makeGains(3, 2, 1.0));
+  EXPECT_EQ(0u, gains.getVersion());
+  EXPECT_EQ(1.0, gains.read([](const ToyMatrix<double>& m) { return m(2,1); }));
+
+  // A new shape and a transposed matrix are published as they are.
+  ToyMatrix<double> t = makeGains(2, 5, 0.0);
+  t(1,4) = 7.0;
+  t.transpose();
+  gains.publish(t);
+  EXPECT_EQ(1u, gains.getVersion());
+  ToyMatrix<double> copy = gains.snapshot();
+  ASSERT_EQ(5, copy.getNumRows());
+  EXPECT_EQ(7.0, copy(4,1));
+
+  gains.modify([](ToyMatrix<double>& m) { m(0,0) += 1.0; });
+  EXPECT_EQ(2u, gains.getVersion());
+  // modify() runs on both copies, so the next update starts from it as well.
+  gains.modify([](ToyMatrix<double>& m) { m(0,0) += 1.0; });
+  EXPECT_EQ(2.0, gains.snapshot()(0,0));
+  EXPECT_EQ(7.0, gains.snapshot()(4,1));
+
+  double x[2] = {1.0, 2.0}, y[5];
+  gains.multiply(x, y);
+  EXPECT_EQ(2.0, y[0]);
+  EXPECT_EQ(7.0*2.0, y[4]);
+}
+
+TEST(ToyPublishTest, ReadersNeverSeeTornMatrix) {
+  const int rows = 24, columns = 40, numReaders = 4;
+  ToyPublishedMatrix<double> gains(makeGains(rows, columns, 0.0));
+  atomic<bool> done(false);
+  atomic<int> torn(0), reads(0);
+
+  vector<thread> readers;
+  for (int r=0; r<numReaders; r++) {
+    readers.push_back(thread([&]() {
+      vector<double> x(columns, 1.0), y(rows);
+      while (!done.load()) {
+        gains.multiply(&x[0], &y[0]);
+        // Every entry of one version holds the same value.
+        for (int i=0; i<rows; i++) {
+          if (y[i] != y[0]) torn++;
+        }
+        double first = gains.read([&](const ToyMatrix<double>& m) {
+          for (int i=0; i<rows; i++) {
+            for (int j=0; j<columns; j++) {
+              if (m(i,j) != m(0,0)) return -1.0;
+            }
+          }
+          return m(0,0);
+        });
+        if (first < 0) torn++;
+        reads++;
+      }
+    }));
+  }
+
+  ToyMatrix<double> next = makeGains(rows, columns, 0.0);
+  for (int v=1; v<=100; v++) {
+    for (int i=0; i<rows; i++) {
+      for (int j=0; j<columns; j++) next(i,j) = v;
+    }
+    gains.publish(next);
+  }
+  while (reads.load() < 100) this_thread::yield();
+  done = true;
+  for (size_t r=0; r<readers.size(); r++) readers[r].join();
+
+  EXPECT_EQ(0, torn.load());
+  EXPECT_EQ(100u, gains.getVersion());
+  EXPECT_EQ(100.0, gains.snapshot()(rows-1, columns-1));
+}
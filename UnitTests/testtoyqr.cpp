@@ -0,0 +1,121 @@
+#include "toyqr.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdlib>
+using namespace std;
+
+template<class T>
+static ToyMatrix<T> makeTallMatrix(int rows, int columns)
+{
+  ToyMatrix<T> a(rows, columns);
+  srand(7);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) a(i,j) = T((rand() % 2000) / 1000.0 - 1.0);
+  }
+  return a;
+}
+
+// b = A*x, computed by hand since ToyVector keeps a homogeneous last entry.
+template<class T>
+static ToyVector<T> multiply(const ToyMatrix<T>& a, const ToyVector<T>& x)
+{
+  T* entries = new T[a.getNumRows()];
+  for (int i=0; i<a.getNumRows(); i++) {
+    entries[i] = T();
+    for (int j=0; j<a.getNumColumns(); j++) entries[i] += a(i,j) * x(j);
+  }
+  return ToyVector<T>(a.getNumRows(), entries);
+}
+
+TEST(ToyQRTest, LineFit) {
+  // Fit y = c0 + c1*t through (0,1), (1,2), (2,2), (3,4).
+  // The normal equations give c0 = 0.9 and c1 = 0.9.
+  double entries[] = {1.0, 0.0,
+                      1.0, 1.0,
+                      1.0, 2.0,
+                      1.0, 3.0};
+  double *entriesp = new double[4*2];
+  memcpy(entriesp, &entries, 4*2*sizeof(double));
+  ToyMatrix<double> a(4, 2, entriesp);
+
+  double *bp = new double[4];
+  bp[0] = 1.0; bp[1] = 2.0; bp[2] = 2.0; bp[3] = 4.0;
+  ToyVector<double> b(4, bp);
+
+  ToyVector<double> c = leastSquares(a, b);
+  ASSERT_EQ(2, c.getNumRows());
+  EXPECT_NEAR(0.9, c(0), 1e-12);
+  EXPECT_NEAR(0.9, c(1), 1e-12);
+}
+
+TEST(ToyQRTest, BlockedFactorisationReproducesA) {
+  const int rows = 120, columns = 70;
+  ToyMatrix<double> a = makeTallMatrix<double>(rows, columns);
+
+  // Q'*A = R, so applying Q' to the columns of A must give R.
+  ToyQR<double> qr(a, 16);
+  ToyMatrix<double> r = qr.getR();
+  vector<double> qta(rows*columns);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) qta[i*columns+j] = a(i,j);
+  }
+  qr.applyQTranspose(&qta[0], columns);
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) {
+      double expected = (i < columns) ? r(i,j) : 0.0;
+      EXPECT_NEAR(expected, qta[i*columns+j], 1e-10) << "row " << i << ", column " << j;
+    }
+  }
+
+  // The blocked and the unblocked factorisation agree.
+  ToyQR<double> unblocked(a, 1);
+  ToyMatrix<double> r1 = unblocked.getR();
+  for (int i=0; i<columns; i++) {
+    for (int j=0; j<columns; j++) EXPECT_NEAR(r1(i,j), r(i,j), 1e-10);
+  }
+}
+
+TEST(ToyQRTest, TallSkinnyMatchesBlocked) {
+  const int rows = 5000, columns = 12;
+  ToyMatrix<float> a = makeTallMatrix<float>(rows, columns);
+  float *xp = new float[columns];
+  for (int j=0; j<columns; j++) xp[j] = j - 5.5f;
+  ToyVector<float> expected(columns, xp);
+  ToyVector<float> b = multiply(a, expected);
+
+  ToyTSQR<float> tsqr(a, 700);
+  EXPECT_EQ(7, tsqr.getNumBlocks());
+  ToyVector<float> x = tsqr.solve(b);
+  for (int j=0; j<columns; j++) EXPECT_NEAR(expected(j), x(j), 1e-3);
+
+  // R is unique up to the signs of its rows.
+  ToyMatrix<float> r = tsqr.getR();
+  ToyMatrix<float> rBlocked = ToyQR<float>(a).getR();
+  for (int i=0; i<columns; i++) {
+    float sign = (r(i,i) * rBlocked(i,i) < 0) ? -1.0f : 1.0f;
+    for (int j=i; j<columns; j++) {
+      EXPECT_NEAR(rBlocked(i,j), sign * r(i,j), 1e-2f * fabs(rBlocked(i,i)));
+    }
+  }
+}
+
+TEST(ToyQRTest, TransposedInputAndRankDeficiency) {
+  ToyMatrix<double> at(3, 6);
+  for (int j=0; j<6; j++) {
+    at(0,j) = 1.0; at(1,j) = j; at(2,j) = 0.0;
+  }
+  at.transpose();
+
+  bool caught = false;
+  try {
+    leastSquares(at, ToyVector<double>(6));
+  }
+  catch (SingularMatrix) {
+    caught = true;
+  }
+  EXPECT_TRUE(caught);
+}
@@ -0,0 +1,156 @@
+#include "toyreduce.h"
+#include "toymatrix.h"
+#include "testmatrices.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+using namespace std;
+
+TEST(ToyReduceTest, WholeMatrix) {
+  // Large enough to be split into several blocks.
+  const int rows = 157, columns = 213;
+  ToyMatrix<double> m = makeTestMatrix<double>(rows, columns);
+  m(100, 7) = 50.0;
+  m(3, 200) = -60.0;
+  double sum = 0, squares = 0, trace = 0;
+  for (int i=0; i<rows; i++) {
+    for (int j=0; j<columns; j++) {
+      sum += m(i,j);
+      squares += m(i,j)*m(i,j);
+    }
+    trace += m(i,i);
+  }
+
+  EXPECT_DOUBLE_EQ(sum, toySum(m));
+  EXPECT_DOUBLE_EQ(sum, toySum(m, ToySummationKahan));
+  EXPECT_DOUBLE_EQ(sqrt(squares), toyFrobeniusNorm(m));
+  EXPECT_DOUBLE_EQ(trace, toyTrace(m));
+  EXPECT_EQ(50.0, toyMax(m));
+  EXPECT_EQ(-60.0, toyMin(m));
+
+  int row = -1, column = -1;
+  EXPECT_EQ(50.0, toyArgMax(m, row, column));
+  EXPECT_EQ(100, row); EXPECT_EQ(7, column);
+  EXPECT_EQ(-60.0, toyArgMin(m, row, column));
+  EXPECT_EQ(3, row); EXPECT_EQ(200, column);
+
+  // The same through a transposed view.
+  m.transpose();
+  EXPECT_DOUBLE_EQ(sum, toySum(m));
+  EXPECT_DOUBLE_EQ(trace, toyTrace(m));
+  EXPECT_EQ(50.0, toyArgMax(m, row, column));
+  EXPECT_EQ(7, row); EXPECT_EQ(100, column);
+}
+
+TEST(ToyReduceTest, ArgMaxPicksFirstInRowMajorOrder) {
+  ToyMatrix<int> m(3, 4);
+  m(2,0) = 9; m(1,3) = 9; m(0,1) = -2;
+  int row, column;
+  EXPECT_EQ(9, toyArgMax(m, row, column));
+  EXPECT_EQ(1, row); EXPECT_EQ(3, column);
+  m.transpose();
+  EXPECT_EQ(9, toyArgMax(m, row, column));
+  EXPECT_EQ(0, row); EXPECT_EQ(2, column);
+}
+
+TEST(ToyReduceTest, RowsAndColumns) {
+  const int rows = 67, columns = 300;
+  ToyMatrix<double> m = makeTestMatrix<double>(rows, columns);
+  for (int pass=0; pass<2; pass++) {
+    int r = m.getNumRows(), c = m.getNumColumns();
+    ToyVector<double> rowSums = toyRowSums(m), columnSums = toyColumnSums(m, ToySummationKahan);
+    ToyVector<double> rowNorms = toyRowNorms(m), columnNorms = toyColumnNorms(m);
+    ToyVector<double> rowMax = toyRowMax(m), columnMin = toyColumnMin(m);
+    ASSERT_EQ(r, rowSums.getNumEntries());
+    ASSERT_EQ(c, columnSums.getNumEntries());
+    double norm1 = 0, normInf = 0;
+    for (int i=0; i<r; i++) {
+      double sum = 0, squares = 0, best = m(i,0), absSum = 0;
+      for (int j=0; j<c; j++) {
+        sum += m(i,j); squares += m(i,j)*m(i,j); best = max(best, m(i,j)); absSum += fabs(m(i,j));
+      }
+      EXPECT_DOUBLE_EQ(sum, rowSums(i));
+      EXPECT_DOUBLE_EQ(sqrt(squares), rowNorms(i));
+      EXPECT_EQ(best, rowMax(i));
+      normInf = max(normInf, absSum);
+    }
+    for (int j=0; j<c; j++) {
+      double sum = 0, squares = 0, best = m(0,j), absSum = 0;
+      for (int i=0; i<r; i++) {
+        sum += m(i,j); squares += m(i,j)*m(i,j); best = min(best, m(i,j)); absSum += fabs(m(i,j));
+      }
+      EXPECT_DOUBLE_EQ(sum, columnSums(j));
+      EXPECT_DOUBLE_EQ(sqrt(squares), columnNorms(j));
+      EXPECT_EQ(best, columnMin(j));
+      norm1 = max(norm1, absSum);
+    }
+    EXPECT_DOUBLE_EQ(norm1, toyNorm1(m));
+    EXPECT_DOUBLE_EQ(normInf, toyNormInf(m));
+    m.transpose();
+  }
+}
+
+TEST(ToyReduceTest, SingleRowAndColumn) {
+  // An untransposed 3x1 matrix has row stride 1, like a transposed one.
+  ToyMatrix<double> column(3, 1);
+  column(0,0) = 1; column(1,0) = 5; column(2,0) = 2;
+  ToyMatrix<double> row(1, 3);
+  row(0,0) = 1; row(0,1) = 5; row(0,2) = 2;
+  ToyMatrix<double> transposed(row);
+  transposed.transpose();
+
+  const ToyMatrix<double>* columns[] = { &column, &transposed };
+  for (const ToyMatrix<double>* m : columns) {
+    ToyVector<double> rowSums = toyRowSums(*m), columnSums = toyColumnSums(*m);
+    ASSERT_EQ(3, rowSums.getNumEntries());
+    EXPECT_EQ(5, rowSums(1));
+    ASSERT_EQ(1, columnSums.getNumEntries());
+    EXPECT_EQ(8, columnSums(0));
+    ToyVector<double> rowMax = toyRowMax(*m), columnMin = toyColumnMin(*m);
+    ASSERT_EQ(3, rowMax.getNumEntries());
+    EXPECT_EQ(2, rowMax(2));
+    ASSERT_EQ(1, columnMin.getNumEntries());
+    EXPECT_EQ(1, columnMin(0));
+    int i = -1, j = -1;
+    EXPECT_EQ(5, toyArgMax(*m, i, j));
+    EXPECT_EQ(1, i); EXPECT_EQ(0, j);
+    EXPECT_EQ(1, toyArgMin(*m, i, j));
+    EXPECT_EQ(0, i); EXPECT_EQ(0, j);
+  }
+
+  ToyVector<double> rowSums = toyRowSums(row), columnSums = toyColumnSums(row);
+  ASSERT_EQ(1, rowSums.getNumEntries());
+  EXPECT_EQ(8, rowSums(0));
+  ASSERT_EQ(3, columnSums.getNumEntries());
+  EXPECT_EQ(2, columnSums(2));
+  int i = -1, j = -1;
+  EXPECT_EQ(5, toyArgMax(row, i, j));
+  EXPECT_EQ(0, i); EXPECT_EQ(1, j);
+
+  // Lines without entries have no extreme to read.
+  ToyMatrix<double> empty(3, 0);
+  ToyVector<double> emptyMax = toyRowMax(empty);
+  ASSERT_EQ(3, emptyMax.getNumEntries());
+  EXPECT_EQ(0, emptyMax(2));
+  empty.transpose();
+  ToyVector<double> emptyMin = toyColumnMin(empty);
+  ASSERT_EQ(3, emptyMin.getNumEntries());
+  EXPECT_EQ(0, emptyMin(0));
+}
+
+TEST(ToyReduceTest, AccurateFloatSums) {
+  // One large entry followed by many small ones: naive float summation
+  // drops all of them.
+  const int n = 1 << 16;
+  ToyMatrix<float> m(1, n + 1);
+  m(0,0) = 1.0f;
+  for (int j=1; j<=n; j++) m(0,j) = 1e-8f;
+  double exact = 1.0 + n * (double)1e-8f;
+  float naive = 0;
+  for (int j=0; j<=n; j++) naive += m(0,j);
+  EXPECT_EQ(1.0f, naive);
+  EXPECT_NEAR(exact, toySum(m), 3e-7);
+  EXPECT_NEAR(exact, toySum(m, ToySummationKahan), 3e-7);
+  EXPECT_NEAR(exact, toyRowSums(m, ToySummationKahan)(0), 3e-7);
+}
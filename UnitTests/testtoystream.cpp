@@ -0,0 +1,169 @@
+#include "toystream.h"
+#include "toymatrix.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+TEST(ToyStreamTest, RingBuffer) {
+  ToyRingBuffer<int> ring(3);
+  EXPECT_EQ(4, ring.getCapacity());
+  for (int i=0; i<4; i++) EXPECT_TRUE(ring.tryPush(i));
+  EXPECT_FALSE(ring.tryPush(4));
+  EXPECT_EQ(4, ring.size());
+  int value = -1;
+  for (int i=0; i<4; i++) {
+    EXPECT_TRUE(ring.tryPop(value));
+    EXPECT_EQ(i, value);
+    EXPECT_TRUE(ring.tryPush(i + 4));
+  }
+  for (int i=4; i<8; i++) {
+    EXPECT_TRUE(ring.tryPop(value));
+    EXPECT_EQ(i, value);
+  }
+  EXPECT_FALSE(ring.tryPop(value));
+}
+
+TEST(ToyStreamTest, BlockingRingBuffer) {
+  // A small ring forces both sides to sleep now and then.
+  ToyRingBuffer<int> ring(2);
+  const int count = 20000;
+  long long sum = 0;
+  thread consumer([&]() {
+    for (int i=0; i<count; i++) {
+      int value;
+      ring.pop(value);
+      EXPECT_EQ(i, value);
+      sum += value;
+    }
+  });
+  for (int i=0; i<count; i++) {
+    if (i % 5000 == 0) this_thread::sleep_for(chrono::milliseconds(20));
+    ring.push(i);
+  }
+  consumer.join();
+  EXPECT_EQ((long long)count*(count - 1)/2, sum);
+}
+
+TEST(ToyStreamTest, IdleStagesSleep) {
+  ToyStreamPipeline<double> pipeline(2);
+  pipeline.addNormalize();
+  pipeline.addNormalize();
+  pipeline.addNormalize();
+  int received = 0;
+  pipeline.start([&](const double*, int count, int) { received += count; });
+  this_thread::sleep_for(chrono::milliseconds(50));
+  clock_t before = clock();
+  this_thread::sleep_for(chrono::milliseconds(300));
+  double seconds = double(clock() - before) / CLOCKS_PER_SEC;
+  // Spinning stages would use about as much CPU as the time that passed.
+  EXPECT_LT(seconds, 0.1);
+
+  const double point[2] = { 3, 4 };
+  pipeline.push(point);
+  pipeline.close();
+  EXPECT_EQ(1, received);
+}
+
+TEST(ToyStreamTest, TransformNormalizeAndFunction) {
+  ToyMatrix<double> a(2, 3);
+  a(0,0) = 1; a(0,1) = 2; a(0,2) = 0;
+  a(1,0) = 0; a(1,1) = -1; a(1,2) = 3;
+  ToyMatrix<double> b(2, 2);
+  b(0,0) = 2; b(0,1) = 1;
+  b(1,0) = 1; b(1,1) = 0;
+  b.transpose();
+
+  ToyStreamOptions options;
+  options.ChunkSize = 16;
+  options.QueueCapacity = 2;
+  ToyStreamPipeline<double> pipeline(3, options);
+  pipeline.addTransform(a);
+  pipeline.addFunction([](double* point, int dimension) {
+    for (int i=0; i<dimension; i++) point[i] += 1;
+  });
+  pipeline.addTransform(b);
+  pipeline.addNormalize();
+  EXPECT_EQ(3, pipeline.getInputDimension());
+  EXPECT_EQ(2, pipeline.getOutputDimension());
+  EXPECT_EQ(4, pipeline.getNumStages());
+
+  vector<double> output;
+  pipeline.start([&](const double* points, int count, int dimension) {
+    EXPECT_EQ(2, dimension);
+    output.insert(output.end(), points, points + count*dimension);
+  });
+  const int n = 1000;
+  for (int p=0; p<n; p++) {
+    double point[3] = { (double)(p % 7), (double)(p % 5) - 2, (double)(p % 3) };
+    pipeline.push(point);
+  }
+  pipeline.close();
+
+  ASSERT_EQ(2u*n, output.size());
+  for (int p=0; p<n; p++) {
+    double x[3] = { (double)(p % 7), (double)(p % 5) - 2, (double)(p % 3) };
+    double y[2] = { x[0] + 2*x[1] + 1, -x[1] + 3*x[2] + 1 };
+    double z[2] = { 2*y[0] + y[1], y[0] };
+    double length = sqrt(z[0]*z[0] + z[1]*z[1]);
+    if (length > 0) {
+      z[0] /= length;
+      z[1] /= length;
+    }
+    EXPECT_NEAR(z[0], output[2*p], 1e-12);
+    EXPECT_NEAR(z[1], output[2*p + 1], 1e-12);
+  }
+
+  for (int s=0; s<pipeline.getNumStages(); s++) {
+    ToyStreamMetrics metrics = pipeline.getStageMetrics(s);
+    EXPECT_EQ(n, metrics.Points);
+    EXPECT_EQ((n + 15)/16, metrics.Chunks);
+    EXPECT_EQ(0, metrics.QueueDepth);
+    // At most 4*(2+1) + 1 chunks exist.
+    EXPECT_LE(metrics.MaxQueueDepth, 13);
+  }
+  EXPECT_EQ(n, pipeline.getSourceMetrics().Points);
+  EXPECT_EQ(0, pipeline.getSourceMetrics().QueueDepth);
+}
+
+TEST(ToyStreamTest, BackpressureAndErrors) {
+  // A slow stage makes the source wait for free chunks.
+  ToyStreamOptions options;
+  options.ChunkSize = 4;
+  options.QueueCapacity = 1;
+  ToyStreamPipeline<float> slow(2, options);
+  slow.addFunction([](float*, int) { std::this_thread::sleep_for(std::chrono::microseconds(50)); });
+  long long received = 0;
+  slow.start([&](const float*, int count, int) { received += count; });
+  float point[2] = { 1, 2 };
+  bool refused = false;
+  for (int p=0; p<200; p++) {
+    if (!slow.tryPush(point)) {
+      refused = true;
+      slow.push(point);
+    }
+  }
+  slow.close();
+  EXPECT_EQ(200, received);
+  EXPECT_TRUE(refused);
+  EXPECT_GT(slow.getSourceMetrics().Stalls, 0);
+
+  // The first exception of a stage is rethrown by close().
+  ToyStreamPipeline<float> failing(2, options);
+  failing.addFunction([](float* point, int) {
+    if (point[0] > 10) throw std::runtime_error("bad point");
+  });
+  failing.start([](const float*, int, int) {});
+  for (int p=0; p<50; p++) {
+    point[0] = (float)p;
+    failing.push(point);
+  }
+  EXPECT_THROW(failing.close(), std::runtime_error);
+}
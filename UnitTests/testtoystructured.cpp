@@ -0,0 +1,129 @@
+#include "toystructured.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+#include "testmatrices.h"
+
+#include <gtest/gtest.h>
+
+using namespace std;
+
+static ToyVector<double> makeVector(int n)
+{
+  double* entries = new double[n];
+  for (int i=0; i<n; i++) entries[i] = (i % 5) - 2.0;
+  return ToyVector<double>(n, entries);
+}
+
+// Dense reference for products with a vector, without the homogeneous 1.
+static void expectProducts(const ToyMatrix<double>& dense, const ToyMatrix<double>& product,
+                           const ToyVector<double>& x, const ToyVector<double>& y)
+{
+  ToyMatrix<double> b = makeTestMatrix<double>(dense.getNumColumns(), 7, 2);
+  for (int i=0; i<dense.getNumRows(); i++) {
+    double dot = 0;
+    for (int j=0; j<dense.getNumColumns(); j++) dot += dense(i,j) * x(j);
+    EXPECT_EQ(dot, y(i)) << i;
+  }
+  ToyMatrix<double> expected = dense * b;
+  ASSERT_EQ(expected.getNumColumns(), product.getNumColumns());
+  for (int i=0; i<expected.getNumRows(); i++) {
+    for (int j=0; j<expected.getNumColumns(); j++) EXPECT_EQ(expected(i,j), product(i,j)) << i << "," << j;
+  }
+}
+
+TEST(ToyStructuredTest, Symmetric) {
+  const int n = 11;
+  ToyMatrix<double> dense = makeTestMatrix<double>(n, n, 1);
+  ToySymmetricMatrix<double> s(dense);
+  ToyMatrix<double> full = s.toMatrix();
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<n; j++) ASSERT_EQ(dense(max(i,j), min(i,j)), full(i,j));
+  }
+  s.set(2, 9, 42.0);
+  EXPECT_EQ(42.0, s(9, 2));
+  full = s.toMatrix();
+  // Transposed right-hand side.
+  ToyMatrix<double> b = makeTestMatrix<double>(7, n, 2);
+  b.transpose();
+  ToyMatrix<double> expected = full * b, product = s * b;
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<7; j++) EXPECT_EQ(expected(i,j), product(i,j));
+  }
+  ToyVector<double> x = makeVector(n);
+  expectProducts(full, s * makeTestMatrix<double>(n, 7, 2), x, s * x);
+}
+
+TEST(ToyStructuredTest, TriangularSolve) {
+  const int n = 40;
+  for (int t=0; t<2; t++) {
+    ToyTriangle triangle = t ? ToyUpperTriangle : ToyLowerTriangle;
+    for (int unit=0; unit<2; unit++) {
+      ToyMatrix<double> dense = makeTestMatrix<double>(n, n, 3);
+      for (int i=0; i<n; i++) dense(i,i) = 10.0 + i;
+      ToyTriangularMatrix<double> a(dense, triangle, unit == 1);
+      ToyMatrix<double> full = a.toMatrix();
+      EXPECT_EQ(0.0, t ? full(5, 2) : full(2, 5));
+      EXPECT_EQ(unit ? 1.0 : 15.0, full(5, 5));
+      ToyVector<double> x = makeVector(n);
+      expectProducts(full, a * makeTestMatrix<double>(n, 7, 2), x, a * x);
+
+      // Solving undoes the product.
+      ToyVector<double> solved = a.solve(a * x);
+      for (int i=0; i<n; i++) EXPECT_NEAR(x(i), solved(i), 1e-9);
+      ToyMatrix<double> b = makeTestMatrix<double>(n, 5, 4);
+      ToyMatrix<double> xs = a.solve(a * b);
+      for (int i=0; i<n; i++) {
+        for (int j=0; j<5; j++) EXPECT_NEAR(b(i,j), xs(i,j), 1e-9);
+      }
+    }
+  }
+  ToyTriangularMatrix<double> singular(3, ToyUpperTriangle);
+  EXPECT_THROW(singular.solve(makeVector(3)), SingularMatrix);
+}
+
+TEST(ToyStructuredTest, Band) {
+  const int n = 50, kl = 2, ku = 3;
+  ToyMatrix<double> dense = makeTestMatrix<double>(n, n, 5);
+  for (int i=0; i<n; i++) dense(i,i) = 20.0;
+  ToyBandMatrix<double> band(dense, kl, ku);
+  ToyMatrix<double> full = band.toMatrix();
+  EXPECT_EQ(dense(10, 8), full(10, 8));
+  EXPECT_EQ(dense(10, 13), full(10, 13));
+  EXPECT_EQ(0.0, full(10, 7));
+  EXPECT_EQ(0.0, full(10, 14));
+  ToyVector<double> x = makeVector(n);
+  expectProducts(full, band * makeTestMatrix<double>(n, 7, 2), x, band * x);
+
+  ToyVector<double> solved = band.solve(band * x);
+  for (int i=0; i<n; i++) EXPECT_NEAR(x(i), solved(i), 1e-12);
+  ToyMatrix<double> b = makeTestMatrix<double>(n, 4, 6);
+  ToyMatrix<double> xs = band.solve(band * b);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<4; j++) EXPECT_NEAR(b(i,j), xs(i,j), 1e-12);
+  }
+
+  // Rectangular bands.
+  ToyBandMatrix<double> wide(4, 9, 1, 2);
+  wide.set(3, 5, 2.0);
+  wide.set(3, 2, -1.0);
+  ToyVector<double> y = wide * makeVector(9);
+  // x(2) = 0, x(5) = -2.
+  EXPECT_EQ(-4.0, y(3));
+}
+
+TEST(ToyStructuredTest, Diagonal) {
+  const int n = 6;
+  ToyDiagonalMatrix<double> d(n, 2.0);
+  d[3] = -1.0;
+  ToyMatrix<double> full = d.toMatrix();
+  ToyVector<double> x = makeVector(n);
+  expectProducts(full, d * makeTestMatrix<double>(n, 7, 2), x, d * x);
+  ToyMatrix<double> a = makeTestMatrix<double>(4, n, 1);
+  ToyMatrix<double> scaled = a * d;
+  EXPECT_EQ(-a(2,3), scaled(2,3));
+  EXPECT_EQ(2.0*a(2,4), scaled(2,4));
+  ToyVector<double> solved = d.solve(d * x);
+  for (int i=0; i<n; i++) EXPECT_EQ(x(i), solved(i));
+  d[0] = 0.0;
+  EXPECT_THROW(d.solve(x), SingularMatrix);
+}
@@ -0,0 +1,150 @@
+#include "toytune.h"
+#include "toymatrix.h"
+#include "toyupdate.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+using namespace std;
+
+static bool sameConfig(const ToyKernelConfig& a, const ToyKernelConfig& b)
+{
+  return a.GemmKC == b.GemmKC && a.GemmNC == b.GemmNC &&
+         a.ParallelThreshold == b.ParallelThreshold &&
+         a.RecursiveGrain == b.RecursiveGrain && a.SyrkBlock == b.SyrkBlock;
+}
+
+TEST(ToyTuneTest, TuneSaveAndLoad) {
+  ToyTuneOptions options;
+  options.Size = 64;
+  options.Repetitions = 1;
+  ToyKernelConfig tuned = toyTune(options);
+  EXPECT_TRUE(sameConfig(tuned, toyKernelConfig()));
+  EXPECT_GT(tuned.GemmKC, 0);
+  EXPECT_GT(tuned.ParallelThreshold, 0);
+
+  string path = testing::TempDir() + "toytune-cache/tuning";
+  ASSERT_TRUE(toySaveTuning(path));
+  toySetKernelConfig(toyDefaultKernelConfig());
+  ASSERT_TRUE(toyLoadTuning(path));
+  EXPECT_TRUE(sameConfig(tuned, toyKernelConfig()));
+  remove(path.c_str());
+  toySetKernelConfig(toyDefaultKernelConfig());
+}
+
+TEST(ToyTuneTest, StaleOrMissingCacheKeepsDefaults) {
+  toySetKernelConfig(toyDefaultKernelConfig());
+  string path = testing::TempDir() + "toytune-stale";
+  EXPECT_FALSE(toyLoadTuning(path + "-missing"));
+
+  ToyKernelConfig other = toyDefaultKernelConfig();
+  other.GemmKC = 17;
+  ASSERT_TRUE(toySaveTuning(path, other));
+  string contents;
+  {
+    ifstream in(path.c_str());
+    getline(in, contents, '\0');
+  }
+  // Written on another machine.
+  {
+    ofstream out(path.c_str());
+    size_t begin = contents.find("signature=") + 10;
+    out << contents.substr(0, begin) << "0|elsewhere" << contents.substr(contents.find('\n', begin));
+  }
+  EXPECT_FALSE(toyLoadTuning(path));
+  EXPECT_TRUE(sameConfig(toyDefaultKernelConfig(), toyKernelConfig()));
+  // An entry is missing.
+  {
+    ofstream out(path.c_str());
+    out << contents.substr(0, contents.find("SyrkBlock"));
+  }
+  EXPECT_FALSE(toyLoadTuning(path));
+  EXPECT_TRUE(sameConfig(toyDefaultKernelConfig(), toyKernelConfig()));
+  // An entry is missing and another one repeated in its place.
+  {
+    ofstream out(path.c_str());
+    size_t syrk = contents.find("SyrkBlock");
+    size_t gemm = contents.find("GemmKC");
+    out << contents.substr(0, syrk) << contents.substr(gemm, contents.find('\n', gemm) + 1 - gemm);
+  }
+  EXPECT_FALSE(toyLoadTuning(path));
+  EXPECT_TRUE(sameConfig(toyDefaultKernelConfig(), toyKernelConfig()));
+  // Values no tuning run produces.
+  other.GemmKC = TOYTUNE_MAX_BLOCK + 1;
+  ASSERT_TRUE(toySaveTuning(path, other));
+  EXPECT_FALSE(toyLoadTuning(path));
+  other = toyDefaultKernelConfig();
+  other.RecursiveGrain = TOYTUNE_MAX_WORK + 1;
+  ASSERT_TRUE(toySaveTuning(path, other));
+  EXPECT_FALSE(toyLoadTuning(path));
+  EXPECT_TRUE(sameConfig(toyDefaultKernelConfig(), toyKernelConfig()));
+  remove(path.c_str());
+}
+
+TEST(ToyTuneTest, StartupReadsCache) {
+  string path = testing::TempDir() + "toytune-startup";
+  ToyKernelConfig cached = toyDefaultKernelConfig();
+  cached.GemmNC = 48;
+  cached.SyrkBlock = 40;
+  ASSERT_TRUE(toySaveTuning(path, cached));
+  setenv("TOYMATRIX_TUNING_CACHE", path.c_str(), 1);
+  EXPECT_TRUE(sameConfig(cached, toyStartupKernelConfig()));
+  EXPECT_FALSE(toyStartupTuningPending());
+
+  // A missing cache leaves tuning to the first product if asked for.
+  remove(path.c_str());
+  EXPECT_TRUE(sameConfig(toyDefaultKernelConfig(), toyStartupKernelConfig()));
+  EXPECT_FALSE(toyStartupTuningPending());
+  setenv("TOYMATRIX_AUTOTUNE", "1", 1);
+  toyStartupKernelConfig();
+  unsetenv("TOYMATRIX_AUTOTUNE");
+  unsetenv("TOYMATRIX_TUNING_CACHE");
+  EXPECT_TRUE(toyStartupTuningPending());
+  toyStartupTuningPending() = false;
+}
+
+TEST(ToyTuneTest, KernelsCorrectForAnyConfig) {
+  const int n = 70, k = 45;
+  ToyMatrix<double> a(n, k), b(k, n);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<k; j++) {
+      a(i,j) = ((i*7 + j*3) % 11) - 5.0;
+      b(j,i) = ((i*5 + j) % 9) - 4.0;
+    }
+  }
+  ToyMatrix<double> expected(n, n);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<n; j++) {
+      double sum = 0;
+      for (int p=0; p<k; p++) sum += a(i,p) * b(p,j);
+      expected(i,j) = sum;
+    }
+  }
+
+  // Odd block sizes and thresholds that force every code path.
+  ToyKernelConfig config = toyDefaultKernelConfig();
+  config.GemmKC = 7;
+  config.GemmNC = 5;
+  config.ParallelThreshold = 1;
+  config.RecursiveGrain = 9*9*9;
+  config.SyrkBlock = 13;
+  toySetKernelConfig(config);
+  ToyMatrix<double> c = a*b;
+  ToyMatrix<double> g(n, n);
+  rankKUpdate(g, 1.0, a);
+  toySetKernelConfig(toyDefaultKernelConfig());
+
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<n; j++) {
+      ASSERT_EQ(expected(i,j), c(i,j)) << i << "," << j;
+      if (j <= i) {
+        double dot = 0;
+        for (int p=0; p<k; p++) dot += a(i,p) * a(j,p);
+        ASSERT_EQ(dot, g(i,j)) << i << "," << j;
+      }
+    }
+  }
+}
@@ -0,0 +1,73 @@
+#include "toyupdate.h"
+#include "toymatrix.h"
+#include "toyvector.h"
+
+#include <gtest/gtest.h>
+
+using namespace std;
+
+static ToyVector<double> makeVector(int n, int seed)
+{
+  double* entries = new double[n];
+  for (int i=0; i<n; i++) entries[i] = ((seed + 5*i) % 7) - 3.0;
+  return ToyVector<double>(n, entries);
+}
+
+TEST(ToyUpdateTest, RankOneUpdate) {
+  for (int transposed=0; transposed<2; transposed++) {
+    // Large enough for the parallel path.
+    const int m = 300, n = 170;
+    ToyMatrix<double> a(transposed ? n : m, transposed ? m : n);
+    if (transposed) a.transpose();
+    for (int i=0; i<m; i++) {
+      for (int j=0; j<n; j++) a(i,j) = i - j;
+    }
+    ToyVector<double> x = makeVector(m, 1), y = makeVector(n, 2);
+    rankOneUpdate(a, 0.5, x, y);
+    for (int i=0; i<m; i++) {
+      for (int j=0; j<n; j++) ASSERT_EQ(i - j + 0.5*x(i)*y(j), a(i,j)) << i << "," << j;
+    }
+  }
+}
+
+TEST(ToyUpdateTest, RankKUpdateTouchesOneTriangle) {
+  // Not a multiple of the tile size, and big enough to run in parallel.
+  const int n = 150, k = 90;
+  ToyMatrix<double> a(n, k);
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<k; j++) a(i,j) = ((i*3 + j*11) % 13) - 6.0;
+  }
+  for (int t=0; t<2; t++) {
+    ToyTriangle triangle = t ? ToyUpperTriangle : ToyLowerTriangle;
+    ToyMatrix<double> c(n, n);
+    for (int i=0; i<n; i++) {
+      for (int j=0; j<n; j++) c(i,j) = 1000.0 + i;
+    }
+    rankKUpdate(c, 2.0, a, 0.5, triangle);
+    for (int i=0; i<n; i++) {
+      for (int j=0; j<n; j++) {
+        bool inside = t ? (j >= i) : (j <= i);
+        double expected = 1000.0 + i;
+        if (inside) {
+          double dot = 0;
+          for (int p=0; p<k; p++) dot += a(i,p) * a(j,p);
+          expected = 2.0*dot + 0.5*expected;
+        }
+        ASSERT_EQ(expected, c(i,j)) << i << "," << j;
+      }
+    }
+  }
+
+  // Gram matrix of a transposed view, accumulating with beta = 1.
+  ToyMatrix<float> b(3, 4);
+  for (int i=0; i<3; i++) {
+    for (int j=0; j<4; j++) b(i,j) = float(i + j);
+  }
+  b.transpose();
+  ToyMatrix<float> g(4, 4);
+  rankKUpdate(g, 1.0f, b);
+  rankKUpdate(g, 1.0f, b);
+  EXPECT_EQ(2.0f*(9 + 16 + 25), g(3,3));
+  EXPECT_EQ(2.0f*(0*3 + 1*4 + 2*5), g(3,0));
+  EXPECT_EQ(0.0f, g(0,3));
+}
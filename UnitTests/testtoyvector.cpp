@@ -218,3 +218,64 @@ TEST(MatrixVectorTest, MatrixVectorMultiplication)
   EXPECT_EQ(32421077, multResult(4)); EXPECT_EQ(7672359, multResult(5));
 
 }
+
+TEST(ToyVectorTest, InlineAndHeapStorage)
+{
+  ToyVector<int> small(3);
+  EXPECT_TRUE(small.isInline());
+  EXPECT_EQ(0, small(0)); EXPECT_EQ(0, small(1)); EXPECT_EQ(1, small(2));
+
+  int *entries = new int[6];
+  for (int i=0; i<6; i++) entries[i] = i+1;
+  ToyVector<int> large(6, entries);
+  EXPECT_FALSE(large.isInline());
+  EXPECT_EQ(entries, large.getEntries());
+
+  // Given entries of small vectors end up in the inline buffer.
+  int *smallEntries = new int[4];
+  for (int i=0; i<4; i++) smallEntries[i] = 10*i;
+  ToyVector<int> adopted(4, smallEntries);
+  EXPECT_TRUE(adopted.isInline());
+  EXPECT_EQ(30, adopted(3));
+
+  // Assignment switches between both modes.
+  small = large;
+  EXPECT_FALSE(small.isInline());
+  EXPECT_EQ(6, small.getNumEntries());
+  EXPECT_EQ(6, small(5));
+  small = adopted;
+  EXPECT_TRUE(small.isInline());
+  EXPECT_EQ(4, small.getNumEntries());
+  EXPECT_EQ(20, small(2));
+
+  ToyVector<int> copy(adopted);
+  EXPECT_TRUE(copy.isInline());
+  EXPECT_NE(adopted.getEntries(), copy.getEntries());
+  EXPECT_EQ(10, copy(1));
+}
+
+TEST(ToyVectorTest, MoveStealsHeapEntries)
+{
+  int *entries = new int[8];
+  for (int i=0; i<8; i++) entries[i] = i;
+  ToyVector<int> large(8, entries);
+  large.transpose();
+
+  ToyVector<int> moved(static_cast<ToyVector<int>&&>(large));
+  EXPECT_EQ(entries, moved.getEntries());
+  EXPECT_TRUE(moved.isTransposed());
+  EXPECT_EQ(8, moved.getNumColumns());
+  EXPECT_EQ(0, large.getNumEntries());
+
+  ToyVector<int> target(2);
+  target = static_cast<ToyVector<int>&&>(moved);
+  EXPECT_EQ(entries, target.getEntries());
+  EXPECT_EQ(7, target(7));
+
+  // Inline vectors are copied, the source stays intact.
+  ToyVector<int> small(3);
+  target = static_cast<ToyVector<int>&&>(small);
+  EXPECT_TRUE(target.isInline());
+  EXPECT_EQ(3, target.getNumEntries());
+  EXPECT_EQ(1, target(2));
+}
@@ -0,0 +1,199 @@
+#include "toyworksteal.h"
+#include "toymatrix.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+using namespace std;
+
+static long long fibonacci(ToyWorkStealingScheduler& scheduler, int n)
+{
+  if (n < 2) return n;
+  if (n < 12) return fibonacci(scheduler, n-1) + fibonacci(scheduler, n-2);
+  long long left = 0;
+  ToyTaskGroup group(scheduler);
+  group.spawn([&]() { left = fibonacci(scheduler, n-1); });
+  long long right = fibonacci(scheduler, n-2);
+  group.sync();
+  return left + right;
+}
+
+TEST(ToyWorkStealTest, SpawnAndSync) {
+  ToyWorkStealingScheduler scheduler(4);
+  EXPECT_EQ(4, scheduler.getNumWorkers());
+  EXPECT_EQ(832040, fibonacci(scheduler, 30));
+
+  ToyWorkStealingScheduler::Statistics stats = scheduler.getStatistics();
+  EXPECT_GT(stats.Spawned, 0);
+  EXPECT_EQ(stats.Spawned, stats.Executed);
+  ASSERT_EQ(5u, stats.ExecutedPerWorker.size());
+  long long perWorker = 0;
+  for (size_t i=0; i<stats.ExecutedPerWorker.size(); i++) perWorker += stats.ExecutedPerWorker[i];
+  EXPECT_EQ(stats.Executed, perWorker);
+
+  scheduler.resetStatistics();
+  EXPECT_EQ(0, scheduler.getStatistics().Executed);
+}
+
+TEST(ToyWorkStealTest, GlobalSchedulerReportsIdleTime) {
+  ToyWorkStealingScheduler& scheduler = ToyWorkStealingScheduler::global();
+  if (scheduler.getNumWorkers() == 0) return;
+  scheduler.resetStatistics();
+  {
+    // One long branch and many short ones leave the other workers idle.
+    ToyTaskGroup group(scheduler);
+    group.spawn([]() { this_thread::sleep_for(chrono::milliseconds(50)); });
+    for (int i=0; i<16; i++) group.spawn([]() {});
+    group.sync();
+  }
+  ToyWorkStealingScheduler::Statistics stats = scheduler.getStatistics();
+  EXPECT_EQ(17, stats.Executed);
+  EXPECT_GT(stats.IdleSeconds, 0.0);
+  // Waiting in sync() is not stealing: each worker fails about once per wakeup.
+  EXPECT_LT(stats.FailedSteals, 1000);
+}
+
+TEST(ToyWorkStealTest, SyncRethrows) {
+  ToyWorkStealingScheduler scheduler(2);
+  atomic<int> finished(0);
+  bool caught = false;
+  {
+    ToyTaskGroup group(scheduler);
+    group.spawn([]() { throw runtime_error("task failed"); });
+    for (int i=0; i<8; i++) group.spawn([&]() { finished++; });
+    try {
+      group.sync();
+    } catch (const runtime_error&) {
+      caught = true;
+    }
+  }
+  EXPECT_TRUE(caught);
+  EXPECT_EQ(8, finished);
+}
+
+TEST(ToyWorkStealTest, RecursiveForCoversRange) {
+  vector<atomic<int> > visits(1000);
+  for (size_t i=0; i<visits.size(); i++) visits[i] = 0;
+  atomic<int> pieces(0);
+  toyRecursiveFor(0, 1000, 16, [&](int lo, int hi) {
+    EXPECT_LE(hi - lo, 16);
+    pieces++;
+    for (int i=lo; i<hi; i++) visits[i]++;
+  });
+  for (size_t i=0; i<visits.size(); i++) EXPECT_EQ(1, visits[i]) << "index " << i;
+  EXPECT_GE(pieces, 1000/16);
+}
+
+TEST(ToyWorkStealTest, LargeMatrixProducts) {
+  // Big enough for operator* to take the recursive path.
+  const int m = 97, k = 131, n = 83;
+  ToyMatrix<int> a(m, k);
+  ToyMatrix<int> bt(n, k);
+  for (int i=0; i<m; i++) {
+    for (int j=0; j<k; j++) a(i,j) = (i*k + j) % 13 - 6;
+  }
+  for (int i=0; i<n; i++) {
+    for (int j=0; j<k; j++) bt(i,j) = (i + 3*j) % 11 - 5;
+  }
+  bt.transpose();
+
+  ToyMatrix<int> c = a * bt;
+  ASSERT_EQ(m, c.getNumRows());
+  ASSERT_EQ(n, c.getNumColumns());
+  for (int i=0; i<m; i++) {
+    for (int j=0; j<n; j++) {
+      int expected = 0;
+      for (int p=0; p<k; p++) expected += a(i,p) * bt(p,j);
+      EXPECT_EQ(expected, c(i,j)) << "row " << i << ", column " << j;
+    }
+  }
+
+  a *= bt;
+  EXPECT_EQ(false, a.isTransposed());
+  ASSERT_EQ(n, a.getNumColumns());
+  for (int i=0; i<m; i++) {
+    for (int j=0; j<n; j++) EXPECT_EQ(c(i,j), a(i,j));
+  }
+}
+
+//! Waits up to ten seconds, without running tasks itself, for done.
+static bool finishedElsewhere(const atomic<bool>& done)
+{
+  for (int i=0; i<10000 && !done; i++) this_thread::sleep_for(chrono::milliseconds(1));
+  return done;
+}
+
+TEST(ToyWorkStealTest, SleepingWorkersWakeUp) {
+  ToyWorkStealingScheduler scheduler(2);
+  for (int round=0; round<20; round++) {
+    // Long enough for both workers to go to sleep.
+    this_thread::sleep_for(chrono::milliseconds(round % 4 == 0 ? 20 : 0));
+    atomic<bool> done(false);
+    ToyTaskGroup group(scheduler);
+    group.spawn([&]() { done = true; });
+    EXPECT_TRUE(finishedElsewhere(done)) << "round " << round;
+    group.sync();
+  }
+}
+
+TEST(ToyWorkStealTest, BorrowsThreadPoolWorkers) {
+  ToyThreadPool pool(4);
+  {
+    ToyWorkStealingScheduler scheduler(pool);
+    EXPECT_EQ(3, scheduler.getNumWorkers());
+    EXPECT_EQ(832040, fibonacci(scheduler, 30));
+
+    atomic<bool> done(false);
+    ToyTaskGroup group(scheduler);
+    group.spawn([&]() { done = true; });
+    EXPECT_TRUE(finishedElsewhere(done));
+    group.sync();
+
+    // The pool still runs its own work while it lends its workers.
+    vector<int> rows(100, 0);
+    pool.parallelFor(0, 100, [&](int lo, int hi) {
+      for (int i=lo; i<hi; i++) rows[i]++;
+    });
+    for (int i=0; i<100; i++) EXPECT_EQ(1, rows[i]);
+  }
+  EXPECT_EQ(ToyThreadPool::global().getNumThreads() - 1,
+            ToyWorkStealingScheduler::global().getNumWorkers());
+}
+
+TEST(ToyWorkStealTest, PoolWorkDuringTaskGroups) {
+  ToyThreadPool pool(2);
+  ToyWorkStealingScheduler scheduler(pool);
+  for (int round=0; round<300; round++) {
+    // The pool worker is often still in the scheduler's hook when the
+    // chunk it owns or the submitted task is posted.
+    EXPECT_EQ(2584, fibonacci(scheduler, 18));
+    vector<int> rows(2, 0);
+    pool.parallelFor(0, 2, [&](int lo, int hi) {
+      for (int i=lo; i<hi; i++) rows[i]++;
+    });
+    EXPECT_EQ(1, rows[0]);
+    EXPECT_EQ(1, rows[1]);
+    atomic<bool> done(false);
+    pool.submit([&]() { done = true; });
+    ASSERT_TRUE(finishedElsewhere(done)) << "round " << round;
+  }
+}
+
+TEST(ToyWorkStealTest, SchedulersSharePool) {
+  ToyThreadPool pool(3);
+  ToyWorkStealingScheduler first(pool);
+  {
+    ToyWorkStealingScheduler second(pool);
+    EXPECT_EQ(832040, fibonacci(second, 30));
+  }
+  // Removing the second scheduler leaves the first one on the pool.
+  atomic<bool> done(false);
+  ToyTaskGroup group(first);
+  group.spawn([&]() { done = true; });
+  EXPECT_TRUE(finishedElsewhere(done));
+  group.sync();
+}